@@ -1,7 +1,18 @@
 #include "ViewerApplication.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <numeric>
+#include <set>
+#include <string>
+#include <thread>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -9,8 +20,25 @@
 #include <glm/gtx/io.hpp>
 
 #include "utils/cameras.hpp"
+#include "utils/allocation_counter.hpp"
+#include "utils/culling.hpp"
+#include "utils/deferred.hpp"
+#include "utils/draw_commands.hpp"
+#include "utils/draw_sort.hpp"
+#include "utils/frame_arena.hpp"
+#include "utils/frame_benchmark.hpp"
+#include "utils/frame_loop.hpp"
+#include "utils/geometry_cache.hpp"
 #include "utils/gltf.hpp"
+#include "utils/gltf_loader.hpp"
+#include "utils/gpu_timer.hpp"
 #include "utils/images.hpp"
+#include "utils/job_system.hpp"
+#include "utils/lights.hpp"
+#include "utils/renderer.hpp"
+#include "utils/shadow_casters.hpp"
+#include "utils/transforms.hpp"
+#include "utils/uniform_ring.hpp"
 
 #include <stb_image_write.h>
 #include <tiny_gltf.h>
@@ -23,17 +51,642 @@ void keyCallback(
   }
 }
 
+// Vertex attribute locations used by the vertex shaders
+enum VertexAttribute
+{
+  VERTEX_ATTRIB_POSITION = 0,
+  VERTEX_ATTRIB_NORMAL = 1,
+  VERTEX_ATTRIB_TEXCOORD0 = 2,
+  VERTEX_ATTRIB_INSTANCE_TRANSLATION = 3,
+  VERTEX_ATTRIB_INSTANCE_ROTATION = 4,
+  VERTEX_ATTRIB_INSTANCE_SCALE = 5,
+  VERTEX_ATTRIB_COUNT
+};
+static_assert(VERTEX_ATTRIB_COUNT == VertexBufferBindings::count,
+    "One vertex buffer binding point per attribute");
+
+// Format of the vertex attributes read by a draw, key of the VAOs shared
+// between primitives: size, type, normalized and divisor of each attribute
+// (all 0 for disabled attributes)
+using VertexFormat = std::array<GLint, 4 * VERTEX_ATTRIB_COUNT>;
+
+// Uniform block binding points used by the vertex shaders
+enum UniformBlockBinding
+{
+  UNIFORM_BINDING_TRANSFORMS = 0
+};
+
+// Shader storage buffer binding points used by forward_pulling.vs.glsl
+enum StorageBlockBinding
+{
+  STORAGE_BINDING_DRAWS = 1,
+  STORAGE_BINDING_GEOMETRY = 2,
+  // Read by pbr_directional_light_pooled.fs.glsl
+  STORAGE_BINDING_MATERIALS = 3,
+  // Read by pbr_clustered_lights.fs.glsl
+  STORAGE_BINDING_LIGHTS = 4,
+  STORAGE_BINDING_CLUSTERS = 5,
+  STORAGE_BINDING_LIGHT_INDICES = 6
+};
+
+// Largest number of draws submitted by one multi-draw call with vertex
+// pulling: size of the draw index buffer
+const GLsizei maxPulledDrawCount = 4096;
+
+// Texture unit of the shadow maps, after the units of the materials
+const GLint shadowMapsTextureUnit = 15;
+// Texture units of the environment lighting, also after the texture pools
+const GLint specularEnvironmentTextureUnit = 13;
+const GLint brdfLutTextureUnit = 14;
+// Texture units of the fullscreen passes of deferred shading, which do not
+// read the materials
+const GLint gbufferFirstTextureUnit = 0;
+const GLint lightBufferTextureUnit = 0; // Then the depth of the G-buffer
+
+// Nodes per job of the frame jobs of drawScene, large enough for the cost of
+// a job to be negligible
+const size_t nodeGrainSize = 256;
+
+// Visible instances of an instanced node are drawn with one draw per range
+// of consecutive instances, with at most this number of ranges (see
+// cullInstances)
+const size_t maxInstanceRangeCount = 16;
+
+// Draw commands recorded by one job
+const size_t drawCommandGrainSize = 1024;
+
+// Point the vertex attribute at the data of an accessor stored in
+// bufferRanges. Returns false if the accessor has no data.
+bool setVertexAttribFromAccessor(const tinygltf::Model &model,
+    const std::vector<GpuBufferRange> &bufferRanges, GLuint attribIndex,
+    int accessorIdx)
+{
+  const auto &accessor = model.accessors[accessorIdx];
+  if (accessor.bufferView < 0) {
+    return false;
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto &bufferRange = bufferRanges[bufferView.buffer];
+
+  glEnableVertexAttribArray(attribIndex);
+  glBindBuffer(GL_ARRAY_BUFFER, bufferRange.buffer);
+  const auto byteOffset =
+      bufferRange.offset + accessor.byteOffset + bufferView.byteOffset;
+  // Remember size is obtained with accessor.type, type is obtained with
+  // accessor.componentType. The stride is obtained in the bufferView, and
+  // pointer is the byteOffset (don't forget the cast).
+  glVertexAttribPointer(attribIndex, accessor.type, accessor.componentType,
+      accessor.normalized ? GL_TRUE : GL_FALSE,
+      GLsizei(bufferView.byteStride), (const GLvoid *)byteOffset);
+  return true;
+}
+
+// Setup the vertex attributes and index buffer of a primitive in the currently
+// bound VAO
+void setupPrimitiveAttributes(const tinygltf::Model &model,
+    const std::vector<GpuBufferRange> &bufferRanges,
+    const tinygltf::Primitive &primitive)
+{
+  struct Attribute
+  {
+    const char *name;
+    GLuint index;
+  };
+  static const Attribute attributes[] = {
+      {"POSITION", VERTEX_ATTRIB_POSITION}, {"NORMAL", VERTEX_ATTRIB_NORMAL},
+      {"TEXCOORD_0", VERTEX_ATTRIB_TEXCOORD0}};
+
+  for (const auto &attribute : attributes) {
+    const auto iterator = primitive.attributes.find(attribute.name);
+    if (iterator != end(primitive.attributes)) {
+      // (*iterator).second is the index of the accessor for this attribute
+      setVertexAttribFromAccessor(
+          model, bufferRanges, attribute.index, (*iterator).second);
+    }
+  }
+
+  if (primitive.indices >= 0) { // Setting up the Index buffer object if exists
+    const auto &accessor = model.accessors[primitive.indices];
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    // Binding the index buffer to GL_ELEMENT_ARRAY_BUFFER while the VAO is
+    // bound is enough to tell OpenGL we want to use that index buffer for that
+    // VAO
+    glBindBuffer(
+        GL_ELEMENT_ARRAY_BUFFER, bufferRanges[bufferView.buffer].buffer);
+  }
+}
+
+// Setup the EXT_mesh_gpu_instancing attributes as per-instance attributes in
+// the currently bound VAO. Missing attributes keep their generic value, see
+// setDefaultInstanceAttributes().
+void setupInstanceAttributes(const tinygltf::Model &model,
+    const std::vector<GpuBufferRange> &bufferRanges,
+    const NodeInstancing &instancing)
+{
+  const std::pair<GLuint, int> attributes[] = {
+      {VERTEX_ATTRIB_INSTANCE_TRANSLATION, instancing.translationAccessor},
+      {VERTEX_ATTRIB_INSTANCE_ROTATION, instancing.rotationAccessor},
+      {VERTEX_ATTRIB_INSTANCE_SCALE, instancing.scaleAccessor}};
+  for (const auto &attribute : attributes) {
+    if (attribute.second >= 0 &&
+        setVertexAttribFromAccessor(
+            model, bufferRanges, attribute.first, attribute.second)) {
+      glVertexAttribDivisor(attribute.first, 1);
+    }
+  }
+}
+
+// Describe the attribute reading an accessor, for a VAO with a separate
+// format and buffer binding per attribute. Returns false if the accessor has
+// no data.
+bool getVertexInputFromAccessor(const tinygltf::Model &model,
+    const std::vector<GpuBufferRange> &bufferRanges, GLuint attribIndex,
+    int accessorIdx, GLint divisor, VertexFormat &format,
+    VertexBufferBindings &bindings)
+{
+  const auto &accessor = model.accessors[accessorIdx];
+  if (accessor.bufferView < 0) {
+    return false;
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  auto *attributeFormat = &format[4 * attribIndex];
+  attributeFormat[0] = tinygltf::GetNumComponentsInType(accessor.type);
+  attributeFormat[1] = accessor.componentType;
+  attributeFormat[2] = accessor.normalized ? GL_TRUE : GL_FALSE;
+  attributeFormat[3] = divisor;
+  const auto &bufferRange = bufferRanges[bufferView.buffer];
+  bindings.buffers[attribIndex] = bufferRange.buffer;
+  bindings.offsets[attribIndex] = bufferRange.offset +
+                                  GLintptr(accessor.byteOffset +
+                                           bufferView.byteOffset);
+  // Unlike glVertexAttribPointer, a 0 stride does not mean tightly packed
+  bindings.strides[attribIndex] = GLsizei(accessor.ByteStride(bufferView));
+  return true;
+}
+
+// Vertex format and buffers of a primitive, also reading the per-instance
+// attributes of instancing if not null
+void getPrimitiveVertexInput(const tinygltf::Model &model,
+    const std::vector<GpuBufferRange> &bufferRanges,
+    const tinygltf::Primitive &primitive, const NodeInstancing *instancing,
+    VertexFormat &format, VertexBufferBindings &bindings)
+{
+  format.fill(0);
+  bindings = VertexBufferBindings{};
+  const std::pair<const char *, GLuint> attributes[] = {
+      {"POSITION", VERTEX_ATTRIB_POSITION}, {"NORMAL", VERTEX_ATTRIB_NORMAL},
+      {"TEXCOORD_0", VERTEX_ATTRIB_TEXCOORD0}};
+  for (const auto &attribute : attributes) {
+    const auto iterator = primitive.attributes.find(attribute.first);
+    if (iterator != end(primitive.attributes)) {
+      getVertexInputFromAccessor(model, bufferRanges, attribute.second,
+          (*iterator).second, 0, format, bindings);
+    }
+  }
+  if (instancing) {
+    const std::pair<GLuint, int> instanceAttributes[] = {
+        {VERTEX_ATTRIB_INSTANCE_TRANSLATION, instancing->translationAccessor},
+        {VERTEX_ATTRIB_INSTANCE_ROTATION, instancing->rotationAccessor},
+        {VERTEX_ATTRIB_INSTANCE_SCALE, instancing->scaleAccessor}};
+    for (const auto &attribute : instanceAttributes) {
+      if (attribute.second >= 0) {
+        getVertexInputFromAccessor(model, bufferRanges, attribute.first,
+            attribute.second, 1, format, bindings);
+      }
+    }
+  }
+  if (primitive.indices >= 0) {
+    const auto &accessor = model.accessors[primitive.indices];
+    bindings.indexBuffer =
+        bufferRanges[model.bufferViews[accessor.bufferView].buffer].buffer;
+  }
+}
+
+// VAO with the given format, attribute i reading binding point i. Its buffers
+// are bound per draw.
+GLuint createVertexFormatVertexArrayObject(const VertexFormat &format)
+{
+  GLuint vertexArrayObject = 0;
+  glGenVertexArrays(1, &vertexArrayObject);
+  glBindVertexArray(vertexArrayObject);
+  for (GLuint attribIndex = 0; attribIndex < VERTEX_ATTRIB_COUNT;
+       ++attribIndex) {
+    const auto *attributeFormat = &format[4 * attribIndex];
+    if (!attributeFormat[0]) {
+      continue;
+    }
+    glEnableVertexAttribArray(attribIndex);
+    glVertexAttribFormat(attribIndex, attributeFormat[0],
+        GLenum(attributeFormat[1]), GLboolean(attributeFormat[2]), 0);
+    glVertexAttribBinding(attribIndex, attribIndex);
+    glVertexBindingDivisor(attribIndex, GLuint(attributeFormat[3]));
+  }
+  return vertexArrayObject;
+}
+
+// Generic values of the instance attributes, read by the shaders when the
+// attribute array is disabled (non instanced draws): identity transform
+void setDefaultInstanceAttributes()
+{
+  glVertexAttrib3f(VERTEX_ATTRIB_INSTANCE_TRANSLATION, 0.f, 0.f, 0.f);
+  glVertexAttrib4f(VERTEX_ATTRIB_INSTANCE_ROTATION, 0.f, 0.f, 0.f, 1.f);
+  glVertexAttrib3f(VERTEX_ATTRIB_INSTANCE_SCALE, 1.f, 1.f, 1.f);
+}
+
+// Upload asset.staticBatches in a VAO reading position, normal and texture
+// coordinates
+void createStaticBatchVertexArrayObject(GltfAsset &asset)
+{
+  const auto &batches = asset.staticBatches;
+  glGenBuffers(2, asset.staticBatchBufferObjects);
+  glBindBuffer(GL_ARRAY_BUFFER, asset.staticBatchBufferObjects[0]);
+  glBufferStorage(GL_ARRAY_BUFFER,
+      std::max(batches.vertices.size(), size_t(1)) * sizeof(CachedVertex),
+      batches.vertices.empty() ? nullptr : batches.vertices.data(), 0);
+
+  glGenVertexArrays(1, &asset.staticBatchVertexArrayObject);
+  glBindVertexArray(asset.staticBatchVertexArrayObject);
+  glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION);
+  glVertexAttribPointer(VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE,
+      sizeof(CachedVertex), (const GLvoid *)offsetof(CachedVertex, position));
+  glEnableVertexAttribArray(VERTEX_ATTRIB_NORMAL);
+  glVertexAttribPointer(VERTEX_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE,
+      sizeof(CachedVertex), (const GLvoid *)offsetof(CachedVertex, normal));
+  glEnableVertexAttribArray(VERTEX_ATTRIB_TEXCOORD0);
+  glVertexAttribPointer(VERTEX_ATTRIB_TEXCOORD0, 2, GL_FLOAT, GL_FALSE,
+      sizeof(CachedVertex), (const GLvoid *)offsetof(CachedVertex, texCoords));
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.staticBatchBufferObjects[1]);
+  glBufferStorage(GL_ELEMENT_ARRAY_BUFFER,
+      std::max(batches.indices.size(), size_t(1)) * sizeof(uint32_t),
+      batches.indices.empty() ? nullptr : batches.indices.data(), 0);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Upload the proxies of asset.hlod in a VAO reading position and normal
+void createHlodVertexArrayObject(GltfAsset &asset)
+{
+  const auto &hlod = asset.hlod;
+  glGenBuffers(2, asset.hlodBufferObjects);
+  glBindBuffer(GL_ARRAY_BUFFER, asset.hlodBufferObjects[0]);
+  glBufferStorage(GL_ARRAY_BUFFER,
+      std::max(hlod.vertices.size(), size_t(1)) * sizeof(HlodVertex),
+      hlod.vertices.empty() ? nullptr : hlod.vertices.data(), 0);
+
+  glGenVertexArrays(1, &asset.hlodVertexArrayObject);
+  glBindVertexArray(asset.hlodVertexArrayObject);
+  glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION);
+  glVertexAttribPointer(VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE,
+      sizeof(HlodVertex), (const GLvoid *)offsetof(HlodVertex, position));
+  glEnableVertexAttribArray(VERTEX_ATTRIB_NORMAL);
+  glVertexAttribPointer(VERTEX_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE,
+      sizeof(HlodVertex), (const GLvoid *)offsetof(HlodVertex, normal));
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.hlodBufferObjects[1]);
+  glBufferStorage(GL_ELEMENT_ARRAY_BUFFER,
+      std::max(hlod.indices.size(), size_t(1)) * sizeof(uint32_t),
+      hlod.indices.empty() ? nullptr : hlod.indices.data(), 0);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Upload all the buffers of asset.model in asset.pullingBuffer and describe
+// each primitive (and each primitive of instanced nodes) for vertex pulling.
+// The ranges of asset are filled as createVertexArrayObjects() would.
+void createPullingBuffer(GltfAsset &asset)
+{
+  const auto &model = asset.model;
+  const auto layout = computePulledGeometryLayout(model);
+  std::vector<char> geometry(std::max(layout.byteCount, size_t(4)), 0);
+  for (size_t bufferIdx = 0; bufferIdx < model.buffers.size(); ++bufferIdx) {
+    const auto &data = model.buffers[bufferIdx].data;
+    std::copy(begin(data), end(data),
+        begin(geometry) + layout.bufferOffsets[bufferIdx]);
+  }
+  glGenBuffers(1, &asset.pullingBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, asset.pullingBuffer);
+  glBufferStorage(
+      GL_SHADER_STORAGE_BUFFER, geometry.size(), geometry.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  size_t unsupportedCount = 0;
+  const auto appendPrimitives = [&](const tinygltf::Mesh &mesh,
+                                    const NodeInstancing *instancing) {
+    const auto range = VaoRange{GLsizei(asset.pulledPrimitives.size()),
+        GLsizei(mesh.primitives.size())};
+    for (const auto &primitive : mesh.primitives) {
+      PulledPrimitive pulledPrimitive;
+      if (!getPulledPrimitive(
+              model, layout, primitive, instancing, pulledPrimitive)) {
+        // Drawn with no vertex
+        pulledPrimitive.vertexCount = 0;
+        ++unsupportedCount;
+      }
+      asset.pulledPrimitives.push_back(pulledPrimitive);
+    }
+    return range;
+  };
+  for (const auto &mesh : model.meshes) {
+    asset.meshIndexToVaoRange.push_back(appendPrimitives(mesh, nullptr));
+  }
+  asset.nodeIndexToInstancedVaoRange.assign(model.nodes.size(), VaoRange{0, 0});
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    const auto &instancing = asset.nodeInstancing[nodeIdx];
+    if (instancing.instanceCount) {
+      asset.nodeIndexToInstancedVaoRange[nodeIdx] = appendPrimitives(
+          model.meshes[model.nodes[nodeIdx].mesh], &instancing);
+    }
+  }
+  std::clog << "Vertex pulling: " << asset.pulledPrimitives.size()
+            << " primitives reading " << layout.byteCount / 1e6 << " MB"
+            << std::endl;
+  if (unsupportedCount) {
+    std::cerr << "Warn: " << unsupportedCount
+              << " primitives without position data are not drawn"
+              << std::endl;
+  }
+}
+
+// VAO of the pulling vertex shader: attribute 0 is the index of the draw,
+// taken from the baseInstance of each draw command. Its divisor is larger
+// than any instance count so it keeps the same value for all the instances.
+// This stands for gl_DrawID, which needs ARB_shader_draw_parameters.
+GLuint createDrawIndexVertexArrayObject(GLuint &drawIndexBuffer)
+{
+  std::vector<GLuint> drawIndices(maxPulledDrawCount);
+  std::iota(begin(drawIndices), end(drawIndices), 0);
+  glGenBuffers(1, &drawIndexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+  glBufferStorage(GL_ARRAY_BUFFER, drawIndices.size() * sizeof(GLuint),
+      drawIndices.data(), 0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  GLuint vertexArrayObject;
+  glGenVertexArrays(1, &vertexArrayObject);
+  glBindVertexArray(vertexArrayObject);
+  glEnableVertexAttribArray(0);
+  glVertexAttribIFormat(0, 1, GL_UNSIGNED_INT, 0);
+  glVertexAttribBinding(0, 0);
+  glVertexBindingDivisor(0, GLuint(1) << 30);
+  glBindVertexBuffer(0, drawIndexBuffer, 0, sizeof(GLuint));
+  glBindVertexArray(0);
+  return vertexArrayObject;
+}
+
+// Upload asset.texturePools, one GL_TEXTURE_2D_ARRAY per pool, and the
+// materials of asset.model referencing them
+void createTexturePoolObjects(GltfAsset &asset, bool generateMipmaps)
+{
+  const auto &model = asset.model;
+  const auto &pools = asset.texturePools.pools;
+  asset.texturePoolObjects.resize(pools.size());
+  if (!pools.empty()) {
+    glGenTextures(GLsizei(pools.size()), asset.texturePoolObjects.data());
+  }
+  for (size_t poolIdx = 0; poolIdx < pools.size(); ++poolIdx) {
+    const auto &pool = pools[poolIdx];
+    const auto levelCount = getTexturePoolLevelCount(pool, generateMipmaps);
+    const auto pixelType =
+        pool.bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, asset.texturePoolObjects[poolIdx]);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount,
+        pool.bits == 16 ? GL_RGBA16 : GL_RGBA8, pool.width, pool.height,
+        pool.layerCount);
+    for (int layer = 0; layer < pool.layerCount; ++layer) {
+      std::vector<unsigned char> page;
+      const unsigned char *pixels = nullptr;
+      if (pool.isAtlas) {
+        page = composeAtlasPage(
+            model, asset.texturePools, int(poolIdx), layer);
+        pixels = page.data();
+      } else {
+        pixels = model.images[pool.images[layer]].image.data();
+      }
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, pool.width,
+          pool.height, 1, GL_RGBA, pixelType, pixels);
+    }
+    if (levelCount > 1) {
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+        levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  const auto materials = getPooledMaterials(model, asset.texturePools);
+  glGenBuffers(1, &asset.materialBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, asset.materialBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      materials.size() * sizeof(PooledMaterial), materials.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Depth range, projection and default camera framing the scene bounds
+struct SceneFraming
+{
+  float maxDistance; // Diagonal of the bounds, 100 if empty
+  float nearDepth;
+  float farDepth;
+  glm::mat4 projMatrix;
+  Camera defaultCamera;
+};
+
+SceneFraming computeSceneFraming(
+    const BoundingBox &sceneBounds, float fovY, float aspectRatio)
+{
+  SceneFraming framing;
+  const auto diagonalVect = sceneBounds.max - sceneBounds.min;
+  const auto distance = glm::length(diagonalVect);
+  framing.maxDistance = distance > 0 ? distance : 100;
+  framing.nearDepth = 0.001f * framing.maxDistance;
+  framing.farDepth = 1.5f * framing.maxDistance;
+  framing.projMatrix = glm::perspective(
+      fovY, aspectRatio, framing.nearDepth, framing.farDepth);
+
+  const auto center = (sceneBounds.max + sceneBounds.min) / 2.f;
+  const auto up = glm::vec3(0, 1, 0);
+  const auto eye = diagonalVect.z > 0
+                       ? center + diagonalVect
+                       : center + 2.f * glm::cross(diagonalVect, up);
+  framing.defaultCamera = Camera{eye, center, up};
+  return framing;
+}
+
+// Load time from loadStart to renderStart (files, GPU uploads and shaders),
+// render time from renderStart to now (drawing and writing the image)
+void printOutputTimes(std::chrono::steady_clock::time_point loadStart,
+    std::chrono::steady_clock::time_point renderStart)
+{
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+  const auto now = std::chrono::steady_clock::now();
+  std::cout << "Output: loaded in "
+            << Milliseconds(renderStart - loadStart).count()
+            << " ms, rendered in " << Milliseconds(now - renderStart).count()
+            << " ms" << std::endl;
+}
+
 int ViewerApplication::run()
 {
+  if (m_options.useRenderer) {
+    return runRenderer();
+  }
+  const auto loadStart = std::chrono::steady_clock::now();
+
   // Loader shaders
   const auto glslProgram =
       compileProgram({m_ShadersRootPath / m_AppName / m_vertexShader,
           m_ShadersRootPath / m_AppName / m_fragmentShader});
+  // With deferred shading, glslProgram draws the scene to the G-buffer and
+  // the lights are read by the lighting pass, shadingProgram
+  GLProgram deferredLightingProgram;
+  GLProgram compositeProgram;
+  if (m_options.deferredShading) {
+    deferredLightingProgram = compileProgram(
+        {m_ShadersRootPath / m_AppName / "fullscreen.vs.glsl",
+            m_ShadersRootPath / m_AppName / "deferred_lighting.fs.glsl"});
+    compositeProgram = compileProgram(
+        {m_ShadersRootPath / m_AppName / "fullscreen.vs.glsl",
+            m_ShadersRootPath / m_AppName / "deferred_composite.fs.glsl"});
+  }
+  const auto &shadingProgram =
+      m_options.deferredShading ? deferredLightingProgram : glslProgram;
 
-  tinygltf::Model model;
-
-  if (!loadGltfFile(model)) {
-    return -1;
+  // Assets of the scene, each with its root transform. Assets used several
+  // times are loaded once and shared through m_assetCache.
+  struct SceneAssetInstance
+  {
+    size_t id; // Index in m_assetPlacements
+    std::shared_ptr<GltfAsset> asset;
+    std::string name; // File name of the asset
+    glm::mat4 rootTransform;
+    std::vector<BoundingBox> nodeWorldBounds;
+    // Instanced nodes only, see GltfAsset::instanceBounds
+    std::vector<BoundingBox> instanceWorldBounds;
+    std::vector<BoundingBox> cellWorldBounds; // Streamed assets only
+    std::vector<BoundingBox> clusterWorldBounds; // HLOD assets only
+    std::vector<BoundingBox> chunkWorldBounds; // Static batches only
+    float scale; // Largest scale factor of rootTransform
+    // The scene is static: world and normal matrices of the nodes are
+    // computed once, the draw transforms of the nodes once per frame
+    glm::mat4 rootNormalMatrix;
+    std::vector<glm::mat4> nodeWorldMatrices;
+    std::vector<glm::mat4> nodeNormalMatrices;
+    std::vector<DrawTransforms> nodeTransforms;
+    // Per frame results of the frame jobs of drawScene
+    std::vector<uint8_t> nodeVisibility;
+    std::vector<uint8_t> cellVisibility; // Streamed assets only
+    std::vector<float> cellPriorities; // Streamed assets only
+    std::vector<float> nodeViewDepths; // Of the centers of nodeWorldBounds
+    // Visible instances of each instanced node, in nodeInstanceRangeCounts[i]
+    // ranges from instanceRanges[instanceRangeOffsets[i]]
+    std::vector<InstanceRange> instanceRanges;
+    std::vector<size_t> instanceRangeOffsets;
+    std::vector<uint8_t> nodeInstanceRangeCounts;
+    // Bit i is set for the nodes seen by cascade i, if it is updated
+    std::vector<uint8_t> nodeShadowMasks;
+    std::vector<PunctualLight> lights; // KHR_lights_punctual, world space
+    // Same for all the instances of an asset, distinct between assets, for
+    // the material field of the draw keys
+    uint32_t assetKey;
+  };
+  std::vector<SceneAssetInstance> sceneAssets;
+  for (const auto &placement : m_assetPlacements) {
+    std::string error;
+    auto asset = m_assetCache.acquire(placement.path, error);
+    if (!asset) {
+      std::cerr << "Error: " << error << std::endl;
+      return -1;
+    }
+    SceneAssetInstance instance;
+    instance.id = sceneAssets.size();
+    instance.asset = std::move(asset);
+    instance.name = instance.asset->path.filename().string();
+    instance.rootTransform = placement.rootTransform;
+    const auto rootMatrix = glm::mat3(placement.rootTransform);
+    instance.scale = std::max(glm::length(rootMatrix[0]),
+        std::max(glm::length(rootMatrix[1]), glm::length(rootMatrix[2])));
+    instance.rootNormalMatrix = computeNormalMatrix(placement.rootTransform);
+    for (const auto &matrix : instance.asset->nodeMatrices) {
+      instance.nodeWorldMatrices.push_back(placement.rootTransform * matrix);
+      instance.nodeNormalMatrices.push_back(
+          computeNormalMatrix(instance.nodeWorldMatrices.back()));
+    }
+    instance.nodeTransforms.resize(instance.nodeWorldMatrices.size());
+    instance.nodeVisibility.resize(instance.nodeWorldMatrices.size());
+    instance.nodeViewDepths.resize(instance.nodeWorldMatrices.size());
+    instance.nodeShadowMasks.resize(instance.nodeWorldMatrices.size());
+    appendPunctualLights(
+        instance.asset->model, instance.nodeWorldMatrices, instance.lights);
+    const auto firstInstance = std::find_if(begin(sceneAssets),
+        end(sceneAssets), [&](const SceneAssetInstance &other) {
+          return other.asset == instance.asset;
+        });
+    instance.assetKey = uint32_t(firstInstance - begin(sceneAssets));
+    // The scene is static so world bounds are computed once
+    for (const auto &bounds : instance.asset->nodeBounds) {
+      instance.nodeWorldBounds.push_back(
+          transformBoundingBox(placement.rootTransform, bounds));
+    }
+    for (const auto &bounds : instance.asset->instanceBounds) {
+      instance.instanceWorldBounds.push_back(
+          transformBoundingBox(placement.rootTransform, bounds));
+    }
+    // Room for the ranges of each instanced node, no more than its number of
+    // instances
+    const auto &instanceOffsets = instance.asset->instanceBoundsOffsets;
+    instance.instanceRangeOffsets.assign(1, 0);
+    for (size_t nodeIdx = 0; nodeIdx < instance.nodeWorldMatrices.size();
+         ++nodeIdx) {
+      const auto instanceCount =
+          nodeIdx + 1 < instanceOffsets.size()
+              ? instanceOffsets[nodeIdx + 1] - instanceOffsets[nodeIdx]
+              : 0;
+      instance.instanceRangeOffsets.push_back(
+          instance.instanceRangeOffsets.back() +
+          std::min(instanceCount, maxInstanceRangeCount));
+    }
+    instance.instanceRanges.resize(instance.instanceRangeOffsets.back());
+    instance.nodeInstanceRangeCounts.resize(instance.nodeWorldMatrices.size());
+    if (instance.asset->streamer) {
+      for (const auto &cell : instance.asset->streamer->cells()) {
+        instance.cellWorldBounds.push_back(
+            transformBoundingBox(placement.rootTransform, cell.bounds()));
+      }
+      instance.cellVisibility.resize(instance.cellWorldBounds.size());
+      instance.cellPriorities.resize(instance.cellWorldBounds.size());
+    }
+    for (const auto &cluster : instance.asset->hlod.clusters) {
+      instance.clusterWorldBounds.push_back(
+          transformBoundingBox(placement.rootTransform, cluster.bounds));
+    }
+    for (const auto &chunk : instance.asset->staticBatches.chunks) {
+      instance.chunkWorldBounds.push_back(
+          transformBoundingBox(placement.rootTransform, chunk.bounds));
+    }
+    sceneAssets.push_back(std::move(instance));
+  }
+  // Nodes of all the instances are numbered in sequence for the frame jobs:
+  // the nodes of sceneAssets[i] start at sceneNodeOffsets[i]. Computed again
+  // when instances are removed from the scene.
+  std::vector<size_t> sceneNodeOffsets;
+  const auto updateSceneNodeOffsets = [&]() {
+    sceneNodeOffsets.assign(1, 0);
+    for (const auto &instance : sceneAssets) {
+      sceneNodeOffsets.push_back(
+          sceneNodeOffsets.back() + instance.nodeTransforms.size());
+    }
+  };
+  updateSceneNodeOffsets();
+  {
+    const auto cacheStats = m_assetCache.stats();
+    std::clog << "Scene assets: " << sceneAssets.size() << " ("
+              << cacheStats.residentAssetCount << " distinct)" << std::endl;
   }
 
   const auto modelViewProjMatrixLocation =
@@ -43,10 +696,49 @@ int ViewerApplication::run()
   const auto normalMatrixLocation =
       glGetUniformLocation(glslProgram.glId(), "uNormalMatrix");
 
+  // Per draw transforms go through a ring of uniform buffer ranges when the
+  // vertex shader declares the Transforms block, through plain uniforms
+  // otherwise (custom shaders)
+  const auto transformsBlockIndex =
+      glGetUniformBlockIndex(glslProgram.glId(), "Transforms");
+  if (transformsBlockIndex != GL_INVALID_INDEX) {
+    glUniformBlockBinding(
+        glslProgram.glId(), transformsBlockIndex, UNIFORM_BINDING_TRANSFORMS);
+  }
+  // Room for 4096 draws per frame with the usual 256 bytes alignment, grows
+  // if needed
+  UniformRingBuffer transformRing{GL_UNIFORM_BUFFER, size_t(1) << 20};
+
+  // Vertex pulling: the draw records and indirect commands of each frame go
+  // through a ring of storage buffer ranges
+  GLuint drawIndexBuffer = 0;
+  GLuint drawIndexVertexArray = 0;
+  std::unique_ptr<UniformRingBuffer> pullingRing;
+  if (m_options.vertexPulling) {
+    drawIndexVertexArray = createDrawIndexVertexArrayObject(drawIndexBuffer);
+    pullingRing = std::make_unique<UniformRingBuffer>(
+        GL_SHADER_STORAGE_BUFFER, size_t(4) << 20);
+  }
+  // Draws of the asset being drawn, submitted by drawPulledPrimitives
+  struct PulledDraw
+  {
+    uint64_t key; // Pass, mode, run material, and depth for blended draws
+    int material;
+    int mode;
+    GLsizei primitiveIdx; // In GltfAsset::pulledPrimitives
+    int nodeIdx;
+    GLuint firstInstance;
+    GLuint instanceCount;
+  };
+  DrawListSorter drawSorter;
+  // Transient lists of drawScene (draw lists, traversal stacks) are
+  // allocated from frameArena, reset at the start of each frame
+  FrameArena frameArena;
+
   const auto lightDirectionLocation =
-      glGetUniformLocation(glslProgram.glId(), "uLightDirection");
+      glGetUniformLocation(shadingProgram.glId(), "uLightDirection");
   const auto lightIntensityLocation =
-      glGetUniformLocation(glslProgram.glId(), "uLightIntensity");
+      glGetUniformLocation(shadingProgram.glId(), "uLightIntensity");
 
   const auto baseColorTextureLocation =
       glGetUniformLocation(glslProgram.glId(), "uBaseColorTexture");
@@ -69,48 +761,148 @@ int ViewerApplication::run()
       glGetUniformLocation(glslProgram.glId(), "uOcclusionTexture");
   const auto occlusionStrengthLocation =
       glGetUniformLocation(glslProgram.glId(), "uOcclusionStrength");
+  const auto alphaCutoffLocation =
+      glGetUniformLocation(glslProgram.glId(), "uAlphaCutoff");
 
-  glm::vec3 lightDirection(1, 1, 1);
-  glm::vec3 lightIntensity(1, 1, 1);
-  bool isLightComingFromCamera = false;
+  // Bindless materials are selected by index when the fragment shader reads
+  // them (pbr_directional_light_bindless.fs.glsl), bound otherwise
+  const auto materialIndexLocation =
+      glGetUniformLocation(glslProgram.glId(), "uMaterialIndex");
+  const auto isBindlessPath =
+      m_options.bindlessTextures && materialIndexLocation >= 0;
 
   // Build projection matrix
-  glm::vec3 boundingBoxMax;
-  glm::vec3 boundingBoxMin;
-
-  computeSceneBounds(model, boundingBoxMin, boundingBoxMax);
-
-  auto diagonalVect = boundingBoxMax - boundingBoxMin;
-  auto distance = glm::length(diagonalVect);
-  auto maxDistance = distance > 0 ? distance : 100;
-  const auto projMatrix =
-      glm::perspective(70.f, float(m_nWindowWidth) / m_nWindowHeight,
-          0.001f * maxDistance, 1.5f * maxDistance);
+  BoundingBox sceneBounds;
+  for (const auto &instance : sceneAssets) {
+    for (const auto &bounds : instance.nodeWorldBounds) {
+      sceneBounds.extend(bounds);
+    }
+    for (const auto &bounds : instance.cellWorldBounds) {
+      sceneBounds.extend(bounds);
+    }
+  }
+  if (sceneBounds.isEmpty()) {
+    sceneBounds.extend(glm::vec3(0));
+  }
+  const auto boundingBoxMin = sceneBounds.min;
+  const auto boundingBoxMax = sceneBounds.max;
+
+  const auto fovY = 70.f;
+  const auto framing = computeSceneFraming(
+      sceneBounds, fovY, float(m_nWindowWidth) / m_nWindowHeight);
+  const auto maxDistance = framing.maxDistance;
+  const auto nearDepth = framing.nearDepth;
+  const auto farDepth = framing.farDepth;
+  const auto projMatrix = framing.projMatrix;
+
+  // Clustered shading: the lights of the scene are binned each frame by
+  // drawScene and go to the fragment shader through a ring of storage
+  // buffer ranges
+  std::unique_ptr<LightClusters> lightClusters;
+  std::unique_ptr<UniformRingBuffer> lightRing;
+  std::vector<PunctualLight> randomLights;
+  if (m_options.clusteredLights) {
+    lightClusters =
+        std::make_unique<LightClusters>(m_options.lightClusterOptions);
+    lightRing = std::make_unique<UniformRingBuffer>(
+        GL_SHADER_STORAGE_BUFFER, size_t(1) << 20);
+    appendRandomLights(boundingBoxMin, boundingBoxMax, 0.05f * maxDistance,
+        size_t(m_options.randomLightCount), 1, randomLights);
+  }
+  const auto directionalLightCountLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uDirectionalLightCount");
+  const auto clusterGridSizeLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uClusterGridSize");
+  const auto viewportSizeLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uViewportSize");
+  const auto clusterDepthScaleLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uClusterDepthScale");
+  const auto clusterDepthBiasLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uClusterDepthBias");
+
+  // Cascaded shadow maps of the directional light, rendered by drawScene
+  // before the scene with shadowProgram. Receivers sample them on
+  // shadowMapsTextureUnit.
+  std::unique_ptr<ShadowMaps> shadowMaps;
+  std::unique_ptr<GpuPassTimer> shadowTimer;
+  GLProgram shadowProgram;
+  const auto shadowMapsLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uShadowMaps");
+  if (m_options.shadows && shadowMapsLocation < 0) {
+    std::clog << "The fragment shader does not read shadow maps, disabling "
+                 "shadows"
+              << std::endl;
+  } else if (m_options.shadows) {
+    shadowMaps = std::make_unique<ShadowMaps>(m_options.shadowOptions);
+    shadowTimer = std::make_unique<GpuPassTimer>();
+    shadowProgram =
+        compileProgram({m_ShadersRootPath / m_AppName / "forward.vs.glsl",
+            m_ShadersRootPath / m_AppName / "shadow_depth.fs.glsl"});
+    glUniformBlockBinding(shadowProgram.glId(),
+        glGetUniformBlockIndex(shadowProgram.glId(), "Transforms"),
+        UNIFORM_BINDING_TRANSFORMS);
+  }
+  const auto shadowCascadeCountLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uShadowCascadeCount");
+  const auto shadowMatricesLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uShadowMatrices");
+  const auto shadowNormalOffsetsLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uShadowNormalOffsets");
+  size_t shadowFrameIdx = 0; // For the updates of distant cascades
+
+  // Image based lighting of the environment map, precomputed (or read from
+  // its cache) once. Its textures stay bound to their units.
+  std::unique_ptr<EnvironmentTextures> environmentTextures;
+  const auto environmentIntensityLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uEnvironmentIntensity");
+  const auto viewToWorldLocation =
+      glGetUniformLocation(shadingProgram.glId(), "uViewToWorld");
+  if (!m_options.environmentPath.empty() &&
+      environmentIntensityLocation < 0) {
+    std::clog << "The fragment shader does not read the environment, "
+                 "ignoring it"
+              << std::endl;
+  } else if (!m_options.environmentPath.empty()) {
+    EnvironmentLighting environmentLighting;
+    std::string error;
+    if (!loadEnvironment(environmentLighting, error)) {
+      std::cerr << "Error: " << error << std::endl;
+      return -1;
+    }
+    environmentTextures =
+        std::make_unique<EnvironmentTextures>(environmentLighting);
+    glActiveTexture(GL_TEXTURE0 + specularEnvironmentTextureUnit);
+    glBindTexture(
+        GL_TEXTURE_CUBE_MAP, environmentTextures->specularCubemap());
+    glActiveTexture(GL_TEXTURE0 + brdfLutTextureUnit);
+    glBindTexture(GL_TEXTURE_2D, environmentTextures->brdfLut());
+    glActiveTexture(GL_TEXTURE0);
+    shadingProgram.use();
+    glUniform3fv(
+        glGetUniformLocation(shadingProgram.glId(), "uIrradianceSH"), 9,
+        value_ptr(environmentLighting.irradianceSH[0]));
+    glUniform1f(
+        glGetUniformLocation(shadingProgram.glId(), "uSpecularMaxLevel"),
+        float(environmentTextures->specularLevelCount() - 1));
+  }
 
   std::unique_ptr<CameraController> cameraController =
       std::make_unique<TrackballCameraController>(
-          m_GLFWHandle.window(), 0.5f * maxDistance);
+          m_GLFWHandle->window(), 0.5f * maxDistance);
 
   if (m_hasUserCamera) {
     cameraController->setCamera(m_userCamera);
   } else {
-    const auto center = (boundingBoxMax + boundingBoxMin) / 2.f;
-    const auto up = glm::vec3(0, 1, 0);
-    const auto eye = diagonalVect.z > 0
-                         ? center + diagonalVect
-                         : center + 2.f * glm::cross(diagonalVect, up);
-
-    cameraController->setCamera(Camera{eye, center, up});
+    cameraController->setCamera(framing.defaultCamera);
   }
 
-  const auto textureObjects = createTextureObjects(model);
   GLuint whiteTexture;
   glGenTextures(1, &whiteTexture);
   float white[] = {1, 1, 1, 1};
 
   glBindTexture(GL_TEXTURE_2D, whiteTexture);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 2, 2, 0, GL_RGBA, GL_FLOAT, white);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_FLOAT, white);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -120,105 +912,231 @@ int ViewerApplication::run()
 
   glBindTexture(GL_TEXTURE_2D, 0);
 
-  const auto vertexBufferObjectList = createBufferObjects(model);
-
-  std::vector<VaoRange> meshVaoRangeList;
-  const auto vertexAttributeObjectList =
-      createVertexArrayObjects(model, vertexBufferObjectList, meshVaoRangeList);
+  // Deferred shading renders to its own targets, then composites into the
+  // framebuffer bound when drawScene is called
+  std::unique_ptr<DeferredTargets> deferredTargets;
+  std::unique_ptr<GpuPassTimer> geometryTimer;
+  std::unique_ptr<GpuPassTimer> lightingTimer;
+  std::unique_ptr<GpuPassTimer> compositeTimer;
+  const auto alphaDitherLocation =
+      glGetUniformLocation(glslProgram.glId(), "uAlphaDither");
+  if (m_options.deferredShading) {
+    deferredTargets =
+        std::make_unique<DeferredTargets>(m_nWindowWidth, m_nWindowHeight);
+    geometryTimer = std::make_unique<GpuPassTimer>();
+    lightingTimer = std::make_unique<GpuPassTimer>();
+    compositeTimer = std::make_unique<GpuPassTimer>();
+    const auto gbufferSamplerNames = {"uGBufferBaseColor", "uGBufferNormal",
+        "uGBufferEmissive", "uGBufferDepth"};
+    deferredLightingProgram.use();
+    auto unit = gbufferFirstTextureUnit;
+    for (const auto name : gbufferSamplerNames) {
+      glUniform1i(
+          glGetUniformLocation(deferredLightingProgram.glId(), name), unit++);
+    }
+    glUniformMatrix4fv(glGetUniformLocation(deferredLightingProgram.glId(),
+                           "uInverseProjMatrix"),
+        1, GL_FALSE, value_ptr(glm::inverse(projMatrix)));
+    compositeProgram.use();
+    glUniform1i(glGetUniformLocation(compositeProgram.glId(), "uLightBuffer"),
+        lightBufferTextureUnit);
+    glUniform1i(glGetUniformLocation(compositeProgram.glId(), "uDepth"),
+        lightBufferTextureUnit + 1);
+  }
 
   // Setup OpenGL state for rendering
   glEnable(GL_DEPTH_TEST);
+  // Even without shadows: samplers of different types cannot share a unit
+  shadingProgram.use();
+  glUniform1i(shadowMapsLocation, shadowMapsTextureUnit);
+  glUniform1i(
+      glGetUniformLocation(shadingProgram.glId(), "uSpecularEnvironment"),
+      specularEnvironmentTextureUnit);
+  glUniform1i(glGetUniformLocation(shadingProgram.glId(), "uBrdfLut"),
+      brdfLutTextureUnit);
   glslProgram.use();
+  // Texture pools are bound to the first texture units
+  const auto texturePoolsLocation =
+      glGetUniformLocation(glslProgram.glId(), "uTexturePools");
+  if (texturePoolsLocation >= 0) {
+    std::vector<GLint> units(m_options.texturePoolOptions.maxPoolCount);
+    std::iota(begin(units), end(units), 0);
+    glUniform1iv(texturePoolsLocation, GLsizei(units.size()), units.data());
+  }
+  setDefaultInstanceAttributes();
+
+  RenderSettings guiSettings;
+  guiSettings.isParallelRecordingEnabled = m_options.parallelRecording;
+  guiSettings.isShadowCachingEnabled = m_options.shadowOptions.cacheStaticDepth;
+  guiSettings.environmentIntensity = m_options.environmentIntensity;
+  guiSettings.hlodMaxScreenError = m_options.hlodMaxScreenError;
+  DrawStats drawStats;
+
+  GLuint boundMaterialBuffer = 0; // Reset by drawScene
+  const auto bindMaterial = [&](const GltfAsset &asset,
+                                const auto materialIndex) {
+    if (isBindlessPath && asset.bindlessMaterialBuffer) {
+      if (asset.bindlessMaterialBuffer != boundMaterialBuffer) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING_MATERIALS,
+            asset.bindlessMaterialBuffer);
+        boundMaterialBuffer = asset.bindlessMaterialBuffer;
+      }
+      // The default material follows the materials of the model
+      glUniform1ui(materialIndexLocation,
+          GLuint(materialIndex >= 0 ? size_t(materialIndex)
+                                    : asset.model.materials.size()));
+      glUniform4f(baseColorFactorLocation, 1.f, 1.f, 1.f, 1.f);
+      return;
+    }
+    const auto &model = asset.model;
+    const auto &textureObjects = asset.textureObjects;
+    // Primitives without material use the default material of the spec
+    static const tinygltf::Material defaultMaterial;
+    const tinygltf::Material &material =
+        materialIndex >= 0 ? model.materials[materialIndex] : defaultMaterial;
+    const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+    drawStats.textureBindCount += 4;
+    glUniform1f(alphaCutoffLocation,
+        materialIndex >= 0 &&
+                asset.materialPasses[materialIndex] == DRAW_PASS_MASK
+            ? float(material.alphaCutoff)
+            : 0.f);
+
+    if (pbrMetallicRoughness.baseColorTexture.index >= 0) {
+      const auto &texture =
+          model.textures[pbrMetallicRoughness.baseColorTexture.index];
+      glActiveTexture(GL_TEXTURE0);
+      assert(texture.source >= 0);
+      glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
+      glUniform1i(baseColorTextureLocation, 0);
+      glUniform4f(baseColorFactorLocation,
+          (float)pbrMetallicRoughness.baseColorFactor[0],
+          (float)pbrMetallicRoughness.baseColorFactor[1],
+          (float)pbrMetallicRoughness.baseColorFactor[2],
+          (float)pbrMetallicRoughness.baseColorFactor[3]);
+
+    } else {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, whiteTexture);
+      glUniform1i(baseColorTextureLocation, 0);
+      glUniform4f(
+          baseColorFactorLocation, white[0], white[1], white[2], white[3]);
+    }
 
-  const auto bindMaterial = [&](const auto materialIndex) {
-    if (materialIndex >= 0) {
-      const tinygltf::Material &material = model.materials[materialIndex];
-      const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
-      
-      if (pbrMetallicRoughness.baseColorTexture.index >= 0) {
-        const auto &texture =
-            model.textures[pbrMetallicRoughness.baseColorTexture.index];
-        glActiveTexture(GL_TEXTURE0);
-        assert(texture.source >= 0);
-        glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
-        glUniform1i(baseColorTextureLocation, 0);
-        glUniform4f(baseColorFactorLocation,
-            (float)pbrMetallicRoughness.baseColorFactor[0],
-            (float)pbrMetallicRoughness.baseColorFactor[1],
-            (float)pbrMetallicRoughness.baseColorFactor[2],
-            (float)pbrMetallicRoughness.baseColorFactor[3]);
+    if (pbrMetallicRoughness.metallicRoughnessTexture.index >= 0) {
+      const auto &texture =
+          model.textures[pbrMetallicRoughness.metallicRoughnessTexture.index];
+      glActiveTexture(GL_TEXTURE1);
+      assert(texture.source >= 0);
+      glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
+      glUniform1i(metallicRoughnessTextureLocation, 1);
+      glUniform1f(
+          metallicFactorLocation, (float)pbrMetallicRoughness.metallicFactor);
+      glUniform1f(roughnessFactorLocation,
+          (float)pbrMetallicRoughness.roughnessFactor);
+    } else {
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glUniform1i(metallicRoughnessTextureLocation, 1);
+      glUniform1f(metallicFactorLocation, 0);
+      glUniform1f(roughnessFactorLocation, 0);
+    }
 
-      } else {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, whiteTexture);
-        glUniform1i(baseColorTextureLocation, 0);
-        glUniform4f(
-            baseColorFactorLocation, white[0], white[1], white[2], white[3]);
-      }
-
-      if (pbrMetallicRoughness.metallicRoughnessTexture.index >= 0) {
-        const auto &texture =
-            model.textures[pbrMetallicRoughness.metallicRoughnessTexture.index];
-        glActiveTexture(GL_TEXTURE1);
-        assert(texture.source >= 0);
-        glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
-        glUniform1i(metallicRoughnessTextureLocation, 1);
-        glUniform1f(
-            metallicFactorLocation, (float)pbrMetallicRoughness.metallicFactor);
-        glUniform1f(roughnessFactorLocation,
-            (float)pbrMetallicRoughness.roughnessFactor);
-      } else {
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glUniform1i(metallicRoughnessTextureLocation, 1);
-        glUniform1f(metallicFactorLocation, 0);
-        glUniform1f(roughnessFactorLocation, 0);
-      }
-
-      if (material.emissiveTexture.index >= 0) {
-        const auto &texture = model.textures[material.emissiveTexture.index];
-        glActiveTexture(GL_TEXTURE2);
-        assert(texture.source >= 0);
-        glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
-        glUniform1i(emissiveTextureLocation, 2);
-        glUniform3f(emissiveFactorLocation, (float)material.emissiveFactor[0],
-            (float)material.emissiveFactor[1],
-            (float)material.emissiveFactor[2]);
-      } else {
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glUniform1i(emissiveTextureLocation, 2);
-        glUniform3f(emissiveFactorLocation, 0.f, 0.f, 0.f);
-      }
-
-      if (material.occlusionTexture.index >= 0) {
-        const auto &texture = model.textures[material.occlusionTexture.index];
-        glActiveTexture(GL_TEXTURE3);
-        assert(texture.source >= 0);
-        glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
-        glUniform1i(occlusionTextureLocation, 3);
-        glUniform1f(occlusionStrengthLocation,
-            (float)material.occlusionTexture.strength);
-      } else {
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glUniform1i(occlusionTextureLocation, 3);
-        glUniform1f(occlusionStrengthLocation,
-            0.f); // the spec says to make 1.0f but we see with the teacher, and
-                  // assume that we need 0.f occlusion by default
-      }
+    if (material.emissiveTexture.index >= 0) {
+      const auto &texture = model.textures[material.emissiveTexture.index];
+      glActiveTexture(GL_TEXTURE2);
+      assert(texture.source >= 0);
+      glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
+      glUniform1i(emissiveTextureLocation, 2);
+      glUniform3f(emissiveFactorLocation, (float)material.emissiveFactor[0],
+          (float)material.emissiveFactor[1],
+          (float)material.emissiveFactor[2]);
+    } else {
+      glActiveTexture(GL_TEXTURE2);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glUniform1i(emissiveTextureLocation, 2);
+      glUniform3f(emissiveFactorLocation, 0.f, 0.f, 0.f);
+    }
+
+    if (material.occlusionTexture.index >= 0) {
+      const auto &texture = model.textures[material.occlusionTexture.index];
+      glActiveTexture(GL_TEXTURE3);
+      assert(texture.source >= 0);
+      glBindTexture(GL_TEXTURE_2D, textureObjects[texture.source]);
+      glUniform1i(occlusionTextureLocation, 3);
+      glUniform1f(occlusionStrengthLocation,
+          (float)material.occlusionTexture.strength);
+    } else {
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      glUniform1i(occlusionTextureLocation, 3);
+      glUniform1f(occlusionStrengthLocation,
+          0.f); // the spec says to make 1.0f but we see with the teacher, and
+                // assume that we need 0.f occlusion by default
+    }
+  };
+  const auto setDrawTransforms = [&](const DrawTransforms &transforms) {
+    if (transformsBlockIndex != GL_INVALID_INDEX) {
+      const auto offset = transformRing.push(transforms);
+      glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BINDING_TRANSFORMS,
+          transformRing.glId(), offset, sizeof(DrawTransforms));
+      return;
     }
+    glUniformMatrix4fv(modelViewMatrixLocation, 1, GL_FALSE,
+        value_ptr(transforms.modelViewMatrix));
+    glUniformMatrix4fv(modelViewProjMatrixLocation, 1, GL_FALSE,
+        value_ptr(transforms.modelViewProjMatrix));
+    glUniformMatrix4fv(normalMatrixLocation, 1, GL_FALSE,
+        value_ptr(transforms.normalMatrix));
   };
+  // Blended draws are composited over what is behind them, without
+  // hiding what is drawn after them
+  const auto setDrawPass = [&](DrawPass pass) {
+    if (deferredTargets) {
+      glUniform1i(alphaDitherLocation, pass == DRAW_PASS_BLEND);
+      return;
+    }
+    if (pass == DRAW_PASS_BLEND) {
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      glDepthMask(GL_FALSE);
+    } else {
+      glDisable(GL_BLEND);
+      glDepthMask(GL_TRUE);
+    }
+  };
+  // Built once: the draw commands of each frame are replayed with it
+  DrawCommandContext drawCommandContext;
+  drawCommandContext.transformRing = &transformRing;
+  drawCommandContext.transformsBinding = UNIFORM_BINDING_TRANSFORMS;
+  drawCommandContext.setDrawPass = setDrawPass;
+  drawCommandContext.setDrawTransforms = setDrawTransforms;
+  drawCommandContext.bindMaterial = bindMaterial;
+
   // Lambda function to draw the scene
-  const auto drawScene = [&](const Camera &camera) {
+  const auto drawScene = [&](const Camera &camera,
+                             const RenderSettings &settings) {
     glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Until the draws of the scene, for the uniforms of the lights
+    shadingProgram.use();
 
     const auto viewMatrix = camera.getViewMatrix();
+    const auto frustum = extractFrustum(projMatrix * viewMatrix);
+    drawStats = DrawStats{};
+    boundMaterialBuffer = 0;
+    frameArena.reset();
+    transformRing.beginFrame();
+    if (pullingRing) {
+      pullingRing->beginFrame();
+    }
+    if (lightRing) {
+      lightRing->beginFrame();
+    }
 
     if (lightDirectionLocation >= 0) {
 
-      if (isLightComingFromCamera) {
+      if (settings.isLightComingFromCamera) {
 
         static auto lightCamera = glm::vec3(0.f, 0.f, 1.f);
 
@@ -226,7 +1144,7 @@ int ViewerApplication::run()
             lightCamera[2]);
       } else {
         const auto viewLightDirection = glm::normalize(
-            glm::vec3(viewMatrix * glm::vec4(lightDirection,
+            glm::vec3(viewMatrix * glm::vec4(settings.lightDirection,
                                        0.))); // 0 in w for the homogenous
         // component (vector = 0, point != 0)
         glUniform3f(lightDirectionLocation, viewLightDirection[0],
@@ -235,91 +1153,891 @@ int ViewerApplication::run()
     }
 
     if (lightIntensityLocation >= 0) {
-      glUniform3f(lightIntensityLocation, lightIntensity[0], lightIntensity[1],
-          lightIntensity[2]);
-    }
-
-    // The recursive function that should draw a node
-    // We use a std::function because a simple lambda cannot be recursive
-    const std::function<void(int, const glm::mat4 &)> drawNode =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          auto node = model.nodes[nodeIdx];
-          auto nodeModelMatrix =
-              getLocalToWorldMatrix(model.nodes[nodeIdx], parentMatrix);
-          if (node.mesh >= 0) {
-            const auto modelViewMatrix = viewMatrix * nodeModelMatrix;
-            const auto modelViewProjectionMatrix = projMatrix * modelViewMatrix;
-            const auto normalMatrix =
-                glm::transpose(glm::inverse(modelViewMatrix));
-
-            glUniformMatrix4fv(modelViewMatrixLocation, 1, GL_FALSE,
-                value_ptr(modelViewMatrix));
-            glUniformMatrix4fv(modelViewProjMatrixLocation, 1, GL_FALSE,
-                value_ptr(modelViewProjectionMatrix));
-            glUniformMatrix4fv(
-                normalMatrixLocation, 1, GL_FALSE, value_ptr(normalMatrix));
-
-            const auto &mesh = model.meshes[node.mesh];
-            const auto &vaoRange = meshVaoRangeList[node.mesh];
-
-            for (uint primIdx = 0; primIdx < mesh.primitives.size();
-                 primIdx++) {
-              const auto &primitiveVao =
-                  vertexAttributeObjectList[vaoRange.begin + primIdx];
-              const auto &primitive = mesh.primitives[primIdx];
-
-              bindMaterial(primitive.material);
-
-              glBindVertexArray(primitiveVao);
-              if (primitive.indices >= 0) {
-                const auto &accessor = model.accessors[primitive.indices];
-                const auto &bufferView = model.bufferViews[accessor.bufferView];
-                const auto byteOffset =
-                    accessor.byteOffset + bufferView.byteOffset;
-                glDrawElements(primitive.mode, GLsizei(accessor.count),
-                    accessor.componentType, (const GLvoid *)byteOffset);
-              } else {
-                const auto accessorIdx = (*begin(primitive.attributes)).second;
-                const auto &accessor = model.accessors[accessorIdx];
-                glDrawArrays(primitive.mode, 0, GLsizei(accessor.count));
-              }
+      const auto &intensity = settings.lightIntensity;
+      glUniform3f(
+          lightIntensityLocation, intensity[0], intensity[1], intensity[2]);
+    }
+
+    // Shadow cascades fitted to the view, and the cascades whose maps are
+    // rendered this frame (bit i for cascade i)
+    ShadowCascade shadowCascades[maxShadowCascadeCount];
+    Frustum shadowFrustums[maxShadowCascadeCount];
+    uint32_t shadowUpdateMask = 0;
+    if (shadowMaps && settings.isShadowEnabled) {
+      const auto lightDirection =
+          settings.isLightComingFromCamera
+              ? glm::vec3(glm::inverse(viewMatrix) * glm::vec4(0, 0, 1, 0))
+              : settings.lightDirection;
+      fitShadowCascades(viewMatrix, projMatrix, nearDepth, farDepth,
+          lightDirection, sceneBounds, shadowMaps->options(), shadowCascades);
+      for (int cascadeIdx = 0; cascadeIdx < shadowMaps->cascadeCount();
+           ++cascadeIdx) {
+        if (shadowMaps->needsUpdate(cascadeIdx, shadowCascades[cascadeIdx],
+                shadowFrameIdx, settings.isShadowCachingEnabled)) {
+          shadowUpdateMask |= 1u << cascadeIdx;
+          shadowFrustums[cascadeIdx] =
+              extractFrustum(shadowCascades[cascadeIdx].viewProjMatrix);
+        }
+      }
+      ++shadowFrameIdx;
+    }
+
+    // CPU work of the frame that does not touch GL runs as jobs, the
+    // calling thread taking part in them until they complete: draw
+    // transforms and visibility of all the nodes, by ranges over the nodes
+    // of all the instances (and in the cascades to update), and visibility
+    // and priorities of the cells of streamed assets
+    const auto isCullingEnabled = settings.isFrustumCullingEnabled;
+    const auto updateNodes = [&](size_t first, size_t last) {
+      auto instanceIdx = size_t(std::upper_bound(begin(sceneNodeOffsets),
+                                    end(sceneNodeOffsets), first) -
+                                begin(sceneNodeOffsets)) -
+                         1;
+      for (; first < last; ++instanceIdx) {
+        auto &instance = sceneAssets[instanceIdx];
+        const auto offset = sceneNodeOffsets[instanceIdx];
+        const auto nodeBegin = first - offset;
+        const auto nodeEnd =
+            std::min(last, sceneNodeOffsets[instanceIdx + 1]) - offset;
+        computeDrawTransforms(viewMatrix, projMatrix,
+            instance.nodeWorldMatrices.data() + nodeBegin,
+            instance.nodeNormalMatrices.data() + nodeBegin,
+            nodeEnd - nodeBegin, instance.nodeTransforms.data() + nodeBegin);
+        // Node bounds do not include the children, which are tested on
+        // their own
+        for (auto nodeIdx = nodeBegin; nodeIdx < nodeEnd; ++nodeIdx) {
+          const auto &bounds = instance.nodeWorldBounds[nodeIdx];
+          instance.nodeVisibility[nodeIdx] =
+              !isCullingEnabled || isBoxVisible(frustum, bounds);
+          // Instanced nodes in view are culled instance by instance, and
+          // are not drawn if none of their instances is visible
+          const auto rangeOffset = instance.instanceRangeOffsets[nodeIdx];
+          const auto rangeCapacity =
+              instance.instanceRangeOffsets[nodeIdx + 1] - rangeOffset;
+          if (rangeCapacity && instance.nodeVisibility[nodeIdx]) {
+            const auto &instanceOffsets =
+                instance.asset->instanceBoundsOffsets;
+            const auto instanceCount =
+                instanceOffsets[nodeIdx + 1] - instanceOffsets[nodeIdx];
+            auto *ranges = instance.instanceRanges.data() + rangeOffset;
+            auto rangeCount = size_t(1);
+            if (isCullingEnabled) {
+              rangeCount = cullInstances(frustum,
+                  instance.instanceWorldBounds.data() +
+                      instanceOffsets[nodeIdx],
+                  instanceCount, ranges, rangeCapacity);
+            } else {
+              ranges[0] = InstanceRange{0, uint32_t(instanceCount)};
             }
+            instance.nodeInstanceRangeCounts[nodeIdx] = uint8_t(rangeCount);
+            instance.nodeVisibility[nodeIdx] = rangeCount > 0;
           }
+          const auto center = 0.5f * (bounds.min + bounds.max);
+          instance.nodeViewDepths[nodeIdx] =
+              -(viewMatrix * glm::vec4(center, 1.f)).z;
+          if (!shadowUpdateMask) {
+            continue;
+          }
+          // Nodes without mesh have empty bounds
+          uint8_t shadowMask = 0;
+          for (int cascadeIdx = 0; cascadeIdx < maxShadowCascadeCount;
+               ++cascadeIdx) {
+            const auto isUpdated = shadowUpdateMask & (1u << cascadeIdx);
+            if (isUpdated && !bounds.isEmpty() &&
+                (!isCullingEnabled ||
+                    isBoxVisible(shadowFrustums[cascadeIdx], bounds))) {
+              shadowMask |= uint8_t(1u << cascadeIdx);
+            }
+          }
+          instance.nodeShadowMasks[nodeIdx] = shadowMask;
+        }
+        first = offset + nodeEnd;
+      }
+    };
+    // Visible cells come first, then cells close to the camera
+    const auto updateCells = [&](size_t first, size_t last) {
+      for (auto instanceIdx = first; instanceIdx < last; ++instanceIdx) {
+        auto &instance = sceneAssets[instanceIdx];
+        for (size_t cellIdx = 0; cellIdx < instance.cellWorldBounds.size();
+             ++cellIdx) {
+          const auto &bounds = instance.cellWorldBounds[cellIdx];
+          const auto isVisible = isBoxVisible(frustum, bounds);
+          const auto distance =
+              glm::distance(camera.eye(), 0.5f * (bounds.min + bounds.max));
+          instance.cellVisibility[cellIdx] = !isCullingEnabled || isVisible;
+          instance.cellPriorities[cellIdx] =
+              (isVisible ? 1.f : 0.f) + 1.f / (1.f + distance);
+        }
+      }
+    };
+    // Lights are binned along with the other frame jobs
+    FrameVector<PunctualLight> sceneLights{
+        FrameArenaAllocator<PunctualLight>(frameArena)};
+    const auto buildLightClusters = [&]() {
+      lightClusters->build(sceneLights.data(), sceneLights.size(), viewMatrix,
+          projMatrix, nearDepth, farDepth);
+    };
+    auto &jobSystem = JobSystem::instance();
+    JobCounter frameJobs;
+    if (lightClusters) {
+      for (const auto &instance : sceneAssets) {
+        sceneLights.insert(
+            end(sceneLights), begin(instance.lights), end(instance.lights));
+      }
+      sceneLights.insert(
+          end(sceneLights), begin(randomLights), end(randomLights));
+      jobSystem.submit(frameJobs, buildLightClusters);
+    }
+    jobSystem.submitRange(
+        frameJobs, sceneNodeOffsets.back(), nodeGrainSize, updateNodes);
+    jobSystem.submitRange(frameJobs, sceneAssets.size(), 1, updateCells);
+    jobSystem.wait(frameJobs);
+
+    if (lightClusters) {
+      // Empty ranges cannot be bound: empty arrays get one element
+      const auto bindLightStorage = [&](GLuint binding, const auto &values) {
+        using Value = typename std::decay_t<decltype(values)>::value_type;
+        const Value empty{};
+        const auto byteCount =
+            std::max(values.size(), size_t(1)) * sizeof(Value);
+        const auto offset = lightRing->push(
+            values.empty() ? &empty : values.data(), byteCount);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding,
+            lightRing->glId(), offset, GLsizeiptr(byteCount));
+      };
+      bindLightStorage(STORAGE_BINDING_LIGHTS, lightClusters->gpuLights());
+      bindLightStorage(
+          STORAGE_BINDING_CLUSTERS, lightClusters->clusterRanges());
+      bindLightStorage(
+          STORAGE_BINDING_LIGHT_INDICES, lightClusters->lightIndices());
+      const auto &clusterOptions = lightClusters->options();
+      glUniform1ui(directionalLightCountLocation,
+          GLuint(lightClusters->stats().directionalLightCount));
+      glUniform3i(clusterGridSizeLocation, clusterOptions.tileCountX,
+          clusterOptions.tileCountY, clusterOptions.sliceCount);
+      glUniform2f(
+          viewportSizeLocation, float(m_nWindowWidth), float(m_nWindowHeight));
+      glUniform1f(clusterDepthScaleLocation, lightClusters->depthScale());
+      glUniform1f(clusterDepthBiasLocation, lightClusters->depthBias());
+      drawStats.lightClusterStats = lightClusters->stats();
+    }
+
+    // For geometry stored in the space of the scene root
+    const auto setRootTransforms = [&](const SceneAssetInstance &instance) {
+      DrawTransforms transforms;
+      computeDrawTransforms(viewMatrix, projMatrix, &instance.rootTransform,
+          &instance.rootNormalMatrix, 1, &transforms);
+      setDrawTransforms(transforms);
+    };
+
+    // Draws of the asset being drawn, submitted by drawPulledPrimitives
+    FrameVector<PulledDraw> pulledDraws{FrameArenaAllocator<PulledDraw>(
+        frameArena)};
+    FrameVector<PulledDrawRecord> pulledRecords{
+        FrameArenaAllocator<PulledDrawRecord>(frameArena)};
+    FrameVector<DrawArraysIndirectCommand> pulledCommands{
+        FrameArenaAllocator<DrawArraysIndirectCommand>(frameArena)};
+    if (pullingRing) {
+      pulledRecords.reserve(maxPulledDrawCount);
+      pulledCommands.reserve(maxPulledDrawCount);
+    }
+    FrameVector<QueuedDraw> queuedDraws{
+        FrameArenaAllocator<QueuedDraw>(frameArena)};
+    FrameVector<uint64_t> drawKeys{FrameArenaAllocator<uint64_t>(frameArena)};
+    const auto getMaterialPass = [&](const GltfAsset &asset, int material) {
+      return material >= 0 ? asset.materialPasses[material] : DRAW_PASS_OPAQUE;
+    };
+
+    // Vertex input bound by all the draws of the frame
+    VertexInputState vertexInput;
+
+    // Draw the mesh of a node (its visible instances for instanced nodes,
+    // with one draw per range of consecutive visible instances)
+    const auto drawMeshNode = [&](const SceneAssetInstance &instance,
+                                  int nodeIdx) {
+      const auto &asset = *instance.asset;
+      const auto &model = asset.model;
+      const auto &node = model.nodes[nodeIdx];
+      if (!instance.nodeVisibility[nodeIdx]) {
+        ++drawStats.culledNodeCount;
+        return;
+      }
+
+      const auto &mesh = model.meshes[node.mesh];
+      const auto instanceCount =
+          GLsizei(asset.nodeInstancing[nodeIdx].instanceCount);
+      const auto &vaoRange = instanceCount
+                                 ? asset.nodeIndexToInstancedVaoRange[nodeIdx]
+                                 : asset.meshIndexToVaoRange[node.mesh];
+
+      const InstanceRange noInstances{0, 0};
+      const auto *instanceRanges =
+          instanceCount ? instance.instanceRanges.data() +
+                              instance.instanceRangeOffsets[nodeIdx]
+                        : &noInstances;
+      const auto rangeCount =
+          instanceCount ? size_t(instance.nodeInstanceRangeCounts[nodeIdx])
+                        : size_t(1);
+
+      ++drawStats.drawnNodeCount;
+      for (size_t rangeIdx = 0; rangeIdx < rangeCount; ++rangeIdx) {
+        drawStats.drawnInstanceCount +=
+            std::max(instanceRanges[rangeIdx].count, 1u);
+      }
 
-          for (const auto &childIdx : node.children) {
-            drawNode(childIdx, nodeModelMatrix);
+      const auto depth = instance.nodeViewDepths[nodeIdx];
+      if (pullingRing) {
+        // Opaque and alpha tested draws are not sorted on depth, so that
+        // runs of draws sharing a material are not split
+        const auto isPooled = asset.materialBuffer != 0;
+        for (size_t primIdx = 0; primIdx < mesh.primitives.size(); primIdx++) {
+          const auto &primitive = mesh.primitives[primIdx];
+          const auto pass = getMaterialPass(asset, primitive.material);
+          const auto runMaterial =
+              isPooled ? 0u : uint32_t(primitive.material + 1);
+          const auto key =
+              makeDrawKey(pass, pass == DRAW_PASS_BLEND ? depth : nearDepth,
+                  nearDepth, farDepth, uint32_t(primitive.mode), runMaterial);
+          for (size_t rangeIdx = 0; rangeIdx < rangeCount; ++rangeIdx) {
+            const auto &range = instanceRanges[rangeIdx];
+            pulledDraws.push_back(PulledDraw{key, primitive.material,
+                primitive.mode, vaoRange.begin + GLsizei(primIdx), nodeIdx,
+                range.first, std::max(range.count, 1u)});
           }
-        };
+        }
+        return;
+      }
+      for (size_t primIdx = 0; primIdx < mesh.primitives.size(); primIdx++) {
+        const auto material = mesh.primitives[primIdx].material;
+        const auto key = makeDrawKey(getMaterialPass(asset, material), depth,
+            nearDepth, farDepth, 0,
+            (instance.assetKey << 20) | uint32_t(material + 1));
+        for (size_t rangeIdx = 0; rangeIdx < rangeCount; ++rangeIdx) {
+          drawKeys.push_back(key);
+          queuedDraws.push_back(
+              QueuedDraw{&asset, &instance.nodeTransforms[nodeIdx], nodeIdx,
+                  int(primIdx), instanceRanges[rangeIdx]});
+        }
+      }
+    };
+
+    // Draw the hierarchies of the root nodes, depth first with children in
+    // order, walked with a stack instead of recursive calls
+    FrameVector<int> nodeStack{FrameArenaAllocator<int>(frameArena)};
+    const auto drawNodes = [&](const SceneAssetInstance &instance,
+                               const std::vector<int> &rootNodes) {
+      const auto &asset = *instance.asset;
+      nodeStack.assign(rootNodes.rbegin(), rootNodes.rend());
+      while (!nodeStack.empty()) {
+        const auto nodeIdx = nodeStack.back();
+        nodeStack.pop_back();
+        const auto &node = asset.model.nodes[nodeIdx];
+        // Batched nodes are drawn by drawStaticBatches
+        const auto isBatched = settings.isStaticBatchingEnabled &&
+                               !asset.staticBatches.isBatchedNode.empty() &&
+                               asset.staticBatches.isBatchedNode[nodeIdx];
+        if (node.mesh >= 0 && !isBatched) {
+          drawMeshNode(instance, nodeIdx);
+        }
+        nodeStack.insert(
+            end(nodeStack), node.children.rbegin(), node.children.rend());
+      }
+    };
+
+    // Vertex pulling: the draws collected by drawMeshNode are sorted by
+    // pass, material and mode, their records written to the ring, and each
+    // run of draws sharing a key is submitted with one multi-draw call. The
+    // index of a draw in its batch of records is its baseInstance. With
+    // texture pools, all the materials are bound at once and runs are only
+    // split by pass and mode.
+    const auto drawPulledPrimitives = [&](const SceneAssetInstance &instance) {
+      const auto &asset = *instance.asset;
+      const auto isPooled = asset.materialBuffer != 0;
+      const auto drawCount = pulledDraws.size();
+      auto *keys = frameArena.allocateArray<uint64_t>(drawCount);
+      auto *order = frameArena.allocateArray<uint32_t>(drawCount);
+      for (size_t drawIdx = 0; drawIdx < drawCount; ++drawIdx) {
+        keys[drawIdx] = pulledDraws[drawIdx].key;
+        order[drawIdx] = uint32_t(drawIdx);
+      }
+      radixSort(keys, order, drawCount, frameArena);
+      auto *sortedDraws = frameArena.allocateArray<PulledDraw>(drawCount);
+      for (size_t drawIdx = 0; drawIdx < drawCount; ++drawIdx) {
+        sortedDraws[drawIdx] = pulledDraws[order[drawIdx]];
+      }
+      std::copy_n(sortedDraws, drawCount, begin(pulledDraws));
+      vertexInput.bindVertexArray(drawIndexVertexArray);
+      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING_GEOMETRY,
+          asset.pullingBuffer);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pullingRing->glId());
+      if (isPooled) {
+        glBindTextures(0, GLsizei(asset.texturePoolObjects.size()),
+            asset.texturePoolObjects.data());
+        drawStats.textureBindCount += asset.texturePoolObjects.size();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING_MATERIALS,
+            asset.materialBuffer);
+      }
+      auto boundMaterial = std::numeric_limits<int>::min();
+      auto pass = DRAW_PASS_OPAQUE;
+      for (size_t batchBegin = 0; batchBegin < pulledDraws.size();
+           batchBegin += maxPulledDrawCount) {
+        const auto batchEnd =
+            std::min(batchBegin + maxPulledDrawCount, pulledDraws.size());
+        pulledRecords.clear();
+        pulledCommands.clear();
+        for (auto drawIdx = batchBegin; drawIdx < batchEnd; ++drawIdx) {
+          const auto &draw = pulledDraws[drawIdx];
+          const auto &primitive = asset.pulledPrimitives[draw.primitiveIdx];
+          pulledRecords.push_back(primitive.record);
+          pulledRecords.back().transforms =
+              instance.nodeTransforms[draw.nodeIdx];
+          // The default material follows the materials of the model
+          pulledRecords.back().materialIndex =
+              uint32_t(draw.material >= 0 ? size_t(draw.material)
+                                          : asset.model.materials.size());
+          // The shader reads the instance attributes at gl_InstanceID, which
+          // starts at 0: they start at the first instance of the range
+          for (auto attribIdx = int(VERTEX_ATTRIB_INSTANCE_TRANSLATION);
+               attribIdx <= VERTEX_ATTRIB_INSTANCE_SCALE; ++attribIdx) {
+            auto &attribute = pulledRecords.back().attributes[attribIdx];
+            attribute.offset += draw.firstInstance * attribute.stride;
+          }
+          pulledCommands.push_back(DrawArraysIndirectCommand{
+              primitive.vertexCount, draw.instanceCount, 0,
+              uint32_t(drawIdx - batchBegin)});
+        }
+        const auto recordsByteCount =
+            pulledRecords.size() * sizeof(PulledDrawRecord);
+        const auto recordsOffset =
+            pullingRing->push(pulledRecords.data(), recordsByteCount);
+        const auto commandsOffset = pullingRing->push(pulledCommands.data(),
+            pulledCommands.size() * sizeof(DrawArraysIndirectCommand));
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, STORAGE_BINDING_DRAWS,
+            pullingRing->glId(), recordsOffset, recordsByteCount);
+
+        for (auto runBegin = batchBegin; runBegin < batchEnd;) {
+          const auto &draw = pulledDraws[runBegin];
+          auto runEnd = runBegin + 1;
+          while (runEnd < batchEnd && pulledDraws[runEnd].key == draw.key) {
+            ++runEnd;
+          }
+          if (getDrawKeyPass(draw.key) != pass) {
+            pass = getDrawKeyPass(draw.key);
+            setDrawPass(pass);
+          }
+          if (pass == DRAW_PASS_BLEND) {
+            drawStats.blendedDrawCount += runEnd - runBegin;
+          }
+          if (!isPooled && draw.material != boundMaterial) {
+            bindMaterial(asset, draw.material);
+            boundMaterial = draw.material;
+          }
+          ++drawStats.drawCallCount;
+          ++drawStats.pulledBatchCount;
+          glMultiDrawArraysIndirect(draw.mode,
+              (const GLvoid *)(commandsOffset +
+                               (runBegin - batchBegin) *
+                                   sizeof(DrawArraysIndirectCommand)),
+              GLsizei(runEnd - runBegin), 0);
+          runBegin = runEnd;
+        }
+      }
+      if (pass != DRAW_PASS_OPAQUE) {
+        setDrawPass(DRAW_PASS_OPAQUE);
+      }
+      drawStats.pulledDrawCount += pulledDraws.size();
+      pulledDraws.clear();
+    };
+
+    // One draw call per visible chunk, with a single matrix upload per asset
+    // and a material bound once per run of chunks sharing it
+    const auto drawStaticBatches = [&](const SceneAssetInstance &instance) {
+      const auto &asset = *instance.asset;
+      const auto &chunks = asset.staticBatches.chunks;
+      setRootTransforms(instance);
+      vertexInput.bindVertexArray(asset.staticBatchVertexArrayObject);
+      auto boundMaterial = std::numeric_limits<int>::min();
+      for (size_t chunkIdx = 0; chunkIdx < chunks.size(); ++chunkIdx) {
+        if (settings.isFrustumCullingEnabled &&
+            !isBoxVisible(frustum, instance.chunkWorldBounds[chunkIdx])) {
+          continue;
+        }
+        const auto &chunk = chunks[chunkIdx];
+        if (chunk.material != boundMaterial) {
+          bindMaterial(asset, chunk.material);
+          boundMaterial = chunk.material;
+        }
+        ++drawStats.drawnChunkCount;
+        ++drawStats.drawCallCount;
+        glDrawElements(chunk.mode, GLsizei(chunk.indexCount), GL_UNSIGNED_INT,
+            (const GLvoid *)(chunk.firstIndex * sizeof(uint32_t)));
+      }
+    };
+
+    // HLOD assets: walk down the hierarchy from the root and stop at the
+    // first cluster whose proxy is accurate enough, leaves that are not
+    // draw their nodes
+    const auto drawClusters = [&](const SceneAssetInstance &instance) {
+      const auto &asset = *instance.asset;
+      nodeStack.assign(1, 0);
+      while (!nodeStack.empty()) {
+        const auto clusterIdx = nodeStack.back();
+        nodeStack.pop_back();
+        const auto &cluster = asset.hlod.clusters[clusterIdx];
+        const auto &bounds = instance.clusterWorldBounds[clusterIdx];
+        if (settings.isFrustumCullingEnabled &&
+            !isBoxVisible(frustum, bounds)) {
+          continue;
+        }
+        const auto screenError = computeScreenSpaceError(
+            instance.scale * cluster.geometricError,
+            computeDistanceToBox(camera.eye(), bounds), fovY,
+            float(m_nWindowHeight));
+        if (screenError <= settings.hlodMaxScreenError) {
+          ++drawStats.drawnHlodProxyCount;
+          if (!cluster.indexCount) {
+            continue; // Simplified away
+          }
+          setRootTransforms(instance);
+          bindMaterial(asset, -1);
+          glUniform4f(baseColorFactorLocation, cluster.color.r,
+              cluster.color.g, cluster.color.b, cluster.color.a);
+          vertexInput.bindVertexArray(asset.hlodVertexArrayObject);
+          ++drawStats.drawCallCount;
+          glDrawElements(GL_TRIANGLES, GLsizei(cluster.indexCount),
+              GL_UNSIGNED_INT,
+              (const GLvoid *)(cluster.firstIndex * sizeof(uint32_t)));
+          continue;
+        }
+        for (const auto nodeIdx : cluster.nodes) {
+          drawMeshNode(instance, nodeIdx);
+        }
+        nodeStack.insert(
+            end(nodeStack), cluster.children.rbegin(), cluster.children.rend());
+      }
+    };
+    const auto drawHlodAsset = [&](const SceneAssetInstance &instance) {
+      const auto &asset = *instance.asset;
+      drawClusters(instance);
+      // Instanced nodes are not part of the hierarchy
+      for (size_t nodeIdx = 0; nodeIdx < asset.nodeInstancing.size();
+           ++nodeIdx) {
+        if (asset.nodeInstancing[nodeIdx].instanceCount) {
+          drawMeshNode(instance, int(nodeIdx));
+        }
+      }
+    };
+
+    // Streamed assets: page cells in and out according to the priorities
+    // they get from all the instances of the asset, gathered in the
+    // priorities of its first instance
+    for (auto instanceIdx = sceneAssets.size(); instanceIdx--;) {
+      auto &instance = sceneAssets[instanceIdx];
+      if (!instance.asset->streamer) {
+        continue;
+      }
+      const auto first = std::find_if(begin(sceneAssets),
+          begin(sceneAssets) + instanceIdx,
+          [&](const SceneAssetInstance &other) {
+            return other.asset == instance.asset;
+          });
+      if (first == begin(sceneAssets) + instanceIdx) {
+        instance.asset->streamer->update(instance.cellPriorities);
+        continue;
+      }
+      auto &priorities = first->cellPriorities;
+      for (size_t cellIdx = 0; cellIdx < priorities.size(); ++cellIdx) {
+        priorities[cellIdx] =
+            std::max(priorities[cellIdx], instance.cellPriorities[cellIdx]);
+      }
+    }
+
+    // Resident cells are drawn with their geometry, the others with their
+    // coarse proxy
+    const auto drawStreamedAsset = [&](const SceneAssetInstance &instance) {
+      const auto &asset = *instance.asset;
+      const auto &streamer = *asset.streamer;
+      setRootTransforms(instance);
+      for (size_t cellIdx = 0; cellIdx < streamer.cells().size(); ++cellIdx) {
+        if (!instance.cellVisibility[cellIdx]) {
+          continue;
+        }
+        if (const auto *cell = streamer.residentCell(cellIdx)) {
+          ++drawStats.drawnCellCount;
+          vertexInput.bindVertexArray(cell->vertexArrayObject);
+          for (const auto &batch : cell->batches) {
+            bindMaterial(asset, batch.material);
+            ++drawStats.drawCallCount;
+            glDrawElements(batch.mode, GLsizei(batch.indexCount),
+                GL_UNSIGNED_INT,
+                (const GLvoid *)(batch.indexOffset * sizeof(uint32_t)));
+          }
+        } else {
+          ++drawStats.drawnProxyCount;
+          const auto &color = streamer.cells()[cellIdx].proxyColor;
+          bindMaterial(asset, -1);
+          glUniform4f(
+              baseColorFactorLocation, color[0], color[1], color[2], color[3]);
+          vertexInput.bindVertexArray(streamer.proxyVertexArrayObject());
+          ++drawStats.drawCallCount;
+          glDrawArrays(GL_TRIANGLES, GLint(36 * cellIdx), 36);
+        }
+      }
+    };
+
+    if (shadowMaps && settings.isShadowEnabled) {
+      const auto shadowStart = glfwGetTime();
+      shadowTimer->begin();
+      if (shadowUpdateMask) {
+        // The scene may be drawn to another framebuffer (renderToImage)
+        GLint framebuffer = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+        shadowProgram.use();
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.f, 4.f);
+        for (int cascadeIdx = 0; cascadeIdx < shadowMaps->cascadeCount();
+             ++cascadeIdx) {
+          if (shadowUpdateMask & (1u << cascadeIdx)) {
+            shadowMaps->beginUpdate(cascadeIdx, shadowCascades[cascadeIdx]);
+            // The casters of each cascade are found by the frame jobs
+            const auto &lightViewProj =
+                shadowCascades[cascadeIdx].viewProjMatrix;
+            for (const auto &instance : sceneAssets) {
+              drawStats.shadowStats.drawCallCount += drawShadowCasters(
+                  *instance.asset, instance.nodeWorldMatrices.data(),
+                  instance.nodeShadowMasks.data(), cascadeIdx, lightViewProj,
+                  transformRing, UNIFORM_BINDING_TRANSFORMS, vertexInput);
+            }
+            ++drawStats.shadowStats.renderedCascadeCount;
+          }
+        }
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(framebuffer));
+        glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
+        shadingProgram.use();
+      }
+      shadowTimer->end();
+      auto &shadowStats = drawStats.shadowStats;
+      shadowStats.cachedCascadeCount =
+          shadowMaps->cascadeCount() - shadowStats.renderedCascadeCount;
+      shadowStats.seconds = glfwGetTime() - shadowStart;
+      shadowStats.gpuSeconds = shadowTimer->seconds();
+    }
+    // Receivers look up the cascades as they were rendered
+    if (shadowCascadeCountLocation >= 0) {
+      const auto cascadeCount =
+          shadowMaps && settings.isShadowEnabled ? shadowMaps->cascadeCount()
+                                                 : 0;
+      glUniform1i(shadowCascadeCountLocation, cascadeCount);
+      glm::mat4 shadowMatrices[maxShadowCascadeCount];
+      float shadowNormalOffsets[maxShadowCascadeCount];
+      const auto clipToTexture = glm::scale(
+          glm::translate(glm::mat4(1), glm::vec3(0.5f)), glm::vec3(0.5f));
+      const auto viewToWorld = glm::inverse(viewMatrix);
+      for (int cascadeIdx = 0; cascadeIdx < cascadeCount; ++cascadeIdx) {
+        const auto &cascade = shadowMaps->cascade(cascadeIdx);
+        shadowMatrices[cascadeIdx] =
+            clipToTexture * cascade.viewProjMatrix * viewToWorld;
+        shadowNormalOffsets[cascadeIdx] = 1.5f * cascade.texelSize;
+      }
+      if (cascadeCount) {
+        glActiveTexture(GL_TEXTURE0 + shadowMapsTextureUnit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMaps->texture());
+        glUniformMatrix4fv(shadowMatricesLocation, cascadeCount, GL_FALSE,
+            value_ptr(shadowMatrices[0]));
+        glUniform1fv(
+            shadowNormalOffsetsLocation, cascadeCount, shadowNormalOffsets);
+      }
+    }
+    if (environmentIntensityLocation >= 0) {
+      glUniform1f(environmentIntensityLocation,
+          environmentTextures ? settings.environmentIntensity : 0.f);
+      glUniformMatrix3fv(viewToWorldLocation, 1, GL_FALSE,
+          value_ptr(glm::mat3(glm::inverse(viewMatrix))));
+    }
 
-    // Draw the scene referenced by gltf file
-    if (model.defaultScene >= 0) {
-      for (auto nodeId : model.scenes[model.defaultScene].nodes) {
-        drawNode(nodeId, glm::mat4(1));
+    // The scene may be drawn to another framebuffer (renderToImage)
+    GLint targetFramebuffer = 0;
+    if (deferredTargets) {
+      glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+      geometryTimer->begin();
+      deferredTargets->beginGeometryPass();
+    }
+    glslProgram.use();
+
+    // Draw the scene referenced by each gltf file
+    for (const auto &instance : sceneAssets) {
+      if (instance.asset->streamer) {
+        drawStreamedAsset(instance);
+        continue;
+      }
+      if (settings.isHlodEnabled && !instance.asset->hlod.clusters.empty()) {
+        drawHlodAsset(instance);
+        continue;
+      }
+      const auto &model = instance.asset->model;
+      if (model.defaultScene >= 0) {
+        drawNodes(instance, model.scenes[model.defaultScene].nodes);
+      }
+      if (pullingRing) {
+        drawPulledPrimitives(instance);
+      }
+      if (settings.isStaticBatchingEnabled &&
+          !instance.asset->staticBatches.chunks.empty()) {
+        drawStaticBatches(instance);
       }
     }
+
+    // Draws of drawMeshNode: sorted, recorded in chunks of commands (by
+    // jobs if parallel recording is enabled), then replayed pass by pass.
+    // The transforms are copied to the ring by the jobs too, once each chunk
+    // knows where its transforms go.
+    const auto &drawOrder =
+        drawSorter.sort(drawKeys.data(), drawKeys.size(), frameArena);
+    const auto recordStart = glfwGetTime();
+    const auto commandCount = drawOrder.size();
+    auto *commands = frameArena.allocateArray<DrawCommand>(commandCount);
+    const auto chunkCount =
+        (commandCount + drawCommandGrainSize - 1) / drawCommandGrainSize;
+    auto *chunkTransformsCounts = frameArena.allocateArray<size_t>(chunkCount);
+    const auto getChunkEnd = [&](size_t chunkIdx) {
+      return std::min(commandCount, (chunkIdx + 1) * drawCommandGrainSize);
+    };
+    const auto recordChunks = [&](size_t chunkBegin, size_t chunkEnd) {
+      for (auto chunkIdx = chunkBegin; chunkIdx < chunkEnd; ++chunkIdx) {
+        chunkTransformsCounts[chunkIdx] =
+            recordDrawCommands(queuedDraws.data(), drawKeys.data(),
+                drawOrder.data(), chunkIdx * drawCommandGrainSize,
+                getChunkEnd(chunkIdx), commands);
+      }
+    };
+    const auto forEachChunk = [&](const auto &body) {
+      if (settings.isParallelRecordingEnabled) {
+        jobSystem.parallelFor(chunkCount, 1, body);
+      } else {
+        body(size_t(0), chunkCount);
+      }
+    };
+    forEachChunk(recordChunks);
+    if (transformsBlockIndex != GL_INVALID_INDEX && commandCount) {
+      const auto stride = transformRing.alignedSize(sizeof(DrawTransforms));
+      size_t transformsCount = 0;
+      for (size_t chunkIdx = 0; chunkIdx < chunkCount; ++chunkIdx) {
+        transformsCount += chunkTransformsCounts[chunkIdx];
+      }
+      const auto transformsOffset = transformRing.reserve(
+          (transformsCount - 1) * stride + sizeof(DrawTransforms));
+      // Otherwise each change of transforms is pushed on replay
+      if (transformsOffset >= 0) {
+        const auto copyChunks = [&](size_t chunkBegin, size_t chunkEnd) {
+          auto offset = transformsOffset;
+          for (size_t chunkIdx = 0; chunkIdx < chunkBegin; ++chunkIdx) {
+            offset += GLintptr(chunkTransformsCounts[chunkIdx] * stride);
+          }
+          for (auto chunkIdx = chunkBegin; chunkIdx < chunkEnd; ++chunkIdx) {
+            copyDrawTransforms(transformRing, offset, stride,
+                chunkIdx * drawCommandGrainSize, getChunkEnd(chunkIdx),
+                commands);
+            offset += GLintptr(chunkTransformsCounts[chunkIdx] * stride);
+          }
+        };
+        forEachChunk(copyChunks);
+      }
+    }
+    const auto replayStart = glfwGetTime();
+    const auto commandStats = replayDrawCommands(
+        commands, commandCount, drawCommandContext, vertexInput);
+    drawStats.drawCallCount += commandStats.drawCallCount;
+    drawStats.blendedDrawCount += commandStats.blendedDrawCount;
+    drawStats.vertexArrayBindCount = vertexInput.vertexArrayBindCount();
+    drawStats.vertexBufferBindCount = vertexInput.vertexBufferBindCount();
+    drawStats.drawRecordSeconds = replayStart - recordStart;
+    drawStats.drawReplaySeconds = glfwGetTime() - replayStart;
+    drawStats.drawRecordJobCount =
+        settings.isParallelRecordingEnabled ? chunkCount : 0;
+    drawStats.sortedDrawCount = drawOrder.size();
+    drawStats.drawSortSeconds = drawSorter.stats().seconds;
+    drawStats.isDrawOrderCoherent = drawSorter.stats().isCoherent;
+
+    // Shade the G-buffer, then resolve it to the target framebuffer
+    if (deferredTargets) {
+      geometryTimer->end();
+      lightingTimer->begin();
+      shadingProgram.use();
+      deferredTargets->beginLightingPass(gbufferFirstTextureUnit);
+      deferredTargets->drawFullscreenTriangle();
+      lightingTimer->end();
+      compositeTimer->begin();
+      compositeProgram.use();
+      deferredTargets->beginCompositePass(
+          GLuint(targetFramebuffer), lightBufferTextureUnit);
+      deferredTargets->drawFullscreenTriangle();
+      deferredTargets->endFullscreenPasses();
+      compositeTimer->end();
+      glslProgram.use();
+      auto &deferredStats = drawStats.deferredStats;
+      deferredStats.gbufferBytesPerPixel =
+          deferredTargets->gbufferBytesPerPixel();
+      deferredStats.gbufferByteCount = deferredTargets->gbufferByteCount();
+      deferredStats.geometrySeconds = geometryTimer->seconds();
+      deferredStats.lightingSeconds = lightingTimer->seconds();
+      deferredStats.compositeSeconds = compositeTimer->seconds();
+    }
+    transformRing.endFrame();
+    if (pullingRing) {
+      pullingRing->endFrame();
+    }
+    if (lightRing) {
+      lightRing->endFrame();
+    }
   };
 
+  if (m_options.benchmarkFrameCount > 0) {
+    FrameBenchmarkOptions benchmarkOptions;
+    benchmarkOptions.frameCount = m_options.benchmarkFrameCount;
+    benchmarkOptions.width = int(m_nWindowWidth);
+    benchmarkOptions.height = int(m_nWindowHeight);
+    benchmarkOptions.materialPath = m_options.textureArrays ? "texture arrays"
+                                    : isBindlessPath ? "bindless textures"
+                                                     : "bound textures";
+    benchmarkOptions.vertexPulling = m_options.vertexPulling;
+    benchmarkOptions.deferredShading = bool(deferredTargets);
+    benchmarkOptions.shadowPassTimer = bool(shadowTimer);
+    benchmarkOptions.shadowCascadeCount =
+        shadowMaps ? shadowMaps->cascadeCount() : 0;
+    benchmarkOptions.clusteredLights = bool(lightClusters);
+    benchmarkOptions.checkAllocations = m_options.checkAllocations;
+    benchmarkOptions.allocationWarmupFrameCount =
+        m_options.allocationWarmupFrameCount;
+    const auto camera = cameraController->getCamera();
+    return runFrameBenchmark(
+        benchmarkOptions, [&]() { drawScene(camera, guiSettings); },
+        [&]() { m_GLFWHandle->swapBuffers(); }, drawStats, frameArena);
+  }
+
   if (!m_OutputPath.empty()) {
+    const auto renderStart = std::chrono::steady_clock::now();
+    // Let the streamed cells needed by the camera page in before rendering
+    // the image (drawScene updates the streamers)
+    const auto isStreaming = [&]() {
+      return std::any_of(begin(sceneAssets), end(sceneAssets),
+          [](const SceneAssetInstance &instance) {
+            return instance.asset->streamer &&
+                   instance.asset->streamer->stats().pendingCellCount;
+          });
+    };
+    do {
+      drawScene(cameraController->getCamera(), guiSettings);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    } while (isStreaming());
+
     std::vector<unsigned char> pixels(m_nWindowWidth * m_nWindowHeight * 3);
     renderToImage(m_nWindowWidth, m_nWindowHeight, 3, pixels.data(),
-        [&]() { drawScene(cameraController->getCamera()); });
+        [&]() { drawScene(cameraController->getCamera(), guiSettings); });
 
     flipImageYAxis(m_nWindowWidth, m_nWindowHeight, 3, pixels.data());
     const auto strPath = m_OutputPath.string();
     stbi_write_png(
         strPath.c_str(), m_nWindowWidth, m_nWindowHeight, 3, pixels.data(), 0);
+    if (m_options.printOutputTimes) {
+      printOutputTimes(loadStart, renderStart);
+      if (m_options.buildHlod) {
+        std::cout << "  " << drawStats.drawnHlodProxyCount
+                  << " HLOD proxies drawn" << std::endl;
+      }
+    }
 
     return 0;
   }
+  // The main thread polls the events, updates the camera and builds the GUI,
+  // the frame loop draws the snapshots, see FrameLoop. The GUI changes the
+  // scene through scene commands.
+  const auto fillFeedback = [&](RenderFeedback &feedback) {
+    feedback.drawStats = drawStats;
+    feedback.transformRingStats = transformRing.stats();
+    if (pullingRing) {
+      feedback.pullingRingStats = pullingRing->stats();
+    }
+    feedback.cacheStats = m_assetCache.stats();
+    feedback.frameArenaStats = frameArena.stats();
+    if (m_bufferPool) {
+      feedback.bufferPoolStats = m_bufferPool->stats();
+    }
+    feedback.instances.resize(sceneAssets.size());
+    for (size_t instanceIdx = 0; instanceIdx < sceneAssets.size();
+         ++instanceIdx) {
+      const auto &instance = sceneAssets[instanceIdx];
+      const auto &asset = *instance.asset;
+      auto &info = feedback.instances[instanceIdx];
+      info.id = instance.id;
+      info.name = instance.name;
+      info.useCount = instance.asset.use_count();
+      info.isFirstInstance = std::none_of(begin(sceneAssets),
+          begin(sceneAssets) + instanceIdx,
+          [&](const SceneAssetInstance &other) {
+            return other.asset == instance.asset;
+          });
+      info.batchedPrimitiveCount = asset.staticBatches.batchedPrimitiveCount;
+      info.batchChunkCount = asset.staticBatches.chunks.size();
+      info.batchByteCount = asset.staticBatches.byteCount();
+      info.isStreamed = bool(asset.streamer);
+      if (asset.streamer) {
+        info.streamerStats = asset.streamer->stats();
+      }
+    }
+  };
+  FrameLoop frameLoop(
+      *m_GLFWHandle,
+      [&](const FrameSnapshot &snapshot) {
+        drawScene(snapshot.camera, snapshot.settings);
+      },
+      fillFeedback);
+
+  const auto defragmentBufferPool = [&]() {
+    if (!m_bufferPool->defragment()) {
+      return;
+    }
+    // Moved buffers have new ranges: the VAOs and bindings reading them are
+    // created again
+    std::set<GltfAsset *> assets;
+    for (const auto &instance : sceneAssets) {
+      assets.insert(instance.asset.get());
+    }
+    for (auto *asset : assets) {
+      if (asset->bufferAllocations.empty()) {
+        continue;
+      }
+      for (size_t bufferIdx = 0; bufferIdx < asset->bufferAllocations.size();
+           ++bufferIdx) {
+        asset->bufferRanges[bufferIdx] =
+            m_bufferPool->range(asset->bufferAllocations[bufferIdx]);
+      }
+      if (!asset->vertexArrayObjects.empty()) {
+        glDeleteVertexArrays(GLsizei(asset->vertexArrayObjects.size()),
+            asset->vertexArrayObjects.data());
+      }
+      asset->vertexArrayObjects = createVertexArrayObjects(asset->model,
+          asset->bufferRanges, asset->nodeInstancing,
+          asset->meshIndexToVaoRange, asset->nodeIndexToInstancedVaoRange,
+          asset->vertexBufferBindings);
+    }
+  };
+
+  if (m_options.renderThread) {
+    frameLoop.startRenderThread();
+  }
+
   // Loop until the user closes the window
-  for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
+  auto lastUpdateTime = glfwGetTime();
+  for (auto iterationCount = 0u; !m_GLFWHandle->shouldClose();
        ++iterationCount) {
-    const auto seconds = glfwGetTime();
+    glfwPollEvents(); // Poll for and process events
+    const auto inputTime = glfwGetTime();
 
+    const auto &feedback = frameLoop.acquireFeedback();
+    const auto &frameStats = feedback.drawStats;
     const auto camera = cameraController->getCamera();
 
-    drawScene(camera);
-
     // GUI code:
     imguiNewFrame();
 
@@ -327,6 +2045,13 @@ int ViewerApplication::run()
       ImGui::Begin("GUI");
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
           1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+      const auto &frameTimes = feedback.frameTimes;
+      ImGui::Text("Rendering %.3f ms/frame (sd %.3f ms, 99%% %.3f ms)",
+          frameTimes.mean * 1e3, frameTimes.standardDeviation * 1e3,
+          frameTimes.percentile99 * 1e3);
+      ImGui::Text("Input latency %.1f ms (median %.1f ms, max %.1f ms)",
+          feedback.latencies.mean * 1e3, feedback.latencies.median * 1e3,
+          feedback.latencies.max * 1e3);
       if (ImGui::CollapsingHeader("Camera", ImGuiTreeNodeFlags_DefaultOpen)) {
         ImGui::Text("eye: %.3f %.3f %.3f", camera.eye().x, camera.eye().y,
             camera.eye().z);
@@ -347,7 +2072,7 @@ int ViewerApplication::run()
              << camera.center().y << "," << camera.center().z << ","
              << camera.up().x << "," << camera.up().y << "," << camera.up().z;
           const auto str = ss.str();
-          glfwSetClipboardString(m_GLFWHandle.window(), str.c_str());
+          glfwSetClipboardString(m_GLFWHandle->window(), str.c_str());
         }
 
         static int cameraControllerType = 0;
@@ -358,10 +2083,10 @@ int ViewerApplication::run()
           const auto currentCamera = cameraController->getCamera();
           if (cameraControllerType == 0) {
             cameraController = std::make_unique<TrackballCameraController>(
-                m_GLFWHandle.window(), 0.5f * maxDistance);
+                m_GLFWHandle->window(), 0.5f * maxDistance);
           } else {
             cameraController = std::make_unique<FirstPersonCameraController>(
-                m_GLFWHandle.window(), 1.0f * maxDistance);
+                m_GLFWHandle->window(), 1.0f * maxDistance);
           }
           cameraController->setCamera(currentCamera);
         }
@@ -373,8 +2098,10 @@ int ViewerApplication::run()
 
         if (ImGui::SliderFloat("Theta", &thetaLight, 0, glm::pi<float>()) ||
             ImGui::SliderFloat("Phi", &phiLight, 0, 2 * glm::pi<float>())) {
-          lightDirection = glm::vec3(glm::sin(thetaLight) * glm::cos(phiLight),
-              glm::cos(thetaLight), glm::sin(thetaLight) * glm::sin(phiLight));
+          guiSettings.lightDirection =
+              glm::vec3(glm::sin(thetaLight) * glm::cos(phiLight),
+                  glm::cos(thetaLight),
+                  glm::sin(thetaLight) * glm::sin(phiLight));
         }
 
         static glm::vec3 lightColor(1.f, 1.f, 1.f);
@@ -382,46 +2109,309 @@ int ViewerApplication::run()
 
         if (ImGui::ColorEdit3("color", (float *)&lightColor) ||
             ImGui::InputFloat("intensity", &lightIntensityFactor)) {
-          lightIntensity = lightColor * lightIntensityFactor;
+          guiSettings.lightIntensity = lightColor * lightIntensityFactor;
         }
 
+        ImGui::Checkbox("Is the light coming from the camera ?",
+            &guiSettings.isLightComingFromCamera);
+        if (shadowMaps) {
+          const auto &shadowStats = frameStats.shadowStats;
+          ImGui::Checkbox("Shadows", &guiSettings.isShadowEnabled);
+          ImGui::Checkbox("Cache static shadow maps",
+              &guiSettings.isShadowCachingEnabled);
+          ImGui::Text("shadow pass: %.3f ms GPU, %.3f ms CPU",
+              shadowStats.gpuSeconds * 1e3, shadowStats.seconds * 1e3);
+          ImGui::Text("cascades: %d rendered, %d cached, %zu draw calls",
+              shadowStats.renderedCascadeCount, shadowStats.cachedCascadeCount,
+              shadowStats.drawCallCount);
+        }
+        if (environmentTextures) {
+          ImGui::SliderFloat("Environment intensity",
+              &guiSettings.environmentIntensity, 0, 4);
+        }
+      }
+      if (ImGui::CollapsingHeader(
+              "Rendering", ImGuiTreeNodeFlags_DefaultOpen)) {
         ImGui::Checkbox(
-            "Is the light coming from the camera ?", &isLightComingFromCamera);
+            "Frustum culling", &guiSettings.isFrustumCullingEnabled);
+        ImGui::Text("nodes: %zu drawn, %zu culled", frameStats.drawnNodeCount,
+            frameStats.culledNodeCount);
+        ImGui::Text("instances: %zu, draw calls: %zu",
+            frameStats.drawnInstanceCount, frameStats.drawCallCount);
+        ImGui::Text("VAO binds: %zu, vertex buffer binds: %zu",
+            frameStats.vertexArrayBindCount, frameStats.vertexBufferBindCount);
+        ImGui::Text("texture binds: %zu", frameStats.textureBindCount);
+        ImGui::Text("sorted draws: %zu (%zu blended), %.3f ms%s",
+            frameStats.sortedDrawCount, frameStats.blendedDrawCount,
+            frameStats.drawSortSeconds * 1e3,
+            frameStats.isDrawOrderCoherent ? ", same order" : "");
+        if (lightClusters) {
+          const auto &lightStats = frameStats.lightClusterStats;
+          ImGui::Text("lights: %zu (%zu directional), binned in %.3f ms",
+              lightStats.lightCount, lightStats.directionalLightCount,
+              lightStats.seconds * 1e3);
+          ImGui::Text("  %zu cluster entries, at most %zu per cluster",
+              lightStats.lightIndexCount, lightStats.maxClusterLightCount);
+        }
+        if (deferredTargets) {
+          const auto &deferredStats = frameStats.deferredStats;
+          ImGui::Text("deferred: G-buffer %.3f ms, lighting %.3f ms, "
+                      "composite %.3f ms GPU",
+              deferredStats.geometrySeconds * 1e3,
+              deferredStats.lightingSeconds * 1e3,
+              deferredStats.compositeSeconds * 1e3);
+          ImGui::Text("  G-buffer: %zu B per pixel, %.1f MB",
+              deferredStats.gbufferBytesPerPixel,
+              deferredStats.gbufferByteCount / 1e6);
+        }
+        ImGui::Checkbox("Parallel command recording",
+            &guiSettings.isParallelRecordingEnabled);
+        ImGui::Text("commands: recorded in %.3f ms (%zu jobs), replayed in "
+                    "%.3f ms",
+            frameStats.drawRecordSeconds * 1e3, frameStats.drawRecordJobCount,
+            frameStats.drawReplaySeconds * 1e3);
+        ImGui::Text("frame arena: %.1f / %.1f KB, heap allocations: %zu",
+            feedback.frameArenaStats.usedByteCount / 1e3,
+            feedback.frameArenaStats.capacityByteCount / 1e3,
+            feedback.frameAllocationCount);
+        if (pullingRing) {
+          const auto &ringStats = feedback.pullingRingStats;
+          ImGui::Text("pulled draws: %zu in %zu batches, %.1f / %.1f KB",
+              frameStats.pulledDrawCount, frameStats.pulledBatchCount,
+              ringStats.usedByteCount / 1e3, ringStats.frameByteCount / 1e3);
+        }
+        if (transformsBlockIndex != GL_INVALID_INDEX) {
+          const auto &ringStats = feedback.transformRingStats;
+          ImGui::Text("transforms: %.1f / %.1f KB per frame, %zu stalls",
+              ringStats.usedByteCount / 1e3, ringStats.frameByteCount / 1e3,
+              ringStats.blockedFrameCount);
+        }
+        if (frameStats.drawnCellCount || frameStats.drawnProxyCount) {
+          ImGui::Text("streamed cells: %zu drawn, %zu proxies",
+              frameStats.drawnCellCount, frameStats.drawnProxyCount);
+        }
+        if (m_options.staticBatching) {
+          ImGui::Checkbox(
+              "Static batching", &guiSettings.isStaticBatchingEnabled);
+          ImGui::Text("static chunks drawn: %zu", frameStats.drawnChunkCount);
+          for (const auto &instance : feedback.instances) {
+            if (!instance.batchChunkCount || !instance.isFirstInstance) {
+              continue;
+            }
+            ImGui::Text("%s: %zu draw calls -> %zu chunks, +%.1f MB",
+                instance.name.c_str(), instance.batchedPrimitiveCount,
+                instance.batchChunkCount, instance.batchByteCount / 1e6);
+          }
+        }
+        if (m_options.buildHlod) {
+          ImGui::Checkbox("HLOD", &guiSettings.isHlodEnabled);
+          ImGui::SliderFloat("HLOD max error (px)",
+              &guiSettings.hlodMaxScreenError, 0.1f, 32.f, "%.1f", 2.f);
+          ImGui::Text(
+              "HLOD proxies drawn: %zu", frameStats.drawnHlodProxyCount);
+        }
+        for (const auto &instance : feedback.instances) {
+          if (!instance.isStreamed || !instance.isFirstInstance) {
+            continue;
+          }
+          const auto &stats = instance.streamerStats;
+          ImGui::Text("%s: %zu/%zu cells resident, %zu pending",
+              instance.name.c_str(), stats.residentCellCount, stats.cellCount,
+              stats.pendingCellCount);
+          ImGui::Text("  %.1f / %.1f MB, %zu loads, %zu evictions",
+              stats.residentByteCount / 1e6, stats.budgetByteCount / 1e6,
+              stats.loadedCellCount, stats.evictedCellCount);
+        }
+      }
+      if (ImGui::CollapsingHeader("Assets")) {
+        const auto &cacheStats = feedback.cacheStats;
+        ImGui::Text("%zu distinct assets, %.1f MB GPU memory",
+            cacheStats.residentAssetCount, cacheStats.gpuByteCount / 1e6);
+        ImGui::Text("cache: %zu loads, %zu hits", cacheStats.loadCount,
+            cacheStats.hitCount);
+        // Unloading the last instance of an asset frees its GPU memory
+        for (const auto &instance : feedback.instances) {
+          ImGui::PushID(int(instance.id));
+          if (ImGui::SmallButton("Unload")) {
+            const auto id = instance.id;
+            frameLoop.pushSceneCommand([&, id]() {
+              const auto isUnloaded = [&](const SceneAssetInstance &other) {
+                return other.id == id;
+              };
+              sceneAssets.erase(
+                  std::remove_if(begin(sceneAssets), end(sceneAssets),
+                      isUnloaded),
+                  end(sceneAssets));
+              updateSceneNodeOffsets();
+              // The instance, and its asset with its last instance, no
+              // longer cast shadows in the cached maps
+              if (shadowMaps) {
+                shadowMaps->invalidate();
+              }
+            });
+          }
+          ImGui::SameLine();
+          ImGui::Text("%s (x%ld)", instance.name.c_str(), instance.useCount);
+          ImGui::PopID();
+        }
+        if (m_bufferPool) {
+          const auto &poolStats = feedback.bufferPoolStats;
+          ImGui::Text("buffer pool: %zu pages, %.1f / %.1f MB (%.0f%%)",
+              poolStats.pageCount, poolStats.usedByteCount / 1e6,
+              poolStats.capacityByteCount / 1e6,
+              100.f * poolStats.utilization());
+          ImGui::Text("  %zu allocations, %zu free blocks, %.0f%% fragmented",
+              poolStats.allocationCount, poolStats.freeBlockCount,
+              100.f * poolStats.fragmentation());
+          if (ImGui::Button("Defragment")) {
+            frameLoop.pushSceneCommand(defragmentBufferPool);
+          }
+        }
       }
       ImGui::End();
     }
 
-    imguiRenderFrame();
+    ImGui::Render();
 
-    glfwPollEvents(); // Poll for and process events
-
-    auto ellapsedTime = glfwGetTime() - seconds;
-    auto guiHasFocus =
+    const auto guiHasFocus =
         ImGui::GetIO().WantCaptureMouse || ImGui::GetIO().WantCaptureKeyboard;
     if (!guiHasFocus) {
-      cameraController->update(float(ellapsedTime));
+      cameraController->update(float(inputTime - lastUpdateTime));
     }
+    lastUpdateTime = inputTime;
+
+    auto &snapshot = frameLoop.nextSnapshot();
+    snapshot.camera = cameraController->getCamera();
+    snapshot.settings = guiSettings;
+    snapshot.inputTime = inputTime;
+    snapshot.gui.copy(*ImGui::GetDrawData());
+    frameLoop.publishSnapshot();
+  }
 
-    m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+  // The GL objects of the assets are deleted by ~GltfAsset when sceneAssets
+  // goes out of scope: the context must be current again on this thread
+  frameLoop.stop();
+
+  return 0;
+}
+
+int ViewerApplication::runRenderer()
+{
+  const auto backendName = getRendererBackendName(m_options.renderer);
+  if (m_OutputPath.empty()) {
+    std::cerr << "Error: the " << backendName
+              << " renderer only draws images, --output is required"
+              << std::endl;
+    return -1;
+  }
+  if (m_options.streamGeometry || m_options.staticBatching ||
+      m_options.buildHlod || m_options.vertexPulling ||
+      m_options.textureArrays || m_options.bindlessTextures ||
+      m_options.suballocateBuffers || m_options.clusteredLights ||
+      m_options.randomLightCount || m_options.shadows ||
+      !m_options.environmentPath.empty() || m_options.deferredShading ||
+      m_options.renderThread || m_options.parallelRecording ||
+      m_options.benchmarkFrameCount || !m_options.shareVertexFormats) {
+    std::cerr << "Warn: the " << backendName
+              << " renderer only implements the default forward shading, "
+                 "ignoring the other rendering options"
+              << std::endl;
   }
 
-  // TODO clean up allocated GL data
+  RendererOptions rendererOptions;
+  rendererOptions.shadersPath = (m_ShadersRootPath / m_AppName).string();
+  rendererOptions.generateMipmaps = m_options.generateMipmaps;
+  const auto loadStart = std::chrono::steady_clock::now();
+  std::string error;
+  const auto renderer =
+      createRenderer(m_options.renderer, rendererOptions, error);
+  if (!renderer) {
+    std::cerr << "Error: " << error << std::endl;
+    return -1;
+  }
+  std::clog << "Renderer: " << backendName << " on "
+            << renderer->deviceName() << std::endl;
+
+  // Assets used several times are loaded once, the scene is framed like in
+  // run()
+  std::map<std::string, int> modelIndices;
+  std::vector<std::vector<BoundingBox>> modelNodeBounds;
+  BoundingBox sceneBounds;
+  for (const auto &placement : m_assetPlacements) {
+    auto found = modelIndices.find(placement.path.string());
+    if (found == end(modelIndices)) {
+      tinygltf::Model model;
+      if (!loadGltfFile(placement.path, model)) {
+        std::cerr << "Error: Unable to load " << placement.path << std::endl;
+        return -1;
+      }
+      const auto modelIdx = renderer->addModel(model, error);
+      if (modelIdx < 0) {
+        std::cerr << "Error: " << error << std::endl;
+        return -1;
+      }
+      modelNodeBounds.resize(size_t(modelIdx) + 1);
+      modelNodeBounds[modelIdx] = computeNodeWorldBounds(model);
+      found =
+          modelIndices.emplace(placement.path.string(), modelIdx).first;
+    }
+    renderer->addModelInstance(found->second, placement.rootTransform);
+    for (const auto &bounds : modelNodeBounds[found->second]) {
+      sceneBounds.extend(
+          transformBoundingBox(placement.rootTransform, bounds));
+    }
+  }
+  if (sceneBounds.isEmpty()) {
+    sceneBounds.extend(glm::vec3(0));
+  }
+
+  const auto framing = computeSceneFraming(
+      sceneBounds, 70.f, float(m_nWindowWidth) / m_nWindowHeight);
+  const auto camera = m_hasUserCamera ? m_userCamera : framing.defaultCamera;
+  RenderView view;
+  view.viewMatrix = camera.getViewMatrix();
+  view.projMatrix = framing.projMatrix;
+  view.nearDepth = framing.nearDepth;
+  view.farDepth = framing.farDepth;
+  // The default light of the GUI settings of run()
+  view.lightDirection =
+      glm::normalize(glm::vec3(view.viewMatrix * glm::vec4(1, 1, 1, 0)));
+  view.lightIntensity = glm::vec3(1, 1, 1);
+
+  const auto renderStart = std::chrono::steady_clock::now();
+  std::vector<unsigned char> pixels(m_nWindowWidth * m_nWindowHeight * 3);
+  if (!renderer->renderImage(view, uint32_t(m_nWindowWidth),
+          uint32_t(m_nWindowHeight), pixels.data(), error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return -1;
+  }
+  const auto strPath = m_OutputPath.string();
+  stbi_write_png(
+      strPath.c_str(), m_nWindowWidth, m_nWindowHeight, 3, pixels.data(), 0);
+  if (m_options.printOutputTimes) {
+    printOutputTimes(loadStart, renderStart);
+  }
 
   return 0;
 }
 
 ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
-    uint32_t height, const fs::path &gltfFile,
+    uint32_t height, const std::vector<AssetPlacement> &assets,
     const std::vector<float> &lookatArgs, const std::string &vertexShader,
-    const std::string &fragmentShader, const fs::path &output) :
+    const std::string &fragmentShader, const fs::path &output,
+    const ViewerOptions &options) :
     m_nWindowWidth(width),
     m_nWindowHeight(height),
     m_AppPath{appPath},
     m_AppName{m_AppPath.stem().string()},
     m_ImGuiIniFilename{m_AppName + ".imgui.ini"},
     m_ShadersRootPath{m_AppPath.parent_path() / "shaders"},
-    m_gltfFilePath{gltfFile},
-    m_OutputPath{output}
+    m_assetPlacements{assets},
+    m_OutputPath{output},
+    m_options{options},
+    m_assetCache{[this](GltfAsset &asset, std::string &error) {
+      return loadAsset(asset, error);
+    }}
 {
   if (!lookatArgs.empty()) {
     m_hasUserCamera = true;
@@ -430,20 +2420,99 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
             glm::vec3(lookatArgs[3], lookatArgs[4], lookatArgs[5]),
             glm::vec3(lookatArgs[6], lookatArgs[7], lookatArgs[8])};
   }
+  // The Renderer creates its own context, the options are checked by
+  // runRenderer()
+  if (!m_GLFWHandle) {
+    if (!vertexShader.empty() || !fragmentShader.empty()) {
+      std::cerr << "Warn: --vs and --fs are ignored with --renderer"
+                << std::endl;
+    }
+    return;
+  }
 
+  // Texture pools are only read through the draw records of vertex pulling
+  m_options.vertexPulling |= m_options.textureArrays;
   if (!vertexShader.empty()) {
     m_vertexShader = vertexShader;
+  } else if (m_options.vertexPulling) {
+    m_vertexShader = "forward_pulling.vs.glsl";
+  }
+  if (m_options.vertexPulling &&
+      (m_options.streamGeometry || m_options.staticBatching ||
+          m_options.buildHlod)) {
+    std::cerr << "Warn: streaming, static batching and HLOD are not "
+                 "supported with vertex pulling, disabling them"
+              << std::endl;
+    m_options.streamGeometry = false;
+    m_options.staticBatching = false;
+    m_options.buildHlod = false;
+  }
+
+  if (m_options.bindlessTextures && m_options.textureArrays) {
+    std::cerr << "Warn: bindless textures are not used with texture arrays"
+              << std::endl;
+    m_options.bindlessTextures = false;
+  }
+  if (m_options.bindlessTextures && !getBindlessTextureApi()) {
+    std::clog << "ARB_bindless_texture is not supported, using bound textures"
+              << std::endl;
+    m_options.bindlessTextures = false;
+  }
+
+  if (m_options.deferredShading &&
+      (m_options.textureArrays || m_options.bindlessTextures)) {
+    std::cerr << "Warn: deferred shading is only implemented with bound "
+                 "textures, disabling it"
+              << std::endl;
+    m_options.deferredShading = false;
+  }
+
+  m_options.clusteredLights |=
+      m_options.randomLightCount > 0 || m_options.deferredShading;
+  if (m_options.clusteredLights &&
+      (m_options.textureArrays || m_options.bindlessTextures)) {
+    std::cerr << "Warn: clustered lights are only implemented with bound "
+                 "textures, disabling them"
+              << std::endl;
+    m_options.clusteredLights = false;
+  }
+
+  m_options.shadowOptions.cascadeCount = std::min(
+      std::max(m_options.shadowOptions.cascadeCount, 1), maxShadowCascadeCount);
+  if (m_options.shadows && m_options.vertexPulling) {
+    std::cerr << "Warn: shadows are not supported with vertex pulling, "
+                 "disabling them"
+              << std::endl;
+    m_options.shadows = false;
+  }
+
+  if (m_options.suballocateBuffers && m_options.vertexPulling) {
+    std::cerr << "Warn: buffer suballocation is not used with vertex pulling"
+              << std::endl;
+    m_options.suballocateBuffers = false;
+  }
+  if (m_options.suballocateBuffers) {
+    m_bufferPool = std::make_unique<GpuMemoryPool>(
+        m_bufferBackend, m_options.bufferPoolOptions);
   }
 
   if (!fragmentShader.empty()) {
     m_fragmentShader = fragmentShader;
+  } else if (m_options.textureArrays) {
+    m_fragmentShader = "pbr_directional_light_pooled.fs.glsl";
+  } else if (m_options.bindlessTextures) {
+    m_fragmentShader = "pbr_directional_light_bindless.fs.glsl";
+  } else if (m_options.deferredShading) {
+    m_fragmentShader = "gbuffer.fs.glsl";
+  } else if (m_options.clusteredLights) {
+    m_fragmentShader = "pbr_clustered_lights.fs.glsl";
   }
 
   ImGui::GetIO().IniFilename =
       m_ImGuiIniFilename.c_str(); // At exit, ImGUI will store its windows
   // positions in this file
 
-  glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
+  glfwSetKeyCallback(m_GLFWHandle->window(), keyCallback);
 
   printGLVersion();
 
@@ -454,17 +2523,18 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
   defaultSampler.wrapR = GL_REPEAT;
 }
 
-bool ViewerApplication::loadGltfFile(tinygltf::Model &model)
+bool ViewerApplication::loadGltfFile(
+    const fs::path &path, tinygltf::Model &model)
 {
-
-  using namespace tinygltf;
-
-  TinyGLTF loader;
   std::string error;
   std::string warning;
+  GltfLoadStats loadStats;
+
+  GltfLoadOptions loadOptions;
+  loadOptions.maxTextureSize = m_options.maxTextureSize;
 
-  bool ret = loader.LoadASCIIFromFile(
-      &model, &error, &warning, m_gltfFilePath.string());
+  bool ret = loadGltfModel(
+      path, loadOptions, model, error, warning, loadStats);
   if (!warning.empty()) {
     std::cerr << "Warn: " << warning.c_str() << std::endl;
   }
@@ -477,9 +2547,198 @@ bool ViewerApplication::loadGltfFile(tinygltf::Model &model)
     std::cerr << "Failed to parse glTF" << std::endl;
     return false;
   }
+
+  std::clog << loadStats << std::endl;
+
+  return true;
+}
+
+bool ViewerApplication::loadAsset(GltfAsset &asset, std::string &error)
+{
+  if (!loadGltfFile(asset.path, asset.model)) {
+    error = "Unable to load " + asset.path.string();
+    return false;
+  }
+  const auto &model = asset.model;
+  for (size_t materialIdx = 0; materialIdx < model.materials.size();
+       ++materialIdx) {
+    asset.materialPasses.push_back(
+        getMaterialDrawPass(model, int(materialIdx)));
+  }
+
+  if (m_options.streamGeometry) {
+    // Out-of-core: the geometry is paged in from the cache file, next to the
+    // glTF file, which is (re)built if missing or out of date
+    const auto cachePath = fs::path(asset.path.string() + ".cells");
+    std::vector<GeometryCacheCell> cells;
+    std::string cacheError;
+    if (!readGeometryCacheCells(
+            cachePath, asset.contentHash, cells, cacheError)) {
+      std::clog << cacheError << ", building it" << std::endl;
+      const auto start = glfwGetTime();
+      if (!buildGeometryCache(model, asset.contentHash, cachePath,
+              GeometryCacheOptions{}, error) ||
+          !readGeometryCacheCells(cachePath, asset.contentHash, cells, error)) {
+        return false;
+      }
+      std::clog << "Built " << cachePath << " (" << cells.size()
+                << " cells) in " << glfwGetTime() - start << "s" << std::endl;
+    }
+    asset.streamer = std::make_unique<GeometryStreamer>(
+        cachePath, std::move(cells), m_options.streamingBudget);
+
+    asset.textureObjects = createTextureObjects(model);
+    createBindlessMaterials(asset);
+    asset.gpuByteCount = computeTextureByteCount(model);
+
+    // Only materials and textures are used from now on
+    for (auto &buffer : asset.model.buffers) {
+      buffer.data.clear();
+      buffer.data.shrink_to_fit();
+    }
+    return true;
+  }
+
+  // EXT_mesh_gpu_instancing attributes of each node
+  asset.nodeInstancing.resize(model.nodes.size());
+  size_t instancedNodeCount = 0;
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    if (getNodeInstancing(
+            model, model.nodes[nodeIdx], asset.nodeInstancing[nodeIdx])) {
+      ++instancedNodeCount;
+    }
+  }
+  if (instancedNodeCount) {
+    std::clog << "Number of instanced nodes: " << instancedNodeCount
+              << std::endl;
+  }
+
+  // Bounds of each node (covering all its instances) and of each instance,
+  // used for culling
+  asset.nodeBounds = computeNodeWorldBounds(model);
+  asset.instanceBounds =
+      computeInstanceWorldBounds(model, asset.instanceBoundsOffsets);
+  asset.nodeMatrices = computeNodeWorldMatrices(model);
+
+  if (m_options.textureArrays) {
+    const auto start = glfwGetTime();
+    auto &pools = asset.texturePools;
+    pools = buildTexturePools(asset.model, m_options.texturePoolOptions);
+    createTexturePoolObjects(asset, m_options.generateMipmaps);
+    std::clog << "Texture pools: " << pools.pooledImageCount << " images in "
+              << pools.pools.size() << " texture arrays ("
+              << pools.layerCount() << " layers), "
+              << pools.atlasedImageCount << " atlased ("
+              << pools.downscaledImageCount << " downscaled to fit), in "
+              << glfwGetTime() - start << "s" << std::endl;
+  } else {
+    asset.textureObjects = createTextureObjects(model);
+    createBindlessMaterials(asset);
+  }
+  if (m_options.vertexPulling) {
+    createPullingBuffer(asset);
+  } else {
+    createBufferRanges(asset);
+    asset.vertexArrayObjects = createVertexArrayObjects(model,
+        asset.bufferRanges, asset.nodeInstancing, asset.meshIndexToVaoRange,
+        asset.nodeIndexToInstancedVaoRange, asset.vertexBufferBindings);
+  }
+
+  asset.gpuByteCount =
+      m_options.textureArrays
+          ? asset.texturePools.byteCount(m_options.generateMipmaps)
+          : computeTextureByteCount(model);
+  for (const auto &buffer : model.buffers) {
+    asset.gpuByteCount += buffer.data.size();
+  }
+
+  if (m_options.staticBatching) {
+    const auto start = glfwGetTime();
+    asset.staticBatches =
+        buildStaticBatches(model, m_options.staticBatchOptions);
+    createStaticBatchVertexArrayObject(asset);
+    const auto &batches = asset.staticBatches;
+    // The source buffers stay resident for the nodes that are not batched
+    asset.gpuByteCount += batches.byteCount();
+    std::clog << "Static batching: " << batches.batchedNodeCount
+              << " nodes, " << batches.batchedPrimitiveCount
+              << " draw calls merged into " << batches.chunks.size()
+              << " chunks in " << glfwGetTime() - start << "s" << std::endl;
+    std::clog << "  " << batches.byteCount() / 1e6 << " MB of batches for "
+              << batches.sourceByteCount / 1e6 << " MB of source geometry"
+              << std::endl;
+  }
+
+  if (m_options.buildHlod) {
+    const auto start = glfwGetTime();
+    asset.hlod = buildHlodHierarchy(
+        model, asset.nodeMatrices, asset.nodeBounds, m_options.hlodOptions);
+    createHlodVertexArrayObject(asset);
+    asset.gpuByteCount += asset.hlod.vertices.size() * sizeof(HlodVertex) +
+                          asset.hlod.indices.size() * sizeof(uint32_t);
+    std::clog << "HLOD: " << asset.hlod.clusters.size() << " clusters, "
+              << asset.hlod.indices.size() / 3 << " proxy triangles, built in "
+              << glfwGetTime() - start << "s" << std::endl;
+  }
   return true;
 }
 
+bool ViewerApplication::loadEnvironment(
+    EnvironmentLighting &lighting, std::string &error)
+{
+  const auto &path = m_options.environmentPath;
+  std::ifstream file(path.string(), std::ios::binary);
+  if (!file) {
+    error = "Unable to open " + path.string();
+    return false;
+  }
+  const std::string content{std::istreambuf_iterator<char>(file), {}};
+  const auto sourceHash =
+      computeEnvironmentHash(content, m_options.environmentOptions);
+
+  // The cache file is next to the map, (re)built if missing or out of date
+  const auto cachePath = fs::path(path.string() + ".ibl");
+  const auto start = glfwGetTime();
+  std::string cacheError;
+  if (readEnvironmentCache(cachePath, sourceHash, lighting, cacheError)) {
+    std::clog << "Read " << cachePath << " in " << glfwGetTime() - start
+              << "s" << std::endl;
+    return true;
+  }
+  std::clog << cacheError << ", building it" << std::endl;
+  EquirectangularImage image;
+  if (!loadEquirectangularImage(content, image, error)) {
+    error = "Unable to load " + path.string() + ": " + error;
+    return false;
+  }
+  EnvironmentStats stats;
+  computeEnvironmentLighting(
+      image, m_options.environmentOptions, lighting, stats);
+  // The lighting is usable even if it cannot be cached
+  if (!writeEnvironmentCache(lighting, sourceHash, cachePath, cacheError)) {
+    std::clog << cacheError << std::endl;
+  }
+  std::clog << "Built " << cachePath << " (irradiance "
+            << stats.irradianceSeconds << "s, specular "
+            << stats.specularSeconds << "s, BRDF " << stats.brdfSeconds
+            << "s) in " << glfwGetTime() - start << "s" << std::endl;
+  return true;
+}
+
+size_t ViewerApplication::computeTextureByteCount(
+    const tinygltf::Model &model) const
+{
+  size_t byteCount = 0;
+  for (const auto &texture : model.textures) {
+    const auto &image = model.images[texture.source];
+    // A full mipmap chain adds a third of the base level
+    const auto mipmapFactor = m_options.generateMipmaps ? 4. / 3. : 1.;
+    byteCount += size_t(mipmapFactor * 4 * image.width * image.height *
+                        (image.pixel_type == GL_UNSIGNED_SHORT ? 2 : 1));
+  }
+  return byteCount;
+}
+
 std::vector<GLuint> ViewerApplication::createBufferObjects(
     const tinygltf::Model &model)
 {
@@ -497,9 +2756,36 @@ std::vector<GLuint> ViewerApplication::createBufferObjects(
   return std::move(vertexBufferObjectList);
 }
 
+void ViewerApplication::createBufferRanges(GltfAsset &asset)
+{
+  const auto &buffers = asset.model.buffers;
+  asset.bufferRanges.resize(buffers.size());
+  if (!m_bufferPool) {
+    asset.bufferObjects = createBufferObjects(asset.model);
+    for (size_t bufferIdx = 0; bufferIdx < buffers.size(); ++bufferIdx) {
+      asset.bufferRanges[bufferIdx] =
+          GpuBufferRange{asset.bufferObjects[bufferIdx], 0};
+    }
+    return;
+  }
+  asset.bufferPool = m_bufferPool.get();
+  asset.bufferAllocations.resize(buffers.size());
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); ++bufferIdx) {
+    const auto &data = buffers[bufferIdx].data;
+    asset.bufferAllocations[bufferIdx] =
+        m_bufferPool->allocate(data.size(), data.data());
+    asset.bufferRanges[bufferIdx] =
+        m_bufferPool->range(asset.bufferAllocations[bufferIdx]);
+  }
+}
+
 std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
-    const tinygltf::Model &model, const std::vector<GLuint> &bufferObjects,
-    std::vector<VaoRange> &meshIndexToVaoRange)
+    const tinygltf::Model &model,
+    const std::vector<GpuBufferRange> &bufferRanges,
+    const std::vector<NodeInstancing> &nodeInstancing,
+    std::vector<VaoRange> &meshIndexToVaoRange,
+    std::vector<VaoRange> &nodeIndexToInstancedVaoRange,
+    std::vector<VertexBufferBindings> &vertexBufferBindings)
 {
   /*
    * Model contains meshes that contains primitives
@@ -507,83 +2793,83 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
    * same mesh.
    */
   std::vector<GLuint> vertexArrayObjectList;
-
-  meshIndexToVaoRange.resize(model.meshes.size());
-
-  struct Attribute
-  {
-    const std::string NAME;
-    const int INDEX;
+  vertexBufferBindings.clear();
+  // With shared vertex formats, VAOs are created on first use of a format
+  std::map<VertexFormat, GLuint> vertexFormatVaos;
+
+  meshIndexToVaoRange.clear();
+  meshIndexToVaoRange.reserve(model.meshes.size());
+
+  const auto allocateVaoRange = [&](size_t count) {
+    const auto vaoRange =
+        VaoRange{GLsizei(vertexArrayObjectList.size()), GLsizei(count)};
+    vertexArrayObjectList.resize(vertexArrayObjectList.size() + count);
+    if (m_options.shareVertexFormats) {
+      vertexBufferBindings.resize(vertexArrayObjectList.size());
+    } else if (count) {
+      glGenVertexArrays(vaoRange.count, &vertexArrayObjectList[vaoRange.begin]);
+    }
+    return vaoRange;
+  };
+  const auto setupVertexArray = [&](size_t vaoIdx,
+                                    const tinygltf::Primitive &primitive,
+                                    const NodeInstancing *instancing) {
+    if (!m_options.shareVertexFormats) {
+      glBindVertexArray(vertexArrayObjectList[vaoIdx]);
+      setupPrimitiveAttributes(model, bufferRanges, primitive);
+      if (instancing) {
+        setupInstanceAttributes(model, bufferRanges, *instancing);
+      }
+      return;
+    }
+    VertexFormat format;
+    getPrimitiveVertexInput(model, bufferRanges, primitive, instancing,
+        format, vertexBufferBindings[vaoIdx]);
+    auto &vertexArrayObject = vertexFormatVaos[format];
+    if (!vertexArrayObject) {
+      vertexArrayObject = createVertexFormatVertexArrayObject(format);
+    }
+    vertexArrayObjectList[vaoIdx] = vertexArrayObject;
   };
 
-  std::vector<Attribute> attributeList;
-  attributeList.push_back({"POSITION", 0});
-  attributeList.push_back({"NORMAL", 1});
-  attributeList.push_back({"TEXCOORD_0", 2});
   for (const auto &mesh : model.meshes) {
-    const auto oldSize = vertexArrayObjectList.size();
-
-    auto vaoRange = VaoRange{static_cast<GLsizei>(oldSize),
-        static_cast<GLsizei>(mesh.primitives.size())};
+    const auto vaoRange = allocateVaoRange(mesh.primitives.size());
     meshIndexToVaoRange.push_back(vaoRange);
 
-    vertexArrayObjectList.resize(oldSize + mesh.primitives.size());
+    for (size_t primitiveId = 0; primitiveId < mesh.primitives.size();
+         primitiveId++) {
+      setupVertexArray(
+          vaoRange.begin + primitiveId, mesh.primitives[primitiveId], nullptr);
+    }
+  }
 
-    glGenVertexArrays(vaoRange.count, &vertexArrayObjectList[vaoRange.begin]);
-    for (unsigned long primitiveId = 0; primitiveId < mesh.primitives.size();
+  // Instanced nodes need their own VAOs: the instance attributes are part of
+  // the VAO state and differ from one node to another (with shared vertex
+  // formats, only their buffer bindings differ)
+  nodeIndexToInstancedVaoRange.assign(model.nodes.size(), VaoRange{0, 0});
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    if (!nodeInstancing[nodeIdx].instanceCount) {
+      continue;
+    }
+    const auto &mesh = model.meshes[model.nodes[nodeIdx].mesh];
+    const auto vaoRange = allocateVaoRange(mesh.primitives.size());
+    nodeIndexToInstancedVaoRange[nodeIdx] = vaoRange;
+
+    for (size_t primitiveId = 0; primitiveId < mesh.primitives.size();
          primitiveId++) {
-      auto primitiveVAO = vertexArrayObjectList[vaoRange.begin + primitiveId];
-      auto primitive = mesh.primitives[primitiveId];
-
-      glBindVertexArray(primitiveVAO);
-      for (Attribute attribute : attributeList) {
-        // I'm opening a scope because I want to reuse the variable iterator in
-        // the code for NORMAL and TEXCOORD_0
-        const auto iterator = primitive.attributes.find(attribute.NAME);
-        if (iterator !=
-            end(primitive
-                    .attributes)) { // If "POSITION" has been found in the map
-          // (*iterator).first is the key "POSITION", (*iterator).second is the
-          // value, ie. the index of the accessor for this attribute
-          const auto accessorIdx = (*iterator).second;
-          const auto &accessor = model.accessors[accessorIdx];
-          const auto &bufferView = model.bufferViews[accessor.bufferView];
-          const auto bufferIdx = bufferView.buffer;
-
-          const auto bufferObject = bufferObjects[bufferIdx];
-
-          glEnableVertexAttribArray(attribute.INDEX);
-          glBindBuffer(GL_ARRAY_BUFFER, bufferObject);
-          const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
-          glVertexAttribPointer(attribute.INDEX, accessor.type,
-              accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
-              (const GLvoid *)byteOffset);
-          // Remember size is obtained with accessor.type, type is obtained with
-          // accessor.componentType. The stride is obtained in the bufferView,
-          // normalized is always GL_FALSE, and pointer is the byteOffset (don't
-          // forget the cast).
-        }
-
-        if (primitive.indices >=
-            0) { // Setting up the Index buffer object if exists
-          const auto accessorIdx = primitive.indices;
-          const auto &accessor = model.accessors[accessorIdx];
-          const auto &bufferView = model.bufferViews[accessor.bufferView];
-          const auto bufferIdx = bufferView.buffer;
-
-          assert(GL_ELEMENT_ARRAY_BUFFER == bufferView.target);
-          glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-              bufferObjects[bufferIdx]); // Binding the index buffer to
-          // GL_ELEMENT_ARRAY_BUFFER while the VAO
-          // is bound is enough to tell OpenGL we
-          // want to use that index buffer for that
-          // VAO
-        }
-      }
-    }
-  }
-
-  std::clog << "Number of VAOs: " << vertexArrayObjectList.size() << std::endl;
+      setupVertexArray(vaoRange.begin + primitiveId,
+          mesh.primitives[primitiveId], &nodeInstancing[nodeIdx]);
+    }
+  }
+
+  if (m_options.shareVertexFormats) {
+    std::clog << "Number of VAOs: " << vertexFormatVaos.size()
+              << " vertex formats shared by " << vertexArrayObjectList.size()
+              << " primitives" << std::endl;
+  } else {
+    std::clog << "Number of VAOs: " << vertexArrayObjectList.size()
+              << std::endl;
+  }
 
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindVertexArray(0);
@@ -609,14 +2895,22 @@ std::vector<GLuint> ViewerApplication::createTextureObjects(
     const auto &sampler =
         texture.sampler >= 0 ? model.samplers[texture.sampler] : defaultSampler;
 
-    if (sampler.minFilter == GL_NEAREST_MIPMAP_NEAREST ||
-        sampler.minFilter == GL_NEAREST_MIPMAP_LINEAR ||
-        sampler.minFilter == GL_LINEAR_MIPMAP_NEAREST ||
-        sampler.minFilter == GL_LINEAR_MIPMAP_LINEAR) {
-      glGenerateMipmap(GL_TEXTURE_2D);
+    auto minFilter = sampler.minFilter != -1 ? sampler.minFilter : GL_LINEAR;
+    if (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+        minFilter == GL_NEAREST_MIPMAP_LINEAR ||
+        minFilter == GL_LINEAR_MIPMAP_NEAREST ||
+        minFilter == GL_LINEAR_MIPMAP_LINEAR) {
+      if (m_options.generateMipmaps) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+      } else {
+        // Without mipmaps the texture would be incomplete
+        minFilter = (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+                        minFilter == GL_NEAREST_MIPMAP_LINEAR)
+                        ? GL_NEAREST
+                        : GL_LINEAR;
+      }
     }
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-        sampler.minFilter != -1 ? sampler.minFilter : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
         sampler.magFilter != -1 ? sampler.magFilter : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, sampler.wrapR);
@@ -625,4 +2919,26 @@ std::vector<GLuint> ViewerApplication::createTextureObjects(
   }
   glBindTexture(GL_TEXTURE_2D, 0);
   return textureList;
-}
\ No newline at end of file
+}
+
+void ViewerApplication::createBindlessMaterials(GltfAsset &asset) const
+{
+  if (!m_options.bindlessTextures) {
+    return;
+  }
+  // Handles capture the sampling state set by createTextureObjects(), which
+  // cannot change once they are resident
+  const auto *bindless = getBindlessTextureApi();
+  for (const auto texture : asset.textureObjects) {
+    const auto handle = bindless->getTextureHandle(texture);
+    bindless->makeTextureHandleResident(handle);
+    asset.textureHandles.push_back(handle);
+  }
+  const auto materials =
+      getBindlessMaterials(asset.model, asset.textureHandles);
+  glGenBuffers(1, &asset.bindlessMaterialBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, asset.bindlessMaterialBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      materials.size() * sizeof(BindlessMaterial), materials.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
@@ -1,30 +1,134 @@
 #pragma once
 
 #include "utils/GLFWHandle.hpp"
+#include "utils/asset_cache.hpp"
+#include "utils/bindless_textures.hpp"
 #include "utils/cameras.hpp"
+#include "utils/environment.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/gltf.hpp"
+#include "utils/gpu_allocator.hpp"
+#include "utils/hlod.hpp"
+#include "utils/lights.hpp"
+#include "utils/renderer.hpp"
+#include "utils/scene_file.hpp"
 #include "utils/shaders.hpp"
+#include "utils/shadows.hpp"
+#include "utils/static_batching.hpp"
+#include "utils/texture_pools.hpp"
+#include "utils/vertex_pulling.hpp"
 #include <tiny_gltf.h>
 
+// Tuning options of the viewer that have a sensible default
+struct ViewerOptions
+{
+  // If true, the --output image is drawn by the Renderer of the renderer
+  // backend, with the default forward shading only. Otherwise the viewer
+  // draws with OpenGL and all its features.
+  bool useRenderer = false;
+  RendererBackend renderer = RENDERER_BACKEND_GL;
+  // Textures larger than this are downscaled on load (0 = no limit)
+  int maxTextureSize = 0;
+  // If false, samplers using mipmaps fall back to their non-mipmap filter
+  bool generateMipmaps = true;
+  // Out-of-core rendering: geometry is paged in and out of GPU memory from a
+  // spatially partitioned cache file, see GeometryStreamer
+  bool streamGeometry = false;
+  size_t streamingBudget = size_t(256) << 20; // Bytes of resident geometry
+  // Merge the small static nodes sharing a material on load, see
+  // StaticBatches. Ignored for streamed assets.
+  bool staticBatching = false;
+  StaticBatchOptions staticBatchOptions;
+  // Share one VAO between all the primitives with the same vertex format,
+  // drawn by binding their buffers (glVertexAttribFormat/glBindVertexBuffers)
+  // instead of one VAO per primitive
+  bool shareVertexFormats = true;
+  // Hierarchical LOD: build proxies of clusters of nodes on load, see
+  // HlodHierarchy. Ignored for streamed assets.
+  bool buildHlod = false;
+  HlodOptions hlodOptions;
+  // Initial value of the HLOD max error of the GUI, in pixels
+  float hlodMaxScreenError = 1.5f;
+  // Programmable vertex pulling: vertices are read from storage buffers by
+  // forward_pulling.vs.glsl and the draws of an asset are submitted with a
+  // few multi-draw calls, see PulledDrawRecord. Streaming, static batching
+  // and HLOD are disabled.
+  bool vertexPulling = false;
+  // Group the textures of each asset in texture arrays and read the materials
+  // from a storage buffer, so that draws with different materials share
+  // multi-draw calls, see TexturePools. Implies vertexPulling.
+  bool textureArrays = false;
+  TexturePoolOptions texturePoolOptions;
+  // Make the textures resident and read their handles from a storage buffer
+  // of materials (ARB_bindless_texture), so that a material change binds no
+  // texture. Ignored if the driver does not support it.
+  bool bindlessTextures = false;
+  // Carve the buffers of the assets out of a few large buffer objects (see
+  // GpuMemoryPool) instead of creating a buffer object per glTF buffer.
+  // Ignored with vertexPulling, which has one buffer per asset already.
+  bool suballocateBuffers = false;
+  GpuMemoryPoolOptions bufferPoolOptions;
+  // Clustered forward shading of the KHR_lights_punctual lights of the scene
+  // with pbr_clustered_lights.fs.glsl, see LightClusters. Not supported with
+  // textureArrays and bindlessTextures.
+  bool clusteredLights = false;
+  LightClusterOptions lightClusterOptions;
+  // Point lights scattered at random in the scene, for testing (implies
+  // clusteredLights)
+  int randomLightCount = 0;
+  // Cascaded shadow maps of the directional light, see ShadowMaps. Read by
+  // pbr_directional_light.fs.glsl, pbr_clustered_lights.fs.glsl and
+  // deferred_lighting.fs.glsl, not supported with vertexPulling.
+  bool shadows = false;
+  ShadowOptions shadowOptions;
+  // Image based lighting from this equirectangular environment map (Radiance
+  // .hdr), see EnvironmentLighting. Precomputed on the first run and cached
+  // next to the map. Read by pbr_directional_light.fs.glsl,
+  // pbr_clustered_lights.fs.glsl and deferred_lighting.fs.glsl.
+  fs::path environmentPath;
+  float environmentIntensity = 1.f; // Can be changed in the GUI
+  EnvironmentOptions environmentOptions;
+  // Deferred shading, see DeferredTargets: the scene is drawn to a G-buffer
+  // with gbuffer.fs.glsl, then each pixel is shaded once with the lights
+  // above by deferred_lighting.fs.glsl (implies clusteredLights). Blended
+  // materials are drawn with screen door transparency. Not supported with
+  // textureArrays and bindlessTextures.
+  bool deferredShading = false;
+  // Draw on a render thread owning the GL context, while the main thread
+  // handles the events, the camera and the GUI and publishes a snapshot of
+  // each frame. The window loop draws on the main thread otherwise.
+  bool renderThread = false;
+  // Record the sorted draws in lists of DrawCommand with the job system,
+  // the thread owning the GL context only replays them. Can be toggled in
+  // the GUI.
+  bool parallelRecording = false;
+  // Draw this many frames with the initial camera, print timings and draw
+  // statistics, then exit
+  int benchmarkFrameCount = 0;
+  // With benchmarkFrameCount: fail if a frame allocates from the heap after
+  // the first allocationWarmupFrameCount frames
+  bool checkAllocations = false;
+  int allocationWarmupFrameCount = 8;
+  // Print the load and render times of the --output image
+  bool printOutputTimes = false;
+};
+
 class ViewerApplication
 {
 public:
   ViewerApplication(const fs::path &appPath, uint32_t width, uint32_t height,
-      const fs::path &gltfFile, const std::vector<float> &lookatArgs,
+      const std::vector<AssetPlacement> &assets,
+      const std::vector<float> &lookatArgs,
       const std::string &vertexShader, const std::string &fragmentShader,
-      const fs::path &output);
+      const fs::path &output, const ViewerOptions &options = {});
 
   int run();
 
 private:
-  tinygltf::Sampler defaultSampler;
+  // run() with useRenderer: draws the output image through a Renderer
+  int runRenderer();
 
-  // A range of indices in a vector containing Vertex Array Objects
-  struct VaoRange
-  {
-    GLsizei begin; // Index of first element in vertexArrayObjects
-    GLsizei count; // Number of elements in range
-  };
+  tinygltf::Sampler defaultSampler;
 
   GLsizei m_nWindowWidth = 1280;
   GLsizei m_nWindowHeight = 720;
@@ -33,7 +137,7 @@ private:
   const std::string m_AppName;
   const fs::path m_ShadersRootPath;
 
-  fs::path m_gltfFilePath;
+  std::vector<AssetPlacement> m_assetPlacements;
   std::string m_vertexShader = "forward.vs.glsl";
   std::string m_fragmentShader = "pbr_directional_light.fs.glsl";
 
@@ -42,12 +146,19 @@ private:
 
   fs::path m_OutputPath;
 
+  ViewerOptions m_options;
+
   // Order is important here, see comment below
   const std::string m_ImGuiIniFilename;
-  // Last to be initialized, first to be destroyed:
-  GLFWHandle m_GLFWHandle{int(m_nWindowWidth), int(m_nWindowHeight),
-      "glTF Viewer",
-      m_OutputPath.empty()}; // show the window only if m_OutputPath is empty
+  // Last to be initialized, first to be destroyed. Not created with
+  // useRenderer, the Renderer owns its window or device.
+  std::unique_ptr<GLFWHandle> m_GLFWHandle =
+      !m_options.useRenderer
+          ? std::make_unique<GLFWHandle>(int(m_nWindowWidth),
+                int(m_nWindowHeight), "glTF Viewer",
+                m_OutputPath.empty()) // show the window only if m_OutputPath
+                                      // is empty
+          : nullptr;
   /*
       ! THE ORDER OF DECLARATION OF MEMBER VARIABLES IS IMPORTANT !
       - m_ImGuiIniFilename.c_str() will be used by ImGUI in ImGui::Shutdown,
@@ -59,13 +170,40 @@ private:
    the creation of a GLFW windows and thus a GL context which must exists
    before most of OpenGL function calls.
        */
+
+  // Shared by all the assets of the scene. It only holds weak references: the
+  // assets themselves are owned by the scene in run().
+  AssetCache m_assetCache;
+
+  // Set if m_options.suballocateBuffers: holds the buffers of all the assets,
+  // which must be released before it
+  GlBufferBackend m_bufferBackend;
+  std::unique_ptr<GpuMemoryPool> m_bufferPool;
+
   /**
    * Loads a glTF file and write in the reference of model.
+   * @param path
    * @param model
    * @return A boolean that can be either true if successful loading or false in
    * case of failure
    */
-  bool loadGltfFile(tinygltf::Model &model);
+  bool loadGltfFile(const fs::path &path, tinygltf::Model &model);
+
+  /**
+   * Loader of m_assetCache: loads asset.path and creates its OpenGL objects
+   * @return false in case of failure, with a message in error
+   */
+  bool loadAsset(GltfAsset &asset, std::string &error);
+
+  /**
+   * Loads the lighting of m_options.environmentPath from its cache file, or
+   * precomputes it and writes the cache file
+   * @return false in case of failure, with a message in error
+   */
+  bool loadEnvironment(EnvironmentLighting &lighting, std::string &error);
+
+  // Approximate GPU memory used by the textures of model
+  size_t computeTextureByteCount(const tinygltf::Model &model) const;
 
   /**
    * Creates a list of buffer objects
@@ -75,16 +213,33 @@ private:
    */
   std::vector<GLuint> createBufferObjects(const tinygltf::Model &model);
 
+  // Fill asset.bufferRanges, from m_bufferPool if set and from new buffer
+  // objects otherwise
+  void createBufferRanges(GltfAsset &asset);
+
   /**
    * Creates a vertex array objects for each meshes
    * @param model Model to fetch the meshes and primitives structure
-   * @param bufferObjects Created VBO from the model file
+   * @param bufferRanges Range of each buffer of the model file in a VBO
+   * @param nodeInstancing EXT_mesh_gpu_instancing attributes of each node
+   * (instanceCount == 0 for nodes that are not instanced)
    * @param meshIndexToVaoRange List of range of indices for the VAO (begin
    * offset + a range starting at the offset)
+   * @param nodeIndexToInstancedVaoRange Same for instanced nodes: their VAOs
+   * also read the per-instance attributes (empty range for other nodes)
+   * @param vertexBufferBindings Filled with the buffers of each element of the
+   * result if m_options.shareVertexFormats is set, cleared otherwise
    * @return the vector containing all the vao for each vbo
    */
   std::vector<GLuint> createVertexArrayObjects(const tinygltf::Model &model,
-      const std::vector<GLuint> &bufferObjects,
-      std::vector<VaoRange> &meshIndexToVaoRange);
+      const std::vector<GpuBufferRange> &bufferRanges,
+      const std::vector<NodeInstancing> &nodeInstancing,
+      std::vector<VaoRange> &meshIndexToVaoRange,
+      std::vector<VaoRange> &nodeIndexToInstancedVaoRange,
+      std::vector<VertexBufferBindings> &vertexBufferBindings);
   std::vector<GLuint> createTextureObjects(const tinygltf::Model &model) const;
+
+  // Make the textures of asset resident and create its storage buffer of
+  // BindlessMaterial, if m_options.bindlessTextures is set
+  void createBindlessMaterials(GltfAsset &asset) const;
 };
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "ViewerApplication.hpp"
 #include "utils/GLFWHandle.hpp"
+#include "utils/benchmarks.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/renderer.hpp"
+#include "utils/scene_file.hpp"
 
 #include <args.hxx>
 
@@ -21,10 +24,75 @@ int main(int argc, char **argv)
         GLFWHandle handle{1, 1, "", false};
         printGLVersion();
       }};
+  args::Command benchDecode{commands, "bench-decode",
+      "Benchmark image decoders on the images of a directory",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> directory{parser, "directory",
+            "Directory searched recursively for png and jpeg images (e.g. "
+            "glTF-Sample-Models)",
+            args::Options::Required};
+        args::ValueFlag<int> iterations{parser, "iterations",
+            "Number of times each image is decoded by each decoder",
+            {"iterations"}};
+        parser.Parse();
+
+        returnCode = benchmarkImageDecoders(
+            args::get(directory), iterations ? args::get(iterations) : 3);
+      }};
+  args::Command benchSort{commands, "bench-sort",
+      "Benchmark the sort of the draw list of a frame",
+      [&](args::Subparser &parser) {
+        args::ValueFlag<size_t> draws{
+            parser, "draws", "Number of draws sorted", {"draws"}};
+        args::ValueFlag<int> frames{parser, "frames",
+            "Number of frames sorted for each case", {"frames"}};
+        parser.Parse();
+
+        returnCode = benchmarkDrawSort(draws ? args::get(draws) : 1000000,
+            frames ? args::get(frames) : 20);
+      }};
+  args::Command benchLights{commands, "bench-lights",
+      "Benchmark the binning of point lights in clusters",
+      [&](args::Subparser &parser) {
+        args::ValueFlag<int> frames{parser, "frames",
+            "Number of frames binned for each light count", {"frames"}};
+        parser.Parse();
+
+        returnCode =
+            benchmarkLightClusters(frames ? args::get(frames) : 20);
+      }};
+  args::Command benchEnvironment{commands, "bench-ibl",
+      "Benchmark the precomputation of the image based lighting of an "
+      "environment map",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> environment{parser, "environment",
+            "Equirectangular environment map (Radiance .hdr)",
+            args::Options::Required};
+        args::ValueFlag<int> iterations{parser, "iterations",
+            "Number of times the lighting is computed", {"iterations"}};
+        parser.Parse();
+
+        returnCode = benchmarkEnvironmentLighting(
+            args::get(environment), iterations ? args::get(iterations) : 3);
+      }};
+  args::Command benchAllocator{commands, "bench-allocator",
+      "Benchmark the suballocation of GPU buffers, without GL",
+      [&](args::Subparser &parser) {
+        args::ValueFlag<size_t> allocations{parser, "allocations",
+            "Number of random allocations", {"allocations"}};
+        parser.Parse();
+
+        returnCode = benchmarkGpuMemoryPool(
+            allocations ? args::get(allocations) : 5000);
+      }};
   args::Command interactive{
       commands, "viewer", "Run glTF viewer", [&](args::Subparser &parser) {
-        args::Positional<std::string> file{
-            parser, "file", "Path to file", args::Options::Required};
+        args::PositionalList<std::string> files{parser, "files",
+            "Paths of the glTF files to load in the scene (at the origin)"};
+        args::ValueFlag<std::string> scene{parser, "scene",
+            "Scene file listing glTF files with their root transforms, one "
+            "per line: path [tx ty tz [qx qy qz qw [sx sy sz]]]",
+            {"scene"}};
         args::ValueFlag<std::string> lookat{parser, "lookat",
             "Look at parameters for the Camera with format "
             "eye_x,eye_y,eye_z,center_x,center_y,center_z,up_x,up_y,up_z",
@@ -43,6 +111,113 @@ int main(int argc, char **argv)
             "Output path to render the image. If specified no window is shown. "
             "Only png is supported.",
             {"o", "output"}};
+        args::ValueFlag<std::string> renderer{parser, "api",
+            "Draw the --output image through the renderer of a graphics "
+            "API, gl or vulkan, with the default forward shading only",
+            {"renderer"}};
+        args::ValueFlag<int> maxTextureSize{parser, "size",
+            "Downscale textures larger than size pixels on load",
+            {"max-texture-size"}};
+        args::Flag thumbnail{parser, "thumbnail",
+            "Fast thumbnail rendering: 256x256 output unless -w/-h are given, "
+            "textures limited to the output size, no mipmap generation, "
+            "coarse HLOD proxies, and load and render times printed",
+            {"thumbnail"}};
+        args::Flag stream{parser, "stream",
+            "Out-of-core rendering: stream geometry from a spatially "
+            "partitioned cache file (<file>.cells, built on first use)",
+            {"stream"}};
+        args::ValueFlag<int> streamBudget{parser, "MB",
+            "GPU memory budget of streamed geometry in MB (default 256)",
+            {"stream-budget"}};
+        args::Flag hlod{parser, "hlod",
+            "Build hierarchical LOD proxies on load: distant clusters of "
+            "nodes are drawn with a single simplified mesh",
+            {"hlod"}};
+        args::Flag staticBatching{parser, "static-batching",
+            "Merge small static nodes sharing a material into pre-transformed "
+            "vertex buffers drawn with one draw call per spatial chunk",
+            {"static-batching"}};
+        args::ValueFlag<size_t> batchMaxVertices{parser, "count",
+            "Static batching: only nodes with at most count vertices are "
+            "merged (default 4096)",
+            {"batch-max-vertices"}};
+        args::ValueFlag<size_t> batchChunkVertices{parser, "count",
+            "Static batching: vertices per spatial chunk (default 65536)",
+            {"batch-chunk-vertices"}};
+        args::Flag vaoPerPrimitive{parser, "vao-per-primitive",
+            "Create one VAO per primitive instead of one per vertex format "
+            "(to compare VAO switches)",
+            {"vao-per-primitive"}};
+        args::Flag vertexPulling{parser, "vertex-pulling",
+            "Read vertices from storage buffers in the vertex shader and "
+            "submit the draws of each asset with multi-draw indirect calls",
+            {"vertex-pulling"}};
+        args::Flag textureArrays{parser, "texture-arrays",
+            "Group textures in texture arrays and atlases so that draws with "
+            "different materials share multi-draw calls (implies "
+            "--vertex-pulling)",
+            {"texture-arrays"}};
+        args::Flag bindless{parser, "bindless",
+            "Sample resident textures through handles stored with the "
+            "materials (ARB_bindless_texture, ignored if not supported)",
+            {"bindless"}};
+        args::Flag suballocate{parser, "suballocate",
+            "Carve the buffers of all the assets out of a few large buffer "
+            "objects with a TLSF suballocator",
+            {"suballocate"}};
+        args::Flag clusteredLights{parser, "clustered-lights",
+            "Shade the KHR_lights_punctual lights of the scene, binned in "
+            "clusters of the view frustum",
+            {"clustered-lights"}};
+        args::ValueFlag<int> randomLights{parser, "count",
+            "Add count random point lights to the scene (implies "
+            "--clustered-lights)",
+            {"random-lights"}};
+        args::Flag shadows{parser, "shadows",
+            "Cascaded shadow maps for the directional light",
+            {"shadows"}};
+        args::ValueFlag<int> shadowCascades{parser, "count",
+            "Number of shadow cascades, at most 4 (default 4)",
+            {"shadow-cascades"}};
+        args::ValueFlag<int> shadowResolution{parser, "size",
+            "Resolution of the shadow map of each cascade (default 2048)",
+            {"shadow-resolution"}};
+        args::ValueFlag<int> shadowDistantInterval{parser, "frames",
+            "Update the distant shadow cascades (third on) on one frame out "
+            "of this many (default 1)",
+            {"shadow-distant-interval"}};
+        args::Flag uncachedShadows{parser, "uncached-shadows",
+            "Render the shadow maps every frame instead of only when their "
+            "cascade moves",
+            {"uncached-shadows"}};
+        args::ValueFlag<std::string> environment{parser, "environment",
+            "Equirectangular environment map (Radiance .hdr) lighting the "
+            "scene, precomputed once and cached next to it",
+            {"environment"}};
+        args::ValueFlag<float> environmentIntensity{parser, "intensity",
+            "Scale of the environment lighting (default 1)",
+            {"environment-intensity"}};
+        args::Flag deferred{parser, "deferred",
+            "Deferred shading: draw the scene to a G-buffer, then shade each "
+            "pixel once",
+            {"deferred"}};
+        args::Flag renderThread{parser, "render-thread",
+            "Draw on a dedicated render thread, decoupled from event "
+            "handling and GUI building",
+            {"render-thread"}};
+        args::Flag parallelRecording{parser, "parallel-recording",
+            "Record draw commands on worker threads, the render thread only "
+            "submits them",
+            {"parallel-recording"}};
+        args::ValueFlag<int> benchmark{parser, "frames",
+            "Draw this many frames, print CPU/GPU frame times and draw "
+            "statistics, then exit",
+            {"benchmark"}};
+        args::Flag checkAllocations{parser, "check-allocations",
+            "With --benchmark, exit with an error if a frame allocates from "
+            "the heap after warm-up",
+            {"check-allocations"}};
         parser.Parse();
 
         std::vector<float> lookatParams;
@@ -59,12 +234,102 @@ int main(int argc, char **argv)
           }
         }
 
-        uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
-        uint32_t height = imageHeight ? args::get(imageHeight) : 720;
+        std::vector<AssetPlacement> assets;
+        if (scene) {
+          std::string error;
+          if (!loadSceneFile(args::get(scene), assets, error)) {
+            throw args::ValidationError(error);
+          }
+        }
+        for (const auto &file : args::get(files)) {
+          assets.push_back(AssetPlacement{file});
+        }
+        if (assets.empty()) {
+          throw args::ValidationError(
+              "Expected at least one glTF file or a --scene");
+        }
+
+        const auto defaultWidth = thumbnail ? 256 : 1280;
+        const auto defaultHeight = thumbnail ? 256 : 720;
+        uint32_t width = imageWidth ? args::get(imageWidth) : defaultWidth;
+        uint32_t height = imageHeight ? args::get(imageHeight) : defaultHeight;
+
+        ViewerOptions options;
+        if (renderer) {
+          if (!parseRendererBackend(args::get(renderer), options.renderer)) {
+            throw args::ValidationError("Unknown --renderer " +
+                                        args::get(renderer) +
+                                        " (expected gl or vulkan)");
+          }
+          options.useRenderer = true;
+        }
+        if (thumbnail) {
+          // Texels finer than the output pixels are never seen
+          options.maxTextureSize = int(std::max(width, height));
+          options.generateMipmaps = false;
+        }
+        if (maxTextureSize) {
+          options.maxTextureSize = args::get(maxTextureSize);
+        }
+        options.streamGeometry = stream;
+        if (streamBudget) {
+          options.streamingBudget = size_t(args::get(streamBudget)) << 20;
+        }
+        options.buildHlod = hlod;
+        if (thumbnail) {
+          // Distant clusters are a few pixels wide at thumbnail sizes. HLOD
+          // is not supported by the renderers and with vertex pulling.
+          options.buildHlod |= !renderer && !vertexPulling && !textureArrays;
+          options.hlodMaxScreenError = 4.f;
+          options.printOutputTimes = true;
+        }
+        options.shareVertexFormats = !vaoPerPrimitive;
+        options.staticBatching = staticBatching;
+        options.vertexPulling = vertexPulling;
+        options.textureArrays = textureArrays;
+        options.bindlessTextures = bindless;
+        options.suballocateBuffers = suballocate;
+        options.clusteredLights = clusteredLights;
+        if (randomLights) {
+          options.randomLightCount = args::get(randomLights);
+        }
+        options.shadows = shadows;
+        if (shadowCascades) {
+          options.shadowOptions.cascadeCount = args::get(shadowCascades);
+        }
+        if (shadowResolution) {
+          options.shadowOptions.resolution = args::get(shadowResolution);
+        }
+        if (shadowDistantInterval) {
+          options.shadowOptions.distantCascadeInterval =
+              args::get(shadowDistantInterval);
+        }
+        options.shadowOptions.cacheStaticDepth = !uncachedShadows;
+        if (environment) {
+          options.environmentPath = args::get(environment);
+        }
+        if (environmentIntensity) {
+          options.environmentIntensity = args::get(environmentIntensity);
+        }
+        options.deferredShading = deferred;
+        options.renderThread = renderThread;
+        options.parallelRecording = parallelRecording;
+        if (benchmark) {
+          options.benchmarkFrameCount = args::get(benchmark);
+        }
+        options.checkAllocations = checkAllocations;
+        if (batchMaxVertices) {
+          options.staticBatchOptions.maxNodeVertexCount =
+              args::get(batchMaxVertices);
+        }
+        if (batchChunkVertices) {
+          options.staticBatchOptions.maxChunkVertexCount =
+              args::get(batchChunkVertices);
+        }
 
-        ViewerApplication app{fs::path{argv[0]}, width, height, args::get(file),
+        ViewerApplication app{fs::path{argv[0]}, width, height, assets,
             lookatParams, args::get(vertexShader), args::get(fragmentShader),
-            args::get(output)};
+            args::get(output), options};
         returnCode = app.run();
       }};
 
@@ -0,0 +1,27 @@
+#version 330
+// Last pass of deferred shading: the light buffer to the target framebuffer,
+// which keeps its clear color where the G-buffer has no surface
+
+uniform sampler2D uLightBuffer; // Linear radiance
+uniform sampler2D uDepth; // Of the G-buffer
+
+out vec4 fColor;
+
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color)
+{
+    return pow(color, vec3(INV_GAMMA));
+}
+
+void main()
+{
+    ivec2 coords = ivec2(gl_FragCoord.xy);
+    if (texelFetch(uDepth, coords, 0).r == 1.0) {
+        discard;
+    }
+    fColor = vec4(LINEARtoSRGB(texelFetch(uLightBuffer, coords, 0).rgb), 1);
+}
@@ -7,11 +7,11 @@ in vec2 vTexCoords;
 uniform vec3 uLightDirection;
 uniform vec3 uLightIntensity;
 
-out vec3 fColor;
+out vec4 fColor;
 
 void main()
 {
     vec3 viewSpaceNormal=normalize(vViewSpaceNormal);
     float oneOverPi = 1. / 3.14;
-    fColor=vec3(oneOverPi) * uLightIntensity * dot(viewSpaceNormal, uLightDirection);
+    fColor=vec4(vec3(oneOverPi) * uLightIntensity * dot(viewSpaceNormal, uLightDirection), 1);
 }
\ No newline at end of file
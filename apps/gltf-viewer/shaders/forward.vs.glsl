@@ -4,18 +4,38 @@ layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
 
+// EXT_mesh_gpu_instancing attributes, per instance. Non instanced draws get
+// the generic values set by the application (identity transform).
+layout(location = 3) in vec3 aInstanceTranslation;
+layout(location = 4) in vec4 aInstanceRotation; // quaternion x, y, z, w
+layout(location = 5) in vec3 aInstanceScale;
+
 out vec3 vViewSpacePosition;
 out vec3 vViewSpaceNormal;
 out vec2 vTexCoords;
 
-uniform mat4 uModelViewProjMatrix;
-uniform mat4 uModelViewMatrix;
-uniform mat4 uNormalMatrix;
+// Per draw transforms, bound by the application with glBindBufferRange
+layout(std140) uniform Transforms
+{
+    mat4 uModelViewProjMatrix;
+    mat4 uModelViewMatrix;
+    mat4 uNormalMatrix;
+};
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
 
 void main()
 {
-    vViewSpacePosition = vec3(uModelViewMatrix * vec4(aPosition, 1));
-	vViewSpaceNormal = normalize(vec3(uNormalMatrix * vec4(aNormal, 0)));
+    // Instance transform is translation * rotation * scale, applied before
+    // the node transform
+    vec3 position = aInstanceTranslation + rotate(aInstanceRotation, aInstanceScale * aPosition);
+    vec3 normal = rotate(aInstanceRotation, aNormal / aInstanceScale);
+
+    vViewSpacePosition = vec3(uModelViewMatrix * vec4(position, 1));
+	vViewSpaceNormal = normalize(vec3(uNormalMatrix * vec4(normal, 0)));
 	vTexCoords = aTexCoords;
-    gl_Position =  uModelViewProjMatrix * vec4(aPosition, 1);
-}
\ No newline at end of file
+    gl_Position =  uModelViewProjMatrix * vec4(position, 1);
+}
@@ -0,0 +1,154 @@
+#version 430
+
+// Programmable vertex pulling variant of forward.vs.glsl: there are no vertex
+// attributes besides the index of the draw. Vertices are read from the
+// geometry buffer of the asset with the layout described by the record of the
+// draw, so draws with any attribute layout can share one multi-draw call.
+
+// Index of the draw in uDraws: a per-instance attribute with a divisor larger
+// than any instance count, read at the baseInstance of the draw command
+layout(location = 0) in uint aDrawIndex;
+
+out vec3 vViewSpacePosition;
+out vec3 vViewSpaceNormal;
+out vec2 vTexCoords;
+// Read by pbr_directional_light_pooled.fs.glsl
+flat out uint vMaterialIndex;
+
+// Must match PulledAttribute and PulledDrawRecord (std430)
+struct Attribute
+{
+    uint offset; // In bytes in uGeometry
+    uint stride;
+    uint componentType; // GL type, 0 if the attribute is missing
+    uint componentCount; // | normalized << 8
+};
+
+const int ATTRIBUTE_POSITION = 0;
+const int ATTRIBUTE_NORMAL = 1;
+const int ATTRIBUTE_TEXCOORD0 = 2;
+const int ATTRIBUTE_INSTANCE_TRANSLATION = 3;
+const int ATTRIBUTE_INSTANCE_ROTATION = 4;
+const int ATTRIBUTE_INSTANCE_SCALE = 5;
+
+struct Draw
+{
+    mat4 modelViewProjMatrix;
+    mat4 modelViewMatrix;
+    mat4 normalMatrix;
+    Attribute attributes[6];
+    uint indexOffset;
+    uint indexType; // GL type, 0 for non indexed draws
+    uint materialIndex; // In the material buffer (texture pools)
+    uint padding;
+};
+
+layout(std430, binding = 1) readonly buffer Draws
+{
+    Draw uDraws[];
+};
+
+layout(std430, binding = 2) readonly buffer Geometry
+{
+    uint uGeometry[];
+};
+
+uint readUnsigned(uint offset, uint size)
+{
+    uint word = uGeometry[offset >> 2];
+    if (size == 4u) {
+        return word;
+    }
+    uint bits = size * 8u;
+    return (word >> ((offset & 3u) * 8u)) & ((1u << bits) - 1u);
+}
+
+int readSigned(uint offset, uint size)
+{
+    uint bits = size * 8u;
+    return int(readUnsigned(offset, size) << (32u - bits)) >> (32u - bits);
+}
+
+uint componentSize(uint componentType)
+{
+    switch (componentType) {
+    case 0x1400u: // GL_BYTE
+    case 0x1401u: // GL_UNSIGNED_BYTE
+        return 1u;
+    case 0x1402u: // GL_SHORT
+    case 0x1403u: // GL_UNSIGNED_SHORT
+        return 2u;
+    }
+    return 4u;
+}
+
+float readComponent(uint offset, uint componentType, bool normalized)
+{
+    switch (componentType) {
+    case 0x1400u: // GL_BYTE
+        return normalized ? max(float(readSigned(offset, 1u)) / 127.0, -1.0)
+                          : float(readSigned(offset, 1u));
+    case 0x1401u: // GL_UNSIGNED_BYTE
+        return normalized ? float(readUnsigned(offset, 1u)) / 255.0
+                          : float(readUnsigned(offset, 1u));
+    case 0x1402u: // GL_SHORT
+        return normalized ? max(float(readSigned(offset, 2u)) / 32767.0, -1.0)
+                          : float(readSigned(offset, 2u));
+    case 0x1403u: // GL_UNSIGNED_SHORT
+        return normalized ? float(readUnsigned(offset, 2u)) / 65535.0
+                          : float(readUnsigned(offset, 2u));
+    case 0x1405u: // GL_UNSIGNED_INT
+        return float(readUnsigned(offset, 4u));
+    }
+    return uintBitsToFloat(uGeometry[offset >> 2]); // GL_FLOAT
+}
+
+// Missing components keep their default value, like vertex attributes
+vec4 readAttribute(Attribute vertexAttribute, uint element, vec4 defaultValue)
+{
+    vec4 value = defaultValue;
+    if (vertexAttribute.componentType == 0u) {
+        return value;
+    }
+    uint size = componentSize(vertexAttribute.componentType);
+    uint count = vertexAttribute.componentCount & 0xFFu;
+    bool normalized = (vertexAttribute.componentCount >> 8) != 0u;
+    uint offset = vertexAttribute.offset + element * vertexAttribute.stride;
+    for (uint c = 0u; c < count; ++c) {
+        value[c] = readComponent(offset + c * size, vertexAttribute.componentType, normalized);
+    }
+    return value;
+}
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    Draw draw = uDraws[aDrawIndex];
+    uint vertex = uint(gl_VertexID);
+    if (draw.indexType != 0u) {
+        uint size = componentSize(draw.indexType);
+        vertex = readUnsigned(draw.indexOffset + vertex * size, size);
+    }
+
+    vec3 aPosition = readAttribute(draw.attributes[ATTRIBUTE_POSITION], vertex, vec4(0, 0, 0, 1)).xyz;
+    vec3 aNormal = readAttribute(draw.attributes[ATTRIBUTE_NORMAL], vertex, vec4(0, 0, 0, 1)).xyz;
+    vec2 aTexCoords = readAttribute(draw.attributes[ATTRIBUTE_TEXCOORD0], vertex, vec4(0, 0, 0, 1)).xy;
+
+    uint instance = uint(gl_InstanceID);
+    vec3 aInstanceTranslation = readAttribute(draw.attributes[ATTRIBUTE_INSTANCE_TRANSLATION], instance, vec4(0, 0, 0, 1)).xyz;
+    vec4 aInstanceRotation = readAttribute(draw.attributes[ATTRIBUTE_INSTANCE_ROTATION], instance, vec4(0, 0, 0, 1));
+    vec3 aInstanceScale = readAttribute(draw.attributes[ATTRIBUTE_INSTANCE_SCALE], instance, vec4(1, 1, 1, 1)).xyz;
+
+    vec3 position = aInstanceTranslation + rotate(aInstanceRotation, aInstanceScale * aPosition);
+    vec3 normal = rotate(aInstanceRotation, aNormal / aInstanceScale);
+
+    vViewSpacePosition = vec3(draw.modelViewMatrix * vec4(position, 1));
+    vViewSpaceNormal = normalize(vec3(draw.normalMatrix * vec4(normal, 0)));
+    vTexCoords = aTexCoords;
+    vMaterialIndex = draw.materialIndex;
+    gl_Position = draw.modelViewProjMatrix * vec4(position, 1);
+}
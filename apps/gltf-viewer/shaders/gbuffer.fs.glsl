@@ -0,0 +1,105 @@
+#version 330
+// Geometry pass of deferred shading: writes the material inputs of the BRDF
+// of the fragment to the G-buffer (see DeferredTargets), which
+// deferred_lighting.fs.glsl shades once per pixel.
+// INPUTS
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+
+//********** UNIFORMS ************
+// BASE COLOR
+uniform sampler2D uBaseColorTexture;
+uniform vec4 uBaseColorFactor;
+// Fragments with a lower alpha are discarded (MASK materials only)
+uniform float uAlphaCutoff;
+// The G-buffer holds a single surface per pixel: blended materials are drawn
+// with screen door transparency, keeping a fraction alpha of their fragments
+uniform int uAlphaDither;
+
+// METALLIC ROUGHNESS
+uniform float uMetallicFactor;
+uniform float uRoughnessFactor;
+uniform sampler2D uMetallicRoughnessTexture;
+
+// EMISSIVE
+uniform sampler2D uEmissiveTexture;
+uniform vec3 uEmissiveFactor;
+
+// OCCLUSION
+uniform sampler2D uOcclusionTexture;
+uniform float uOcclusionStrength;
+
+//********** OUTPUTS ***********
+layout(location = 0) out vec4 fBaseColorMetallic;
+layout(location = 1) out vec4 fNormalRoughness;
+layout(location = 2) out vec4 fEmissiveOcclusion;
+
+// Constants
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+
+// Thresholds of a 4x4 ordered dither (Bayer matrix)
+const float ditherThresholds[16] = float[16](
+    0.5 / 16, 8.5 / 16, 2.5 / 16, 10.5 / 16,
+    12.5 / 16, 4.5 / 16, 14.5 / 16, 6.5 / 16,
+    3.5 / 16, 11.5 / 16, 1.5 / 16, 9.5 / 16,
+    15.5 / 16, 7.5 / 16, 13.5 / 16, 5.5 / 16);
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color)
+{
+    return pow(color, vec3(INV_GAMMA));
+}
+
+// sRGB to linear approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec4 SRGBtoLINEAR(vec4 srgbIn)
+{
+    return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+}
+
+// Octahedral encoding of a unit vector in [0, 1]^2 (Cigolle et al., A Survey
+// of Efficient Representations for Independent Unit Vectors)
+vec2 encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0) {
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0 ? 1.0 : -1.0, n.y >= 0 ? 1.0 : -1.0);
+    }
+    return e * 0.5 + 0.5;
+}
+
+void main()
+{
+    vec3 N = normalize(vViewSpaceNormal);
+
+    vec4 baseColorVectorFromTexture = SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
+    vec4 computedBaseColorVector = baseColorVectorFromTexture * uBaseColorFactor;
+    if (computedBaseColorVector.a < uAlphaCutoff) {
+        discard;
+    }
+    if (uAlphaDither != 0) {
+        ivec2 ditherCoords = ivec2(gl_FragCoord.xy) & 3;
+        if (computedBaseColorVector.a <= ditherThresholds[ditherCoords.y * 4 + ditherCoords.x]) {
+            discard;
+        }
+    }
+
+    vec4 metallicRoughnessVectorFromTexture = texture(uMetallicRoughnessTexture, vTexCoords);
+    float computedMetallicValue = uMetallicFactor * metallicRoughnessVectorFromTexture.b;
+    float computedRoughnessValue = uRoughnessFactor * metallicRoughnessVectorFromTexture.g;
+
+    vec4 baseEmissiveVectorFromTexture = SRGBtoLINEAR(texture(uEmissiveTexture, vTexCoords));
+    vec3 computedEmissiveVector = baseEmissiveVectorFromTexture.rgb * uEmissiveFactor;
+
+    // Factor of the shaded color, as mix(color, color * occlusion, strength)
+    float occlusion = texture(uOcclusionTexture, vTexCoords).r;
+    float computedOcclusionValue = mix(1.0, occlusion, uOcclusionStrength);
+
+    fBaseColorMetallic = vec4(LINEARtoSRGB(computedBaseColorVector.rgb), computedMetallicValue);
+    fNormalRoughness = vec4(encodeOctahedral(N), computedRoughnessValue, 0);
+    fEmissiveOcclusion = vec4(LINEARtoSRGB(computedEmissiveVector), computedOcclusionValue);
+}
@@ -4,11 +4,11 @@ in vec3 vViewSpacePosition;
 in vec3 vViewSpaceNormal;
 in vec2 vTexCoords;
 
-out vec3 fColor;
+out vec4 fColor;
 
 void main()
 {
    // Need another normalization because interpolation of vertex attributes does not maintain unit length
    vec3 viewSpaceNormal = normalize(vViewSpaceNormal);
-   fColor = vec3(1, 0, 1);
+   fColor = vec4(1, 0, 1, 1);
 }
\ No newline at end of file
@@ -0,0 +1,284 @@
+#version 430
+// pbr_directional_light.fs.glsl with the KHR_lights_punctual lights of the
+// scene on top of the directional light. The lights are binned in a grid of
+// clusters of the view frustum on the CPU (see LightClusters), and each
+// fragment only shades the lights of its cluster.
+// INPUTS
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+
+//********** UNIFORMS ************
+// LIGHT
+uniform vec3 uLightDirection;
+uniform vec3 uLightIntensity;
+
+// CASCADED SHADOW MAPS of the directional light (see ShadowMaps)
+uniform sampler2DArrayShadow uShadowMaps;
+uniform int uShadowCascadeCount; // 0 without shadows
+// View space to the texture space of each cascade, depth in z
+uniform mat4 uShadowMatrices[4];
+// Receivers are moved along their normal by about a texel of the cascade
+// before the lookup, against shadow acne
+uniform float uShadowNormalOffsets[4];
+
+// IMAGE BASED LIGHTING from an environment map (see EnvironmentLighting)
+uniform float uEnvironmentIntensity; // 0 without environment
+// Irradiance divided by pi on the 9 first spherical harmonics
+uniform vec3 uIrradianceSH[9];
+// Environment prefiltered for roughness i / uSpecularMaxLevel on level i
+uniform samplerCube uSpecularEnvironment;
+uniform float uSpecularMaxLevel;
+// Split sum scale and bias of F0, NdotV along x, roughness along y
+uniform sampler2D uBrdfLut;
+// The environment is in world space
+uniform mat3 uViewToWorld;
+
+// PUNCTUAL LIGHTS, in view space
+const uint LIGHT_DIRECTIONAL = 0u;
+const uint LIGHT_SPOT = 2u;
+struct Light
+{
+    vec3 position;
+    float range;
+    vec3 color;
+    uint type;
+    vec3 direction;
+    float spotScale;
+    float spotOffset;
+};
+layout(std430, binding = 4) readonly buffer Lights
+{
+    Light lights[]; // Directional lights first
+};
+// Offset in lightIndices and light count of each cluster
+layout(std430, binding = 5) readonly buffer Clusters
+{
+    uvec2 clusterRanges[];
+};
+layout(std430, binding = 6) readonly buffer LightIndices
+{
+    uint lightIndices[];
+};
+uniform uint uDirectionalLightCount;
+uniform ivec3 uClusterGridSize; // Tiles in x and y, depth slices
+uniform vec2 uViewportSize;
+// Slice of a depth: log(depth) * uClusterDepthScale + uClusterDepthBias
+uniform float uClusterDepthScale;
+uniform float uClusterDepthBias;
+
+// BASE COLOR
+uniform sampler2D uBaseColorTexture;
+uniform vec4 uBaseColorFactor;
+// Fragments with a lower alpha are discarded (MASK materials only)
+uniform float uAlphaCutoff;
+
+// METALLIC ROUGHNESS
+uniform float uMetallicFactor;
+uniform float uRoughnessFactor;
+uniform sampler2D uMetallicRoughnessTexture;
+
+// EMISSIVE
+uniform sampler2D uEmissiveTexture;
+uniform vec3 uEmissiveFactor;
+
+// OCCLUSION
+uniform sampler2D uOcclusionTexture;
+uniform float uOcclusionStrength;
+
+//********** OUTPUTS ***********
+out vec4 fColor; // Alpha is only used by blended materials
+
+// Constants
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+const float M_PI = 3.141592653589793;
+const float M_1_PI = 1.0 / M_PI;
+const vec3 dielectricSpecular = vec3(0.04, 0.04, 0.04);
+const vec3 black = vec3(0, 0, 0);
+
+// We need some simple tone mapping functions
+// Basic gamma = 2.2 implementation
+// Stolen here: https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/tonemapping.glsl
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color)
+{
+    return pow(color, vec3(INV_GAMMA));
+}
+
+// sRGB to linear approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec4 SRGBtoLINEAR(vec4 srgbIn)
+{
+    return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+}
+
+// Fraction of the directional light reaching the fragment, from the first
+// cascade that contains it, filtered by 4 bilinear comparisons (PCF)
+float computeShadow(vec3 N)
+{
+    for (int i = 0; i < uShadowCascadeCount; ++i) {
+        vec3 position = vViewSpacePosition + N * uShadowNormalOffsets[i];
+        vec3 coords = (uShadowMatrices[i] * vec4(position, 1)).xyz;
+        if (any(lessThan(coords, vec3(0))) || any(greaterThan(coords, vec3(1)))) {
+            continue;
+        }
+        vec2 texelSize = 1.0 / vec2(textureSize(uShadowMaps, 0).xy);
+        float lit = 0;
+        for (int y = -1; y <= 1; y += 2) {
+            for (int x = -1; x <= 1; x += 2) {
+                lit += texture(uShadowMaps, vec4(coords.xy + vec2(x, y) * texelSize, i, coords.z));
+            }
+        }
+        return 0.25 * lit;
+    }
+    return 1.0;
+}
+
+// Irradiance divided by pi around the world space normal n
+vec3 computeIrradiance(vec3 n)
+{
+    return uIrradianceSH[0] * 0.282095
+        + uIrradianceSH[1] * (0.488603 * n.y)
+        + uIrradianceSH[2] * (0.488603 * n.z)
+        + uIrradianceSH[3] * (0.488603 * n.x)
+        + uIrradianceSH[4] * (1.092548 * n.x * n.y)
+        + uIrradianceSH[5] * (1.092548 * n.y * n.z)
+        + uIrradianceSH[6] * (0.315392 * (3.0 * n.z * n.z - 1.0))
+        + uIrradianceSH[7] * (1.092548 * n.x * n.z)
+        + uIrradianceSH[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+}
+
+// Radiance of the environment reflected towards V: the irradiance for the
+// diffuse lobe, the prefiltered environment and the split sum for the
+// specular lobe
+vec3 shadeEnvironment(vec3 c_diffuse, vec3 F_O, float roughness, vec3 N, vec3 V)
+{
+    float NdotV = clamp(dot(N, V), 0, 1);
+    vec3 R = uViewToWorld * reflect(-V, N);
+    vec3 specular = textureLod(uSpecularEnvironment, R, roughness * uSpecularMaxLevel).rgb;
+    vec2 brdf = texture(uBrdfLut, vec2(NdotV, roughness)).rg;
+    vec3 irradiance = max(computeIrradiance(uViewToWorld * N), black);
+    return uEnvironmentIntensity * (c_diffuse * irradiance + specular * (F_O * brdf.x + brdf.y));
+}
+
+// Material inputs of the BRDF
+struct Surface
+{
+    vec3 c_diffuse;
+    vec3 F_O;
+    float alpha;
+};
+
+// Radiance reflected towards V of the light coming from L with the given
+// intensity
+vec3 shade(Surface surface, vec3 N, vec3 V, vec3 L, vec3 intensity)
+{
+    vec3 c_diffuse = surface.c_diffuse;
+    vec3 F_O = surface.F_O;
+    float alpha = surface.alpha;
+    vec3 H = normalize(L + V);
+
+    float NdotL = clamp(dot(N, L), 0, 1);
+    float NdotV = clamp(dot(N, V), 0, 1);
+    float NdotH = clamp(dot(N, H), 0, 1);
+    float VdotH = clamp(dot(V, H), 0, 1);
+
+
+    float NdotLpow2 = NdotL * NdotL;
+    float NdotVpow2 = NdotV * NdotV;
+    float NdotHpow2 = NdotH * NdotH;
+
+    float baseShlickFactor = (1 - VdotH);
+    float shlickFactor = baseShlickFactor * baseShlickFactor;
+    shlickFactor *= shlickFactor;
+    shlickFactor *= baseShlickFactor;
+    vec3 F = F_O + (1 - F_O) * shlickFactor;
+
+    float alphaPow2 = alpha * alpha;
+    float VisDenominator = NdotL * sqrt(NdotVpow2 * (1 - alphaPow2) + alphaPow2) + NdotV * sqrt(NdotLpow2 * (1 - alphaPow2) + alphaPow2);
+    float Vis = 0;
+    if (VisDenominator > 0) {
+        Vis = 0.5 / VisDenominator;
+    }
+
+    float DDenominator = M_PI * (NdotHpow2 * (alphaPow2 - 1) + 1) * (NdotHpow2 * (alphaPow2 - 1) + 1);
+    float D = 0;
+    if (DDenominator > 0) {
+        D = alphaPow2 / DDenominator;
+    }
+
+    vec3 diffuse = c_diffuse / M_PI;
+
+    vec3 f_diffuse = (1 - F) * diffuse;
+    vec3 f_specular = F * Vis * D;
+
+    return (f_diffuse + f_specular) * intensity * NdotL;
+}
+
+// Radiance reflected towards V by a punctual light
+vec3 shadeLight(Light light, Surface surface, vec3 N, vec3 V)
+{
+    if (light.type == LIGHT_DIRECTIONAL) {
+        return shade(surface, N, V, -light.direction, light.color);
+    }
+    vec3 toLight = light.position - vViewSpacePosition;
+    float lightDistance = length(toLight);
+    vec3 L = toLight / lightDistance;
+    // Inverse square falloff, smoothly cut off at the range (glTF spec)
+    float rangeRatio = lightDistance / light.range;
+    float rangeRatioPow4 = rangeRatio * rangeRatio * rangeRatio * rangeRatio;
+    float attenuation = clamp(1 - rangeRatioPow4, 0, 1) / max(lightDistance * lightDistance, 1e-4);
+    if (light.type == LIGHT_SPOT) {
+        float spot = clamp(dot(light.direction, -L) * light.spotScale + light.spotOffset, 0, 1);
+        attenuation *= spot * spot;
+    }
+    return shade(surface, N, V, L, light.color * attenuation);
+}
+
+void main()
+{
+
+    vec3 N = normalize(vViewSpaceNormal);
+    vec3 V = normalize(-vViewSpacePosition);
+
+    vec4 baseColorVectorFromTexture = SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
+    vec4 computedBaseColorVector = baseColorVectorFromTexture * uBaseColorFactor;
+    if (computedBaseColorVector.a < uAlphaCutoff) {
+        discard;
+    }
+
+    vec4 metallicRoughnessVectorFromTexture = texture(uMetallicRoughnessTexture, vTexCoords);
+    float computedMetallicValue = uMetallicFactor * metallicRoughnessVectorFromTexture.b;
+    float computedRoughnessValue = uRoughnessFactor * metallicRoughnessVectorFromTexture.g;
+
+    vec4 baseEmissiveVectorFromTexture = SRGBtoLINEAR(texture(uEmissiveTexture, vTexCoords));
+    vec4 computedEmissiveVector = baseEmissiveVectorFromTexture * vec4(uEmissiveFactor, 0);
+
+    vec4 baseOcclusionVectorFromTexture = texture(uOcclusionTexture, vTexCoords);
+
+    Surface surface;
+    surface.c_diffuse = mix(computedBaseColorVector.rgb * (1 - dielectricSpecular.r), black, computedMetallicValue);
+    surface.F_O = mix(dielectricSpecular, computedBaseColorVector.rgb, computedMetallicValue);
+    surface.alpha = computedRoughnessValue * computedRoughnessValue;
+
+    vec3 color = shade(surface, N, V, uLightDirection, uLightIntensity * computeShadow(N));
+    for (uint lightIdx = 0u; lightIdx < uDirectionalLightCount; ++lightIdx) {
+        color += shadeLight(lights[lightIdx], surface, N, V);
+    }
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / uViewportSize * vec2(uClusterGridSize.xy)), ivec2(0), uClusterGridSize.xy - 1);
+    int slice = clamp(int(floor(log(-vViewSpacePosition.z) * uClusterDepthScale + uClusterDepthBias)), 0, uClusterGridSize.z - 1);
+    uvec2 cluster = clusterRanges[(slice * uClusterGridSize.y + tile.y) * uClusterGridSize.x + tile.x];
+    for (uint i = 0u; i < cluster.y; ++i) {
+        color += shadeLight(lights[lightIndices[cluster.x + i]], surface, N, V);
+    }
+
+    if (uEnvironmentIntensity > 0) {
+        color += shadeEnvironment(surface.c_diffuse, surface.F_O, computedRoughnessValue, N, V);
+    }
+    color += vec3(computedEmissiveVector);
+    color = mix(color, color * baseOcclusionVectorFromTexture.r, uOcclusionStrength);
+    fColor = vec4(LINEARtoSRGB(color), computedBaseColorVector.a);
+}
@@ -9,9 +9,32 @@ in vec2 vTexCoords;
 uniform vec3 uLightDirection;
 uniform vec3 uLightIntensity;
 
+// CASCADED SHADOW MAPS of the directional light (see ShadowMaps)
+uniform sampler2DArrayShadow uShadowMaps;
+uniform int uShadowCascadeCount; // 0 without shadows
+// View space to the texture space of each cascade, depth in z
+uniform mat4 uShadowMatrices[4];
+// Receivers are moved along their normal by about a texel of the cascade
+// before the lookup, against shadow acne
+uniform float uShadowNormalOffsets[4];
+
+// IMAGE BASED LIGHTING from an environment map (see EnvironmentLighting)
+uniform float uEnvironmentIntensity; // 0 without environment
+// Irradiance divided by pi on the 9 first spherical harmonics
+uniform vec3 uIrradianceSH[9];
+// Environment prefiltered for roughness i / uSpecularMaxLevel on level i
+uniform samplerCube uSpecularEnvironment;
+uniform float uSpecularMaxLevel;
+// Split sum scale and bias of F0, NdotV along x, roughness along y
+uniform sampler2D uBrdfLut;
+// The environment is in world space
+uniform mat3 uViewToWorld;
+
 // BASE COLOR
 uniform sampler2D uBaseColorTexture;
 uniform vec4 uBaseColorFactor;
+// Fragments with a lower alpha are discarded (MASK materials only)
+uniform float uAlphaCutoff;
 
 // METALLIC ROUGHNESS
 uniform float uMetallicFactor;
@@ -27,7 +50,7 @@ uniform sampler2D uOcclusionTexture;
 uniform float uOcclusionStrength;
 
 //********** OUTPUTS ***********
-out vec3 fColor;
+out vec4 fColor; // Alpha is only used by blended materials
 
 // Constants
 const float GAMMA = 2.2;
@@ -55,6 +78,55 @@ vec4 SRGBtoLINEAR(vec4 srgbIn)
     return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
 }
 
+// Fraction of the directional light reaching the fragment, from the first
+// cascade that contains it, filtered by 4 bilinear comparisons (PCF)
+float computeShadow(vec3 N)
+{
+    for (int i = 0; i < uShadowCascadeCount; ++i) {
+        vec3 position = vViewSpacePosition + N * uShadowNormalOffsets[i];
+        vec3 coords = (uShadowMatrices[i] * vec4(position, 1)).xyz;
+        if (any(lessThan(coords, vec3(0))) || any(greaterThan(coords, vec3(1)))) {
+            continue;
+        }
+        vec2 texelSize = 1.0 / vec2(textureSize(uShadowMaps, 0).xy);
+        float lit = 0;
+        for (int y = -1; y <= 1; y += 2) {
+            for (int x = -1; x <= 1; x += 2) {
+                lit += texture(uShadowMaps, vec4(coords.xy + vec2(x, y) * texelSize, i, coords.z));
+            }
+        }
+        return 0.25 * lit;
+    }
+    return 1.0;
+}
+
+// Irradiance divided by pi around the world space normal n
+vec3 computeIrradiance(vec3 n)
+{
+    return uIrradianceSH[0] * 0.282095
+        + uIrradianceSH[1] * (0.488603 * n.y)
+        + uIrradianceSH[2] * (0.488603 * n.z)
+        + uIrradianceSH[3] * (0.488603 * n.x)
+        + uIrradianceSH[4] * (1.092548 * n.x * n.y)
+        + uIrradianceSH[5] * (1.092548 * n.y * n.z)
+        + uIrradianceSH[6] * (0.315392 * (3.0 * n.z * n.z - 1.0))
+        + uIrradianceSH[7] * (1.092548 * n.x * n.z)
+        + uIrradianceSH[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+}
+
+// Radiance of the environment reflected towards V: the irradiance for the
+// diffuse lobe, the prefiltered environment and the split sum for the
+// specular lobe
+vec3 shadeEnvironment(vec3 c_diffuse, vec3 F_O, float roughness, vec3 N, vec3 V)
+{
+    float NdotV = clamp(dot(N, V), 0, 1);
+    vec3 R = uViewToWorld * reflect(-V, N);
+    vec3 specular = textureLod(uSpecularEnvironment, R, roughness * uSpecularMaxLevel).rgb;
+    vec2 brdf = texture(uBrdfLut, vec2(NdotV, roughness)).rg;
+    vec3 irradiance = max(computeIrradiance(uViewToWorld * N), black);
+    return uEnvironmentIntensity * (c_diffuse * irradiance + specular * (F_O * brdf.x + brdf.y));
+}
+
 void main()
 {
 
@@ -65,6 +137,9 @@ void main()
 
     vec4 baseColorVectorFromTexture = SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
     vec4 computedBaseColorVector = baseColorVectorFromTexture * uBaseColorFactor;
+    if (computedBaseColorVector.a < uAlphaCutoff) {
+        discard;
+    }
 
     vec4 metallicRoughnessVectorFromTexture = texture(uMetallicRoughnessTexture, vTexCoords);
     float computedMetallicValue = uMetallicFactor * metallicRoughnessVectorFromTexture.b;
@@ -113,7 +188,10 @@ void main()
     vec3 f_diffuse = (1 - F) * diffuse;
     vec3 f_specular = F * Vis * D;
 
-    fColor = (f_diffuse + f_specular) * uLightIntensity * NdotL + vec3(computedEmissiveVector);
-    fColor = mix(fColor, fColor * baseOcclusionVectorFromTexture.r, uOcclusionStrength);
-    fColor = LINEARtoSRGB(fColor);
+    vec3 color = (f_diffuse + f_specular) * uLightIntensity * computeShadow(N) * NdotL + vec3(computedEmissiveVector);
+    if (uEnvironmentIntensity > 0) {
+        color += shadeEnvironment(c_diffuse, F_O, computedRoughnessValue, N, V);
+    }
+    color = mix(color, color * baseOcclusionVectorFromTexture.r, uOcclusionStrength);
+    fColor = vec4(LINEARtoSRGB(color), computedBaseColorVector.a);
 }
\ No newline at end of file
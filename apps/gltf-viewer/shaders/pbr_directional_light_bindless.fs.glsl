@@ -0,0 +1,145 @@
+#version 430
+#extension GL_ARB_bindless_texture : require
+// pbr_directional_light.fs.glsl with the materials read from a storage buffer
+// holding the handles of resident textures (ARB_bindless_texture): a material
+// change sets uMaterialIndex instead of binding four textures.
+
+// INPUTS
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+
+//********** UNIFORMS ************
+// LIGHT
+uniform vec3 uLightDirection;
+uniform vec3 uLightIntensity;
+
+// MATERIAL
+uniform uint uMaterialIndex;
+// Multiplies the base color factor of the material, white unless overridden
+// (proxies of streamed cells and HLOD clusters)
+uniform vec4 uBaseColorFactor;
+
+// Must match BindlessMaterial (std430)
+struct Material
+{
+    vec4 baseColorFactor;
+    vec4 emissiveFactor;
+    float metallicFactor;
+    float roughnessFactor;
+    float occlusionStrength;
+    float alphaCutoff;
+    uvec2 baseColorTexture; // 0 for no texture
+    uvec2 metallicRoughnessTexture;
+    uvec2 emissiveTexture;
+    uvec2 occlusionTexture;
+};
+
+layout(std430, binding = 3) readonly buffer Materials
+{
+    Material uMaterials[];
+};
+
+//********** OUTPUTS ***********
+out vec4 fColor; // Alpha is only used by blended materials
+
+// Constants
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+const float M_PI = 3.141592653589793;
+const float M_1_PI = 1.0 / M_PI;
+const vec3 dielectricSpecular = vec3(0.04, 0.04, 0.04);
+const vec3 black = vec3(0, 0, 0);
+
+// We need some simple tone mapping functions
+// Basic gamma = 2.2 implementation
+// Stolen here: https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/tonemapping.glsl
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color)
+{
+    return pow(color, vec3(INV_GAMMA));
+}
+
+// sRGB to linear approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec4 SRGBtoLINEAR(vec4 srgbIn)
+{
+    return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+}
+
+vec4 sampleTexture(uvec2 handle, vec2 uv)
+{
+    if (handle == uvec2(0)) {
+        return vec4(1);
+    }
+    return texture(sampler2D(handle), uv);
+}
+
+void main()
+{
+    Material material = uMaterials[uMaterialIndex];
+
+    vec3 N = normalize(vViewSpaceNormal);
+    vec3 L = uLightDirection;
+    vec3 V = normalize(-vViewSpacePosition);
+    vec3 H = normalize(L + V);
+
+    vec4 baseColorVectorFromTexture = SRGBtoLINEAR(sampleTexture(material.baseColorTexture, vTexCoords));
+    vec4 computedBaseColorVector = baseColorVectorFromTexture * material.baseColorFactor * uBaseColorFactor;
+    if (computedBaseColorVector.a < material.alphaCutoff) {
+        discard;
+    }
+
+    vec4 metallicRoughnessVectorFromTexture = sampleTexture(material.metallicRoughnessTexture, vTexCoords);
+    float computedMetallicValue = material.metallicFactor * metallicRoughnessVectorFromTexture.b;
+    float computedRoughnessValue = material.roughnessFactor * metallicRoughnessVectorFromTexture.g;
+
+    vec4 baseEmissiveVectorFromTexture = SRGBtoLINEAR(sampleTexture(material.emissiveTexture, vTexCoords));
+    vec4 computedEmissiveVector = baseEmissiveVectorFromTexture * vec4(material.emissiveFactor.rgb, 0);
+
+    vec4 baseOcclusionVectorFromTexture = sampleTexture(material.occlusionTexture, vTexCoords);
+
+    vec3 c_diffuse = mix(computedBaseColorVector.rgb * (1 - dielectricSpecular.r), black, computedMetallicValue);
+    vec3 F_O = mix(dielectricSpecular, computedBaseColorVector.rgb, computedMetallicValue);
+    float alpha = computedRoughnessValue * computedRoughnessValue;
+
+    float NdotL = clamp(dot(N, L), 0, 1);
+    float NdotV = clamp(dot(N, V), 0, 1);
+    float NdotH = clamp(dot(N, H), 0, 1);
+    float VdotH = clamp(dot(V, H), 0, 1);
+
+
+    float NdotLpow2 = NdotL * NdotL;
+    float NdotVpow2 = NdotV * NdotV;
+    float NdotHpow2 = NdotH * NdotH;
+
+    float baseShlickFactor = (1 - VdotH);
+    float shlickFactor = baseShlickFactor * baseShlickFactor;
+    shlickFactor *= shlickFactor;
+    shlickFactor *= baseShlickFactor;
+    vec3 F = F_O + (1 - F_O) * shlickFactor;
+
+    float alphaPow2 = alpha * alpha;
+    float VisDenominator = NdotL * sqrt(NdotVpow2 * (1 - alphaPow2) + alphaPow2) + NdotV * sqrt(NdotLpow2 * (1 - alphaPow2) + alphaPow2);
+    float Vis = 0;
+    if (VisDenominator > 0) {
+        Vis = 0.5 / VisDenominator;
+    }
+
+    float DDenominator = M_PI * (NdotHpow2 * (alphaPow2 - 1) + 1) * (NdotHpow2 * (alphaPow2 - 1) + 1);
+    float D = 0;
+    if (DDenominator > 0) {
+        D = alphaPow2 / DDenominator;
+    }
+
+    vec3 diffuse = c_diffuse / M_PI;
+
+    vec3 f_diffuse = (1 - F) * diffuse;
+    vec3 f_specular = F * Vis * D;
+
+    vec3 color = (f_diffuse + f_specular) * uLightIntensity * NdotL + vec3(computedEmissiveVector);
+    color = mix(color, color * baseOcclusionVectorFromTexture.r, material.occlusionStrength);
+    fColor = vec4(LINEARtoSRGB(color), computedBaseColorVector.a);
+}
\ No newline at end of file
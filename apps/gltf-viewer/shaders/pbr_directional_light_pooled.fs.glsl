@@ -0,0 +1,182 @@
+#version 430
+// pbr_directional_light.fs.glsl with the materials read from a storage buffer
+// and the textures from texture pools (GL_TEXTURE_2D_ARRAY), so that draws
+// with different materials need no texture binding, see TexturePools.
+
+// INPUTS
+in vec3 vViewSpacePosition;
+in vec3 vViewSpaceNormal;
+in vec2 vTexCoords;
+flat in uint vMaterialIndex;
+
+//********** UNIFORMS ************
+// LIGHT
+uniform vec3 uLightDirection;
+uniform vec3 uLightIntensity;
+
+// TEXTURE POOLS, bound to the texture units 0 to POOL_COUNT - 1
+const int POOL_COUNT = 12;
+uniform sampler2DArray uTexturePools[POOL_COUNT];
+
+// Must match PooledTextureRef and PooledMaterial (std430)
+struct TextureRef
+{
+    int pool; // -1 for no texture
+    float layer;
+    uint isAtlased;
+    uint padding;
+    vec4 scaleOffset; // Atlases: fract(uv) * scale + offset
+};
+
+struct Material
+{
+    vec4 baseColorFactor;
+    vec4 emissiveFactor;
+    float metallicFactor;
+    float roughnessFactor;
+    float occlusionStrength;
+    float alphaCutoff;
+    TextureRef baseColorTexture;
+    TextureRef metallicRoughnessTexture;
+    TextureRef emissiveTexture;
+    TextureRef occlusionTexture;
+};
+
+layout(std430, binding = 3) readonly buffer Materials
+{
+    Material uMaterials[];
+};
+
+//********** OUTPUTS ***********
+out vec4 fColor; // Alpha is only used by blended materials
+
+// Constants
+const float GAMMA = 2.2;
+const float INV_GAMMA = 1. / GAMMA;
+const float M_PI = 3.141592653589793;
+const float M_1_PI = 1.0 / M_PI;
+const vec3 dielectricSpecular = vec3(0.04, 0.04, 0.04);
+const vec3 black = vec3(0, 0, 0);
+
+// We need some simple tone mapping functions
+// Basic gamma = 2.2 implementation
+// Stolen here: https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/tonemapping.glsl
+
+// linear to sRGB approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec3 LINEARtoSRGB(vec3 color)
+{
+    return pow(color, vec3(INV_GAMMA));
+}
+
+// sRGB to linear approximation
+// see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+vec4 SRGBtoLINEAR(vec4 srgbIn)
+{
+    return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+}
+
+// The pool index is not dynamically uniform (draws of a multi-draw call have
+// different materials): each pool is sampled with a constant index
+vec4 samplePool(int pool, vec3 coords, vec2 dx, vec2 dy)
+{
+    switch (pool) {
+    case 0: return textureGrad(uTexturePools[0], coords, dx, dy);
+    case 1: return textureGrad(uTexturePools[1], coords, dx, dy);
+    case 2: return textureGrad(uTexturePools[2], coords, dx, dy);
+    case 3: return textureGrad(uTexturePools[3], coords, dx, dy);
+    case 4: return textureGrad(uTexturePools[4], coords, dx, dy);
+    case 5: return textureGrad(uTexturePools[5], coords, dx, dy);
+    case 6: return textureGrad(uTexturePools[6], coords, dx, dy);
+    case 7: return textureGrad(uTexturePools[7], coords, dx, dy);
+    case 8: return textureGrad(uTexturePools[8], coords, dx, dy);
+    case 9: return textureGrad(uTexturePools[9], coords, dx, dy);
+    case 10: return textureGrad(uTexturePools[10], coords, dx, dy);
+    case 11: return textureGrad(uTexturePools[11], coords, dx, dy);
+    }
+    return vec4(1);
+}
+
+// Gradients are taken before wrapping, so that the mipmap level does not jump
+// on the seams of atlased textures
+vec4 sampleTexture(TextureRef ref, vec2 uv)
+{
+    vec2 dx = dFdx(uv);
+    vec2 dy = dFdy(uv);
+    if (ref.pool < 0) {
+        return vec4(1);
+    }
+    if (ref.isAtlased != 0u) {
+        uv = fract(uv) * ref.scaleOffset.xy + ref.scaleOffset.zw;
+        dx *= ref.scaleOffset.xy;
+        dy *= ref.scaleOffset.xy;
+    }
+    return samplePool(ref.pool, vec3(uv, ref.layer), dx, dy);
+}
+
+void main()
+{
+    Material material = uMaterials[vMaterialIndex];
+
+    vec3 N = normalize(vViewSpaceNormal);
+    vec3 L = uLightDirection;
+    vec3 V = normalize(-vViewSpacePosition);
+    vec3 H = normalize(L + V);
+
+    vec4 baseColorVectorFromTexture = SRGBtoLINEAR(sampleTexture(material.baseColorTexture, vTexCoords));
+    vec4 computedBaseColorVector = baseColorVectorFromTexture * material.baseColorFactor;
+    if (computedBaseColorVector.a < material.alphaCutoff) {
+        discard;
+    }
+
+    vec4 metallicRoughnessVectorFromTexture = sampleTexture(material.metallicRoughnessTexture, vTexCoords);
+    float computedMetallicValue = material.metallicFactor * metallicRoughnessVectorFromTexture.b;
+    float computedRoughnessValue = material.roughnessFactor * metallicRoughnessVectorFromTexture.g;
+
+    vec4 baseEmissiveVectorFromTexture = SRGBtoLINEAR(sampleTexture(material.emissiveTexture, vTexCoords));
+    vec4 computedEmissiveVector = baseEmissiveVectorFromTexture * vec4(material.emissiveFactor.rgb, 0);
+
+    vec4 baseOcclusionVectorFromTexture = sampleTexture(material.occlusionTexture, vTexCoords);
+
+    vec3 c_diffuse = mix(computedBaseColorVector.rgb * (1 - dielectricSpecular.r), black, computedMetallicValue);
+    vec3 F_O = mix(dielectricSpecular, computedBaseColorVector.rgb, computedMetallicValue);
+    float alpha = computedRoughnessValue * computedRoughnessValue;
+
+    float NdotL = clamp(dot(N, L), 0, 1);
+    float NdotV = clamp(dot(N, V), 0, 1);
+    float NdotH = clamp(dot(N, H), 0, 1);
+    float VdotH = clamp(dot(V, H), 0, 1);
+
+
+    float NdotLpow2 = NdotL * NdotL;
+    float NdotVpow2 = NdotV * NdotV;
+    float NdotHpow2 = NdotH * NdotH;
+
+    float baseShlickFactor = (1 - VdotH);
+    float shlickFactor = baseShlickFactor * baseShlickFactor;
+    shlickFactor *= shlickFactor;
+    shlickFactor *= baseShlickFactor;
+    vec3 F = F_O + (1 - F_O) * shlickFactor;
+
+    float alphaPow2 = alpha * alpha;
+    float VisDenominator = NdotL * sqrt(NdotVpow2 * (1 - alphaPow2) + alphaPow2) + NdotV * sqrt(NdotLpow2 * (1 - alphaPow2) + alphaPow2);
+    float Vis = 0;
+    if (VisDenominator > 0) {
+        Vis = 0.5 / VisDenominator;
+    }
+
+    float DDenominator = M_PI * (NdotHpow2 * (alphaPow2 - 1) + 1) * (NdotHpow2 * (alphaPow2 - 1) + 1);
+    float D = 0;
+    if (DDenominator > 0) {
+        D = alphaPow2 / DDenominator;
+    }
+
+    vec3 diffuse = c_diffuse / M_PI;
+
+    vec3 f_diffuse = (1 - F) * diffuse;
+    vec3 f_specular = F * Vis * D;
+
+    vec3 color = (f_diffuse + f_specular) * uLightIntensity * NdotL + vec3(computedEmissiveVector);
+    color = mix(color, color * baseOcclusionVectorFromTexture.r, material.occlusionStrength);
+    fColor = vec4(LINEARtoSRGB(color), computedBaseColorVector.a);
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#version 330
+// Shadow pass with forward.vs.glsl: only the depth of the casters is written
+// to the shadow map bound as the depth attachment.
+
+void main()
+{
+}
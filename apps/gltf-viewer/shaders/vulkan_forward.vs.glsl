@@ -0,0 +1,62 @@
+#version 450
+// forward.vs.glsl for the Vulkan renderer (see VulkanRenderer): the transforms
+// of the nodes are read from a storage buffer, at the index pushed with each
+// draw. Attributes missing from a primitive, and the instance attributes of
+// non instanced draws, are read from a buffer of default values.
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+// EXT_mesh_gpu_instancing attributes, per instance
+layout(location = 3) in vec3 aInstanceTranslation;
+layout(location = 4) in vec4 aInstanceRotation; // quaternion x, y, z, w
+layout(location = 5) in vec3 aInstanceScale;
+
+layout(location = 0) out vec3 vViewSpacePosition;
+layout(location = 1) out vec3 vViewSpaceNormal;
+layout(location = 2) out vec2 vTexCoords;
+
+// Must match DrawTransforms
+struct Transforms
+{
+    mat4 modelViewProjMatrix;
+    mat4 modelViewMatrix;
+    mat4 normalMatrix;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer NodeTransforms
+{
+    Transforms uTransforms[];
+};
+
+// Must match VulkanDrawConstants
+layout(push_constant) uniform DrawConstants
+{
+    vec4 uLightDirection; // View space
+    vec4 uLightIntensity;
+    uint uTransformsIndex;
+    uint uMaterialIndex;
+};
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    Transforms transforms = uTransforms[uTransformsIndex];
+
+    // Instance transform is translation * rotation * scale, applied before
+    // the node transform
+    vec3 position = aInstanceTranslation + rotate(aInstanceRotation, aInstanceScale * aPosition);
+    vec3 normal = rotate(aInstanceRotation, aNormal / aInstanceScale);
+
+    vViewSpacePosition = vec3(transforms.modelViewMatrix * vec4(position, 1));
+    vViewSpaceNormal = normalize(vec3(transforms.normalMatrix * vec4(normal, 0)));
+    vTexCoords = aTexCoords;
+    gl_Position = transforms.modelViewProjMatrix * vec4(position, 1);
+    // Required by point lists, 1 like the OpenGL default
+    gl_PointSize = 1.0;
+}
@@ -1,4 +1,9 @@
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
+// stb_image uses SSE2 for JPEG IDCT and color conversion on x86 by default,
+// NEON has to be requested explicitly
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define STBI_NEON
+#endif
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <tiny_gltf.h>
\ No newline at end of file
@@ -8,8 +8,10 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 // Class responsible for initializing GLFW, creating a window, initializing
 // OpenGL function pointers with GLAD library and initializing ImGUI
@@ -104,6 +106,66 @@ inline void imguiRenderFrame()
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// Copy of the draw data of an ImGui frame, to render it on another thread
+// than the one building the GUI (ImGui::Render() only builds the draw data,
+// the OpenGL back-end does not use the ImGui context to render it). The draw
+// lists are reused from one copy to the next.
+class ImGuiDrawDataCopy
+{
+public:
+  ImGuiDrawDataCopy() = default;
+  ImGuiDrawDataCopy(const ImGuiDrawDataCopy &) = delete;
+  ImGuiDrawDataCopy &operator=(const ImGuiDrawDataCopy &) = delete;
+
+  ~ImGuiDrawDataCopy()
+  {
+    for (auto *drawList : m_drawLists) {
+      IM_DELETE(drawList);
+    }
+  }
+
+  // Must be called on the thread building the GUI: ImGui allocations are not
+  // thread safe
+  void copy(const ImDrawData &drawData)
+  {
+    while (int(m_drawLists.size()) < drawData.CmdListsCount) {
+      m_drawLists.push_back(
+          IM_NEW(ImDrawList)(ImGui::GetDrawListSharedData()));
+    }
+    for (int listIdx = 0; listIdx < drawData.CmdListsCount; ++listIdx) {
+      const auto &source = *drawData.CmdLists[listIdx];
+      auto &destination = *m_drawLists[listIdx];
+      copyVector(source.CmdBuffer, destination.CmdBuffer);
+      copyVector(source.IdxBuffer, destination.IdxBuffer);
+      copyVector(source.VtxBuffer, destination.VtxBuffer);
+      destination.Flags = source.Flags;
+    }
+    m_drawData = drawData;
+    m_drawData.CmdLists = m_drawLists.data();
+  }
+
+  void render()
+  {
+    if (m_drawData.Valid) {
+      ImGui_ImplOpenGL3_RenderDrawData(&m_drawData);
+    }
+  }
+
+private:
+  // Unlike ImVector::operator=, keeps the capacity of destination
+  template <typename T>
+  static void copyVector(const ImVector<T> &source, ImVector<T> &destination)
+  {
+    destination.resize(source.Size);
+    if (source.Size) {
+      memcpy(destination.Data, source.Data, source.size_in_bytes());
+    }
+  }
+
+  ImDrawData m_drawData;
+  std::vector<ImDrawList *> m_drawLists;
+};
+
 inline void printGLVersion()
 {
   GLint glVersion[2];
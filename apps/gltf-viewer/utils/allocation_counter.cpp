@@ -0,0 +1,110 @@
+#include "allocation_counter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+std::atomic<size_t> allocationCount{0};
+
+void *countedAllocate(size_t byteCount)
+{
+  ++allocationCount;
+  for (;;) {
+    if (auto *pointer = std::malloc(byteCount ? byteCount : 1)) {
+      return pointer;
+    }
+    const auto handler = std::get_new_handler();
+    if (!handler) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+
+void *countedAllocate(size_t byteCount, std::align_val_t alignment)
+{
+  ++allocationCount;
+  const auto alignmentValue = static_cast<size_t>(alignment);
+  // aligned_alloc needs a size multiple of the alignment
+  const auto size = (std::max(byteCount, size_t(1)) + alignmentValue - 1) /
+                    alignmentValue * alignmentValue;
+  for (;;) {
+    if (auto *pointer = std::aligned_alloc(alignmentValue, size)) {
+      return pointer;
+    }
+    const auto handler = std::get_new_handler();
+    if (!handler) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+
+} // namespace
+
+size_t heapAllocationCount() { return allocationCount.load(); }
+
+void *operator new(size_t byteCount)
+{
+  if (auto *pointer = countedAllocate(byteCount)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t byteCount)
+{
+  return operator new(byteCount);
+}
+
+void *operator new(size_t byteCount, const std::nothrow_t &) noexcept
+{
+  return countedAllocate(byteCount);
+}
+
+void *operator new[](size_t byteCount, const std::nothrow_t &) noexcept
+{
+  return countedAllocate(byteCount);
+}
+
+void *operator new(size_t byteCount, std::align_val_t alignment)
+{
+  if (auto *pointer = countedAllocate(byteCount, alignment)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t byteCount, std::align_val_t alignment)
+{
+  return operator new(byteCount, alignment);
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+void operator delete[](void *pointer) noexcept { std::free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept
+{
+  std::free(pointer);
+}
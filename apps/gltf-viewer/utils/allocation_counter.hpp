@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+
+// Number of heap allocations made through operator new by all the threads
+// since the start of the program. The global operator new is replaced to
+// count them: the difference between two calls tells whether the code in
+// between allocated (steady state frames must not).
+size_t heapAllocationCount();
@@ -0,0 +1,103 @@
+#include "asset_cache.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <string_view>
+
+GltfAsset::~GltfAsset()
+{
+  if (!vertexArrayObjects.empty()) {
+    // Names shared by several elements are deleted once: deleting a name
+    // that is no longer in use is ignored
+    glDeleteVertexArrays(
+        GLsizei(vertexArrayObjects.size()), vertexArrayObjects.data());
+  }
+  // Handles must not be resident when their texture is deleted
+  for (const auto handle : textureHandles) {
+    getBindlessTextureApi()->makeTextureHandleNonResident(handle);
+  }
+  if (bindlessMaterialBuffer) {
+    glDeleteBuffers(1, &bindlessMaterialBuffer);
+  }
+  if (!textureObjects.empty()) {
+    glDeleteTextures(GLsizei(textureObjects.size()), textureObjects.data());
+  }
+  if (!bufferObjects.empty()) {
+    glDeleteBuffers(GLsizei(bufferObjects.size()), bufferObjects.data());
+  }
+  for (const auto allocation : bufferAllocations) {
+    bufferPool->free(allocation);
+  }
+  if (staticBatchVertexArrayObject) {
+    glDeleteVertexArrays(1, &staticBatchVertexArrayObject);
+    glDeleteBuffers(2, staticBatchBufferObjects);
+  }
+  if (hlodVertexArrayObject) {
+    glDeleteVertexArrays(1, &hlodVertexArrayObject);
+    glDeleteBuffers(2, hlodBufferObjects);
+  }
+  if (pullingBuffer) {
+    glDeleteBuffers(1, &pullingBuffer);
+  }
+  if (!texturePoolObjects.empty()) {
+    glDeleteTextures(
+        GLsizei(texturePoolObjects.size()), texturePoolObjects.data());
+  }
+  if (materialBuffer) {
+    glDeleteBuffers(1, &materialBuffer);
+  }
+}
+
+std::shared_ptr<GltfAsset> AssetCache::acquire(
+    const fs::path &path, std::string &error)
+{
+  std::ifstream file(path.string(), std::ios::binary);
+  if (!file) {
+    error = "Unable to open " + path.string();
+    return nullptr;
+  }
+  const std::string content{std::istreambuf_iterator<char>(file), {}};
+  const auto contentHash = std::hash<std::string_view>{}(content);
+
+  std::error_code ec;
+  auto canonicalPath = fs::canonical(path, ec);
+  if (ec) {
+    canonicalPath = path;
+  }
+  const auto key = canonicalPath.string() + '#' + std::to_string(contentHash);
+
+  // Drop the entries of the assets that have been destroyed
+  for (auto it = begin(m_assets); it != end(m_assets);) {
+    it = (*it).second.expired() ? m_assets.erase(it) : std::next(it);
+  }
+
+  const auto it = m_assets.find(key);
+  if (it != end(m_assets)) {
+    ++m_hitCount;
+    return (*it).second.lock();
+  }
+
+  auto asset = std::make_shared<GltfAsset>();
+  asset->path = path;
+  asset->contentHash = contentHash;
+  if (!m_loader(*asset, error)) {
+    return nullptr;
+  }
+  ++m_loadCount;
+  m_assets.emplace(key, asset);
+  return asset;
+}
+
+AssetCacheStats AssetCache::stats() const
+{
+  AssetCacheStats stats;
+  stats.hitCount = m_hitCount;
+  stats.loadCount = m_loadCount;
+  for (const auto &entry : m_assets) {
+    if (const auto asset = entry.second.lock()) {
+      ++stats.residentAssetCount;
+      stats.gpuByteCount += asset->gpuByteCount;
+    }
+  }
+  return stats;
+}
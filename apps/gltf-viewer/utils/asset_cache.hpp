@@ -0,0 +1,158 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "bindless_textures.hpp"
+#include "geometry_streamer.hpp"
+#include "gltf.hpp"
+#include "gpu_allocator.hpp"
+#include "hlod.hpp"
+#include "static_batching.hpp"
+#include "texture_pools.hpp"
+#include "vertex_pulling.hpp"
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A range of indices in a vector containing Vertex Array Objects
+struct VaoRange
+{
+  GLsizei begin; // Index of first element in vertexArrayObjects
+  GLsizei count; // Number of elements in range
+};
+
+// Vertex and index buffers read by a draw through a VAO shared by all the
+// draws with the same vertex format. Binding point i feeds the vertex
+// attribute at location i, unused bindings have a 0 buffer.
+struct VertexBufferBindings
+{
+  static const int count = 6;
+  GLuint buffers[count] = {};
+  GLintptr offsets[count] = {};
+  GLsizei strides[count] = {};
+  GLuint indexBuffer = 0;
+};
+
+// A glTF file loaded in memory together with the OpenGL objects created from
+// it. The OpenGL objects are deleted with the asset, so the last reference
+// must be released while the GL context is alive.
+struct GltfAsset
+{
+  GltfAsset() = default;
+  GltfAsset(const GltfAsset &) = delete;
+  GltfAsset &operator=(const GltfAsset &) = delete;
+  ~GltfAsset();
+
+  fs::path path;
+  size_t contentHash = 0;
+
+  tinygltf::Model model;
+
+  std::vector<GLuint> bufferObjects;
+  // Set for assets loaded with ViewerOptions::suballocateBuffers, instead of
+  // bufferObjects: the allocation of each glTF buffer in bufferPool
+  GpuMemoryPool *bufferPool = nullptr;
+  std::vector<GpuMemoryPool::AllocationId> bufferAllocations;
+  // Range of each glTF buffer read by the VAOs and draws: a whole buffer of
+  // bufferObjects or an allocation of bufferPool
+  std::vector<GpuBufferRange> bufferRanges;
+  std::vector<GLuint> textureObjects;
+  // One element per primitive (and per primitive of instanced nodes), see
+  // VaoRange. With shared vertex formats several elements name the same VAO
+  // and vertexBufferBindings holds the buffers of each element.
+  std::vector<GLuint> vertexArrayObjects;
+  std::vector<VertexBufferBindings> vertexBufferBindings;
+  std::vector<VaoRange> meshIndexToVaoRange;
+  std::vector<VaoRange> nodeIndexToInstancedVaoRange;
+  std::vector<NodeInstancing> nodeInstancing;
+
+  // Bounds and local to world matrix of each node in the space of the asset
+  // (scene root)
+  std::vector<BoundingBox> nodeBounds;
+  std::vector<glm::mat4> nodeMatrices;
+  // Bounds of each instance of the instanced nodes, in the same space: those
+  // of node i are in [instanceBoundsOffsets[i], instanceBoundsOffsets[i + 1])
+  std::vector<BoundingBox> instanceBounds;
+  std::vector<size_t> instanceBoundsOffsets;
+  // Pass in which the primitives of each material are drawn
+  std::vector<DrawPass> materialPasses;
+
+  // Set for assets loaded with ViewerOptions::staticBatching: merged geometry
+  // of the small static nodes, in one VAO reading CachedVertex
+  StaticBatches staticBatches;
+  GLuint staticBatchVertexArrayObject = 0;
+  GLuint staticBatchBufferObjects[2] = {0, 0}; // Vertices, indices
+
+  // Set for assets loaded with ViewerOptions::buildHlod: clusters of nodes
+  // far enough from the camera are drawn with a single proxy. The proxies of
+  // all clusters share one VAO (position, normal) and its buffers.
+  HlodHierarchy hlod;
+  GLuint hlodVertexArrayObject = 0;
+  GLuint hlodBufferObjects[2] = {0, 0}; // Vertices, indices
+
+  // Set for assets loaded with ViewerOptions::vertexPulling, instead of the
+  // buffer objects and VAOs: all the buffers of the model in one storage
+  // buffer (see PulledGeometryLayout) and one element per primitive with the
+  // same layout as vertexArrayObjects
+  GLuint pullingBuffer = 0;
+  std::vector<PulledPrimitive> pulledPrimitives;
+
+  // Set for assets loaded with ViewerOptions::textureArrays, instead of the
+  // texture objects: one GL_TEXTURE_2D_ARRAY per pool and a storage buffer of
+  // PooledMaterial
+  TexturePools texturePools;
+  std::vector<GLuint> texturePoolObjects;
+  GLuint materialBuffer = 0;
+
+  // Set for assets loaded with ViewerOptions::bindlessTextures: resident
+  // handle of each texture object and a storage buffer of BindlessMaterial
+  std::vector<GLuint64> textureHandles;
+  GLuint bindlessMaterialBuffer = 0;
+
+  // Set for out-of-core assets: the geometry is drawn from the streamed cells
+  // and the buffers of the model are empty (no VAO is created)
+  std::unique_ptr<GeometryStreamer> streamer;
+
+  // Approximate size of the buffer and texture storage of the asset, streamed
+  // geometry excluded
+  size_t gpuByteCount = 0;
+};
+
+struct AssetCacheStats
+{
+  size_t residentAssetCount = 0;
+  size_t gpuByteCount = 0;
+  size_t hitCount = 0; // acquire() calls served from the cache
+  size_t loadCount = 0; // acquire() calls that loaded the asset
+};
+
+// Shares loaded glTF assets between all their uses. Assets are identified by
+// their canonical path and the hash of the content of the .gltf/.glb file, so
+// an asset that changed on disk is loaded again. The cache does not keep
+// assets alive: an asset is destroyed, and its GPU memory freed, as soon as
+// the last std::shared_ptr returned by acquire() is released.
+class AssetCache
+{
+public:
+  // Fills asset.model and the GL objects of asset (path and contentHash are
+  // already set). Returns false and sets error on failure.
+  using Loader = std::function<bool(GltfAsset &asset, std::string &error)>;
+
+  explicit AssetCache(Loader loader) : m_loader(std::move(loader)) {}
+
+  // Returns nullptr and sets error if the file cannot be read or loaded
+  std::shared_ptr<GltfAsset> acquire(const fs::path &path, std::string &error);
+
+  AssetCacheStats stats() const;
+
+private:
+  Loader m_loader;
+  std::unordered_map<std::string, std::weak_ptr<GltfAsset>> m_assets;
+  size_t m_hitCount = 0;
+  size_t m_loadCount = 0;
+};
@@ -0,0 +1,592 @@
+#include "benchmarks.hpp"
+#include "draw_sort.hpp"
+#include "environment.hpp"
+#include "file_reader.hpp"
+#include "gpu_allocator.hpp"
+#include "image_decoders.hpp"
+#include "lights.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+bool isBenchmarkedImage(const fs::path &path)
+{
+  auto extension = path.extension().string();
+  std::transform(begin(extension), end(extension), begin(extension),
+      [](unsigned char c) { return char(std::tolower(c)); });
+  return extension == ".png" || extension == ".jpg" || extension == ".jpeg";
+}
+
+// Bytes of the allocation seeded with seed, as written by the pool checks
+std::vector<unsigned char> makeAllocationBytes(size_t byteCount, uint32_t seed)
+{
+  std::vector<unsigned char> bytes(byteCount);
+  auto state = seed * 2654435761u + 1;
+  for (auto &byte : bytes) {
+    state = state * 1664525u + 1013904223u;
+    byte = (unsigned char)(state >> 24);
+  }
+  return bytes;
+}
+
+// True if the range of allocation in the buffers of backend holds bytes
+bool hasAllocationBytes(const CpuBufferBackend &backend,
+    const GpuMemoryPool &pool, GpuMemoryPool::AllocationId allocation,
+    const std::vector<unsigned char> &bytes)
+{
+  const auto range = pool.range(allocation);
+  const auto &data = backend.data(range.buffer);
+  return size_t(range.offset) + bytes.size() <= data.size() &&
+         std::equal(begin(bytes), end(bytes), data.begin() + range.offset);
+}
+
+struct DecoderTimings
+{
+  size_t imageCount = 0;
+  size_t failureCount = 0;
+  size_t mismatchCount = 0;
+  double megaPixels = 0.;
+  double seconds = 0.;
+};
+
+} // namespace
+
+int benchmarkImageDecoders(const fs::path &directory, int iterations)
+{
+  iterations = std::max(iterations, 1);
+
+  std::vector<std::string> paths;
+  for (const auto &entry : fs::recursive_directory_iterator(directory)) {
+    if (fs::is_regular_file(entry.status()) &&
+        isBenchmarkedImage(entry.path())) {
+      paths.push_back(entry.path().string());
+    }
+  }
+  if (paths.empty()) {
+    std::cerr << "No png or jpeg image found in " << directory << std::endl;
+    return 1;
+  }
+
+  std::vector<std::vector<unsigned char>> contents(paths.size());
+  readFiles(paths,
+      [&](size_t fileIdx, std::vector<unsigned char> &data, bool succeeded) {
+        if (succeeded) {
+          contents[fileIdx] = std::move(data);
+        }
+      });
+
+  auto decoders = getImageDecoders();
+  if (std::none_of(begin(decoders), end(decoders), [](const auto &decoder) {
+        return decoder.decode == stbImageDecoder.decode;
+      })) {
+    decoders.push_back(stbImageDecoder);
+  }
+
+  // format -> decoder name -> timings
+  std::map<std::string, std::map<std::string, DecoderTimings>> timings;
+
+  for (size_t fileIdx = 0; fileIdx < paths.size(); ++fileIdx) {
+    const auto &bytes = contents[fileIdx];
+    if (bytes.empty()) {
+      continue;
+    }
+    const std::string format = getImageFormatName(bytes.data(), bytes.size());
+
+    tinygltf::Image reference;
+    std::string error;
+    const auto hasReference =
+        stbImageDecoder.decode(bytes.data(), bytes.size(), reference, error);
+
+    for (const auto &decoder : decoders) {
+      if (!decoder.canDecode(bytes.data(), bytes.size())) {
+        continue;
+      }
+      auto &decoderTimings = timings[format][decoder.name];
+      tinygltf::Image image;
+      bool succeeded = true;
+      const auto start = Clock::now();
+      for (auto i = 0; i < iterations && succeeded; ++i) {
+        image = tinygltf::Image{};
+        succeeded = decoder.decode(bytes.data(), bytes.size(), image, error);
+      }
+      if (!succeeded) {
+        // Unsupported variant, it will be handled by the next decoder
+        ++decoderTimings.failureCount;
+        continue;
+      }
+      decoderTimings.seconds +=
+          std::chrono::duration<double>(Clock::now() - start).count();
+      ++decoderTimings.imageCount;
+      decoderTimings.megaPixels +=
+          iterations * 1e-6 * double(image.width) * double(image.height);
+      if (hasReference && image.image != reference.image) {
+        std::cerr << decoder.name << " output differs from stb for "
+                  << paths[fileIdx] << std::endl;
+        ++decoderTimings.mismatchCount;
+      }
+    }
+  }
+
+  auto mismatch = false;
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << paths.size() << " images, " << iterations
+            << " iterations each\n";
+  std::cout << "(" << fastPngDecoder.name
+            << " inflates with stb's zlib decoder, jpeg is only decoded by "
+               "stb)\n";
+  for (const auto &formatTimings : timings) {
+    std::cout << formatTimings.first << ":\n";
+    const auto stbIt = formatTimings.second.find(stbImageDecoder.name);
+    for (const auto &decoderTimings : formatTimings.second) {
+      const auto &t = decoderTimings.second;
+      std::cout << "  " << std::setw(12) << std::left << decoderTimings.first
+                << std::right << std::setw(5) << t.imageCount << " images "
+                << std::setw(10) << 1000. * t.seconds << " ms "
+                << std::setw(8)
+                << (t.seconds > 0 ? t.megaPixels / t.seconds : 0.)
+                << " MPix/s";
+      if (stbIt != formatTimings.second.end() && t.megaPixels > 0 &&
+          (*stbIt).second.megaPixels > 0 && &(*stbIt).second != &t) {
+        // Only compare throughputs, the decoders may not accept the same
+        // subset of images
+        const auto &stb = (*stbIt).second;
+        std::cout << "  x" << (t.megaPixels / t.seconds) /
+                                  (stb.megaPixels / stb.seconds)
+                  << " vs stb";
+      }
+      if (t.failureCount) {
+        std::cout << "  (" << t.failureCount << " unsupported)";
+      }
+      if (t.mismatchCount) {
+        std::cout << "  (" << t.mismatchCount << " MISMATCHES)";
+        mismatch = true;
+      }
+      std::cout << "\n";
+    }
+  }
+
+  return mismatch ? 1 : 0;
+}
+
+int benchmarkDrawSort(size_t drawCount, int frameCount)
+{
+  frameCount = std::max(frameCount, 1);
+  const auto nearDepth = 0.1f;
+  const auto farDepth = 1000.f;
+
+  // 80% opaque, 10% alpha tested and 10% blended draws of 4096 materials,
+  // spread over the depth range
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  std::vector<float> depths(drawCount);
+  std::vector<DrawPass> passes(drawCount);
+  std::vector<uint32_t> materials(drawCount);
+  for (size_t drawIdx = 0; drawIdx < drawCount; ++drawIdx) {
+    depths[drawIdx] = nearDepth * std::pow(farDepth / nearDepth, unit(random));
+    const auto p = unit(random);
+    passes[drawIdx] = p < 0.8f   ? DRAW_PASS_OPAQUE
+                      : p < 0.9f ? DRAW_PASS_MASK
+                                 : DRAW_PASS_BLEND;
+    materials[drawIdx] = uint32_t(random() % 4096);
+  }
+
+  FrameArena arena;
+  DrawListSorter sorter;
+  std::vector<uint64_t> keys(drawCount);
+  const auto computeKeys = [&](float cameraOffset) {
+    for (size_t drawIdx = 0; drawIdx < drawCount; ++drawIdx) {
+      keys[drawIdx] = makeDrawKey(passes[drawIdx],
+          depths[drawIdx] + cameraOffset, nearDepth, farDepth, 0,
+          materials[drawIdx]);
+    }
+  };
+  auto isOrdered = true;
+  const auto sortFrame = [&]() {
+    arena.reset();
+    const auto &order = sorter.sort(keys.data(), keys.size(), arena);
+    for (size_t i = 1; i < order.size(); ++i) {
+      isOrdered = isOrdered && keys[order[i - 1]] <= keys[order[i]];
+    }
+    return sorter.stats();
+  };
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << drawCount << " draws, " << frameCount
+            << " frames per case\n";
+  const auto printCase = [&](const char *name, double seconds,
+                             size_t passCount, size_t coherentFrameCount) {
+    std::cout << "  " << std::setw(14) << std::left << name << std::right
+              << std::setw(8) << 1000. * seconds << " ms/frame, "
+              << passCount << " radix passes, " << coherentFrameCount
+              << " frames already sorted\n";
+  };
+
+  computeKeys(0.f);
+  const auto firstStats = sortFrame();
+  printCase("random order", firstStats.seconds, firstStats.radixPassCount,
+      firstStats.isCoherent);
+
+  double seconds = 0;
+  size_t passCount = 0;
+  size_t coherentFrameCount = 0;
+  for (int frame = 0; frame < frameCount; ++frame) {
+    const auto stats = sortFrame();
+    seconds += stats.seconds;
+    passCount = std::max(passCount, stats.radixPassCount);
+    coherentFrameCount += stats.isCoherent;
+  }
+  printCase("static camera", seconds / frameCount, passCount,
+      coherentFrameCount);
+
+  seconds = 0;
+  passCount = 0;
+  coherentFrameCount = 0;
+  for (int frame = 0; frame < frameCount; ++frame) {
+    // The camera moves back a little each frame
+    computeKeys(0.01f * float(frame + 1));
+    const auto stats = sortFrame();
+    seconds += stats.seconds;
+    passCount = std::max(passCount, stats.radixPassCount);
+    coherentFrameCount += stats.isCoherent;
+  }
+  printCase("moving camera", seconds / frameCount, passCount,
+      coherentFrameCount);
+
+  seconds = 0;
+  for (int frame = 0; frame < frameCount; ++frame) {
+    auto sortedKeys = keys;
+    const auto start = Clock::now();
+    std::sort(begin(sortedKeys), end(sortedKeys));
+    seconds += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  std::cout << "  " << std::setw(14) << std::left << "std::sort"
+            << std::right << std::setw(8) << 1000. * seconds / frameCount
+            << " ms/frame\n";
+
+  if (!isOrdered) {
+    std::cerr << "Sorted draws are out of order" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int benchmarkLightClusters(int frameCount)
+{
+  frameCount = std::max(frameCount, 1);
+  const auto nearDepth = 0.1f;
+  const auto farDepth = 200.f;
+  const auto viewMatrix = glm::mat4(1);
+  const auto projMatrix = glm::perspective(
+      glm::radians(60.f), 16.f / 9.f, nearDepth, farDepth);
+
+  std::cout << std::fixed << std::setprecision(3);
+  auto missingCount = 0;
+  for (const auto lightCount : {size_t(10), size_t(1000), size_t(10000)}) {
+    // Lights of range 5 in the frustum, up to depth 150
+    std::vector<PunctualLight> lights;
+    appendRandomLights(glm::vec3(-100, -60, -150), glm::vec3(100, 60, 0), 5.f,
+        lightCount, 1, lights);
+    LightClusters clusters;
+    double seconds = 0;
+    for (int frame = 0; frame < frameCount; ++frame) {
+      clusters.build(lights.data(), lights.size(), viewMatrix, projMatrix,
+          nearDepth, farDepth);
+      seconds += clusters.stats().seconds;
+    }
+    const auto &stats = clusters.stats();
+    std::cout << "  " << std::setw(6) << lightCount << " lights: "
+              << std::setw(8) << 1000. * seconds / frameCount
+              << " ms/frame, " << stats.lightIndexCount << " entries, max "
+              << stats.maxClusterLightCount << " per cluster\n";
+
+    // Look the clusters up as pbr_clustered_lights.fs.glsl does
+    const auto &options = clusters.options();
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for (int pointIdx = 0; pointIdx < 100000; ++pointIdx) {
+      const auto ndc = glm::vec2(2 * unit(random) - 1, 2 * unit(random) - 1);
+      const auto depth =
+          nearDepth * std::pow(farDepth / nearDepth, unit(random));
+      const auto point = glm::vec3(ndc.x * depth / projMatrix[0][0],
+          ndc.y * depth / projMatrix[1][1], -depth);
+      const auto tileX = std::min(int((ndc.x + 1) / 2 * options.tileCountX),
+          options.tileCountX - 1);
+      const auto tileY = std::min(int((ndc.y + 1) / 2 * options.tileCountY),
+          options.tileCountY - 1);
+      const auto slice = std::min(std::max(int(std::floor(
+                                               std::log(depth) *
+                                                   clusters.depthScale() +
+                                               clusters.depthBias())),
+                                      0),
+          options.sliceCount - 1);
+      const auto clusterIdx =
+          (slice * options.tileCountY + tileY) * options.tileCountX + tileX;
+      const auto offset = clusters.clusterRanges()[2 * clusterIdx];
+      const auto count = clusters.clusterRanges()[2 * clusterIdx + 1];
+      const auto *indices = clusters.lightIndices().data() + offset;
+      const auto &gpuLights = clusters.gpuLights();
+      for (size_t lightIdx = 0; lightIdx < gpuLights.size(); ++lightIdx) {
+        const auto &light = gpuLights[lightIdx];
+        if (glm::length(light.position - point) < light.range * 0.999f &&
+            std::find(indices, indices + count, uint32_t(lightIdx)) ==
+                indices + count) {
+          ++missingCount;
+        }
+      }
+    }
+  }
+
+  if (missingCount) {
+    std::cerr << missingCount << " lights missing from their clusters"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int benchmarkEnvironmentLighting(const fs::path &path, int iterations)
+{
+  iterations = std::max(iterations, 1);
+  std::ifstream file(path.string(), std::ios::binary);
+  if (!file) {
+    std::cerr << "Unable to open " << path << std::endl;
+    return 1;
+  }
+  const std::string content{std::istreambuf_iterator<char>(file), {}};
+  std::string error;
+  EquirectangularImage image;
+  auto start = Clock::now();
+  if (!loadEquirectangularImage(content, image, error)) {
+    std::cerr << "Unable to load " << path << ": " << error << std::endl;
+    return 1;
+  }
+  const auto decodeSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  const EnvironmentOptions options;
+  EnvironmentLighting lighting;
+  EnvironmentStats totals;
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    EnvironmentStats stats;
+    computeEnvironmentLighting(image, options, lighting, stats);
+    totals.irradianceSeconds += stats.irradianceSeconds;
+    totals.specularSeconds += stats.specularSeconds;
+    totals.brdfSeconds += stats.brdfSeconds;
+  }
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << image.width << "x" << image.height
+            << " environment, decoded in "
+            << 1000. * decodeSeconds << " ms\n"
+            << "  irradiance SH:     " << std::setw(9)
+            << 1000. * totals.irradianceSeconds / iterations << " ms\n"
+            << "  specular cubemap:  " << std::setw(9)
+            << 1000. * totals.specularSeconds / iterations << " ms ("
+            << lighting.specularLevelCount << " levels of "
+            << lighting.specularSize << "x" << lighting.specularSize << ")\n"
+            << "  BRDF LUT:          " << std::setw(9)
+            << 1000. * totals.brdfSeconds / iterations << " ms\n";
+
+  const auto cachePath = fs::temp_directory_path() / "bench-environment.ibl";
+  const auto sourceHash = computeEnvironmentHash(content, options);
+  start = Clock::now();
+  if (!writeEnvironmentCache(lighting, sourceHash, cachePath, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  const auto writeSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  EnvironmentLighting cachedLighting;
+  start = Clock::now();
+  if (!readEnvironmentCache(cachePath, sourceHash, cachedLighting, error)) {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  const auto readSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::error_code ec;
+  fs::remove(cachePath, ec);
+  std::cout << "  cache: written in " << 1000. * writeSeconds
+            << " ms, read in " << 1000. * readSeconds << " ms\n";
+
+  auto failureCount = 0;
+  if (cachedLighting.specularTexels != lighting.specularTexels ||
+      cachedLighting.brdfLut != lighting.brdfLut ||
+      !std::equal(std::begin(lighting.irradianceSH),
+          std::end(lighting.irradianceSH),
+          std::begin(cachedLighting.irradianceSH))) {
+    std::cerr << "The cache file does not read back the lighting" << std::endl;
+    ++failureCount;
+  }
+  for (size_t i = 0; i < lighting.brdfLut.size(); i += 2) {
+    if (lighting.brdfLut[i] + lighting.brdfLut[i + 1] > 1.01f) {
+      std::cerr << "The BRDF LUT reflects more than it receives" << std::endl;
+      ++failureCount;
+      break;
+    }
+  }
+
+  // A constant environment reflects its radiance in every direction
+  EquirectangularImage constantImage;
+  constantImage.width = 256;
+  constantImage.height = 128;
+  constantImage.texels.assign(size_t(256) * 128 * 3, 1.f);
+  EnvironmentOptions constantOptions;
+  constantOptions.specularSize = 16;
+  EnvironmentLighting constantLighting;
+  EnvironmentStats constantStats;
+  computeEnvironmentLighting(
+      constantImage, constantOptions, constantLighting, constantStats);
+  // Irradiance divided by pi is 1, all on the constant harmonic
+  auto irradianceError = std::abs(
+      constantLighting.irradianceSH[0].r * 0.282095f - 1);
+  for (int i = 1; i < 9; ++i) {
+    irradianceError = std::max(
+        irradianceError, std::abs(constantLighting.irradianceSH[i].r));
+  }
+  auto specularError = 0.f;
+  for (const auto value : constantLighting.specularTexels) {
+    specularError = std::max(specularError, std::abs(value - 1));
+  }
+  if (irradianceError > 1e-3f || specularError > 1e-3f) {
+    std::cerr << "A constant environment gives an irradiance error of "
+              << irradianceError << " and a specular error of "
+              << specularError << std::endl;
+    ++failureCount;
+  }
+  return failureCount ? 1 : 0;
+}
+
+int benchmarkGpuMemoryPool(size_t allocationCount)
+{
+  auto failureCount = 0;
+  const auto check = [&](bool condition, const char *message) {
+    if (!condition) {
+      std::cerr << "GpuMemoryPool: " << message << std::endl;
+      ++failureCount;
+    }
+  };
+
+  // Random allocations of 16 bytes to 64 KB in pages of 1 MB, one in 500
+  // larger than a page
+  GpuMemoryPoolOptions options;
+  options.pageByteCount = size_t(1) << 20;
+  CpuBufferBackend backend;
+  GpuMemoryPool pool(backend, options);
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> logSize(4.f, 16.f);
+  std::uniform_int_distribution<int> largeChance(0, 499);
+  std::vector<GpuMemoryPool::AllocationId> allocations(allocationCount);
+  std::vector<std::vector<unsigned char>> contents(allocationCount);
+  for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+       ++allocationIdx) {
+    const auto byteCount =
+        largeChance(random) == 0
+            ? options.pageByteCount + size_t(random() % 65536)
+            : size_t(std::exp2(logSize(random)));
+    contents[allocationIdx] =
+        makeAllocationBytes(byteCount, uint32_t(allocationIdx));
+  }
+
+  auto start = Clock::now();
+  for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+       ++allocationIdx) {
+    allocations[allocationIdx] = pool.allocate(contents[allocationIdx].size(),
+        contents[allocationIdx].data());
+  }
+  const auto allocateSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  const auto checkContents = [&](const char *message) {
+    for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+         ++allocationIdx) {
+      if (allocations[allocationIdx] != GpuMemoryPool::invalidAllocation &&
+          !hasAllocationBytes(backend, pool, allocations[allocationIdx],
+              contents[allocationIdx])) {
+        check(false, message);
+        return;
+      }
+    }
+  };
+  checkContents("an allocation does not hold its data");
+
+  std::vector<size_t> freeOrder(allocationCount);
+  std::iota(begin(freeOrder), end(freeOrder), size_t(0));
+  std::shuffle(begin(freeOrder), end(freeOrder), random);
+  freeOrder.resize(allocationCount / 2);
+  start = Clock::now();
+  for (const auto allocationIdx : freeOrder) {
+    pool.free(allocations[allocationIdx]);
+    allocations[allocationIdx] = GpuMemoryPool::invalidAllocation;
+  }
+  const auto freeSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  checkContents("freeing an allocation changes the data of another");
+
+  size_t requestedByteCount = 0;
+  for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+       ++allocationIdx) {
+    if (allocations[allocationIdx] != GpuMemoryPool::invalidAllocation) {
+      requestedByteCount += contents[allocationIdx].size();
+    }
+  }
+  const auto before = pool.stats();
+  check(before.allocationCount == allocationCount - freeOrder.size() &&
+            before.requestedByteCount == requestedByteCount,
+      "the stats do not count the allocations left");
+  check(before.usedByteCount >= requestedByteCount &&
+            before.usedByteCount <= before.capacityByteCount &&
+            before.pageCount == backend.bufferCount(),
+      "the stats do not match the pages");
+
+  start = Clock::now();
+  const auto movedCount = pool.defragment();
+  const auto defragmentSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  const auto after = pool.stats();
+  checkContents("defragment() changes the data of a moved allocation");
+  check(after.allocationCount == before.allocationCount &&
+            after.usedByteCount == before.usedByteCount &&
+            after.pageCount <= before.pageCount &&
+            after.pageCount == backend.bufferCount(),
+      "defragment() loses allocations or pages");
+  check(!movedCount || after.movedByteCount > before.movedByteCount,
+      "defragment() does not count the moved bytes");
+
+  std::cout << std::fixed << std::setprecision(3);
+  const auto printStats = [](const char *name,
+                              const GpuMemoryPoolStats &stats) {
+    std::cout << "  " << name << std::setw(4) << stats.pageCount
+              << " pages, " << std::setw(8) << stats.capacityByteCount / 1e6
+              << " MB, utilization " << stats.utilization()
+              << ", fragmentation " << stats.fragmentation() << ", "
+              << stats.freeBlockCount << " free blocks\n";
+  };
+  std::cout << allocationCount << " allocations: allocate "
+            << 1e6 * allocateSeconds / std::max(allocationCount, size_t(1))
+            << " us, free "
+            << 1e6 * freeSeconds / std::max(freeOrder.size(), size_t(1))
+            << " us\n";
+  printStats("before defragment():", before);
+  printStats("after defragment(): ", after);
+  std::cout << "  defragment(): " << 1000. * defragmentSeconds << " ms, "
+            << movedCount << " allocations moved ("
+            << (after.movedByteCount - before.movedByteCount) / 1e6
+            << " MB)\n";
+  return failureCount ? 1 : 0;
+}
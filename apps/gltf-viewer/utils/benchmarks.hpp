@@ -0,0 +1,42 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+// Decode every .png/.jpg/.jpeg found recursively under directory with each
+// available image decoder, `iterations` times, and print per format and per
+// decoder timings on std::cout. Outputs of the other decoders are checked
+// against stb_image. Inflate and JPEG decoding are stb's for every decoder,
+// see fastPngDecoder and stbImageDecoder. Returns 0 on success, 1 if no image
+// was found or if a decoder produced different pixels.
+int benchmarkImageDecoders(const fs::path &directory, int iterations);
+
+// Sort the keys of drawCount random draws frameCount times with a
+// DrawListSorter, as drawScene does: a first frame in random order, frames
+// with a static camera, then frames with a moving camera. Prints the mean
+// sort time of each case next to std::sort on std::cout. Returns 1 if a
+// sorted list is out of order, 0 otherwise.
+int benchmarkDrawSort(size_t drawCount, int frameCount);
+
+// Bin 10, 1000 and 10000 random point lights in a LightClusters grid
+// frameCount times each and print the mean binning time on std::cout. The
+// clusters are checked at random points of the frustum: every light reaching
+// a point must be in the list of its cluster. Returns 1 if one is missing, 0
+// otherwise.
+int benchmarkLightClusters(int frameCount);
+
+// Precompute the lighting of the environment map at path iterations times
+// and print the mean time of each step, then the time to write and read it
+// back from a cache file, on std::cout. Checks that a constant environment
+// gives a constant lighting, that the BRDF LUT does not reflect more than it
+// receives and that the cache file reads back what was written. Returns 1
+// if a check fails or the map cannot be loaded, 0 otherwise.
+int benchmarkEnvironmentLighting(const fs::path &path, int iterations);
+
+// Drive a GpuMemoryPool with a CpuBufferBackend: allocationCount random
+// allocations, half of them freed in random order and the pool
+// defragmented. Prints the mean time of each operation and the stats before
+// and after defragment() on std::cout. The bytes of every allocation are
+// checked after the allocations and after defragment(), the rest of the
+// behaviour of the pool by tests/gpu_allocator_tests.cpp (ctest). Returns 1
+// if a check fails, 0 otherwise.
+int benchmarkGpuMemoryPool(size_t allocationCount);
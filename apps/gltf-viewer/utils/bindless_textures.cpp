@@ -0,0 +1,83 @@
+#include "bindless_textures.hpp"
+#include "glfw.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+bool isExtensionSupported(const char *name)
+{
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; ++i) {
+    const auto *extension =
+        reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+    if (extension && !std::strcmp(extension, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+BindlessTextureApi loadBindlessTextureApi()
+{
+  BindlessTextureApi api;
+  if (!isExtensionSupported("GL_ARB_bindless_texture")) {
+    return api;
+  }
+  api.getTextureHandle = reinterpret_cast<BindlessTextureApi::GetTextureHandle>(
+      glfwGetProcAddress("glGetTextureHandleARB"));
+  api.makeTextureHandleResident =
+      reinterpret_cast<BindlessTextureApi::MakeTextureHandleResident>(
+          glfwGetProcAddress("glMakeTextureHandleResidentARB"));
+  api.makeTextureHandleNonResident =
+      reinterpret_cast<BindlessTextureApi::MakeTextureHandleNonResident>(
+          glfwGetProcAddress("glMakeTextureHandleNonResidentARB"));
+  return api;
+}
+
+GLuint64 getTextureHandle(
+    const std::vector<GLuint64> &textureHandles, int textureIdx)
+{
+  return textureIdx >= 0 ? textureHandles[textureIdx] : 0;
+}
+
+} // namespace
+
+const BindlessTextureApi *getBindlessTextureApi()
+{
+  static const auto api = loadBindlessTextureApi();
+  const auto isLoaded = api.getTextureHandle &&
+                        api.makeTextureHandleResident &&
+                        api.makeTextureHandleNonResident;
+  return isLoaded ? &api : nullptr;
+}
+
+std::vector<BindlessMaterial> getBindlessMaterials(
+    const tinygltf::Model &model, const std::vector<GLuint64> &textureHandles)
+{
+  // Primitives without material use the default material of the spec
+  const tinygltf::Material defaultMaterial;
+  std::vector<BindlessMaterial> materials;
+  for (size_t materialIdx = 0; materialIdx <= model.materials.size();
+       ++materialIdx) {
+    const auto isDefault = materialIdx == model.materials.size();
+    const auto &material =
+        isDefault ? defaultMaterial : model.materials[materialIdx];
+    const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+    BindlessMaterial bindless;
+    bindless.factors =
+        getMaterialFactors(model, isDefault ? -1 : int(materialIdx));
+    bindless.baseColorTexture = getTextureHandle(
+        textureHandles, pbrMetallicRoughness.baseColorTexture.index);
+    bindless.metallicRoughnessTexture = getTextureHandle(
+        textureHandles, pbrMetallicRoughness.metallicRoughnessTexture.index);
+    bindless.emissiveTexture =
+        getTextureHandle(textureHandles, material.emissiveTexture.index);
+    bindless.occlusionTexture =
+        getTextureHandle(textureHandles, material.occlusionTexture.index);
+    materials.push_back(bindless);
+  }
+  return materials;
+}
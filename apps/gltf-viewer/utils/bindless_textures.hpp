@@ -0,0 +1,47 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <glad/glad.h>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// ARB_bindless_texture: a texture made resident is referenced by a 64-bit
+// handle stored in a buffer and sampled without being bound to a texture
+// unit. glad is generated for the core profile only, so the entry points of
+// the extension are loaded at runtime when the driver exposes it.
+
+struct BindlessTextureApi
+{
+  using GetTextureHandle = GLuint64(APIENTRYP)(GLuint texture);
+  using MakeTextureHandleResident = void(APIENTRYP)(GLuint64 handle);
+  using MakeTextureHandleNonResident = void(APIENTRYP)(GLuint64 handle);
+
+  GetTextureHandle getTextureHandle = nullptr;
+  MakeTextureHandleResident makeTextureHandleResident = nullptr;
+  MakeTextureHandleNonResident makeTextureHandleNonResident = nullptr;
+};
+
+// nullptr if the current context does not support ARB_bindless_texture. The
+// first call, which detects the extension and loads its entry points, must be
+// made with a current context.
+const BindlessTextureApi *getBindlessTextureApi();
+
+// std430 layout of Material in pbr_directional_light_bindless.fs.glsl
+struct BindlessMaterial
+{
+  MaterialFactors factors;
+  // Resident handles, 0 for no texture (the shader samples 1)
+  GLuint64 baseColorTexture = 0;
+  GLuint64 metallicRoughnessTexture = 0;
+  GLuint64 emissiveTexture = 0;
+  GLuint64 occlusionTexture = 0;
+};
+static_assert(sizeof(BindlessMaterial) % 16 == 0, "std430 array stride");
+
+// One BindlessMaterial per material of model, followed by the default
+// material. textureHandles holds the handle of each texture of model.
+std::vector<BindlessMaterial> getBindlessMaterials(
+    const tinygltf::Model &model, const std::vector<GLuint64> &textureHandles);
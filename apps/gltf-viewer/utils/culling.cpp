@@ -0,0 +1,62 @@
+#include "culling.hpp"
+
+Frustum extractFrustum(const glm::mat4 &matrix)
+{
+  // Gribb & Hartmann: each plane is a combination of the rows of the matrix
+  // (glm is column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i]))
+  const auto row = [&](int i) {
+    return glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+  };
+  Frustum frustum;
+  frustum.planes[0] = row(3) + row(0); // left
+  frustum.planes[1] = row(3) - row(0); // right
+  frustum.planes[2] = row(3) + row(1); // bottom
+  frustum.planes[3] = row(3) - row(1); // top
+  frustum.planes[4] = row(3) + row(2); // near
+  frustum.planes[5] = row(3) - row(2); // far
+  for (auto &plane : frustum.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return frustum;
+}
+
+bool isBoxVisible(const Frustum &frustum, const BoundingBox &box)
+{
+  if (box.isEmpty()) {
+    return false;
+  }
+  for (const auto &plane : frustum.planes) {
+    // Corner of the box that is the furthest along the plane normal
+    const auto positiveVertex = glm::vec3(plane.x >= 0 ? box.max.x : box.min.x,
+        plane.y >= 0 ? box.max.y : box.min.y,
+        plane.z >= 0 ? box.max.z : box.min.z);
+    if (glm::dot(glm::vec3(plane), positiveVertex) + plane.w < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t cullInstances(const Frustum &frustum, const BoundingBox *instanceBounds,
+    size_t instanceCount, InstanceRange *ranges, size_t maxRangeCount)
+{
+  size_t rangeCount = 0;
+  for (size_t instanceIdx = 0; instanceIdx < instanceCount; ++instanceIdx) {
+    if (!isBoxVisible(frustum, instanceBounds[instanceIdx])) {
+      continue;
+    }
+    const auto instance = uint32_t(instanceIdx);
+    if (rangeCount) {
+      auto &last = ranges[rangeCount - 1];
+      if (last.first + last.count == instance ||
+          rangeCount == maxRangeCount) {
+        last.count = instance + 1 - last.first;
+        continue;
+      }
+    }
+    if (rangeCount < maxRangeCount) {
+      ranges[rangeCount++] = InstanceRange{instance, 1};
+    }
+  }
+  return rangeCount;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// The 6 planes of a view frustum, in the space in which the frustum has been
+// extracted. A point p is inside a plane if dot(plane, vec4(p, 1)) >= 0.
+struct Frustum
+{
+  glm::vec4 planes[6];
+};
+
+// Extract the frustum of a projection * view (* model) matrix. The planes are
+// expressed in the input space of the matrix (world space for a view
+// projection matrix).
+Frustum extractFrustum(const glm::mat4 &matrix);
+
+// Conservative test: may return true for some boxes that are outside of the
+// frustum near its corners, never returns false for a visible box.
+bool isBoxVisible(const Frustum &frustum, const BoundingBox &box);
+
+// Consecutive instances of an instanced node, drawn by one instanced draw
+struct InstanceRange
+{
+  uint32_t first;
+  uint32_t count;
+};
+
+// Test the instances of an instanced node one by one and compact the visible
+// ones into ranges of consecutive instances, written to ranges. Past
+// maxRangeCount ranges, the last one is extended to the last visible
+// instance, so it also covers the culled instances in between. Returns the
+// number of ranges, 0 if no instance is visible.
+size_t cullInstances(const Frustum &frustum, const BoundingBox *instanceBounds,
+    size_t instanceCount, InstanceRange *ranges, size_t maxRangeCount);
@@ -0,0 +1,122 @@
+#include "deferred.hpp"
+
+namespace
+{
+
+// Of the textures of GBufferTexture
+const GLenum gbufferFormats[GBUFFER_TEXTURE_COUNT] = {GL_RGBA8,
+    GL_RGB10_A2, GL_RGBA8, GL_DEPTH_COMPONENT32F};
+const size_t gbufferFormatSizes[GBUFFER_TEXTURE_COUNT] = {4, 4, 4, 4};
+
+GLuint createTexture(GLenum format, GLsizei width, GLsizei height)
+{
+  GLuint texture = 0;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+  // Read texel by texel with texelFetch
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return texture;
+}
+
+} // namespace
+
+DeferredTargets::DeferredTargets(GLsizei width, GLsizei height) :
+    m_width(width), m_height(height)
+{
+  for (int textureIdx = 0; textureIdx < GBUFFER_TEXTURE_COUNT; ++textureIdx) {
+    m_gbufferTextures[textureIdx] =
+        createTexture(gbufferFormats[textureIdx], width, height);
+  }
+  m_lightTexture = createTexture(GL_R11F_G11F_B10F, width, height);
+
+  GLint previousDrawFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
+  glGenFramebuffers(1, &m_gbufferFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_gbufferFramebuffer);
+  GLenum drawBuffers[GBUFFER_DEPTH];
+  for (int textureIdx = 0; textureIdx < GBUFFER_DEPTH; ++textureIdx) {
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
+        GL_COLOR_ATTACHMENT0 + textureIdx, GL_TEXTURE_2D,
+        m_gbufferTextures[textureIdx], 0);
+    drawBuffers[textureIdx] = GL_COLOR_ATTACHMENT0 + textureIdx;
+  }
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_TEXTURE_2D, m_gbufferTextures[GBUFFER_DEPTH], 0);
+  glDrawBuffers(GBUFFER_DEPTH, drawBuffers);
+
+  glGenFramebuffers(1, &m_lightFramebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_lightFramebuffer);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, m_lightTexture, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(previousDrawFramebuffer));
+
+  glGenVertexArrays(1, &m_fullscreenVertexArray);
+}
+
+DeferredTargets::~DeferredTargets()
+{
+  glDeleteVertexArrays(1, &m_fullscreenVertexArray);
+  glDeleteFramebuffers(1, &m_lightFramebuffer);
+  glDeleteFramebuffers(1, &m_gbufferFramebuffer);
+  glDeleteTextures(1, &m_lightTexture);
+  glDeleteTextures(GBUFFER_TEXTURE_COUNT, m_gbufferTextures);
+}
+
+size_t DeferredTargets::gbufferBytesPerPixel() const
+{
+  size_t byteCount = 0;
+  for (const auto size : gbufferFormatSizes) {
+    byteCount += size;
+  }
+  return byteCount;
+}
+
+void DeferredTargets::beginGeometryPass()
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_gbufferFramebuffer);
+  glViewport(0, 0, m_width, m_height);
+  // Without changing the clear color of the target framebuffer
+  const GLfloat zero[] = {0, 0, 0, 0};
+  const GLfloat farDepth = 1;
+  for (int textureIdx = 0; textureIdx < GBUFFER_DEPTH; ++textureIdx) {
+    glClearBufferfv(GL_COLOR, textureIdx, zero);
+  }
+  glClearBufferfv(GL_DEPTH, 0, &farDepth);
+}
+
+void DeferredTargets::beginLightingPass(GLint firstTextureUnit)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_lightFramebuffer);
+  glDisable(GL_DEPTH_TEST);
+  // Pixels without surface stay black
+  const GLfloat black[] = {0, 0, 0, 0};
+  glClearBufferfv(GL_COLOR, 0, black);
+  for (int textureIdx = 0; textureIdx < GBUFFER_TEXTURE_COUNT; ++textureIdx) {
+    glActiveTexture(GL_TEXTURE0 + firstTextureUnit + textureIdx);
+    glBindTexture(GL_TEXTURE_2D, m_gbufferTextures[textureIdx]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void DeferredTargets::beginCompositePass(
+    GLuint framebuffer, GLint firstTextureUnit)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  glActiveTexture(GL_TEXTURE0 + firstTextureUnit);
+  glBindTexture(GL_TEXTURE_2D, m_lightTexture);
+  glActiveTexture(GL_TEXTURE0 + firstTextureUnit + 1);
+  glBindTexture(GL_TEXTURE_2D, m_gbufferTextures[GBUFFER_DEPTH]);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void DeferredTargets::drawFullscreenTriangle() const
+{
+  glBindVertexArray(m_fullscreenVertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glBindVertexArray(0);
+}
+
+void DeferredTargets::endFullscreenPasses() { glEnable(GL_DEPTH_TEST); }
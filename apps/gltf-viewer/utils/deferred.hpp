@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// Textures of the G-buffer, bound to consecutive texture units for the
+// lighting pass in this order
+enum GBufferTexture
+{
+  // Base color (gamma encoded) and metallic
+  GBUFFER_BASE_COLOR = 0,
+  // View space normal (octahedral encoding) and roughness
+  GBUFFER_NORMAL,
+  // Emissive color (gamma encoded) and occlusion
+  GBUFFER_EMISSIVE,
+  GBUFFER_DEPTH,
+  GBUFFER_TEXTURE_COUNT
+};
+
+struct DeferredStats
+{
+  // Written by the geometry pass (each overdrawn fragment writes it again)
+  // and read once by the lighting pass
+  size_t gbufferBytesPerPixel = 0;
+  size_t gbufferByteCount = 0; // Of one full screen write
+  // GPU time of each pass, a few frames late (see GpuPassTimer)
+  double geometrySeconds = 0;
+  double lightingSeconds = 0;
+  double compositeSeconds = 0;
+};
+
+// Render targets of deferred shading. The geometry pass draws the scene to
+// the G-buffer, which holds the surface seen by each pixel in 16 bytes (4
+// render targets of 32 bits with the depth). The lighting pass then shades
+// each pixel once, whatever the overdraw of the geometry pass, into the
+// light buffer (linear radiance, GL_R11F_G11F_B10F), and the composite pass
+// converts the light buffer to sRGB into the target framebuffer.
+class DeferredTargets
+{
+public:
+  DeferredTargets(GLsizei width, GLsizei height);
+  ~DeferredTargets();
+
+  DeferredTargets(const DeferredTargets &) = delete;
+  DeferredTargets &operator=(const DeferredTargets &) = delete;
+
+  size_t gbufferBytesPerPixel() const;
+  size_t gbufferByteCount() const
+  {
+    return gbufferBytesPerPixel() * size_t(m_width) * size_t(m_height);
+  }
+
+  // Bind the G-buffer for drawing and clear it
+  void beginGeometryPass();
+
+  // Bind the light buffer for drawing, and the textures of the G-buffer to
+  // the GBUFFER_TEXTURE_COUNT units from firstTextureUnit. Depth testing is
+  // disabled until endFullscreenPasses().
+  void beginLightingPass(GLint firstTextureUnit);
+
+  // Bind framebuffer for drawing, the light buffer to firstTextureUnit and
+  // the depth of the G-buffer to the next unit
+  void beginCompositePass(GLuint framebuffer, GLint firstTextureUnit);
+
+  // Draw a triangle covering the viewport, with fullscreen.vs.glsl
+  void drawFullscreenTriangle() const;
+
+  void endFullscreenPasses();
+
+private:
+  GLsizei m_width = 0;
+  GLsizei m_height = 0;
+  GLuint m_gbufferTextures[GBUFFER_TEXTURE_COUNT] = {};
+  GLuint m_lightTexture = 0;
+  GLuint m_gbufferFramebuffer = 0;
+  GLuint m_lightFramebuffer = 0;
+  // Empty: the fullscreen triangle is generated from gl_VertexID
+  GLuint m_fullscreenVertexArray = 0;
+};
@@ -0,0 +1,216 @@
+#include "draw_commands.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+const tinygltf::Primitive &getDrawPrimitive(const QueuedDraw &draw)
+{
+  const auto &model = draw.asset->model;
+  const auto &node = model.nodes[draw.nodeIdx];
+  return model.meshes[node.mesh].primitives[draw.primitiveIdx];
+}
+
+// Element of GltfAsset::vertexArrayObjects of a queued draw
+size_t getDrawVaoIdx(const QueuedDraw &draw)
+{
+  const auto &asset = *draw.asset;
+  const auto &node = asset.model.nodes[draw.nodeIdx];
+  const auto &vaoRange = asset.nodeInstancing[draw.nodeIdx].instanceCount
+                             ? asset.nodeIndexToInstancedVaoRange[draw.nodeIdx]
+                             : asset.meshIndexToVaoRange[node.mesh];
+  return size_t(vaoRange.begin + draw.primitiveIdx);
+}
+
+bool areSameBindings(
+    const VertexBufferBindings &lhs, const VertexBufferBindings &rhs)
+{
+  const auto count = VertexBufferBindings::count;
+  return std::equal(lhs.buffers, lhs.buffers + count, rhs.buffers) &&
+         std::equal(lhs.offsets, lhs.offsets + count, rhs.offsets) &&
+         std::equal(lhs.strides, lhs.strides + count, rhs.strides) &&
+         lhs.indexBuffer == rhs.indexBuffer;
+}
+
+} // namespace
+
+void VertexInputState::bindVertexArray(GLuint vertexArray)
+{
+  if (vertexArray != m_vertexArray) {
+    glBindVertexArray(vertexArray);
+    ++m_vertexArrayBindCount;
+    m_vertexArray = vertexArray;
+    m_vertexBuffers = nullptr;
+  }
+}
+
+void VertexInputState::bindVertexBuffers(const VertexBufferBindings &bindings)
+{
+  glBindVertexBuffers(0, VertexBufferBindings::count, bindings.buffers,
+      bindings.offsets, bindings.strides);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bindings.indexBuffer);
+  ++m_vertexBufferBindCount;
+  m_vertexBuffers = &bindings;
+}
+
+void VertexInputState::bindVertexInput(const GltfAsset &asset, size_t vaoIdx)
+{
+  bindVertexArray(asset.vertexArrayObjects[vaoIdx]);
+  if (asset.vertexBufferBindings.empty()) {
+    return;
+  }
+  const auto &bindings = asset.vertexBufferBindings[vaoIdx];
+  if (!m_vertexBuffers || !areSameBindings(bindings, *m_vertexBuffers)) {
+    bindVertexBuffers(bindings);
+  }
+}
+
+size_t recordDrawCommands(const QueuedDraw *draws, const uint64_t *drawKeys,
+    const uint32_t *drawOrder, size_t begin, size_t end,
+    DrawCommand *commands)
+{
+  size_t transformsCount = 0;
+  for (auto commandIdx = begin; commandIdx < end; ++commandIdx) {
+    const auto &draw = draws[drawOrder[commandIdx]];
+    const auto &asset = *draw.asset;
+    const auto &model = asset.model;
+    const auto &primitive = getDrawPrimitive(draw);
+    const auto vaoIdx = getDrawVaoIdx(draw);
+
+    auto &command = commands[commandIdx];
+    command.pass = getDrawKeyPass(drawKeys[drawOrder[commandIdx]]);
+    command.transforms = draw.transforms;
+    command.transformsOffset = -1;
+    command.asset = &asset;
+    command.material = primitive.material;
+    command.vertexArray = asset.vertexArrayObjects[vaoIdx];
+    command.vertexBuffers = asset.vertexBufferBindings.empty()
+                                ? nullptr
+                                : &asset.vertexBufferBindings[vaoIdx];
+    command.mode = GLenum(primitive.mode);
+    command.instanceCount = GLsizei(draw.instances.count);
+    command.baseInstance = draw.instances.first;
+    if (primitive.indices >= 0) {
+      const auto &accessor = model.accessors[primitive.indices];
+      const auto &bufferView = model.bufferViews[accessor.bufferView];
+      command.indexType = GLenum(accessor.componentType);
+      command.count = GLsizei(accessor.count);
+      command.indexOffset = asset.bufferRanges[bufferView.buffer].offset +
+                            accessor.byteOffset + bufferView.byteOffset;
+    } else {
+      const auto accessorIdx = (*std::begin(primitive.attributes)).second;
+      command.indexType = 0;
+      command.count = GLsizei(model.accessors[accessorIdx].count);
+      command.indexOffset = 0;
+    }
+
+    // The first command sets everything
+    if (commandIdx == 0) {
+      command.flags =
+          DRAW_COMMAND_PASS | DRAW_COMMAND_TRANSFORMS | DRAW_COMMAND_MATERIAL |
+          DRAW_COMMAND_VERTEX_ARRAY |
+          (command.vertexBuffers ? DRAW_COMMAND_VERTEX_BUFFERS : 0);
+      ++transformsCount;
+      continue;
+    }
+    const auto &previous = draws[drawOrder[commandIdx - 1]];
+    const auto &previousAsset = *previous.asset;
+    const auto previousVaoIdx = getDrawVaoIdx(previous);
+    command.flags = 0;
+    if (getDrawKeyPass(drawKeys[drawOrder[commandIdx - 1]]) != command.pass) {
+      command.flags |= DRAW_COMMAND_PASS;
+    }
+    // Each node of each scene instance has its own transforms
+    if (previous.transforms != draw.transforms) {
+      command.flags |= DRAW_COMMAND_TRANSFORMS;
+      ++transformsCount;
+    }
+    if (&previousAsset != &asset ||
+        getDrawPrimitive(previous).material != command.material) {
+      command.flags |= DRAW_COMMAND_MATERIAL;
+    }
+    if (previousAsset.vertexArrayObjects[previousVaoIdx] !=
+        command.vertexArray) {
+      command.flags |= DRAW_COMMAND_VERTEX_ARRAY;
+    }
+    const auto *previousBuffers =
+        previousAsset.vertexBufferBindings.empty()
+            ? nullptr
+            : &previousAsset.vertexBufferBindings[previousVaoIdx];
+    const auto *buffers = command.vertexBuffers;
+    if (buffers &&
+        (!previousBuffers || (command.flags & DRAW_COMMAND_VERTEX_ARRAY) ||
+            !areSameBindings(*buffers, *previousBuffers))) {
+      command.flags |= DRAW_COMMAND_VERTEX_BUFFERS;
+    }
+  }
+  return transformsCount;
+}
+
+void copyDrawTransforms(UniformRingBuffer &transformRing,
+    GLintptr transformsOffset, size_t transformsStride, size_t begin,
+    size_t end, DrawCommand *commands)
+{
+  for (auto commandIdx = begin; commandIdx < end; ++commandIdx) {
+    auto &command = commands[commandIdx];
+    if (command.flags & DRAW_COMMAND_TRANSFORMS) {
+      std::memcpy(transformRing.data(transformsOffset), command.transforms,
+          sizeof(DrawTransforms));
+      command.transformsOffset = transformsOffset;
+      transformsOffset += GLintptr(transformsStride);
+    }
+  }
+}
+
+DrawCommandStats replayDrawCommands(const DrawCommand *commands, size_t count,
+    const DrawCommandContext &context, VertexInputState &vertexInput)
+{
+  DrawCommandStats stats;
+  for (size_t commandIdx = 0; commandIdx < count; ++commandIdx) {
+    const auto &command = commands[commandIdx];
+    if (command.flags & DRAW_COMMAND_PASS) {
+      context.setDrawPass(command.pass);
+    }
+    if (command.flags & DRAW_COMMAND_TRANSFORMS) {
+      if (command.transformsOffset >= 0) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, context.transformsBinding,
+            context.transformRing->glId(), command.transformsOffset,
+            sizeof(DrawTransforms));
+      } else {
+        context.setDrawTransforms(*command.transforms);
+      }
+    }
+    if (command.flags & DRAW_COMMAND_MATERIAL) {
+      context.bindMaterial(*command.asset, command.material);
+    }
+    if (command.flags & DRAW_COMMAND_VERTEX_ARRAY) {
+      vertexInput.bindVertexArray(command.vertexArray);
+    }
+    if (command.flags & DRAW_COMMAND_VERTEX_BUFFERS) {
+      vertexInput.bindVertexBuffers(*command.vertexBuffers);
+    }
+    ++stats.drawCallCount;
+    stats.blendedDrawCount += command.pass == DRAW_PASS_BLEND;
+    if (command.indexType) {
+      if (command.instanceCount) {
+        glDrawElementsInstancedBaseInstance(command.mode, command.count,
+            command.indexType, (const GLvoid *)command.indexOffset,
+            command.instanceCount, command.baseInstance);
+      } else {
+        glDrawElements(command.mode, command.count, command.indexType,
+            (const GLvoid *)command.indexOffset);
+      }
+    } else if (command.instanceCount) {
+      glDrawArraysInstancedBaseInstance(command.mode, 0, command.count,
+          command.instanceCount, command.baseInstance);
+    } else {
+      glDrawArrays(command.mode, 0, command.count);
+    }
+  }
+  if (count && commands[count - 1].pass != DRAW_PASS_OPAQUE) {
+    context.setDrawPass(DRAW_PASS_OPAQUE);
+  }
+  return stats;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "asset_cache.hpp"
+#include "culling.hpp"
+#include "draw_sort.hpp"
+#include "transforms.hpp"
+#include "uniform_ring.hpp"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Draws of mesh nodes are queued by drawScene, sorted on their keys (see
+// makeDrawKey), resolved to the GL calls that submit them by
+// recordDrawCommands, and replayed in order on the thread owning the context
+// by replayDrawCommands. Commands can be recorded by jobs, each comparing its
+// draws with the previous ones in the list.
+
+// A draw of a primitive of a mesh node
+struct QueuedDraw
+{
+  const GltfAsset *asset;
+  const DrawTransforms *transforms; // Of the node, in the frame
+  int nodeIdx;
+  int primitiveIdx; // In the mesh of the node
+  InstanceRange instances; // {0, 0} for nodes that are not instanced
+};
+
+// State of a DrawCommand that differs from the previous command
+enum DrawCommandFlag
+{
+  DRAW_COMMAND_PASS = 1,
+  DRAW_COMMAND_TRANSFORMS = 2,
+  DRAW_COMMAND_MATERIAL = 4,
+  DRAW_COMMAND_VERTEX_ARRAY = 8,
+  DRAW_COMMAND_VERTEX_BUFFERS = 16
+};
+
+// A draw of the sorted draw list resolved to the GL calls that submit it
+struct DrawCommand
+{
+  uint32_t flags; // See DrawCommandFlag
+  DrawPass pass;
+  const DrawTransforms *transforms;
+  GLintptr transformsOffset; // Copy of transforms in the ring, or -1
+  const GltfAsset *asset;
+  int material;
+  GLuint vertexArray;
+  const VertexBufferBindings *vertexBuffers; // Null without shared formats
+  GLenum mode;
+  GLenum indexType; // 0 for glDrawArrays
+  GLsizei count;
+  GLintptr indexOffset;
+  GLsizei instanceCount; // 0 for draws of nodes that are not instanced
+  GLuint baseInstance; // First instance of the range drawn
+};
+
+// Vertex input bound by the draws of a frame, to skip redundant binds.
+// Vertex buffer bindings are part of the VAO state: they are unknown after a
+// VAO change.
+class VertexInputState
+{
+public:
+  void bindVertexArray(GLuint vertexArray);
+  // Bind the buffers of the draws sharing the bound VAO
+  void bindVertexBuffers(const VertexBufferBindings &bindings);
+  // Bind element vaoIdx of asset.vertexArrayObjects, and its buffers with
+  // shared vertex formats
+  void bindVertexInput(const GltfAsset &asset, size_t vaoIdx);
+
+  size_t vertexArrayBindCount() const { return m_vertexArrayBindCount; }
+  size_t vertexBufferBindCount() const { return m_vertexBufferBindCount; }
+
+private:
+  GLuint m_vertexArray = 0;
+  const VertexBufferBindings *m_vertexBuffers = nullptr;
+  size_t m_vertexArrayBindCount = 0;
+  size_t m_vertexBufferBindCount = 0;
+};
+
+// State set by replayDrawCommands through the renderer, which depends on the
+// shaders in use
+struct DrawCommandContext
+{
+  // Ring holding the transforms copied by copyDrawTransforms, bound to
+  // transformsBinding of GL_UNIFORM_BUFFER
+  const UniformRingBuffer *transformRing = nullptr;
+  GLuint transformsBinding = 0;
+  std::function<void(DrawPass)> setDrawPass;
+  // Transforms that were not copied to the ring
+  std::function<void(const DrawTransforms &)> setDrawTransforms;
+  std::function<void(const GltfAsset &, int)> bindMaterial;
+};
+
+struct DrawCommandStats
+{
+  size_t drawCallCount = 0;
+  size_t blendedDrawCount = 0;
+};
+
+// Record the commands [begin, end) of draws in the order of drawOrder, with
+// drawKeys the keys of draws. State is only set when it differs from the
+// previous draw. Returns the number of transforms changes.
+size_t recordDrawCommands(const QueuedDraw *draws, const uint64_t *drawKeys,
+    const uint32_t *drawOrder, size_t begin, size_t end,
+    DrawCommand *commands);
+
+// Copy the transforms changed by the commands [begin, end) to transformRing,
+// in consecutive elements of transformsStride bytes from transformsOffset
+// (reserved by the caller)
+void copyDrawTransforms(UniformRingBuffer &transformRing,
+    GLintptr transformsOffset, size_t transformsStride, size_t begin,
+    size_t end, DrawCommand *commands);
+
+// Submit count commands recorded by recordDrawCommands. The pass is opaque
+// again after the last command.
+DrawCommandStats replayDrawCommands(const DrawCommand *commands, size_t count,
+    const DrawCommandContext &context, VertexInputState &vertexInput);
@@ -0,0 +1,170 @@
+#include "draw_sort.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+
+const size_t radixBucketCount = 256;
+// Elements per histogram and scatter job, large enough for the jobs to be
+// worth it, small enough for all the workers to get some
+const size_t radixBlockSize = 1 << 15;
+
+const uint64_t depthBitCount = 22;
+const uint64_t depthMask = (uint64_t(1) << depthBitCount) - 1;
+const uint64_t opaqueDepthBitCount = 8;
+
+uint64_t quantizeDepth(
+    float viewDepth, float nearDepth, float farDepth, uint64_t bitCount)
+{
+  const auto maxValue = double((uint64_t(1) << bitCount) - 1);
+  nearDepth = std::max(nearDepth, 1e-6f);
+  farDepth = std::max(farDepth, nearDepth * (1.f + 1e-6f));
+  const auto t = std::log(double(std::max(viewDepth, nearDepth)) / nearDepth) /
+                 std::log(double(farDepth) / nearDepth);
+  return uint64_t(std::min(t, 1.) * maxValue);
+}
+
+} // namespace
+
+uint64_t makeDrawKey(DrawPass pass, float viewDepth, float nearDepth,
+    float farDepth, uint32_t program, uint32_t material)
+{
+  uint64_t depth;
+  if (pass == DRAW_PASS_BLEND) {
+    // Far to near
+    depth = depthMask -
+            quantizeDepth(viewDepth, nearDepth, farDepth, depthBitCount);
+  } else {
+    depth = quantizeDepth(viewDepth, nearDepth, farDepth, opaqueDepthBitCount)
+            << (depthBitCount - opaqueDepthBitCount);
+  }
+  return (uint64_t(pass) << 62) | (depth << 40) |
+         (uint64_t(program & 0xff) << 32) | material;
+}
+
+size_t radixSort(
+    uint64_t *keys, uint32_t *values, size_t count, FrameArena &arena)
+{
+  if (count < 2) {
+    return 0;
+  }
+  auto &jobSystem = JobSystem::instance();
+  const auto blockCount = (count + radixBlockSize - 1) / radixBlockSize;
+  const auto forEachBlock = [&](const auto &body) {
+    jobSystem.parallelFor(blockCount, 1, [&](size_t first, size_t last) {
+      for (auto blockIdx = first; blockIdx < last; ++blockIdx) {
+        body(blockIdx, blockIdx * radixBlockSize,
+            std::min(count, (blockIdx + 1) * radixBlockSize));
+      }
+    });
+  };
+
+  // Counts of the values of the 8 bytes of the keys, all counted at once
+  // since they do not depend on the order of the keys
+  auto *byteCounts =
+      arena.allocateArray<size_t>(blockCount * 8 * radixBucketCount);
+  std::fill_n(byteCounts, blockCount * 8 * radixBucketCount, size_t(0));
+  forEachBlock([&](size_t blockIdx, size_t begin, size_t end) {
+    auto *counts = byteCounts + blockIdx * 8 * radixBucketCount;
+    for (auto i = begin; i < end; ++i) {
+      const auto key = keys[i];
+      for (size_t byteIdx = 0; byteIdx < 8; ++byteIdx) {
+        ++counts[byteIdx * radixBucketCount + ((key >> (8 * byteIdx)) & 0xff)];
+      }
+    }
+  });
+  for (size_t blockIdx = 1; blockIdx < blockCount; ++blockIdx) {
+    for (size_t i = 0; i < 8 * radixBucketCount; ++i) {
+      byteCounts[i] += byteCounts[blockIdx * 8 * radixBucketCount + i];
+    }
+  }
+
+  // Where each block writes its elements of each bucket
+  auto *blockOffsets =
+      arena.allocateArray<size_t>(blockCount * radixBucketCount);
+  auto *keyScratch = arena.allocateArray<uint64_t>(count);
+  auto *valueScratch = arena.allocateArray<uint32_t>(count);
+  auto *sourceKeys = keys;
+  auto *sourceValues = values;
+  auto *targetKeys = keyScratch;
+  auto *targetValues = valueScratch;
+  size_t passCount = 0;
+  for (size_t byteIdx = 0; byteIdx < 8; ++byteIdx) {
+    const auto *counts = byteCounts + byteIdx * radixBucketCount;
+    if (std::count(counts, counts + radixBucketCount, count)) {
+      continue; // All the keys have the same byte
+    }
+    const auto shift = 8 * byteIdx;
+
+    forEachBlock([&](size_t blockIdx, size_t begin, size_t end) {
+      auto *offsets = blockOffsets + blockIdx * radixBucketCount;
+      std::fill_n(offsets, radixBucketCount, size_t(0));
+      for (auto i = begin; i < end; ++i) {
+        ++offsets[(sourceKeys[i] >> shift) & 0xff];
+      }
+    });
+    // Buckets in order, and in each bucket the blocks in order, so that the
+    // sort is stable
+    size_t offset = 0;
+    for (size_t bucket = 0; bucket < radixBucketCount; ++bucket) {
+      for (size_t blockIdx = 0; blockIdx < blockCount; ++blockIdx) {
+        auto &blockOffset = blockOffsets[blockIdx * radixBucketCount + bucket];
+        const auto bucketCount = blockOffset;
+        blockOffset = offset;
+        offset += bucketCount;
+      }
+    }
+    forEachBlock([&](size_t blockIdx, size_t begin, size_t end) {
+      auto *offsets = blockOffsets + blockIdx * radixBucketCount;
+      for (auto i = begin; i < end; ++i) {
+        const auto target = offsets[(sourceKeys[i] >> shift) & 0xff]++;
+        targetKeys[target] = sourceKeys[i];
+        targetValues[target] = sourceValues[i];
+      }
+    });
+    std::swap(sourceKeys, targetKeys);
+    std::swap(sourceValues, targetValues);
+    ++passCount;
+  }
+
+  if (sourceKeys != keys) {
+    std::copy_n(sourceKeys, count, keys);
+    std::copy_n(sourceValues, count, values);
+  }
+  return passCount;
+}
+
+const std::vector<uint32_t> &DrawListSorter::sort(
+    const uint64_t *keys, size_t count, FrameArena &arena)
+{
+  const auto start = std::chrono::steady_clock::now();
+  m_stats.drawCount = count;
+  m_stats.radixPassCount = 0;
+  if (m_order.size() != count) {
+    // Not the draws of the previous frame
+    m_order.resize(count);
+    std::iota(begin(m_order), end(m_order), 0);
+  }
+
+  auto *orderedKeys = arena.allocateArray<uint64_t>(count);
+  JobSystem::instance().parallelFor(
+      count, radixBlockSize, [&](size_t first, size_t last) {
+        for (auto i = first; i < last; ++i) {
+          orderedKeys[i] = keys[m_order[i]];
+        }
+      });
+  m_stats.isCoherent = std::is_sorted(orderedKeys, orderedKeys + count);
+  if (!m_stats.isCoherent) {
+    m_stats.radixPassCount =
+        radixSort(orderedKeys, m_order.data(), count, arena);
+  }
+  m_stats.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                        .count();
+  return m_order;
+}
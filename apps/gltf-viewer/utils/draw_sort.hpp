@@ -0,0 +1,63 @@
+#pragma once
+
+#include "frame_arena.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Passes of the draws, in drawing order: opaque draws front to back (the
+// early depth test rejects hidden fragments), alpha tested draws, then
+// blended draws back to front with depth writes off, so that they composite
+// correctly. Values follow the AlphaMode of their materials.
+enum DrawPass
+{
+  DRAW_PASS_OPAQUE = 0,
+  DRAW_PASS_MASK = 1,
+  DRAW_PASS_BLEND = 2
+};
+
+// 64 bits sort key of a draw, from the most significant bits: pass (2 bits),
+// view depth (22 bits), program (8 bits) and material (32 bits). Opaque and
+// alpha tested draws only get 256 depth buckets, so that draws sharing a
+// program and a material are grouped within a bucket. Blended draws are
+// sorted on the full depth, far to near. Depths are quantized on a log scale
+// between nearDepth and farDepth.
+uint64_t makeDrawKey(DrawPass pass, float viewDepth, float nearDepth,
+    float farDepth, uint32_t program, uint32_t material);
+
+inline DrawPass getDrawKeyPass(uint64_t key) { return DrawPass(key >> 62); }
+
+// Stable LSD radix sort of keys with their values, 8 bits per pass. Passes
+// over bytes equal in all the keys are skipped. Histograms and scatters of
+// large arrays run as jobs of the shared JobSystem, scratch arrays are
+// allocated from arena. Returns the number of radix passes.
+size_t radixSort(
+    uint64_t *keys, uint32_t *values, size_t count, FrameArena &arena);
+
+struct DrawSortStats
+{
+  size_t drawCount = 0;
+  size_t radixPassCount = 0;
+  // The keys were still sorted in the order of the previous frame
+  bool isCoherent = false;
+  double seconds = 0;
+};
+
+// Sorts the draw list of each frame. Successive frames mostly have the same
+// draws with similar keys: the keys are first put in the order of the
+// previous frame, which is often still sorted, in which case the radix sort
+// is skipped.
+class DrawListSorter
+{
+public:
+  // Indices of the draws sorted by keys[index], valid until the next call
+  const std::vector<uint32_t> &sort(
+      const uint64_t *keys, size_t count, FrameArena &arena);
+
+  const DrawSortStats &stats() const { return m_stats; }
+
+private:
+  std::vector<uint32_t> m_order;
+  DrawSortStats m_stats;
+};
@@ -0,0 +1,631 @@
+#include "environment.hpp"
+#include "job_system.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string_view>
+
+#if defined(__SSE__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define USE_SSE 1
+#endif
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+const float pi = 3.14159265358979f;
+
+const char cacheMagic[8] = {'G', 'L', 'T', 'F', 'E', 'N', 'V', 'L'};
+const uint32_t cacheVersion = 1;
+
+struct EnvironmentCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  int32_t specularSize;
+  int32_t specularLevelCount;
+  int32_t brdfLutSize;
+  uint64_t sourceHash; // See computeEnvironmentHash()
+  float irradianceSH[27];
+};
+
+// Constants of the real spherical harmonics of bands 0 to 2
+const float shY00 = 0.282095f;
+const float shY1 = 0.488603f;
+const float shY2 = 1.092548f;
+const float shY20 = 0.315392f;
+const float shY22 = 0.546274f;
+
+void evaluateSH(const glm::vec3 &d, float *basis)
+{
+  basis[0] = shY00;
+  basis[1] = shY1 * d.y;
+  basis[2] = shY1 * d.z;
+  basis[3] = shY1 * d.x;
+  basis[4] = shY2 * d.x * d.y;
+  basis[5] = shY2 * d.y * d.z;
+  basis[6] = shY20 * (3 * d.z * d.z - 1);
+  basis[7] = shY2 * d.x * d.z;
+  basis[8] = shY22 * (d.x * d.x - d.y * d.y);
+}
+
+// Sum of the radiance of row y weighted by each basis function (27 floats,
+// coefficient major), without the solid angle of the texels
+void sumRowSH(const EquirectangularImage &image, int y,
+    const std::vector<float> &cosPhi, const std::vector<float> &sinPhi,
+    double *sums)
+{
+  const auto theta = pi * (y + 0.5f) / image.height;
+  const auto sinTheta = std::sin(theta);
+  const auto cosTheta = std::cos(theta);
+  const auto *texels = image.texels.data() + size_t(y) * image.width * 3;
+  float rowSums[27] = {};
+  int x = 0;
+#if defined(USE_SSE)
+  __m128 acc[27];
+  for (auto &value : acc) {
+    value = _mm_setzero_ps();
+  }
+  const auto vSinTheta = _mm_set1_ps(sinTheta);
+  const auto dy = _mm_set1_ps(cosTheta);
+  const auto c1 = _mm_set1_ps(shY1);
+  const auto c2 = _mm_set1_ps(shY2);
+  const auto c20 = _mm_set1_ps(shY20);
+  const auto c22 = _mm_set1_ps(shY22);
+  const auto three = _mm_set1_ps(3);
+  for (; x + 4 <= image.width; x += 4) {
+    const auto dx = _mm_mul_ps(vSinTheta, _mm_loadu_ps(&cosPhi[x]));
+    const auto dz = _mm_mul_ps(vSinTheta, _mm_loadu_ps(&sinPhi[x]));
+    __m128 basis[9];
+    basis[0] = _mm_set1_ps(shY00);
+    basis[1] = _mm_mul_ps(c1, dy);
+    basis[2] = _mm_mul_ps(c1, dz);
+    basis[3] = _mm_mul_ps(c1, dx);
+    basis[4] = _mm_mul_ps(c2, _mm_mul_ps(dx, dy));
+    basis[5] = _mm_mul_ps(c2, _mm_mul_ps(dy, dz));
+    basis[6] = _mm_mul_ps(c20,
+        _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), _mm_set1_ps(1)));
+    basis[7] = _mm_mul_ps(c2, _mm_mul_ps(dx, dz));
+    basis[8] = _mm_mul_ps(
+        c22, _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+    const auto *t = texels + x * 3;
+    const __m128 colors[3] = {_mm_set_ps(t[9], t[6], t[3], t[0]),
+        _mm_set_ps(t[10], t[7], t[4], t[1]),
+        _mm_set_ps(t[11], t[8], t[5], t[2])};
+    for (int i = 0; i < 9; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        acc[i * 3 + c] =
+            _mm_add_ps(acc[i * 3 + c], _mm_mul_ps(basis[i], colors[c]));
+      }
+    }
+  }
+  for (int i = 0; i < 27; ++i) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc[i]);
+    rowSums[i] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+#endif
+  for (; x < image.width; ++x) {
+    float basis[9];
+    evaluateSH(
+        glm::vec3(sinTheta * cosPhi[x], cosTheta, sinTheta * sinPhi[x]),
+        basis);
+    for (int i = 0; i < 9; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        rowSums[i * 3 + c] += basis[i] * texels[x * 3 + c];
+      }
+    }
+  }
+  for (int i = 0; i < 27; ++i) {
+    sums[i] = rowSums[i];
+  }
+}
+
+// Direction of the texel (u, v) of face, u and v in [-1, 1]
+glm::vec3 cubemapDirection(int face, float u, float v)
+{
+  switch (face) {
+  case 0:
+    return glm::vec3(1, -v, -u);
+  case 1:
+    return glm::vec3(-1, -v, u);
+  case 2:
+    return glm::vec3(u, 1, v);
+  case 3:
+    return glm::vec3(u, -1, -v);
+  case 4:
+    return glm::vec3(u, -v, 1);
+  default:
+    return glm::vec3(-u, -v, -1);
+  }
+}
+
+glm::vec3 fetch(const EquirectangularImage &image, int x, int y)
+{
+  const auto *texel = &image.texels[(size_t(y) * image.width + x) * 3];
+  return glm::vec3(texel[0], texel[1], texel[2]);
+}
+
+// u and v in [0, 1], wraps around horizontally, clamps at the poles
+glm::vec3 sampleBilinear(const EquirectangularImage &image, float u, float v)
+{
+  const auto x = u * image.width - 0.5f;
+  const auto y = v * image.height - 0.5f;
+  const auto x0 = int(std::floor(x));
+  const auto y0 = int(std::floor(y));
+  const auto fx = x - x0;
+  const auto fy = y - y0;
+  const auto left = (x0 % image.width + image.width) % image.width;
+  const auto right = (left + 1) % image.width;
+  const auto top = glm::clamp(y0, 0, image.height - 1);
+  const auto bottom = glm::clamp(y0 + 1, 0, image.height - 1);
+  return glm::mix(
+      glm::mix(fetch(image, left, top), fetch(image, right, top), fx),
+      glm::mix(fetch(image, left, bottom), fetch(image, right, bottom), fx),
+      fy);
+}
+
+// Halved down to a single row
+std::vector<EquirectangularImage> buildMipLevels(
+    const EquirectangularImage &image)
+{
+  std::vector<EquirectangularImage> levels;
+  levels.push_back(image);
+  while (levels.back().height > 1) {
+    const auto &source = levels.back();
+    EquirectangularImage level;
+    level.width = std::max(source.width / 2, 1);
+    level.height = source.height / 2;
+    level.texels.resize(size_t(level.width) * level.height * 3);
+    JobSystem::instance().parallelFor(
+        size_t(level.height), 16, [&](size_t begin, size_t end) {
+          for (auto y = int(begin); y < int(end); ++y) {
+            for (int x = 0; x < level.width; ++x) {
+              const auto x1 = std::min(2 * x + 1, source.width - 1);
+              const auto color =
+                  0.25f * (fetch(source, 2 * x, 2 * y) +
+                              fetch(source, x1, 2 * y) +
+                              fetch(source, 2 * x, 2 * y + 1) +
+                              fetch(source, x1, 2 * y + 1));
+              auto *texel = &level.texels[(size_t(y) * level.width + x) * 3];
+              texel[0] = color.r;
+              texel[1] = color.g;
+              texel[2] = color.b;
+            }
+          }
+        });
+    levels.push_back(std::move(level));
+  }
+  return levels;
+}
+
+glm::vec3 sampleTrilinear(const std::vector<EquirectangularImage> &levels,
+    const glm::vec3 &d, float lod)
+{
+  const auto u = std::atan2(d.z, d.x) / (2 * pi) + 0.5f;
+  const auto v = std::acos(glm::clamp(d.y, -1.f, 1.f)) / pi;
+  if (levels.size() == 1) {
+    return sampleBilinear(levels[0], u, v);
+  }
+  lod = glm::clamp(lod, 0.f, float(levels.size() - 1));
+  const auto level = std::min(size_t(lod), levels.size() - 2);
+  return glm::mix(sampleBilinear(levels[level], u, v),
+      sampleBilinear(levels[level + 1], u, v), lod - level);
+}
+
+float radicalInverse(uint32_t bits)
+{
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return float(bits) * 2.3283064365386963e-10f;
+}
+
+// Half vector of the i-th of count GGX samples around +Z (Hammersley set),
+// alpha is the squared roughness as in the shaders
+glm::vec3 sampleGgxHalfVector(int i, int count, float alpha)
+{
+  const auto phi = 2 * pi * (i + 0.5f) / count;
+  const auto xi = radicalInverse(uint32_t(i));
+  const auto cosTheta =
+      std::sqrt((1 - xi) / (1 + (alpha * alpha - 1) * xi));
+  const auto sinTheta = std::sqrt(std::max(1 - cosTheta * cosTheta, 0.f));
+  return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi),
+      cosTheta);
+}
+
+float ggxDistribution(float NdotH, float alpha)
+{
+  const auto alpha2 = alpha * alpha;
+  const auto denominator = NdotH * NdotH * (alpha2 - 1) + 1;
+  return alpha2 / (pi * denominator * denominator);
+}
+
+// Light direction around +Z of a GGX sample reflected by a surface seen
+// along its normal, with the weight and the source level of the sample
+struct PrefilterSample
+{
+  glm::vec3 direction;
+  float weight; // NdotL
+  float lod;
+};
+
+std::vector<PrefilterSample> computePrefilterSamples(
+    int count, float alpha, float texelSolidAngle)
+{
+  std::vector<PrefilterSample> samples;
+  for (int i = 0; i < count; ++i) {
+    const auto H = sampleGgxHalfVector(i, count, alpha);
+    // V = N = +Z
+    const auto L = glm::vec3(2 * H.z * H.x, 2 * H.z * H.y, 2 * H.z * H.z - 1);
+    if (L.z <= 0) {
+      continue;
+    }
+    // pdf of L is D * NdotH / (4 * VdotH), with NdotH = VdotH
+    const auto pdf = ggxDistribution(H.z, alpha) / 4;
+    const auto sampleSolidAngle = 1 / (count * pdf + 1e-6f);
+    // One level more blurs between the samples (GPU Gems 3, chapter 20)
+    const auto lod =
+        std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1, 0.f);
+    samples.push_back(PrefilterSample{L, L.z, lod});
+  }
+  return samples;
+}
+
+void convolveSH(glm::vec3 *irradianceSH)
+{
+  // Clamped cosine lobe (Ramamoorthi and Hanrahan) divided by pi
+  const float bandFactors[3] = {1.f, 2.f / 3, 1.f / 4};
+  for (int i = 0; i < 9; ++i) {
+    irradianceSH[i] *= bandFactors[i == 0 ? 0 : i < 4 ? 1 : 2];
+  }
+}
+
+size_t specularTexelCount(int size, int levelCount)
+{
+  size_t count = 0;
+  for (int level = 0; level < levelCount; ++level) {
+    const auto levelSize = size_t(std::max(size >> level, 1));
+    count += 6 * levelSize * levelSize * 3;
+  }
+  return count;
+}
+
+} // namespace
+
+bool loadEquirectangularImage(const std::string &content,
+    EquirectangularImage &image, std::string &error)
+{
+  int width = 0;
+  int height = 0;
+  int componentCount = 0;
+  auto *texels = stbi_loadf_from_memory(
+      reinterpret_cast<const stbi_uc *>(content.data()), int(content.size()),
+      &width, &height, &componentCount, 3);
+  if (!texels) {
+    error = stbi_failure_reason();
+    return false;
+  }
+  image.width = width;
+  image.height = height;
+  image.texels.assign(texels, texels + size_t(width) * height * 3);
+  stbi_image_free(texels);
+  return true;
+}
+
+void projectIrradianceSH(
+    const EquirectangularImage &image, glm::vec3 *irradianceSH)
+{
+  std::vector<float> cosPhi(size_t(image.width));
+  std::vector<float> sinPhi(size_t(image.width));
+  for (int x = 0; x < image.width; ++x) {
+    const auto phi = 2 * pi * ((x + 0.5f) / image.width - 0.5f);
+    cosPhi[x] = std::cos(phi);
+    sinPhi[x] = std::sin(phi);
+  }
+  // Rows are summed in order afterwards: the result does not depend on the
+  // scheduling
+  std::vector<double> rowSums(size_t(image.height) * 27);
+  JobSystem::instance().parallelFor(
+      size_t(image.height), 8, [&](size_t begin, size_t end) {
+        for (auto y = begin; y < end; ++y) {
+          sumRowSH(image, int(y), cosPhi, sinPhi, &rowSums[y * 27]);
+        }
+      });
+
+  double sums[27] = {};
+  const auto texelArea = (2 * double(pi) / image.width) * (pi / image.height);
+  for (int y = 0; y < image.height; ++y) {
+    const auto solidAngle = texelArea * std::sin(pi * (y + 0.5) / image.height);
+    for (int i = 0; i < 27; ++i) {
+      sums[i] += solidAngle * rowSums[size_t(y) * 27 + i];
+    }
+  }
+  for (int i = 0; i < 9; ++i) {
+    irradianceSH[i] =
+        glm::vec3(sums[i * 3], sums[i * 3 + 1], sums[i * 3 + 2]);
+  }
+  convolveSH(irradianceSH);
+}
+
+void prefilterSpecularCubemap(const EquirectangularImage &image,
+    const EnvironmentOptions &options, EnvironmentLighting &lighting)
+{
+  auto levelCount = std::max(options.specularLevelCount, 1);
+  while (levelCount > 1 && (options.specularSize >> (levelCount - 1)) < 4) {
+    --levelCount;
+  }
+  lighting.specularSize = options.specularSize;
+  lighting.specularLevelCount = levelCount;
+  lighting.specularTexels.resize(
+      specularTexelCount(options.specularSize, levelCount));
+
+  const auto sourceLevels = buildMipLevels(image);
+  const auto sourceTexelSolidAngle =
+      4 * pi / (float(image.width) * image.height);
+  auto *texels = lighting.specularTexels.data();
+  for (int level = 0; level < levelCount; ++level) {
+    const auto size = std::max(options.specularSize >> level, 1);
+    const auto roughness = levelCount > 1 ? float(level) / (levelCount - 1) : 0;
+    const auto alpha = roughness * roughness;
+    // The mirror level reads the source at the resolution of the cubemap
+    const auto cubeTexelSolidAngle = 4 * pi / (6.f * size * size);
+    const auto mirrorLod = std::max(
+        0.5f * std::log2(cubeTexelSolidAngle / sourceTexelSolidAngle), 0.f);
+    const auto samples =
+        level ? computePrefilterSamples(
+                    options.specularSampleCount, alpha, sourceTexelSolidAngle)
+              : std::vector<PrefilterSample>();
+
+    JobSystem::instance().parallelFor(
+        size_t(6 * size), 4, [&](size_t begin, size_t end) {
+          for (auto row = begin; row < end; ++row) {
+            const auto face = int(row) / size;
+            const auto y = int(row) % size;
+            auto *rowTexels = texels + row * size * 3;
+            for (int x = 0; x < size; ++x) {
+              const auto N = glm::normalize(cubemapDirection(face,
+                  2 * (x + 0.5f) / size - 1, 2 * (y + 0.5f) / size - 1));
+              auto color = glm::vec3(0);
+              if (samples.empty()) {
+                color = sampleTrilinear(sourceLevels, N, mirrorLod);
+              } else {
+                const auto up = std::abs(N.y) < 0.999f ? glm::vec3(0, 1, 0)
+                                                       : glm::vec3(1, 0, 0);
+                const auto T = glm::normalize(glm::cross(up, N));
+                const auto B = glm::cross(N, T);
+                auto weightSum = 0.f;
+                for (const auto &sample : samples) {
+                  const auto L = T * sample.direction.x +
+                                 B * sample.direction.y +
+                                 N * sample.direction.z;
+                  color += sample.weight *
+                           sampleTrilinear(sourceLevels, L, sample.lod);
+                  weightSum += sample.weight;
+                }
+                color /= std::max(weightSum, 1e-6f);
+              }
+              rowTexels[x * 3] = color.r;
+              rowTexels[x * 3 + 1] = color.g;
+              rowTexels[x * 3 + 2] = color.b;
+            }
+          }
+        });
+    texels += size_t(6) * size * size * 3;
+  }
+}
+
+void computeBrdfLut(
+    const EnvironmentOptions &options, EnvironmentLighting &lighting)
+{
+  const auto size = std::max(options.brdfLutSize, 1);
+  const auto sampleCount = std::max(options.brdfSampleCount, 1);
+  lighting.brdfLutSize = size;
+  lighting.brdfLut.resize(size_t(size) * size * 2);
+  JobSystem::instance().parallelFor(
+      size_t(size), 1, [&](size_t begin, size_t end) {
+        for (auto y = begin; y < end; ++y) {
+          const auto roughness = (y + 0.5f) / size;
+          const auto alpha = roughness * roughness;
+          const auto alpha2 = alpha * alpha;
+          for (int x = 0; x < size; ++x) {
+            const auto NdotV = (x + 0.5f) / size;
+            const auto V =
+                glm::vec3(std::sqrt(1 - NdotV * NdotV), 0, NdotV);
+            auto scale = 0.f;
+            auto bias = 0.f;
+            for (int i = 0; i < sampleCount; ++i) {
+              const auto H = sampleGgxHalfVector(i, sampleCount, alpha);
+              const auto VdotH = glm::dot(V, H);
+              const auto L = 2 * VdotH * H - V;
+              const auto NdotL = L.z;
+              if (NdotL <= 0 || VdotH <= 0) {
+                continue;
+              }
+              // Height correlated Smith visibility, as in the shaders. The
+              // sample weight is f * NdotL / pdf without F and D.
+              const auto vis =
+                  0.5f / (NdotL * std::sqrt(NdotV * NdotV * (1 - alpha2) +
+                                            alpha2) +
+                             NdotV * std::sqrt(NdotL * NdotL * (1 - alpha2) +
+                                                alpha2));
+              const auto weight = 4 * vis * NdotL * VdotH / H.z;
+              const auto fresnel = std::pow(1 - VdotH, 5.f);
+              scale += (1 - fresnel) * weight;
+              bias += fresnel * weight;
+            }
+            auto *texel = &lighting.brdfLut[(y * size + x) * 2];
+            texel[0] = scale / sampleCount;
+            texel[1] = bias / sampleCount;
+          }
+        }
+      });
+}
+
+void computeEnvironmentLighting(const EquirectangularImage &image,
+    const EnvironmentOptions &options, EnvironmentLighting &lighting,
+    EnvironmentStats &stats)
+{
+  auto start = Clock::now();
+  projectIrradianceSH(image, lighting.irradianceSH);
+  stats.irradianceSeconds = secondsSince(start);
+  start = Clock::now();
+  prefilterSpecularCubemap(image, options, lighting);
+  stats.specularSeconds = secondsSince(start);
+  start = Clock::now();
+  computeBrdfLut(options, lighting);
+  stats.brdfSeconds = secondsSince(start);
+}
+
+uint64_t computeEnvironmentHash(
+    const std::string &content, const EnvironmentOptions &options)
+{
+  uint64_t hash = std::hash<std::string_view>{}(content);
+  const int values[] = {options.specularSize, options.specularLevelCount,
+      options.specularSampleCount, options.brdfLutSize,
+      options.brdfSampleCount};
+  for (const auto value : values) {
+    hash ^= std::hash<int>{}(value) + 0x9e3779b97f4a7c15ull + (hash << 6) +
+            (hash >> 2);
+  }
+  return hash;
+}
+
+bool writeEnvironmentCache(const EnvironmentLighting &lighting,
+    uint64_t sourceHash, const fs::path &cachePath, std::string &error)
+{
+  // Written to a temporary file first so that an interrupted write never
+  // leaves a valid looking cache
+  const auto tmpPath = cachePath.string() + ".tmp";
+  std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    error = "Unable to create " + tmpPath;
+    return false;
+  }
+  EnvironmentCacheHeader header;
+  std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+  header.version = cacheVersion;
+  header.specularSize = lighting.specularSize;
+  header.specularLevelCount = lighting.specularLevelCount;
+  header.brdfLutSize = lighting.brdfLutSize;
+  header.sourceHash = sourceHash;
+  std::memcpy(header.irradianceSH, lighting.irradianceSH,
+      sizeof(header.irradianceSH));
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(lighting.specularTexels.data()),
+      std::streamsize(lighting.specularTexels.size() * sizeof(float)));
+  file.write(reinterpret_cast<const char *>(lighting.brdfLut.data()),
+      std::streamsize(lighting.brdfLut.size() * sizeof(float)));
+  file.close();
+  if (!file) {
+    error = "Unable to write " + tmpPath;
+    return false;
+  }
+
+  std::error_code ec;
+  fs::rename(tmpPath, cachePath, ec);
+  if (ec) {
+    error = "Unable to rename " + tmpPath + ": " + ec.message();
+    return false;
+  }
+  return true;
+}
+
+bool readEnvironmentCache(const fs::path &cachePath, uint64_t sourceHash,
+    EnvironmentLighting &lighting, std::string &error)
+{
+  std::ifstream file(cachePath.string(), std::ios::binary);
+  if (!file) {
+    error = "Unable to open " + cachePath.string();
+    return false;
+  }
+  EnvironmentCacheHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+      header.version != cacheVersion) {
+    error = cachePath.string() + " is not an environment cache file";
+    return false;
+  }
+  if (header.sourceHash != sourceHash) {
+    error = cachePath.string() +
+            " has been built from another environment or other options";
+    return false;
+  }
+  lighting.specularSize = header.specularSize;
+  lighting.specularLevelCount = header.specularLevelCount;
+  lighting.brdfLutSize = header.brdfLutSize;
+  std::memcpy(lighting.irradianceSH, header.irradianceSH,
+      sizeof(header.irradianceSH));
+  lighting.specularTexels.resize(
+      specularTexelCount(header.specularSize, header.specularLevelCount));
+  lighting.brdfLut.resize(size_t(header.brdfLutSize) * header.brdfLutSize * 2);
+  if (!file.read(reinterpret_cast<char *>(lighting.specularTexels.data()),
+          std::streamsize(lighting.specularTexels.size() * sizeof(float))) ||
+      !file.read(reinterpret_cast<char *>(lighting.brdfLut.data()),
+          std::streamsize(lighting.brdfLut.size() * sizeof(float)))) {
+    error = "Unable to read the textures of " + cachePath.string();
+    return false;
+  }
+  return true;
+}
+
+EnvironmentTextures::EnvironmentTextures(const EnvironmentLighting &lighting) :
+    m_specularLevelCount(lighting.specularLevelCount)
+{
+  // Filtering across the edges of the faces: rough levels are small
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  glGenTextures(1, &m_specularCubemap);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, m_specularCubemap);
+  glTexStorage2D(GL_TEXTURE_CUBE_MAP, lighting.specularLevelCount, GL_RGB16F,
+      lighting.specularSize, lighting.specularSize);
+  const auto *texels = lighting.specularTexels.data();
+  for (int level = 0; level < lighting.specularLevelCount; ++level) {
+    const auto size = std::max(lighting.specularSize >> level, 1);
+    for (int face = 0; face < 6; ++face) {
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0,
+          size, size, GL_RGB, GL_FLOAT, texels);
+      texels += size_t(size) * size * 3;
+    }
+  }
+  glTexParameteri(
+      GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+  glGenTextures(1, &m_brdfLut);
+  glBindTexture(GL_TEXTURE_2D, m_brdfLut);
+  glTexStorage2D(
+      GL_TEXTURE_2D, 1, GL_RG16F, lighting.brdfLutSize, lighting.brdfLutSize);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lighting.brdfLutSize,
+      lighting.brdfLutSize, GL_RG, GL_FLOAT, lighting.brdfLut.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+EnvironmentTextures::~EnvironmentTextures()
+{
+  glDeleteTextures(1, &m_specularCubemap);
+  glDeleteTextures(1, &m_brdfLut);
+}
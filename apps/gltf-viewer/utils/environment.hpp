@@ -0,0 +1,119 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Image based lighting from an equirectangular environment map: the diffuse
+// irradiance as 9 spherical harmonics coefficients, a cubemap of the
+// environment prefiltered with the GGX distribution of increasing roughness
+// along its mip levels, and the split sum BRDF lookup table (Karis, Real
+// Shading in Unreal Engine 4). Everything is computed once on the CPU and
+// cached to disk; a fragment then costs the evaluation of the harmonics and
+// two texture fetches.
+
+struct EnvironmentOptions
+{
+  int specularSize = 256; // Side of the faces of the base level of the cubemap
+  // Roughness of level i is i / (specularLevelCount - 1). Reduced so that the
+  // last level is at least 4x4.
+  int specularLevelCount = 6;
+  int specularSampleCount = 128; // GGX samples per texel of rough levels
+  int brdfLutSize = 128;
+  int brdfSampleCount = 512; // GGX samples per texel of the BRDF LUT
+};
+
+// RGB floats, row 0 at the top (+Y). The left column looks along -X, the
+// columns a quarter of the width further along -Z, +X and +Z.
+struct EquirectangularImage
+{
+  int width = 0;
+  int height = 0;
+  std::vector<float> texels;
+};
+
+struct EnvironmentLighting
+{
+  // Irradiance divided by pi: a surface of normal n and diffuse color c
+  // reflects c * sum(irradianceSH[i] * Y_i(n))
+  glm::vec3 irradianceSH[9];
+  int specularSize = 0;
+  int specularLevelCount = 0;
+  // RGB floats of the 6 faces of each level from the base level, faces in
+  // GL order (+X, -X, +Y, -Y, +Z, -Z)
+  std::vector<float> specularTexels;
+  int brdfLutSize = 0;
+  // Scale and bias of F0 (RG floats), NdotV along x, roughness along y
+  std::vector<float> brdfLut;
+};
+
+// Times of the steps of computeEnvironmentLighting()
+struct EnvironmentStats
+{
+  double irradianceSeconds = 0;
+  double specularSeconds = 0;
+  double brdfSeconds = 0;
+};
+
+// Decode an image stb_image reads as floats: Radiance .hdr, or LDR images
+// converted to linear
+bool loadEquirectangularImage(const std::string &content,
+    EquirectangularImage &image, std::string &error);
+
+// Project the irradiance of image on the 9 first spherical harmonics. Rows
+// are summed by jobs of the JobSystem, 4 texels at a time with SSE.
+void projectIrradianceSH(
+    const EquirectangularImage &image, glm::vec3 *irradianceSH);
+
+// Fill lighting.specularTexels, by jobs over the rows of the faces. Each
+// texel averages GGX importance samples of image, each one read from the mip
+// level of image whose texels match its solid angle (filtered importance
+// sampling), so that a few samples do not alias.
+void prefilterSpecularCubemap(const EquirectangularImage &image,
+    const EnvironmentOptions &options, EnvironmentLighting &lighting);
+
+// Fill lighting.brdfLut
+void computeBrdfLut(
+    const EnvironmentOptions &options, EnvironmentLighting &lighting);
+
+// All of the above
+void computeEnvironmentLighting(const EquirectangularImage &image,
+    const EnvironmentOptions &options, EnvironmentLighting &lighting,
+    EnvironmentStats &stats);
+
+// Identifies the lighting computed from the file content with options
+uint64_t computeEnvironmentHash(
+    const std::string &content, const EnvironmentOptions &options);
+
+bool writeEnvironmentCache(const EnvironmentLighting &lighting,
+    uint64_t sourceHash, const fs::path &cachePath, std::string &error);
+
+// Fails if the cache file has been written for another sourceHash
+bool readEnvironmentCache(const fs::path &cachePath, uint64_t sourceHash,
+    EnvironmentLighting &lighting, std::string &error);
+
+// GL textures of an EnvironmentLighting: the specular cubemap (RGB16F, with
+// seamless filtering) and the BRDF LUT (RG16F)
+class EnvironmentTextures
+{
+public:
+  explicit EnvironmentTextures(const EnvironmentLighting &lighting);
+  ~EnvironmentTextures();
+
+  EnvironmentTextures(const EnvironmentTextures &) = delete;
+  EnvironmentTextures &operator=(const EnvironmentTextures &) = delete;
+
+  GLuint specularCubemap() const { return m_specularCubemap; }
+  GLuint brdfLut() const { return m_brdfLut; }
+  int specularLevelCount() const { return m_specularLevelCount; }
+
+private:
+  GLuint m_specularCubemap = 0;
+  GLuint m_brdfLut = 0;
+  int m_specularLevelCount = 0;
+};
@@ -0,0 +1,494 @@
+#include "file_reader.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_PREAD 1
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define USE_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Synchronous read of a whole file, used by the thread pool fallback
+bool readWholeFile(const std::string &path, std::vector<unsigned char> &data)
+{
+#ifdef USE_PREAD
+  const auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    close(fd);
+    return false;
+  }
+  data.resize(size_t(fileStat.st_size));
+  size_t offset = 0;
+  while (offset < data.size()) {
+    const auto readBytes =
+        pread(fd, data.data() + offset, data.size() - offset, off_t(offset));
+    if (readBytes <= 0) {
+      close(fd);
+      data.clear();
+      return false;
+    }
+    offset += size_t(readBytes);
+  }
+  close(fd);
+  return true;
+#else
+  std::ifstream input(path, std::ios::binary | std::ios::ate);
+  if (!input) {
+    return false;
+  }
+  data.resize(size_t(input.tellg()));
+  input.seekg(0);
+  if (!input.read(reinterpret_cast<char *>(data.data()), data.size())) {
+    data.clear();
+    return false;
+  }
+  return true;
+#endif
+}
+
+FileReadStats readFilesWithThreadPool(
+    const std::vector<std::string> &paths, const FileReadCallback &onFileRead)
+{
+  FileReadStats stats;
+  stats.fileCount = paths.size();
+
+  std::vector<std::vector<unsigned char>> contents(paths.size());
+  std::vector<char> succeeded(paths.size(), 0);
+
+  std::mutex mutex;
+  std::condition_variable completionAvailable;
+  std::deque<size_t> completedFiles;
+
+  // More threads than cores: they spend their time blocked on I/O
+  const auto threadCount =
+      std::min(paths.size(), std::max(size_t(4), 2 * workerThreadCount()));
+  std::atomic<size_t> nextFile{0};
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount);
+  for (size_t t = 0; t < threadCount; ++t) {
+    threads.emplace_back([&]() {
+      for (auto fileIdx = nextFile++; fileIdx < paths.size();
+           fileIdx = nextFile++) {
+        succeeded[fileIdx] = readWholeFile(paths[fileIdx], contents[fileIdx]);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          completedFiles.push_back(fileIdx);
+        }
+        completionAvailable.notify_one();
+      }
+    });
+  }
+
+  for (size_t handledCount = 0; handledCount < paths.size(); ++handledCount) {
+    size_t fileIdx;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (completedFiles.empty()) {
+        const auto waitStart = Clock::now();
+        completionAvailable.wait(
+            lock, [&]() { return !completedFiles.empty(); });
+        stats.ioWaitSeconds += secondsSince(waitStart);
+      }
+      fileIdx = completedFiles.front();
+      completedFiles.pop_front();
+    }
+    stats.byteCount += contents[fileIdx].size();
+    onFileRead(fileIdx, contents[fileIdx], succeeded[fileIdx] != 0);
+    contents[fileIdx] = std::vector<unsigned char>();
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  return stats;
+}
+
+#ifdef USE_IO_URING
+
+// Minimal io_uring wrapper using raw syscalls (liburing is not a dependency).
+// Only what readFiles needs: submit READV operations and reap completions.
+class IoUring
+{
+public:
+  explicit IoUring(unsigned entries)
+  {
+    io_uring_params params = {};
+    m_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (m_fd < 0) {
+      return;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const auto singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+      m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    m_cqRing = singleMmap ? m_sqRing
+                          : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, m_fd,
+                                IORING_OFF_CQ_RING);
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe *>(
+        mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+    if (m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED ||
+        m_sqes == MAP_FAILED) {
+      release();
+      return;
+    }
+
+    auto *sq = static_cast<char *>(m_sqRing);
+    m_sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    m_sqEntries = params.sq_entries;
+
+    auto *cq = static_cast<char *>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  ~IoUring() { release(); }
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  bool valid() const { return m_fd >= 0; }
+
+  unsigned capacity() const { return m_sqEntries; }
+
+  // Queue a read; it is only sent to the kernel by submitAndWait()
+  void queueRead(int fd, const iovec *iov, uint64_t offset, uint64_t userData)
+  {
+    const auto tail = *m_sqTail;
+    const auto index = tail & m_sqMask;
+    auto &sqe = m_sqes[index];
+    sqe = io_uring_sqe{};
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = fd;
+    sqe.off = offset;
+    sqe.addr = reinterpret_cast<uint64_t>(iov);
+    sqe.len = 1;
+    sqe.user_data = userData;
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  // Submit queued reads and block until at least one completion is available.
+  // Interrupted calls are retried. Returns 0, or the errno of io_uring_enter:
+  // after EAGAIN or EBUSY, the completions must be reaped before trying again,
+  // the reads that were not submitted stay queued.
+  int submitAndWait()
+  {
+    for (;;) {
+      const auto toSubmit = unsubmittedCount();
+      if (syscall(__NR_io_uring_enter, m_fd, toSubmit, 1,
+              IORING_ENTER_GETEVENTS, nullptr, 0) >= 0) {
+        return 0;
+      }
+      if (errno != EINTR) {
+        return errno;
+      }
+    }
+  }
+
+  // Block until a completion is available, without submitting anything.
+  // Returns false if the ring can no longer be waited on.
+  bool waitCompletion()
+  {
+    for (;;) {
+      if (syscall(__NR_io_uring_enter, m_fd, 0, 1, IORING_ENTER_GETEVENTS,
+              nullptr, 0) >= 0) {
+        return true;
+      }
+      if (errno == EBUSY) {
+        return true; // Completions are waiting to be reaped
+      }
+      if (errno != EINTR && errno != EAGAIN) {
+        return false;
+      }
+    }
+  }
+
+  // Remove the queued reads that were not submitted, calling
+  // onDropped(userData) for each of them
+  template <typename Function> void dropUnsubmitted(Function &&onDropped)
+  {
+    const auto head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    for (auto tail = *m_sqTail; tail != head;) {
+      --tail;
+      onDropped(m_sqes[m_sqArray[tail & m_sqMask]].user_data);
+    }
+    __atomic_store_n(m_sqTail, head, __ATOMIC_RELEASE);
+  }
+
+  // Pop a completion if one is available
+  bool popCompletion(io_uring_cqe &cqe)
+  {
+    const auto head = *m_cqHead;
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+      return false;
+    }
+    cqe = m_cqes[head & m_cqMask];
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+private:
+  unsigned unsubmittedCount() const
+  {
+    return *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+  }
+
+  void release()
+  {
+    if (m_sqes && m_sqes != MAP_FAILED) {
+      munmap(m_sqes, m_sqesSize);
+    }
+    if (m_cqRing && m_cqRing != MAP_FAILED && m_cqRing != m_sqRing) {
+      munmap(m_cqRing, m_cqRingSize);
+    }
+    if (m_sqRing && m_sqRing != MAP_FAILED) {
+      munmap(m_sqRing, m_sqRingSize);
+    }
+    m_sqes = nullptr;
+    m_cqRing = m_sqRing = nullptr;
+    if (m_fd >= 0) {
+      close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+  int m_fd = -1;
+  void *m_sqRing = nullptr;
+  void *m_cqRing = nullptr;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqRingSize = 0;
+  size_t m_cqRingSize = 0;
+  size_t m_sqesSize = 0;
+
+  unsigned *m_sqHead = nullptr;
+  unsigned *m_sqTail = nullptr;
+  unsigned *m_sqArray = nullptr;
+  unsigned m_sqMask = 0;
+  unsigned m_sqEntries = 0;
+
+  unsigned *m_cqHead = nullptr;
+  unsigned *m_cqTail = nullptr;
+  unsigned m_cqMask = 0;
+  io_uring_cqe *m_cqes = nullptr;
+};
+
+// Returns false if io_uring could not be used at all, in which case no
+// callback has been called and the caller should fall back to the thread pool
+bool readFilesWithIoUring(const std::vector<std::string> &paths,
+    const FileReadCallback &onFileRead, FileReadStats &stats)
+{
+  // All reads are in flight at the same time, up to the ring capacity
+  const auto ringEntries =
+      unsigned(std::min(std::max(paths.size(), size_t(1)), size_t(4096)));
+  IoUring ring(ringEntries);
+  if (!ring.valid()) {
+    return false;
+  }
+
+  struct FileRead
+  {
+    int fd = -1;
+    std::vector<unsigned char> data;
+    size_t offset = 0; // Number of bytes already read
+    iovec iov;
+    bool done = false;
+  };
+  std::vector<FileRead> reads(paths.size());
+
+  stats = FileReadStats{};
+  stats.fileCount = paths.size();
+  stats.usedIoUring = true;
+
+  size_t completedCount = 0;
+  const auto completeWith = [&](size_t fileIdx,
+                                std::vector<unsigned char> &data,
+                                bool succeeded) {
+    if (!succeeded) {
+      data.clear();
+    }
+    stats.byteCount += data.size();
+    ++completedCount;
+    onFileRead(fileIdx, data, succeeded);
+    data = std::vector<unsigned char>();
+  };
+  const auto complete = [&](size_t fileIdx, bool succeeded) {
+    auto &read = reads[fileIdx];
+    if (read.fd >= 0) {
+      close(read.fd);
+      read.fd = -1;
+    }
+    read.done = true;
+    completeWith(fileIdx, read.data, succeeded);
+  };
+
+  // Opening is synchronous, only the reads go through the ring
+  std::vector<size_t> toQueue;
+  for (size_t fileIdx = 0; fileIdx < paths.size(); ++fileIdx) {
+    auto &read = reads[fileIdx];
+    read.fd = open(paths[fileIdx].c_str(), O_RDONLY);
+    struct stat fileStat;
+    if (read.fd < 0 || fstat(read.fd, &fileStat) != 0) {
+      complete(fileIdx, false);
+      continue;
+    }
+    read.data.resize(size_t(fileStat.st_size));
+    if (read.data.empty()) {
+      complete(fileIdx, true);
+      continue;
+    }
+    toQueue.push_back(fileIdx);
+  }
+
+  const auto queueRead = [&](size_t fileIdx) {
+    auto &read = reads[fileIdx];
+    read.iov.iov_base = read.data.data() + read.offset;
+    read.iov.iov_len = read.data.size() - read.offset;
+    ring.queueRead(read.fd, &read.iov, read.offset, fileIdx);
+  };
+
+  size_t nextToQueue = 0;
+  unsigned inFlight = 0;
+  while (completedCount < paths.size()) {
+    while (nextToQueue < toQueue.size() && inFlight < ring.capacity()) {
+      queueRead(toQueue[nextToQueue++]);
+      ++inFlight;
+    }
+
+    const auto waitStart = Clock::now();
+    const auto error = ring.submitAndWait();
+    if (error == EAGAIN || error == EBUSY) {
+      // Out of kernel resources: reap what completed, then submit again
+      std::this_thread::yield();
+    } else if (error) {
+      std::cerr << "io_uring_enter failed (" << std::strerror(error)
+                << "), finishing reads with pread" << std::endl;
+      // The kernel writes into the buffers of the submitted reads until they
+      // complete: wait for them before reading the files again
+      ring.dropUnsubmitted([&](uint64_t) { --inFlight; });
+      io_uring_cqe cqe;
+      while (inFlight > 0) {
+        if (ring.popCompletion(cqe)) {
+          --inFlight;
+        } else if (!ring.waitCompletion()) {
+          break;
+        }
+      }
+      std::vector<size_t> remaining;
+      for (size_t fileIdx = 0; fileIdx < reads.size(); ++fileIdx) {
+        auto &read = reads[fileIdx];
+        if (!read.done) {
+          remaining.push_back(fileIdx);
+          if (read.fd >= 0) {
+            close(read.fd);
+            read.fd = -1;
+          }
+        }
+      }
+      if (inFlight > 0) {
+        // Some reads could not be waited on: leak their buffers and iovecs
+        // rather than freeing memory the kernel may still write to
+        new std::vector<FileRead>(std::move(reads));
+      }
+      for (const auto fileIdx : remaining) {
+        std::vector<unsigned char> data;
+        const auto succeeded = readWholeFile(paths[fileIdx], data);
+        completeWith(fileIdx, data, succeeded);
+      }
+      break;
+    }
+    stats.ioWaitSeconds += secondsSince(waitStart);
+
+    io_uring_cqe cqe;
+    while (ring.popCompletion(cqe)) {
+      --inFlight;
+      const auto fileIdx = size_t(cqe.user_data);
+      auto &read = reads[fileIdx];
+      if (cqe.res <= 0) {
+        complete(fileIdx, false);
+        continue;
+      }
+      read.offset += size_t(cqe.res);
+      if (read.offset < read.data.size()) {
+        // Short read: queue the remaining part
+        toQueue.push_back(fileIdx);
+      } else {
+        complete(fileIdx, true);
+      }
+    }
+  }
+
+  return true;
+}
+
+#endif
+
+} // namespace
+
+FileReadStats readFiles(
+    const std::vector<std::string> &paths, const FileReadCallback &onFileRead)
+{
+  if (paths.empty()) {
+    return FileReadStats{};
+  }
+#ifdef USE_IO_URING
+  FileReadStats stats;
+  if (readFilesWithIoUring(paths, onFileRead, stats)) {
+    return stats;
+  }
+#endif
+  return readFilesWithThreadPool(paths, onFileRead);
+}
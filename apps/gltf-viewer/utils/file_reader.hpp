@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+struct FileReadStats
+{
+  size_t fileCount = 0;
+  size_t byteCount = 0;
+  // Time the calling thread spent blocked waiting for reads to complete
+  double ioWaitSeconds = 0.;
+  bool usedIoUring = false;
+};
+
+// Called on the calling thread of readFiles() each time a file has been
+// entirely read. data can be moved from. succeeded is false if the file could
+// not be opened or read, data is empty in that case.
+using FileReadCallback = std::function<void(
+    size_t fileIdx, std::vector<unsigned char> &data, bool succeeded)>;
+
+// Read all the files in one batch and call onFileRead as soon as each one
+// completes, in completion order.
+// On Linux all reads are submitted at once to an io_uring; if io_uring is not
+// available (old kernel, seccomp, other OS) the reads are issued by a pool of
+// threads using pread. Either way the latency of each read overlaps with the
+// others, which matters on network-mounted or cold-cache storage.
+FileReadStats readFiles(
+    const std::vector<std::string> &paths, const FileReadCallback &onFileRead);
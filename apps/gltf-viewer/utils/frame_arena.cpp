@@ -0,0 +1,61 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+
+// Alignment of the blocks, and largest alignment supported by allocate()
+const size_t blockAlignment = alignof(std::max_align_t);
+
+size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+FrameArena::FrameArena(size_t byteCount) :
+    m_block(new unsigned char[std::max(byteCount, blockAlignment)]),
+    m_byteCount(std::max(byteCount, blockAlignment))
+{
+}
+
+void *FrameArena::allocate(size_t byteCount, size_t alignment)
+{
+  const auto offset = alignUp(m_offset, alignment);
+  if (offset + byteCount <= m_byteCount) {
+    m_offset = offset + byteCount;
+    return m_block.get() + offset;
+  }
+  // Does not fit: the allocation gets its own block until reset()
+  m_extraBlocks.emplace_back(new unsigned char[std::max(byteCount, size_t(1))]);
+  m_extraByteCount += alignUp(byteCount, blockAlignment);
+  return m_extraBlocks.back().get();
+}
+
+void FrameArena::reset()
+{
+  m_usedByteCount = m_offset + m_extraByteCount;
+  if (!m_extraBlocks.empty()) {
+    // Room for the whole frame with some slack, since frames vary
+    const auto byteCount = alignUp(
+        m_usedByteCount + m_usedByteCount / 4, blockAlignment);
+    m_extraBlocks.clear();
+    m_extraByteCount = 0;
+    m_block.reset(new unsigned char[byteCount]);
+    m_byteCount = byteCount;
+    ++m_growCount;
+  }
+  m_offset = 0;
+}
+
+FrameArenaStats FrameArena::stats() const
+{
+  FrameArenaStats stats;
+  stats.capacityByteCount = m_byteCount;
+  stats.usedByteCount = m_usedByteCount;
+  stats.growCount = m_growCount;
+  return stats;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+struct FrameArenaStats
+{
+  size_t capacityByteCount = 0;
+  size_t usedByteCount = 0; // By the last frame
+  size_t growCount = 0; // Frames that did not fit in the arena
+};
+
+// Bump allocator for the transient data of a frame (draw lists, sort
+// buffers). Allocating moves a pointer forward and reset() frees everything
+// at once, at the start of the next frame. Allocations that do not fit go to
+// extra blocks and reset() replaces the arena with a single block large
+// enough for the whole frame: after a few frames of warm-up, frames do not
+// allocate from the heap anymore.
+// Objects allocated in the arena are never destroyed: they must be trivially
+// destructible, or destroyed by their user.
+class FrameArena
+{
+public:
+  explicit FrameArena(size_t byteCount = 1 << 20);
+
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  void *allocate(size_t byteCount, size_t alignment);
+
+  template <typename T> T *allocateArray(size_t count)
+  {
+    return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Free all the allocations of the frame
+  void reset();
+
+  FrameArenaStats stats() const;
+
+private:
+  std::unique_ptr<unsigned char[]> m_block;
+  size_t m_byteCount;
+  size_t m_offset = 0;
+  std::vector<std::unique_ptr<unsigned char[]>> m_extraBlocks;
+  size_t m_extraByteCount = 0;
+  size_t m_usedByteCount = 0;
+  size_t m_growCount = 0;
+};
+
+// Standard allocator allocating from a FrameArena, for containers that live
+// during a frame: FrameVector<T> list(FrameArenaAllocator<T>(arena))
+// Memory is only reclaimed by FrameArena::reset(), reserve() the expected
+// size to avoid leaving the smaller buffers of a growing vector behind.
+template <typename T> class FrameArenaAllocator
+{
+public:
+  using value_type = T;
+
+  explicit FrameArenaAllocator(FrameArena &arena) : m_arena(&arena) {}
+
+  template <typename U>
+  FrameArenaAllocator(const FrameArenaAllocator<U> &other) :
+      m_arena(other.arena())
+  {
+  }
+
+  T *allocate(size_t count) { return m_arena->allocateArray<T>(count); }
+  void deallocate(T *, size_t) {}
+
+  FrameArena *arena() const { return m_arena; }
+
+  template <typename U> bool operator==(const FrameArenaAllocator<U> &other)
+  {
+    return m_arena == other.arena();
+  }
+  template <typename U> bool operator!=(const FrameArenaAllocator<U> &other)
+  {
+    return m_arena != other.arena();
+  }
+
+private:
+  FrameArena *m_arena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameArenaAllocator<T>>;
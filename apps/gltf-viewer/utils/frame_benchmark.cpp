@@ -0,0 +1,133 @@
+#include "frame_benchmark.hpp"
+
+#include "allocation_counter.hpp"
+#include "glfw.hpp"
+#include "gpu_timer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+namespace
+{
+
+void printTimes(const char *name, std::vector<double> times)
+{
+  // The first frame uploads and warms up caches
+  if (times.size() > 1) {
+    times.erase(begin(times));
+  }
+  std::sort(begin(times), end(times));
+  const auto mean =
+      std::accumulate(begin(times), end(times), 0.) / times.size();
+  std::cout << "  " << name << ": mean " << mean * 1e3 << " ms, median "
+            << times[times.size() / 2] * 1e3 << " ms, max "
+            << times.back() * 1e3 << " ms" << std::endl;
+}
+
+} // namespace
+
+int runFrameBenchmark(const FrameBenchmarkOptions &options,
+    const std::function<void()> &drawFrame,
+    const std::function<void()> &swapBuffers, const DrawStats &drawStats,
+    const FrameArena &frameArena)
+{
+  GLuint timerQuery;
+  glGenQueries(1, &timerQuery);
+  std::vector<double> cpuTimes;
+  std::vector<double> gpuTimes;
+  std::vector<double> shadowGpuTimes; // Of the frames read so far
+  std::vector<double> geometryGpuTimes; // Deferred passes, likewise
+  std::vector<double> lightingGpuTimes;
+  std::vector<double> compositeGpuTimes;
+  size_t renderedCascadeCount = 0;
+  cpuTimes.reserve(options.frameCount);
+  gpuTimes.reserve(options.frameCount);
+  for (int frame = 0; frame < options.frameCount; ++frame) {
+    const auto allocationCount = heapAllocationCount();
+    const auto start = glfwGetTime();
+    glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+    drawFrame();
+    glEndQuery(GL_TIME_ELAPSED);
+    cpuTimes.push_back(glfwGetTime() - start);
+    GLuint64 gpuTime = 0;
+    glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuTime);
+    gpuTimes.push_back(gpuTime * 1e-9);
+    renderedCascadeCount += drawStats.shadowStats.renderedCascadeCount;
+    if (options.shadowPassTimer && frame >= int(GpuPassTimer::frameCount)) {
+      shadowGpuTimes.push_back(drawStats.shadowStats.gpuSeconds);
+    }
+    if (options.deferredShading && frame >= int(GpuPassTimer::frameCount)) {
+      const auto &deferredStats = drawStats.deferredStats;
+      geometryGpuTimes.push_back(deferredStats.geometrySeconds);
+      lightingGpuTimes.push_back(deferredStats.lightingSeconds);
+      compositeGpuTimes.push_back(deferredStats.compositeSeconds);
+    }
+    swapBuffers();
+    const auto frameAllocationCount = heapAllocationCount() - allocationCount;
+    if (options.checkAllocations &&
+        frame >= options.allocationWarmupFrameCount && frameAllocationCount) {
+      std::cerr << "Error: frame " << frame << " made " << frameAllocationCount
+                << " heap allocations after warm-up" << std::endl;
+      glDeleteQueries(1, &timerQuery);
+      return -1;
+    }
+  }
+  glDeleteQueries(1, &timerQuery);
+
+  std::cout << "Benchmark: " << options.frameCount << " frames, "
+            << options.width << "x" << options.height << ", "
+            << options.materialPath
+            << (options.vertexPulling ? ", vertex pulling" : "")
+            << (options.deferredShading ? ", deferred shading" : "")
+            << std::endl;
+  printTimes("CPU", cpuTimes);
+  printTimes("GPU", gpuTimes);
+  std::cout << "  per frame: " << drawStats.drawCallCount << " draw calls, "
+            << drawStats.textureBindCount << " texture binds, "
+            << drawStats.vertexArrayBindCount << " VAO binds, "
+            << drawStats.drawnNodeCount << " nodes" << std::endl;
+  std::cout << "  draw list: " << drawStats.sortedDrawCount << " draws ("
+            << drawStats.blendedDrawCount << " blended) sorted in "
+            << drawStats.drawSortSeconds * 1e3 << " ms" << std::endl;
+  std::cout << "  draw commands: recorded in "
+            << drawStats.drawRecordSeconds * 1e3 << " ms ("
+            << drawStats.drawRecordJobCount << " jobs), replayed in "
+            << drawStats.drawReplaySeconds * 1e3 << " ms" << std::endl;
+  if (!shadowGpuTimes.empty()) {
+    std::cout << "  shadows: " << options.shadowCascadeCount << " cascades, "
+              << renderedCascadeCount << " cascade renders in "
+              << options.frameCount << " frames" << std::endl;
+    printTimes("shadow pass GPU", shadowGpuTimes);
+  }
+  if (!geometryGpuTimes.empty()) {
+    // Lower bound of the G-buffer traffic: each overdrawn fragment writes it
+    // again
+    const auto &deferredStats = drawStats.deferredStats;
+    const auto byteCount = 2 * deferredStats.gbufferByteCount;
+    const auto passesSeconds =
+        std::accumulate(begin(geometryGpuTimes), end(geometryGpuTimes), 0.) +
+        std::accumulate(begin(lightingGpuTimes), end(lightingGpuTimes), 0.);
+    std::cout << "  G-buffer: " << deferredStats.gbufferBytesPerPixel
+              << " B per pixel, " << byteCount / 1e6
+              << " MB written and read per frame, "
+              << byteCount * geometryGpuTimes.size() / passesSeconds / 1e9
+              << " GB/s over the geometry and lighting passes" << std::endl;
+    printTimes("G-buffer pass GPU", geometryGpuTimes);
+    printTimes("lighting pass GPU", lightingGpuTimes);
+    printTimes("composite pass GPU", compositeGpuTimes);
+  }
+  if (options.clusteredLights) {
+    const auto &lightStats = drawStats.lightClusterStats;
+    std::cout << "  lights: " << lightStats.lightCount << " binned in "
+              << lightStats.seconds * 1e3 << " ms, "
+              << lightStats.lightIndexCount << " cluster entries"
+              << std::endl;
+  }
+  const auto arenaStats = frameArena.stats();
+  std::cout << "  frame arena: " << arenaStats.usedByteCount / 1e3 << " / "
+            << arenaStats.capacityByteCount / 1e3 << " KB, grown "
+            << arenaStats.growCount << " times" << std::endl;
+  return 0;
+}
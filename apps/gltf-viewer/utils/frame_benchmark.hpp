@@ -0,0 +1,38 @@
+#pragma once
+
+#include "frame_arena.hpp"
+#include "frame_loop.hpp"
+
+#include <functional>
+#include <string>
+
+// Configuration of the benchmarked frames, printed with their timings
+struct FrameBenchmarkOptions
+{
+  int frameCount = 0;
+  int width = 0;
+  int height = 0;
+  std::string materialPath; // "bound textures", "texture arrays", ...
+  bool vertexPulling = false;
+  // The passes are timed on the GPU, their times read in DrawStats after
+  // GpuPassTimer::frameCount frames
+  bool deferredShading = false;
+  bool shadowPassTimer = false;
+  int shadowCascadeCount = 0;
+  bool clusteredLights = false;
+  // Fail on the first frame making heap allocations after warm-up
+  bool checkAllocations = false;
+  int allocationWarmupFrameCount = 0;
+};
+
+// Draw options.frameCount frames with drawFrame, each followed by
+// swapBuffers, and print on std::cout their CPU and GPU times, the times of
+// the timed passes and the drawStats and frameArena stats of the last frame.
+// The GPU time of each frame is read right after its draws, so frames do not
+// overlap: CPU and GPU times are measured separately, not the throughput of
+// a pipelined frame loop.
+// Returns -1 if a frame failed the allocation check, 0 otherwise.
+int runFrameBenchmark(const FrameBenchmarkOptions &options,
+    const std::function<void()> &drawFrame,
+    const std::function<void()> &swapBuffers, const DrawStats &drawStats,
+    const FrameArena &frameArena);
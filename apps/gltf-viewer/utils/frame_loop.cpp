@@ -0,0 +1,150 @@
+#include "frame_loop.hpp"
+
+#include "allocation_counter.hpp"
+
+#include <chrono>
+
+namespace
+{
+
+const size_t maxPendingFrameCount = 8;
+
+// Without a new snapshot, the render thread draws the last one again at
+// this rate. The main thread waits at most as long for its snapshots to be
+// taken.
+const auto maxFrameInterval = std::chrono::milliseconds(16);
+
+} // namespace
+
+FrameLoop::FrameLoop(GLFWHandle &glfwHandle,
+    std::function<void(const FrameSnapshot &)> drawScene,
+    std::function<void(RenderFeedback &)> fillFeedback) :
+    m_glfwHandle(glfwHandle),
+    m_drawScene(std::move(drawScene)),
+    m_fillFeedback(std::move(fillFeedback))
+{
+  m_pendingFrames.reserve(maxPendingFrameCount);
+}
+
+FrameLoop::~FrameLoop() { stop(); }
+
+void FrameLoop::startRenderThread()
+{
+  // Create the objects of the ImGui OpenGL back-end while the context is
+  // current here: this thread builds the ImGui frames, the render thread
+  // only renders their draw data
+  ImGui_ImplOpenGL3_NewFrame();
+  glfwMakeContextCurrent(nullptr);
+  m_renderThread = std::thread([this]() {
+    glfwMakeContextCurrent(m_glfwHandle.window());
+    auto hasSnapshot = false;
+    while (!m_snapshots.isClosed()) {
+      const auto isNewSnapshot = m_snapshots.waitAndAcquire(maxFrameInterval);
+      hasSnapshot |= isNewSnapshot;
+      if (hasSnapshot && !m_snapshots.isClosed()) {
+        renderFrame(m_snapshots.front(), isNewSnapshot);
+      }
+    }
+    deletePendingFrames();
+    glFinish();
+    glfwMakeContextCurrent(nullptr);
+  });
+}
+
+void FrameLoop::pushSceneCommand(std::function<void()> command)
+{
+  std::lock_guard<std::mutex> lock(m_sceneCommandMutex);
+  m_sceneCommands.push_back(std::move(command));
+}
+
+const RenderFeedback &FrameLoop::acquireFeedback()
+{
+  m_feedbacks.acquire();
+  return m_feedbacks.front();
+}
+
+void FrameLoop::publishSnapshot()
+{
+  m_snapshots.publish();
+  if (m_renderThread.joinable()) {
+    // Keep pace with the rendering, without waiting for a slow frame
+    m_snapshots.waitAcquired(maxFrameInterval);
+  } else {
+    m_snapshots.acquire();
+    renderFrame(m_snapshots.front(), true);
+  }
+}
+
+void FrameLoop::stop()
+{
+  // The render thread releases the context on exit: the callers delete GL
+  // objects after stop()
+  if (m_renderThread.joinable()) {
+    m_snapshots.close();
+    m_renderThread.join();
+    glfwMakeContextCurrent(m_glfwHandle.window());
+  } else {
+    deletePendingFrames();
+  }
+}
+
+void FrameLoop::renderFrame(FrameSnapshot &snapshot, bool isNewSnapshot)
+{
+  const auto allocationCount = heapAllocationCount();
+  {
+    std::lock_guard<std::mutex> lock(m_sceneCommandMutex);
+    std::swap(m_sceneCommands, m_runningSceneCommands);
+  }
+  for (const auto &command : m_runningSceneCommands) {
+    command();
+  }
+  m_runningSceneCommands.clear();
+
+  m_drawScene(snapshot);
+  snapshot.gui.render();
+  m_glfwHandle.swapBuffers(); // Swap front and back buffers
+
+  const auto swapTime = glfwGetTime();
+  if (m_lastSwapTime > 0) {
+    m_frameTimes.add(swapTime - m_lastSwapTime);
+  }
+  m_lastSwapTime = swapTime;
+  while (!m_pendingFrames.empty()) {
+    const auto status = glClientWaitSync(m_pendingFrames.front().fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      break;
+    }
+    retirePendingFrame();
+  }
+  if (m_pendingFrames.size() == maxPendingFrameCount) {
+    glClientWaitSync(m_pendingFrames.front().fence,
+        GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1e9));
+    retirePendingFrame();
+  }
+  if (isNewSnapshot) {
+    m_pendingFrames.push_back(PendingFrame{
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), snapshot.inputTime});
+  }
+
+  auto &feedback = m_feedbacks.back();
+  m_fillFeedback(feedback);
+  feedback.frameTimes = m_frameTimes.summary();
+  feedback.latencies = m_latencies.summary();
+  feedback.frameAllocationCount = heapAllocationCount() - allocationCount;
+  m_feedbacks.publish();
+}
+
+void FrameLoop::retirePendingFrame()
+{
+  m_latencies.add(glfwGetTime() - m_pendingFrames.front().inputTime);
+  glDeleteSync(m_pendingFrames.front().fence);
+  m_pendingFrames.erase(begin(m_pendingFrames));
+}
+
+void FrameLoop::deletePendingFrames()
+{
+  for (const auto &frame : m_pendingFrames) {
+    glDeleteSync(frame.fence);
+  }
+  m_pendingFrames.clear();
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "GLFWHandle.hpp"
+#include "asset_cache.hpp"
+#include "cameras.hpp"
+#include "deferred.hpp"
+#include "frame_arena.hpp"
+#include "frame_mailbox.hpp"
+#include "frame_timing.hpp"
+#include "geometry_streamer.hpp"
+#include "gpu_allocator.hpp"
+#include "lights.hpp"
+#include "shadows.hpp"
+#include "uniform_ring.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Settings edited by the GUI. drawScene reads the copy published with each
+// frame, so that the GUI can run on another thread than the rendering.
+struct RenderSettings
+{
+  glm::vec3 lightDirection = glm::vec3(1, 1, 1);
+  glm::vec3 lightIntensity = glm::vec3(1, 1, 1);
+  bool isLightComingFromCamera = false;
+  bool isFrustumCullingEnabled = true;
+  bool isStaticBatchingEnabled = true;
+  bool isHlodEnabled = true;
+  // Record the draw commands with the job system, see DrawCommand
+  bool isParallelRecordingEnabled = false;
+  // With shadow maps
+  bool isShadowEnabled = true;
+  bool isShadowCachingEnabled = true;
+  // Scale of the environment lighting, if any
+  float environmentIntensity = 1.f;
+  // A cluster is drawn with its proxy if the proxy is off by at most this
+  // many pixels on screen
+  float hlodMaxScreenError = 1.5f;
+};
+
+// Counters of the last frame drawn by drawScene
+struct DrawStats
+{
+  size_t drawnNodeCount = 0;
+  size_t culledNodeCount = 0;
+  size_t drawnInstanceCount = 0;
+  size_t drawCallCount = 0;
+  size_t drawnCellCount = 0; // Streamed cells drawn with their geometry
+  size_t drawnProxyCount = 0; // Streamed cells drawn with their proxy
+  size_t drawnHlodProxyCount = 0;
+  size_t drawnChunkCount = 0; // Static batches
+  size_t vertexArrayBindCount = 0;
+  size_t vertexBufferBindCount = 0; // With shared vertex formats
+  size_t pulledDrawCount = 0; // Submitted by multi-draw calls
+  size_t pulledBatchCount = 0; // Multi-draw calls
+  size_t textureBindCount = 0;
+  size_t sortedDrawCount = 0; // Draws of drawMeshNode
+  size_t blendedDrawCount = 0;
+  double drawSortSeconds = 0;
+  bool isDrawOrderCoherent = false; // See DrawListSorter
+  // Recording of the sorted draws in DrawCommand lists and their
+  // submission
+  double drawRecordSeconds = 0;
+  double drawReplaySeconds = 0;
+  size_t drawRecordJobCount = 0; // 0 when recorded on the render thread
+  LightClusterStats lightClusterStats; // With clustered shading
+  ShadowStats shadowStats; // With shadow maps
+  DeferredStats deferredStats; // With deferred shading
+};
+
+// What the main thread publishes for each frame
+struct FrameSnapshot
+{
+  Camera camera;
+  RenderSettings settings;
+  double inputTime = 0; // glfwGetTime() when the input was polled
+  ImGuiDrawDataCopy gui;
+};
+
+// What the renderer publishes back after each frame, for the GUI
+struct RenderFeedback
+{
+  DrawStats drawStats;
+  UniformRingStats transformRingStats;
+  UniformRingStats pullingRingStats;
+  AssetCacheStats cacheStats;
+  GpuMemoryPoolStats bufferPoolStats;
+  FrameArenaStats frameArenaStats;
+  // Made by the frame, and by the main thread meanwhile with a render thread
+  size_t frameAllocationCount = 0;
+  struct Instance
+  {
+    size_t id; // SceneAssetInstance::id
+    std::string name; // File name of the asset
+    long useCount; // Of the asset
+    bool isFirstInstance; // Of its asset in the scene
+    size_t batchedPrimitiveCount;
+    size_t batchChunkCount;
+    size_t batchByteCount;
+    bool isStreamed;
+    GeometryStreamerStats streamerStats;
+  };
+  std::vector<Instance> instances;
+  // Time between the swaps of the rendered frames, and time from the
+  // polling of the input of a frame to the completion of its GPU work
+  // (input-to-photon latency, without the display scan out). Completion is
+  // detected on the next frames, so latencies are up to a frame late.
+  TimingSummary frameTimes;
+  TimingSummary latencies;
+};
+
+// Frame loop of the window. The main thread polls the events, updates the
+// camera and builds the GUI, then publishes a FrameSnapshot. With a render
+// thread owning the GL context, the latest snapshot is drawn there, so that
+// a slow GUI frame or a burst of events does not delay the rendering.
+// Otherwise the snapshot is drawn right away. Either way the GUI only reads
+// the RenderFeedback of the renderer, and changes the scene through
+// commands run by the renderer before its next frame.
+class FrameLoop
+{
+public:
+  // drawScene draws a snapshot without its GUI, fillFeedback fills the
+  // feedback of the frame but its timings and allocation count. Both are
+  // called on the thread owning the context.
+  FrameLoop(GLFWHandle &glfwHandle,
+      std::function<void(const FrameSnapshot &)> drawScene,
+      std::function<void(RenderFeedback &)> fillFeedback);
+  // Calls stop()
+  ~FrameLoop();
+
+  FrameLoop(const FrameLoop &) = delete;
+  FrameLoop &operator=(const FrameLoop &) = delete;
+
+  // Move the context to a render thread drawing the snapshots. Must be
+  // called by the thread owning the context, before the first snapshot.
+  void startRenderThread();
+
+  // Run command on the renderer before its next frame. Thread safe.
+  void pushSceneCommand(std::function<void()> command);
+
+  // Main thread: the last feedback of the renderer
+  const RenderFeedback &acquireFeedback();
+
+  // Main thread: fill the snapshot of the next frame, then publish it. With a
+  // render thread, publishSnapshot() waits at most a frame for the renderer
+  // to take it, otherwise it draws it.
+  FrameSnapshot &nextSnapshot() { return m_snapshots.back(); }
+  void publishSnapshot();
+
+  // Stop the render thread, if any, and make the context current again on
+  // the calling thread
+  void stop();
+
+private:
+  // Frames whose GPU work may not be complete, oldest first
+  struct PendingFrame
+  {
+    GLsync fence;
+    double inputTime;
+  };
+
+  // Latencies are only measured for new snapshots: a snapshot drawn again
+  // has old input
+  void renderFrame(FrameSnapshot &snapshot, bool isNewSnapshot);
+  void retirePendingFrame();
+  void deletePendingFrames();
+
+  GLFWHandle &m_glfwHandle;
+  std::function<void(const FrameSnapshot &)> m_drawScene;
+  std::function<void(RenderFeedback &)> m_fillFeedback;
+
+  FrameMailbox<FrameSnapshot> m_snapshots;
+  FrameMailbox<RenderFeedback> m_feedbacks;
+  std::thread m_renderThread;
+
+  std::mutex m_sceneCommandMutex;
+  std::vector<std::function<void()>> m_sceneCommands;
+  std::vector<std::function<void()>> m_runningSceneCommands;
+
+  RollingTimings m_frameTimes;
+  RollingTimings m_latencies;
+  double m_lastSwapTime = 0;
+  std::vector<PendingFrame> m_pendingFrames;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Hands the latest value of a producer thread to a consumer thread (frame
+// snapshots from the main thread to the render thread). Triple buffered: the
+// producer fills back() while the consumer reads front(), and publish() swaps
+// back() with a shared middle slot that acquire() swaps with front(). Neither
+// side ever waits for the other to exchange values; a value published while
+// the previous one has not been acquired replaces it.
+//
+// The wait functions only block the caller until the other side made
+// progress, for pacing: the values themselves are exchanged without lock.
+template <typename T> class FrameMailbox
+{
+public:
+  // Producer side
+  T &back() { return m_slots[m_back]; }
+
+  void publish()
+  {
+    const auto previous = m_middle.exchange(m_back | freshBit);
+    m_back = previous & indexMask;
+    notify();
+  }
+
+  // Wait until the consumer acquired the last published value, or until
+  // timeout. Returns false on timeout.
+  template <typename Duration> bool waitAcquired(Duration timeout)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_condition.wait_for(lock, timeout, [&]() {
+      return !(m_middle.load() & freshBit) || m_isClosed;
+    });
+  }
+
+  // Consumer side: makes front() the last published value. Returns false if
+  // nothing was published since the last call (front() is unchanged).
+  bool acquire()
+  {
+    if (!(m_middle.load() & freshBit)) {
+      return false;
+    }
+    const auto previous = m_middle.exchange(m_front);
+    m_front = previous & indexMask;
+    notify();
+    return true;
+  }
+
+  // Wait until a value is published and acquire it. Returns false on timeout
+  // or if the mailbox is closed.
+  template <typename Duration> bool waitAndAcquire(Duration timeout)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait_for(lock, timeout,
+          [&]() { return (m_middle.load() & freshBit) || m_isClosed; });
+      if (m_isClosed) {
+        return false;
+      }
+    }
+    return acquire();
+  }
+
+  T &front() { return m_slots[m_front]; }
+
+  // Wake up and fail the waits of both sides, for shutdown
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_isClosed = true;
+    m_condition.notify_all();
+  }
+
+  bool isClosed() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_isClosed;
+  }
+
+private:
+  static const unsigned indexMask = 3;
+  static const unsigned freshBit = 4; // The middle slot was published
+
+  // Taking the lock after changing m_middle ensures a waiter either sees the
+  // change in its predicate or is already waiting when notified
+  void notify()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_condition.notify_all();
+  }
+
+  T m_slots[3];
+  unsigned m_back = 0;
+  unsigned m_front = 1;
+  std::atomic<unsigned> m_middle{2};
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_isClosed = false;
+};
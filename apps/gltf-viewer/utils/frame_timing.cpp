@@ -0,0 +1,54 @@
+#include "frame_timing.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+RollingTimings::RollingTimings(size_t capacity) :
+    m_samples(std::max(capacity, size_t(1))),
+    m_sortedSamples(m_samples.size())
+{
+}
+
+void RollingTimings::add(double seconds)
+{
+  m_samples[m_nextSample] = seconds;
+  m_nextSample = (m_nextSample + 1) % m_samples.size();
+  m_sampleCount = std::min(m_sampleCount + 1, m_samples.size());
+}
+
+void RollingTimings::clear()
+{
+  m_nextSample = 0;
+  m_sampleCount = 0;
+}
+
+TimingSummary RollingTimings::summary() const
+{
+  TimingSummary summary;
+  summary.sampleCount = m_sampleCount;
+  if (!m_sampleCount) {
+    return summary;
+  }
+  // The oldest samples are overwritten first, so the valid ones are always
+  // the first m_sampleCount of the ring
+  const auto first = begin(m_samples);
+  const auto last = first + m_sampleCount;
+  double sum = 0;
+  for (auto it = first; it != last; ++it) {
+    sum += *it;
+  }
+  summary.mean = sum / m_sampleCount;
+  double squaredDeviationSum = 0;
+  for (auto it = first; it != last; ++it) {
+    squaredDeviationSum += (*it - summary.mean) * (*it - summary.mean);
+  }
+  summary.standardDeviation = std::sqrt(squaredDeviationSum / m_sampleCount);
+
+  const auto sortedFirst = begin(m_sortedSamples);
+  const auto sortedLast = std::copy(first, last, sortedFirst);
+  std::sort(sortedFirst, sortedLast);
+  summary.median = m_sortedSamples[m_sampleCount / 2];
+  summary.percentile99 = m_sortedSamples[(m_sampleCount - 1) * 99 / 100];
+  summary.max = m_sortedSamples[m_sampleCount - 1];
+  return summary;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+struct TimingSummary
+{
+  size_t sampleCount = 0;
+  double mean = 0; // In seconds, like all the fields below
+  double standardDeviation = 0;
+  double median = 0;
+  double percentile99 = 0;
+  double max = 0;
+};
+
+// Statistics of the last capacity samples of a duration (frame times,
+// latencies). Adding a sample does not allocate.
+class RollingTimings
+{
+public:
+  explicit RollingTimings(size_t capacity = 240);
+
+  void add(double seconds);
+  void clear();
+
+  TimingSummary summary() const;
+
+private:
+  std::vector<double> m_samples; // Ring of the last samples
+  size_t m_nextSample = 0;
+  size_t m_sampleCount = 0;
+  mutable std::vector<double> m_sortedSamples; // Scratch of summary()
+};
@@ -0,0 +1,361 @@
+#include "geometry_cache.hpp"
+#include "parallel.hpp"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <numeric>
+
+namespace
+{
+
+const char cacheMagic[8] = {'G', 'L', 'T', 'F', 'C', 'E', 'L', 'L'};
+const uint32_t cacheVersion = 1;
+
+// A primitive of a node (or of one instance of a node) placed in scene space
+struct CacheItem
+{
+  int meshIdx;
+  int primitiveIdx;
+  glm::mat4 matrix;
+  BoundingBox bounds;
+  size_t vertexCount;
+};
+
+BoundingBox computePrimitiveLocalBounds(
+    const tinygltf::Model &model, const tinygltf::Primitive &primitive)
+{
+  BoundingBox bounds;
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return bounds;
+  }
+  const auto &accessor = model.accessors[(*positionAttrIdxIt).second];
+  // min and max are required for POSITION accessors
+  if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+    bounds.min = glm::vec3(
+        accessor.minValues[0], accessor.minValues[1], accessor.minValues[2]);
+    bounds.max = glm::vec3(
+        accessor.maxValues[0], accessor.maxValues[1], accessor.maxValues[2]);
+    return bounds;
+  }
+  std::vector<glm::vec4> positions;
+  readAccessorAsVec4(model, (*positionAttrIdxIt).second, positions);
+  for (const auto &position : positions) {
+    bounds.extend(glm::vec3(position));
+  }
+  return bounds;
+}
+
+std::vector<CacheItem> gatherCacheItems(const tinygltf::Model &model)
+{
+  std::map<std::pair<int, int>, BoundingBox> localBounds;
+  std::vector<CacheItem> items;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &worldMatrix) {
+    const auto &node = model.nodes[nodeIdx];
+    if (node.mesh < 0) {
+      return;
+    }
+    std::vector<glm::mat4> matrices{worldMatrix};
+    NodeInstancing instancing;
+    if (getNodeInstancing(model, node, instancing)) {
+      matrices = getNodeInstanceMatrices(model, instancing);
+      for (auto &matrix : matrices) {
+        matrix = worldMatrix * matrix;
+      }
+    }
+    const auto &mesh = model.meshes[node.mesh];
+    for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+      const auto &primitive = mesh.primitives[primIdx];
+      const auto key = std::make_pair(node.mesh, int(primIdx));
+      if (!localBounds.count(key)) {
+        localBounds[key] = computePrimitiveLocalBounds(model, primitive);
+      }
+      const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+      if (positionAttrIdxIt == end(primitive.attributes)) {
+        continue;
+      }
+      const auto vertexCount =
+          model.accessors[(*positionAttrIdxIt).second].count;
+      for (const auto &matrix : matrices) {
+        items.push_back(CacheItem{node.mesh, int(primIdx), matrix,
+            transformBoundingBox(matrix, localBounds[key]), vertexCount});
+      }
+    }
+  });
+  return items;
+}
+
+// Split items with an octree until cells are small enough, appending the
+// leaves to cells
+void partitionItems(const std::vector<CacheItem> &items,
+    std::vector<size_t> itemIndices, const BoundingBox &region, int depth,
+    const GeometryCacheOptions &options,
+    std::vector<std::vector<size_t>> &cells)
+{
+  const auto vertexCount = std::accumulate(begin(itemIndices),
+      end(itemIndices), size_t(0),
+      [&](size_t sum, size_t i) { return sum + items[i].vertexCount; });
+  if (itemIndices.size() <= 1 || vertexCount <= options.maxCellVertexCount ||
+      depth >= options.maxDepth) {
+    if (!itemIndices.empty()) {
+      cells.push_back(std::move(itemIndices));
+    }
+    return;
+  }
+
+  // Items are assigned to the child containing the center of their bounds
+  const auto center = 0.5f * (region.min + region.max);
+  std::vector<size_t> children[8];
+  for (const auto i : itemIndices) {
+    const auto itemCenter = 0.5f * (items[i].bounds.min + items[i].bounds.max);
+    const auto child = (itemCenter.x > center.x ? 1 : 0) |
+                       (itemCenter.y > center.y ? 2 : 0) |
+                       (itemCenter.z > center.z ? 4 : 0);
+    children[child].push_back(i);
+  }
+  for (auto child = 0; child < 8; ++child) {
+    BoundingBox childRegion;
+    childRegion.min = glm::vec3(child & 1 ? center.x : region.min.x,
+        child & 2 ? center.y : region.min.y,
+        child & 4 ? center.z : region.min.z);
+    childRegion.max = glm::vec3(child & 1 ? region.max.x : center.x,
+        child & 2 ? region.max.y : center.y,
+        child & 4 ? region.max.z : center.z);
+    partitionItems(items, std::move(children[child]), childRegion, depth + 1,
+        options, cells);
+  }
+}
+
+void buildCellData(const tinygltf::Model &model,
+    const std::vector<glm::vec4> &materialColors,
+    const std::vector<CacheItem> &items, std::vector<size_t> itemIndices,
+    GeometryCacheCell &cell, GeometryCacheCellData &data)
+{
+  const auto getPrimitive = [&](size_t i) -> const tinygltf::Primitive & {
+    return model.meshes[items[i].meshIdx].primitives[items[i].primitiveIdx];
+  };
+  // Group by material so that batches can be merged
+  std::stable_sort(
+      begin(itemIndices), end(itemIndices), [&](size_t lhs, size_t rhs) {
+        return getPrimitive(lhs).material < getPrimitive(rhs).material;
+      });
+
+  BoundingBox bounds;
+  glm::dvec4 colorSum(0);
+  double triangleCount = 0;
+  std::vector<glm::vec4> positions, normals, texCoords;
+  std::vector<uint32_t> indices;
+  for (const auto i : itemIndices) {
+    const auto &item = items[i];
+    const auto &primitive = getPrimitive(i);
+    const auto attributeAccessor = [&](const char *name) {
+      const auto it = primitive.attributes.find(name);
+      return it == end(primitive.attributes) ? -1 : (*it).second;
+    };
+    if (!readAccessorAsVec4(
+            model, attributeAccessor("POSITION"), positions, glm::vec4(1)) ||
+        positions.empty() || !readPrimitiveIndices(model, primitive, indices)) {
+      continue;
+    }
+    if (!readAccessorAsVec4(
+            model, attributeAccessor("NORMAL"), normals, glm::vec4(0))) {
+      normals.assign(positions.size(), glm::vec4(0));
+    }
+    if (!readAccessorAsVec4(
+            model, attributeAccessor("TEXCOORD_0"), texCoords, glm::vec4(0))) {
+      texCoords.assign(positions.size(), glm::vec4(0));
+    }
+    // Tolerate attributes with less elements than POSITION
+    normals.resize(positions.size(), glm::vec4(0));
+    texCoords.resize(positions.size(), glm::vec4(0));
+    const auto mode = convertToListMode(primitive.mode, indices);
+
+    const auto baseVertex = uint32_t(data.vertices.size());
+    const auto normalMatrix =
+        glm::transpose(glm::inverse(glm::mat3(item.matrix)));
+    for (size_t v = 0; v < positions.size(); ++v) {
+      const auto position =
+          glm::vec3(item.matrix * glm::vec4(glm::vec3(positions[v]), 1.f));
+      auto normal = normalMatrix * glm::vec3(normals[v]);
+      if (glm::dot(normal, normal) > 0.f) {
+        normal = glm::normalize(normal);
+      }
+      bounds.extend(position);
+      data.vertices.push_back(CachedVertex{{position.x, position.y, position.z},
+          {normal.x, normal.y, normal.z}, {texCoords[v].x, texCoords[v].y}});
+    }
+
+    if (data.batches.empty() ||
+        data.batches.back().material != primitive.material ||
+        data.batches.back().mode != mode) {
+      data.batches.push_back(GeometryCacheBatch{primitive.material, mode,
+          uint32_t(data.indices.size()), 0});
+    }
+    for (const auto index : indices) {
+      data.indices.push_back(baseVertex + std::min(index,
+                                              uint32_t(positions.size() - 1)));
+    }
+    data.batches.back().indexCount += uint32_t(indices.size());
+
+    if (mode == GL_TRIANGLES) {
+      const auto color = glm::dvec4(primitive.material >= 0
+                                        ? materialColors[primitive.material]
+                                        : glm::vec4(1));
+      colorSum += color * double(indices.size() / 3);
+      triangleCount += double(indices.size() / 3);
+    }
+  }
+
+  cell = GeometryCacheCell{};
+  for (auto c = 0; c < 3; ++c) {
+    cell.boundsMin[c] = bounds.min[c];
+    cell.boundsMax[c] = bounds.max[c];
+  }
+  const auto proxyColor =
+      triangleCount > 0 ? colorSum / triangleCount : glm::dvec4(1);
+  for (auto c = 0; c < 4; ++c) {
+    cell.proxyColor[c] = float(proxyColor[c]);
+  }
+  cell.vertexCount = uint32_t(data.vertices.size());
+  cell.indexCount = uint32_t(data.indices.size());
+  cell.batchCount = uint32_t(data.batches.size());
+  cell.byteSize = data.batches.size() * sizeof(GeometryCacheBatch) +
+                  data.vertices.size() * sizeof(CachedVertex) +
+                  data.indices.size() * sizeof(uint32_t);
+}
+
+template <typename T>
+void writeVector(std::ostream &out, const std::vector<T> &values)
+{
+  out.write(reinterpret_cast<const char *>(values.data()),
+      std::streamsize(values.size() * sizeof(T)));
+}
+
+template <typename T>
+bool readVector(std::istream &in, size_t count, std::vector<T> &values)
+{
+  values.resize(count);
+  return bool(in.read(reinterpret_cast<char *>(values.data()),
+      std::streamsize(count * sizeof(T))));
+}
+
+} // namespace
+
+bool buildGeometryCache(const tinygltf::Model &model, uint64_t sourceHash,
+    const fs::path &cachePath, const GeometryCacheOptions &options,
+    std::string &error)
+{
+  const auto items = gatherCacheItems(model);
+  BoundingBox sceneBounds;
+  for (const auto &item : items) {
+    sceneBounds.extend(item.bounds);
+  }
+  std::vector<size_t> itemIndices(items.size());
+  std::iota(begin(itemIndices), end(itemIndices), size_t(0));
+  std::vector<std::vector<size_t>> cellItems;
+  partitionItems(items, std::move(itemIndices), sceneBounds, 0, options,
+      cellItems);
+
+  // Written to a temporary file first so that an interrupted build never
+  // leaves a valid looking cache
+  const auto tmpPath = cachePath.string() + ".tmp";
+  std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    error = "Unable to create " + tmpPath;
+    return false;
+  }
+
+  GeometryCacheHeader header;
+  std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+  header.version = cacheVersion;
+  header.cellCount = uint32_t(cellItems.size());
+  header.sourceHash = sourceHash;
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  // The cell table is rewritten once the blocks have been written
+  std::vector<GeometryCacheCell> cells(cellItems.size());
+  writeVector(file, cells);
+  auto byteOffset =
+      uint64_t(sizeof(header) + cells.size() * sizeof(GeometryCacheCell));
+
+  std::vector<glm::vec4> materialColors(model.materials.size());
+  parallelFor(materialColors.size(), [&](size_t i) {
+    materialColors[i] = computeMaterialAverageColor(model, int(i));
+  });
+
+  // Cells are built in parallel by groups to bound memory usage
+  const auto groupSize = std::max(workerThreadCount(), size_t(1));
+  std::vector<GeometryCacheCellData> cellData(groupSize);
+  for (size_t first = 0; first < cells.size(); first += groupSize) {
+    const auto count = std::min(groupSize, cells.size() - first);
+    parallelFor(count, [&](size_t i) {
+      cellData[i] = GeometryCacheCellData{};
+      buildCellData(model, materialColors, items, cellItems[first + i],
+          cells[first + i], cellData[i]);
+    });
+    for (size_t i = 0; i < count; ++i) {
+      auto &cell = cells[first + i];
+      cell.byteOffset = byteOffset;
+      byteOffset += cell.byteSize;
+      writeVector(file, cellData[i].batches);
+      writeVector(file, cellData[i].vertices);
+      writeVector(file, cellData[i].indices);
+    }
+  }
+
+  file.seekp(sizeof(header));
+  writeVector(file, cells);
+  file.close();
+  if (!file) {
+    error = "Unable to write " + tmpPath;
+    return false;
+  }
+
+  std::error_code ec;
+  fs::rename(tmpPath, cachePath, ec);
+  if (ec) {
+    error = "Unable to rename " + tmpPath + ": " + ec.message();
+    return false;
+  }
+  return true;
+}
+
+bool readGeometryCacheCells(const fs::path &cachePath, uint64_t sourceHash,
+    std::vector<GeometryCacheCell> &cells, std::string &error)
+{
+  std::ifstream file(cachePath.string(), std::ios::binary);
+  if (!file) {
+    error = "Unable to open " + cachePath.string();
+    return false;
+  }
+  GeometryCacheHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+      header.version != cacheVersion) {
+    error = cachePath.string() + " is not a geometry cache file";
+    return false;
+  }
+  if (header.sourceHash != sourceHash) {
+    error = cachePath.string() + " has been built from another glTF file";
+    return false;
+  }
+  if (!readVector(file, header.cellCount, cells)) {
+    error = "Unable to read the cells of " + cachePath.string();
+    return false;
+  }
+  return true;
+}
+
+bool readGeometryCacheCellData(std::istream &file,
+    const GeometryCacheCell &cell, GeometryCacheCellData &data)
+{
+  file.clear();
+  file.seekg(std::streamoff(cell.byteOffset));
+  return readVector(file, cell.batchCount, data.batches) &&
+         readVector(file, cell.vertexCount, data.vertices) &&
+         readVector(file, cell.indexCount, data.indices);
+}
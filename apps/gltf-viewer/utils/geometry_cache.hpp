@@ -0,0 +1,109 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Geometry cache file for out-of-core rendering.
+//
+// The geometry of the default scene of a glTF model is transformed to scene
+// space, spatially partitioned with an octree over the bounds of its
+// primitives, and each leaf cell is stored in its own block of a cache file so
+// that it can be read independently with a single seek + read:
+//
+//   GeometryCacheHeader
+//   GeometryCacheCell[cellCount]
+//   cell blocks: GeometryCacheBatch[batchCount], CachedVertex[vertexCount],
+//                uint32_t[indexCount]
+//
+// Batches group the primitives of a cell sharing the same material and mode
+// (strips and fans are converted to lists), so a cell is drawn with one draw
+// call per material.
+
+struct CachedVertex
+{
+  float position[3];
+  float normal[3];
+  float texCoords[2];
+};
+
+struct GeometryCacheHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t cellCount;
+  uint64_t sourceHash; // Hash of the glTF file the cache has been built from
+};
+
+struct GeometryCacheCell
+{
+  float boundsMin[3];
+  float boundsMax[3];
+  // Base color of the coarse proxy drawn while the cell is not resident:
+  // average color of its materials, weighted by triangle count
+  float proxyColor[4];
+  uint64_t byteOffset; // Of the cell block in the file
+  uint64_t byteSize;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t batchCount;
+  uint32_t padding;
+
+  BoundingBox bounds() const
+  {
+    BoundingBox box;
+    box.min = glm::vec3(boundsMin[0], boundsMin[1], boundsMin[2]);
+    box.max = glm::vec3(boundsMax[0], boundsMax[1], boundsMax[2]);
+    return box;
+  }
+
+  // Size of the cell once uploaded to the GPU
+  size_t gpuByteCount() const
+  {
+    return vertexCount * sizeof(CachedVertex) + indexCount * sizeof(uint32_t);
+  }
+};
+
+struct GeometryCacheBatch
+{
+  int32_t material; // -1 for the default material
+  int32_t mode; // GL_POINTS, GL_LINES or GL_TRIANGLES
+  uint32_t indexOffset; // In the indices of the cell
+  uint32_t indexCount;
+};
+
+// Content of a cell block
+struct GeometryCacheCellData
+{
+  std::vector<GeometryCacheBatch> batches;
+  std::vector<CachedVertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+struct GeometryCacheOptions
+{
+  // Cells holding more vertices are split, unless maxDepth is reached
+  size_t maxCellVertexCount = 1 << 16;
+  int maxDepth = 8;
+};
+
+// Build the cache file of the default scene of model. EXT_mesh_gpu_instancing
+// instances are expanded. Returns false and sets error on failure.
+bool buildGeometryCache(const tinygltf::Model &model, uint64_t sourceHash,
+    const fs::path &cachePath, const GeometryCacheOptions &options,
+    std::string &error);
+
+// Read the header and the cell table of a cache file. Returns false if the
+// file cannot be read, is not a cache file or has not been built from
+// sourceHash.
+bool readGeometryCacheCells(const fs::path &cachePath, uint64_t sourceHash,
+    std::vector<GeometryCacheCell> &cells, std::string &error);
+
+// Read the block of a cell from an opened cache file
+bool readGeometryCacheCellData(std::istream &file,
+    const GeometryCacheCell &cell, GeometryCacheCellData &data);
@@ -0,0 +1,279 @@
+#include "geometry_streamer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+
+namespace
+{
+
+// Cells read ahead of their upload. Small so that requests follow the camera
+// closely.
+const size_t maxPendingCellCount = 4;
+
+} // namespace
+
+GeometryStreamer::GeometryStreamer(const fs::path &cachePath,
+    std::vector<GeometryCacheCell> cells, size_t budgetByteCount) :
+    m_cachePath(cachePath),
+    m_cells(std::move(cells)),
+    m_budgetByteCount(budgetByteCount),
+    m_residentCells(m_cells.size()),
+    m_isPending(m_cells.size(), false),
+    m_isFailed(m_cells.size(), false)
+{
+  for (size_t cellIdx = 0; cellIdx < m_cells.size(); ++cellIdx) {
+    // Nothing to draw, the GL buffers could not even be created
+    m_isFailed[cellIdx] =
+        !m_cells[cellIdx].vertexCount || !m_cells[cellIdx].indexCount;
+  }
+  createProxies();
+  m_thread = std::thread([this]() { loaderThread(); });
+}
+
+GeometryStreamer::~GeometryStreamer()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+  m_thread.join();
+
+  for (size_t cellIdx = 0; cellIdx < m_cells.size(); ++cellIdx) {
+    if (residentCell(cellIdx)) {
+      evictCell(cellIdx);
+    }
+  }
+  glDeleteVertexArrays(1, &m_proxyVertexArrayObject);
+  glDeleteBuffers(1, &m_proxyVertexBuffer);
+}
+
+void GeometryStreamer::update(const std::vector<float> &cellPriorities)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_uploadedCells.swap(m_completed);
+  }
+  for (const auto &result : m_uploadedCells) {
+    const auto cellIdx = result.first;
+    const auto &cell = m_cells[cellIdx];
+    m_isPending[cellIdx] = false;
+    if (result.second.vertices.size() != cell.vertexCount) {
+      // Read error: never requested again
+      m_isFailed[cellIdx] = true;
+      m_usedByteCount -= cell.gpuByteCount();
+      continue;
+    }
+    uploadCell(cellIdx, result.second);
+  }
+  m_uploadedCells.clear();
+
+  // The wanted cells are the most important ones that fit in the budget
+  auto &order = m_order;
+  order.clear();
+  for (size_t cellIdx = 0; cellIdx < m_cells.size(); ++cellIdx) {
+    if (cellPriorities[cellIdx] > 0.f && !m_isFailed[cellIdx]) {
+      order.push_back(cellIdx);
+    }
+  }
+  std::sort(begin(order), end(order), [&](size_t lhs, size_t rhs) {
+    return cellPriorities[lhs] > cellPriorities[rhs];
+  });
+  auto &isWanted = m_isWanted;
+  isWanted.assign(m_cells.size(), false);
+  size_t wantedByteCount = 0;
+  for (const auto cellIdx : order) {
+    const auto byteCount = m_cells[cellIdx].gpuByteCount();
+    if (wantedByteCount + byteCount <= m_budgetByteCount) {
+      isWanted[cellIdx] = true;
+      wantedByteCount += byteCount;
+    }
+  }
+
+  auto pendingCellCount =
+      size_t(std::count(begin(m_isPending), end(m_isPending), true));
+  auto &requests = m_newRequests;
+  requests.clear();
+  for (const auto cellIdx : order) {
+    if (pendingCellCount >= maxPendingCellCount) {
+      break;
+    }
+    if (!isWanted[cellIdx] || residentCell(cellIdx) || m_isPending[cellIdx]) {
+      continue;
+    }
+    const auto byteCount = m_cells[cellIdx].gpuByteCount();
+    // Make room by evicting the least important cells that are not wanted
+    while (m_usedByteCount + byteCount > m_budgetByteCount) {
+      auto evictedCellIdx = m_cells.size();
+      for (size_t i = 0; i < m_cells.size(); ++i) {
+        if (residentCell(i) && !isWanted[i] &&
+            (evictedCellIdx == m_cells.size() ||
+                cellPriorities[i] < cellPriorities[evictedCellIdx])) {
+          evictedCellIdx = i;
+        }
+      }
+      if (evictedCellIdx == m_cells.size()) {
+        break;
+      }
+      evictCell(evictedCellIdx);
+    }
+    if (m_usedByteCount + byteCount > m_budgetByteCount) {
+      // Pending cells that are no longer wanted hold the memory, retry later
+      break;
+    }
+    m_isPending[cellIdx] = true;
+    m_usedByteCount += byteCount;
+    ++pendingCellCount;
+    requests.push_back(cellIdx);
+  }
+
+  if (!requests.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_requests.insert(end(m_requests), begin(requests), end(requests));
+    }
+    m_condition.notify_one();
+  }
+}
+
+GeometryStreamerStats GeometryStreamer::stats() const
+{
+  GeometryStreamerStats stats;
+  stats.cellCount = m_cells.size();
+  for (size_t cellIdx = 0; cellIdx < m_cells.size(); ++cellIdx) {
+    if (residentCell(cellIdx)) {
+      ++stats.residentCellCount;
+      stats.residentByteCount += m_cells[cellIdx].gpuByteCount();
+    }
+  }
+  stats.pendingCellCount =
+      size_t(std::count(begin(m_isPending), end(m_isPending), true));
+  stats.budgetByteCount = m_budgetByteCount;
+  stats.loadedCellCount = m_loadedCellCount;
+  stats.evictedCellCount = m_evictedCellCount;
+  return stats;
+}
+
+void GeometryStreamer::loaderThread()
+{
+  std::ifstream file(m_cachePath.string(), std::ios::binary);
+  for (;;) {
+    size_t cellIdx;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [&]() { return m_stop || !m_requests.empty(); });
+      if (m_stop) {
+        return;
+      }
+      cellIdx = m_requests.front();
+      m_requests.pop_front();
+    }
+
+    GeometryCacheCellData data;
+    if (!readGeometryCacheCellData(file, m_cells[cellIdx], data)) {
+      data = GeometryCacheCellData{};
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_completed.emplace_back(cellIdx, std::move(data));
+  }
+}
+
+void GeometryStreamer::uploadCell(
+    size_t cellIdx, const GeometryCacheCellData &data)
+{
+  auto &cell = m_residentCells[cellIdx];
+  cell.batches = data.batches;
+
+  glGenBuffers(1, &cell.vertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, cell.vertexBuffer);
+  glBufferStorage(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(CachedVertex),
+      data.vertices.data(), 0);
+
+  glGenVertexArrays(1, &cell.vertexArrayObject);
+  glBindVertexArray(cell.vertexArrayObject);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CachedVertex),
+      (const GLvoid *)offsetof(CachedVertex, position));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(CachedVertex),
+      (const GLvoid *)offsetof(CachedVertex, normal));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(CachedVertex),
+      (const GLvoid *)offsetof(CachedVertex, texCoords));
+
+  glGenBuffers(1, &cell.indexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cell.indexBuffer);
+  glBufferStorage(GL_ELEMENT_ARRAY_BUFFER,
+      data.indices.size() * sizeof(uint32_t), data.indices.data(), 0);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  ++m_loadedCellCount;
+}
+
+void GeometryStreamer::evictCell(size_t cellIdx)
+{
+  auto &cell = m_residentCells[cellIdx];
+  glDeleteVertexArrays(1, &cell.vertexArrayObject);
+  glDeleteBuffers(1, &cell.vertexBuffer);
+  glDeleteBuffers(1, &cell.indexBuffer);
+  cell = ResidentCell{};
+  m_usedByteCount -= m_cells[cellIdx].gpuByteCount();
+  ++m_evictedCellCount;
+}
+
+void GeometryStreamer::createProxies()
+{
+  // Two triangles per face of each cell box: position and normal
+  std::vector<glm::vec3> vertices;
+  vertices.reserve(m_cells.size() * 36 * 2);
+  for (const auto &cell : m_cells) {
+    const auto bounds = cell.bounds();
+    const auto corner = [&](int x, int y, int z) {
+      return glm::vec3(x ? bounds.max.x : bounds.min.x,
+          y ? bounds.max.y : bounds.min.y, z ? bounds.max.z : bounds.min.z);
+    };
+    for (auto axis = 0; axis < 3; ++axis) {
+      for (auto side = 0; side < 2; ++side) {
+        // (u, v) spans the face, counter clockwise seen from outside
+        const auto u = side ? (axis + 1) % 3 : (axis + 2) % 3;
+        const auto v = side ? (axis + 2) % 3 : (axis + 1) % 3;
+        const auto faceCorner = [&](int a, int b) {
+          int c[3];
+          c[axis] = side;
+          c[u] = a;
+          c[v] = b;
+          return corner(c[0], c[1], c[2]);
+        };
+        auto normal = glm::vec3(0);
+        normal[axis] = side ? 1.f : -1.f;
+        for (const auto &uv : {glm::ivec2(0, 0), glm::ivec2(1, 0),
+                 glm::ivec2(1, 1), glm::ivec2(0, 0), glm::ivec2(1, 1),
+                 glm::ivec2(0, 1)}) {
+          vertices.push_back(faceCorner(uv.x, uv.y));
+          vertices.push_back(normal);
+        }
+      }
+    }
+  }
+
+  glGenBuffers(1, &m_proxyVertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, m_proxyVertexBuffer);
+  glBufferStorage(GL_ARRAY_BUFFER,
+      std::max(vertices.size(), size_t(1)) * sizeof(glm::vec3),
+      vertices.empty() ? nullptr : vertices.data(), 0);
+
+  glGenVertexArrays(1, &m_proxyVertexArrayObject);
+  glBindVertexArray(m_proxyVertexArrayObject);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(
+      0, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3), (const GLvoid *)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec3),
+      (const GLvoid *)sizeof(glm::vec3));
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
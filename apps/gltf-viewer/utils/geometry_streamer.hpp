@@ -0,0 +1,106 @@
+#pragma once
+
+#include "geometry_cache.hpp"
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct GeometryStreamerStats
+{
+  size_t cellCount = 0;
+  size_t residentCellCount = 0;
+  size_t pendingCellCount = 0; // Being read from the cache file
+  size_t residentByteCount = 0; // GPU memory of the resident cells
+  size_t budgetByteCount = 0;
+  size_t loadedCellCount = 0; // Since the creation of the streamer
+  size_t evictedCellCount = 0;
+};
+
+// Pages the cells of a geometry cache file in and out of GPU memory. Cells are
+// read from the file by a background thread and uploaded by update(), which
+// must be called from the thread owning the GL context. The GPU memory of
+// resident and pending cells never exceeds the budget: when a cell with a
+// higher priority needs room, the resident cells with the lowest priorities
+// are evicted.
+//
+// A coarse proxy (the bounding box of the cell) is available for every cell,
+// to be drawn while the cell is not resident.
+class GeometryStreamer
+{
+public:
+  struct ResidentCell
+  {
+    GLuint vertexArrayObject = 0;
+    GLuint vertexBuffer = 0;
+    GLuint indexBuffer = 0;
+    std::vector<GeometryCacheBatch> batches;
+  };
+
+  GeometryStreamer(const fs::path &cachePath,
+      std::vector<GeometryCacheCell> cells, size_t budgetByteCount);
+  ~GeometryStreamer();
+
+  GeometryStreamer(const GeometryStreamer &) = delete;
+  GeometryStreamer &operator=(const GeometryStreamer &) = delete;
+
+  const std::vector<GeometryCacheCell> &cells() const { return m_cells; }
+
+  // Upload the cells read since the last call, then evict and request cells
+  // according to cellPriorities (one per cell, higher is more important, 0
+  // means not needed).
+  void update(const std::vector<float> &cellPriorities);
+
+  // nullptr if the cell is not resident
+  const ResidentCell *residentCell(size_t cellIdx) const
+  {
+    return m_residentCells[cellIdx].vertexArrayObject
+               ? &m_residentCells[cellIdx]
+               : nullptr;
+  }
+
+  // VAO holding 36 vertices (position, normal) per cell: the triangles of the
+  // bounding box of cell i start at vertex 36 * i
+  GLuint proxyVertexArrayObject() const { return m_proxyVertexArrayObject; }
+
+  GeometryStreamerStats stats() const;
+
+private:
+  void loaderThread();
+  void uploadCell(size_t cellIdx, const GeometryCacheCellData &data);
+  void evictCell(size_t cellIdx);
+  void createProxies();
+
+  const fs::path m_cachePath;
+  const std::vector<GeometryCacheCell> m_cells;
+  const size_t m_budgetByteCount;
+
+  std::vector<ResidentCell> m_residentCells;
+  std::vector<bool> m_isPending;
+  std::vector<bool> m_isFailed; // Empty or unreadable, never requested
+  size_t m_usedByteCount = 0; // Resident and pending cells
+  size_t m_loadedCellCount = 0;
+  size_t m_evictedCellCount = 0;
+  // Scratch of update(), kept to not allocate every frame
+  std::vector<std::pair<size_t, GeometryCacheCellData>> m_uploadedCells;
+  std::vector<size_t> m_order;
+  std::vector<bool> m_isWanted;
+  std::vector<size_t> m_newRequests;
+
+  GLuint m_proxyVertexArrayObject = 0;
+  GLuint m_proxyVertexBuffer = 0;
+
+  // Shared with the loader thread
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<size_t> m_requests;
+  std::vector<std::pair<size_t, GeometryCacheCellData>> m_completed;
+  bool m_stop = false;
+
+  std::thread m_thread;
+};
@@ -0,0 +1,507 @@
+#include "gl_renderer.hpp"
+
+#include "images.hpp"
+#include "transforms.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+
+// Attribute locations of forward.vs.glsl
+enum VertexAttribute
+{
+  VERTEX_ATTRIB_POSITION = 0,
+  VERTEX_ATTRIB_NORMAL = 1,
+  VERTEX_ATTRIB_TEXCOORD0 = 2,
+  VERTEX_ATTRIB_INSTANCE_TRANSLATION = 3,
+  VERTEX_ATTRIB_INSTANCE_ROTATION = 4,
+  VERTEX_ATTRIB_INSTANCE_SCALE = 5
+};
+
+const GLuint transformsBinding = 0;
+
+// Texture units of the materials, then of the samplers of
+// pbr_directional_light.fs.glsl that are not read (no shadows nor
+// environment), on units of their own since samplers of different types
+// cannot share a unit
+const GLint baseColorTextureUnit = 0;
+const GLint metallicRoughnessTextureUnit = 1;
+const GLint emissiveTextureUnit = 2;
+const GLint occlusionTextureUnit = 3;
+const GLint specularEnvironmentTextureUnit = 13;
+const GLint brdfLutTextureUnit = 14;
+const GLint shadowMapsTextureUnit = 15;
+
+bool isMipmapFilter(int filter)
+{
+  return filter == GL_NEAREST_MIPMAP_NEAREST ||
+         filter == GL_NEAREST_MIPMAP_LINEAR ||
+         filter == GL_LINEAR_MIPMAP_NEAREST ||
+         filter == GL_LINEAR_MIPMAP_LINEAR;
+}
+
+GLenum getPrimitiveMode(int mode)
+{
+  switch (mode) {
+  case TINYGLTF_MODE_POINTS:
+    return GL_POINTS;
+  case TINYGLTF_MODE_LINE:
+    return GL_LINES;
+  case TINYGLTF_MODE_LINE_LOOP:
+    return GL_LINE_LOOP;
+  case TINYGLTF_MODE_LINE_STRIP:
+    return GL_LINE_STRIP;
+  case TINYGLTF_MODE_TRIANGLE_STRIP:
+    return GL_TRIANGLE_STRIP;
+  case TINYGLTF_MODE_TRIANGLE_FAN:
+    return GL_TRIANGLE_FAN;
+  default:
+    return GL_TRIANGLES;
+  }
+}
+
+} // namespace
+
+GlRenderer::GlRenderer(const RendererOptions &options) :
+    m_glfwHandle(1, 1, "glTF Viewer", false),
+    m_options(options),
+    m_program(compileProgram(
+        {fs::path(options.shadersPath) / "forward.vs.glsl",
+            fs::path(options.shadersPath) / "pbr_directional_light.fs.glsl"}))
+{
+  const auto *deviceName = glGetString(GL_RENDERER);
+  m_deviceName = deviceName ? reinterpret_cast<const char *>(deviceName) : "";
+
+  const auto program = m_program.glId();
+  m_lightDirectionLocation = glGetUniformLocation(program, "uLightDirection");
+  m_lightIntensityLocation = glGetUniformLocation(program, "uLightIntensity");
+  m_baseColorFactorLocation = glGetUniformLocation(program, "uBaseColorFactor");
+  m_alphaCutoffLocation = glGetUniformLocation(program, "uAlphaCutoff");
+  m_metallicFactorLocation = glGetUniformLocation(program, "uMetallicFactor");
+  m_roughnessFactorLocation =
+      glGetUniformLocation(program, "uRoughnessFactor");
+  m_emissiveFactorLocation = glGetUniformLocation(program, "uEmissiveFactor");
+  m_occlusionStrengthLocation =
+      glGetUniformLocation(program, "uOcclusionStrength");
+
+  m_program.use();
+  glUniformBlockBinding(program,
+      glGetUniformBlockIndex(program, "Transforms"), transformsBinding);
+  glUniform1i(glGetUniformLocation(program, "uBaseColorTexture"),
+      baseColorTextureUnit);
+  glUniform1i(glGetUniformLocation(program, "uMetallicRoughnessTexture"),
+      metallicRoughnessTextureUnit);
+  glUniform1i(glGetUniformLocation(program, "uEmissiveTexture"),
+      emissiveTextureUnit);
+  glUniform1i(glGetUniformLocation(program, "uOcclusionTexture"),
+      occlusionTextureUnit);
+  glUniform1i(glGetUniformLocation(program, "uSpecularEnvironment"),
+      specularEnvironmentTextureUnit);
+  glUniform1i(glGetUniformLocation(program, "uBrdfLut"), brdfLutTextureUnit);
+  glUniform1i(
+      glGetUniformLocation(program, "uShadowMaps"), shadowMapsTextureUnit);
+  glUniform1i(glGetUniformLocation(program, "uShadowCascadeCount"), 0);
+  glUniform1f(glGetUniformLocation(program, "uEnvironmentIntensity"), 0.f);
+
+  // Generic values of the attributes the draws do not read from buffers:
+  // identity instance transform
+  glVertexAttrib3f(VERTEX_ATTRIB_INSTANCE_TRANSLATION, 0.f, 0.f, 0.f);
+  glVertexAttrib4f(VERTEX_ATTRIB_INSTANCE_ROTATION, 0.f, 0.f, 0.f, 1.f);
+  glVertexAttrib3f(VERTEX_ATTRIB_INSTANCE_SCALE, 1.f, 1.f, 1.f);
+
+  // Bound in place of the textures materials do not have
+  const unsigned char white[] = {255, 255, 255, 255};
+  glGenTextures(1, &m_whiteTexture);
+  glBindTexture(GL_TEXTURE_2D, m_whiteTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+  glTexSubImage2D(
+      GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  GLint alignment = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  alignment = std::max(alignment, 1);
+  m_transformsStride = (sizeof(DrawTransforms) + alignment - 1) / alignment *
+                       alignment;
+  glGenBuffers(1, &m_transformsBuffer);
+}
+
+GlRenderer::~GlRenderer()
+{
+  for (const auto &model : m_models) {
+    glDeleteVertexArrays(GLsizei(model.vertexArrayObjects.size()),
+        model.vertexArrayObjects.data());
+    glDeleteTextures(
+        GLsizei(model.textureObjects.size()), model.textureObjects.data());
+    glDeleteBuffers(
+        GLsizei(model.bufferObjects.size()), model.bufferObjects.data());
+  }
+  glDeleteBuffers(1, &m_transformsBuffer);
+  glDeleteTextures(1, &m_whiteTexture);
+}
+
+std::vector<GLuint> GlRenderer::createTextureObjects(
+    const tinygltf::Model &model)
+{
+  std::vector<GLuint> textureObjects(model.textures.size(), 0);
+  for (size_t textureIdx = 0; textureIdx < model.textures.size();
+       ++textureIdx) {
+    const auto &texture = model.textures[textureIdx];
+    if (texture.source < 0) {
+      continue;
+    }
+    const auto &image = model.images[texture.source];
+    glGenTextures(1, &textureObjects[textureIdx]);
+    glBindTexture(GL_TEXTURE_2D, textureObjects[textureIdx]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
+        GL_RGBA, image.pixel_type, image.image.data());
+
+    const auto sampler = texture.sampler >= 0
+                             ? model.samplers[texture.sampler]
+                             : tinygltf::Sampler{};
+    auto minFilter = sampler.minFilter != -1 ? sampler.minFilter : GL_LINEAR;
+    if (isMipmapFilter(minFilter)) {
+      if (m_options.generateMipmaps) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+      } else {
+        // Without mipmaps the texture would be incomplete
+        minFilter = (minFilter == GL_NEAREST_MIPMAP_NEAREST ||
+                        minFilter == GL_NEAREST_MIPMAP_LINEAR)
+                        ? GL_NEAREST
+                        : GL_LINEAR;
+      }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+        sampler.magFilter != -1 ? sampler.magFilter : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrapS);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrapT);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return textureObjects;
+}
+
+GLuint GlRenderer::createVertexArrayObject(const tinygltf::Model &model,
+    const Model &glModel, int nodeIdx, const tinygltf::Primitive &primitive,
+    DrawItem &item, std::string &warning)
+{
+  // Accessor of the attribute at each location, -1 for the generic value
+  int accessors[] = {-1, -1, -1, -1, -1, -1};
+  const char *attributeNames[] = {"POSITION", "NORMAL", "TEXCOORD_0"};
+  for (size_t location = 0; location < 3; ++location) {
+    const auto found = primitive.attributes.find(attributeNames[location]);
+    if (found != end(primitive.attributes)) {
+      accessors[location] = found->second;
+    }
+  }
+  if (accessors[VERTEX_ATTRIB_POSITION] < 0) {
+    warning = "primitive without POSITION";
+    return 0;
+  }
+  NodeInstancing instancing;
+  if (getNodeInstancing(model, model.nodes[nodeIdx], instancing)) {
+    accessors[VERTEX_ATTRIB_INSTANCE_TRANSLATION] =
+        instancing.translationAccessor;
+    accessors[VERTEX_ATTRIB_INSTANCE_ROTATION] = instancing.rotationAccessor;
+    accessors[VERTEX_ATTRIB_INSTANCE_SCALE] = instancing.scaleAccessor;
+    item.instanceCount = GLsizei(instancing.instanceCount);
+  } else {
+    item.instanceCount = 1;
+  }
+
+  item.mode = getPrimitiveMode(primitive.mode);
+  item.isIndexed = primitive.indices >= 0;
+  if (item.isIndexed) {
+    const auto &accessor = model.accessors[primitive.indices];
+    if (accessor.bufferView < 0) {
+      warning = "index accessor without data";
+      return 0;
+    }
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    item.indexType = GLenum(accessor.componentType);
+    item.indexOffset = bufferView.byteOffset + accessor.byteOffset;
+    item.count = GLsizei(accessor.count);
+  } else {
+    item.indexType = GL_UNSIGNED_INT;
+    item.indexOffset = 0;
+    item.count = GLsizei(model.accessors[accessors[0]].count);
+  }
+  if (!item.count) {
+    warning = "primitive without vertices";
+    return 0;
+  }
+
+  GLuint vertexArrayObject = 0;
+  glGenVertexArrays(1, &vertexArrayObject);
+  glBindVertexArray(vertexArrayObject);
+  for (GLuint location = 0; location < 6; ++location) {
+    const auto accessorIdx = accessors[location];
+    if (accessorIdx < 0 || model.accessors[accessorIdx].bufferView < 0) {
+      continue;
+    }
+    const auto &accessor = model.accessors[accessorIdx];
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    glEnableVertexAttribArray(location);
+    glBindBuffer(GL_ARRAY_BUFFER, glModel.bufferObjects[bufferView.buffer]);
+    glVertexAttribPointer(location,
+        tinygltf::GetNumComponentsInType(uint32_t(accessor.type)),
+        GLenum(accessor.componentType),
+        accessor.normalized ? GL_TRUE : GL_FALSE,
+        GLsizei(bufferView.byteStride),
+        (const GLvoid *)(bufferView.byteOffset + accessor.byteOffset));
+    if (location >= VERTEX_ATTRIB_INSTANCE_TRANSLATION) {
+      glVertexAttribDivisor(location, 1);
+    }
+  }
+  if (item.isIndexed) {
+    const auto &accessor = model.accessors[primitive.indices];
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+        glModel.bufferObjects[model.bufferViews[accessor.bufferView].buffer]);
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  item.nodeIdx = nodeIdx;
+  item.material = primitive.material;
+  item.pass = getMaterialDrawPass(model, primitive.material);
+  item.vertexArrayObject = vertexArrayObject;
+  return vertexArrayObject;
+}
+
+int GlRenderer::addModel(const tinygltf::Model &model, std::string &)
+{
+  Model glModel;
+  glModel.nodeMatrices = computeNodeWorldMatrices(model);
+  glModel.nodeBounds = computeNodeWorldBounds(model);
+
+  glModel.bufferObjects.resize(model.buffers.size(), 0);
+  if (!model.buffers.empty()) {
+    glGenBuffers(
+        GLsizei(glModel.bufferObjects.size()), glModel.bufferObjects.data());
+  }
+  for (size_t bufferIdx = 0; bufferIdx < model.buffers.size(); ++bufferIdx) {
+    const auto &data = model.buffers[bufferIdx].data;
+    glBindBuffer(GL_ARRAY_BUFFER, glModel.bufferObjects[bufferIdx]);
+    glBufferStorage(GL_ARRAY_BUFFER, std::max(data.size(), size_t(1)),
+        data.empty() ? nullptr : data.data(), 0);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glModel.textureObjects = createTextureObjects(model);
+
+  // Materials of the model, then its default material
+  const auto materialBase = uint32_t(m_materials.size());
+  const auto getTextureObject = [&](int textureIdx) {
+    return textureIdx >= 0 ? glModel.textureObjects[textureIdx] : 0;
+  };
+  const tinygltf::Material defaultMaterial;
+  for (size_t materialIdx = 0; materialIdx <= model.materials.size();
+       ++materialIdx) {
+    const auto isDefault = materialIdx == model.materials.size();
+    const auto &material =
+        isDefault ? defaultMaterial : model.materials[materialIdx];
+    const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+    Material glMaterial;
+    glMaterial.factors =
+        getMaterialFactors(model, isDefault ? -1 : int(materialIdx));
+    glMaterial.baseColorTexture =
+        getTextureObject(pbrMetallicRoughness.baseColorTexture.index);
+    glMaterial.metallicRoughnessTexture =
+        getTextureObject(pbrMetallicRoughness.metallicRoughnessTexture.index);
+    glMaterial.emissiveTexture =
+        getTextureObject(material.emissiveTexture.index);
+    glMaterial.occlusionTexture =
+        getTextureObject(material.occlusionTexture.index);
+    m_materials.push_back(glMaterial);
+  }
+
+  // Draws of the primitives of the mesh nodes, in the order of the other
+  // paths so that draws with equal keys are sorted the same way
+  size_t skippedCount = 0;
+  std::string warning;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &) {
+    const auto &node = model.nodes[nodeIdx];
+    if (node.mesh < 0) {
+      return;
+    }
+    for (const auto &primitive : model.meshes[node.mesh].primitives) {
+      DrawItem item;
+      if (!createVertexArrayObject(
+              model, glModel, nodeIdx, primitive, item, warning)) {
+        ++skippedCount;
+        continue;
+      }
+      glModel.vertexArrayObjects.push_back(item.vertexArrayObject);
+      const auto materialIdx = primitive.material >= 0
+                                   ? size_t(primitive.material)
+                                   : model.materials.size();
+      item.materialIdx = materialBase + uint32_t(materialIdx);
+      glModel.draws.push_back(item);
+    }
+  });
+  if (skippedCount) {
+    std::cerr << "Warn: " << skippedCount
+              << " primitives are not drawn by the OpenGL renderer"
+              << (warning.empty() ? "" : " (" + warning + ")") << std::endl;
+  }
+
+  m_models.push_back(std::move(glModel));
+  return int(m_models.size() - 1);
+}
+
+void GlRenderer::addModelInstance(int modelIdx, const glm::mat4 &rootTransform)
+{
+  const auto &model = m_models[modelIdx];
+  ModelInstance instance;
+  instance.modelIdx = modelIdx;
+  for (size_t nodeIdx = 0; nodeIdx < model.nodeMatrices.size(); ++nodeIdx) {
+    instance.nodeWorldMatrices.push_back(
+        rootTransform * model.nodeMatrices[nodeIdx]);
+    instance.nodeNormalMatrices.push_back(
+        computeNormalMatrix(instance.nodeWorldMatrices.back()));
+    const auto bounds =
+        transformBoundingBox(rootTransform, model.nodeBounds[nodeIdx]);
+    instance.nodeWorldCenters.push_back(0.5f * (bounds.min + bounds.max));
+  }
+  instance.firstTransforms = 0;
+  m_instances.push_back(std::move(instance));
+}
+
+void GlRenderer::bindMaterial(const Material &material)
+{
+  const auto &factors = material.factors;
+  glUniform4fv(m_baseColorFactorLocation, 1, factors.baseColorFactor);
+  glUniform3fv(m_emissiveFactorLocation, 1, factors.emissiveFactor);
+  glUniform1f(m_metallicFactorLocation, factors.metallicFactor);
+  glUniform1f(m_roughnessFactorLocation, factors.roughnessFactor);
+  glUniform1f(m_occlusionStrengthLocation, factors.occlusionStrength);
+  glUniform1f(m_alphaCutoffLocation, factors.alphaCutoff);
+
+  const std::pair<GLint, GLuint> textures[] = {
+      {baseColorTextureUnit, material.baseColorTexture},
+      {metallicRoughnessTextureUnit, material.metallicRoughnessTexture},
+      {emissiveTextureUnit, material.emissiveTexture},
+      {occlusionTextureUnit, material.occlusionTexture}};
+  for (const auto &texture : textures) {
+    glActiveTexture(GLenum(GL_TEXTURE0 + texture.first));
+    glBindTexture(
+        GL_TEXTURE_2D, texture.second ? texture.second : m_whiteTexture);
+  }
+}
+
+void GlRenderer::drawScene(
+    const RenderView &view, uint32_t width, uint32_t height)
+{
+  // Transforms of the nodes of all the instances, each at an offset the
+  // uniform buffer can be bound at
+  size_t transformsCount = 0;
+  for (auto &instance : m_instances) {
+    instance.firstTransforms = uint32_t(transformsCount);
+    transformsCount += instance.nodeWorldMatrices.size();
+  }
+  std::vector<DrawTransforms> transforms(transformsCount);
+  for (const auto &instance : m_instances) {
+    computeDrawTransforms(view.viewMatrix, view.projMatrix,
+        instance.nodeWorldMatrices.data(), instance.nodeNormalMatrices.data(),
+        instance.nodeWorldMatrices.size(),
+        transforms.data() + instance.firstTransforms);
+  }
+  m_transforms.resize(std::max(transformsCount, size_t(1)) *
+                      m_transformsStride);
+  for (size_t transformsIdx = 0; transformsIdx < transformsCount;
+       ++transformsIdx) {
+    std::memcpy(m_transforms.data() + transformsIdx * m_transformsStride,
+        &transforms[transformsIdx], sizeof(DrawTransforms));
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, m_transformsBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(m_transforms.size()),
+      m_transforms.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  // Draws sorted on the keys of the other paths: opaque, alpha tested, then
+  // blended back to front
+  m_frameArena.reset();
+  size_t drawCount = 0;
+  for (const auto &instance : m_instances) {
+    drawCount += m_models[instance.modelIdx].draws.size();
+  }
+  auto *draws = m_frameArena.allocateArray<FrameDraw>(drawCount);
+  auto *drawKeys = m_frameArena.allocateArray<uint64_t>(drawCount);
+  size_t drawIdx = 0;
+  for (const auto &instance : m_instances) {
+    for (const auto &item : m_models[instance.modelIdx].draws) {
+      const auto depth =
+          -(view.viewMatrix *
+              glm::vec4(instance.nodeWorldCenters[item.nodeIdx], 1.f))
+               .z;
+      drawKeys[drawIdx] = makeDrawKey(item.pass, depth, view.nearDepth,
+          view.farDepth, 0,
+          (uint32_t(instance.modelIdx) << 20) | uint32_t(item.material + 1));
+      draws[drawIdx] = FrameDraw{
+          &item, instance.firstTransforms + uint32_t(item.nodeIdx)};
+      ++drawIdx;
+    }
+  }
+  const auto &drawOrder = m_drawSorter.sort(drawKeys, drawCount, m_frameArena);
+
+  glViewport(0, 0, GLsizei(width), GLsizei(height));
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
+  m_program.use();
+  glUniform3fv(m_lightDirectionLocation, 1, &view.lightDirection[0]);
+  glUniform3fv(m_lightIntensityLocation, 1, &view.lightIntensity[0]);
+
+  const DrawItem *previous = nullptr;
+  for (size_t orderIdx = 0; orderIdx < drawCount; ++orderIdx) {
+    const auto &draw = draws[drawOrder[orderIdx]];
+    const auto &item = *draw.item;
+    if (item.pass == DRAW_PASS_BLEND &&
+        (!previous || previous->pass != DRAW_PASS_BLEND)) {
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      glDepthMask(GL_FALSE);
+    }
+    if (!previous || previous->vertexArrayObject != item.vertexArrayObject) {
+      glBindVertexArray(item.vertexArrayObject);
+    }
+    if (!previous || previous->materialIdx != item.materialIdx) {
+      bindMaterial(m_materials[item.materialIdx]);
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, transformsBinding, m_transformsBuffer,
+        GLintptr(draw.transformsIndex * m_transformsStride),
+        sizeof(DrawTransforms));
+    if (item.isIndexed) {
+      glDrawElementsInstanced(item.mode, item.count, item.indexType,
+          (const GLvoid *)item.indexOffset, item.instanceCount);
+    } else {
+      glDrawArraysInstanced(item.mode, 0, item.count, item.instanceCount);
+    }
+    previous = &item;
+  }
+  glBindVertexArray(0);
+  glDisable(GL_BLEND);
+  glDepthMask(GL_TRUE);
+}
+
+bool GlRenderer::renderImage(const RenderView &view, uint32_t width,
+    uint32_t height, unsigned char *pixels, std::string &error)
+{
+  renderToImage(width, height, 3, pixels,
+      [&]() { drawScene(view, width, height); });
+  // Read bottom row first
+  flipImageYAxis(width, height, 3, pixels);
+  const auto glError = glGetError();
+  if (glError != GL_NO_ERROR) {
+    error = "OpenGL error " + std::to_string(glError);
+    return false;
+  }
+  return true;
+}
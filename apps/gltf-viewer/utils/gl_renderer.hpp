@@ -0,0 +1,131 @@
+#pragma once
+
+#include "GLFWHandle.hpp"
+#include "draw_sort.hpp"
+#include "frame_arena.hpp"
+#include "gltf.hpp"
+#include "renderer.hpp"
+#include "shaders.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Offscreen forward renderer on OpenGL 4.4, in a hidden window of its own.
+// It draws with the shaders of the default path of ViewerApplication
+// (forward.vs.glsl and pbr_directional_light.fs.glsl, without shadows nor
+// environment), so that the images of the other backends can be compared
+// with it through the same Renderer calls:
+// - One VAO per draw of a primitive by a node, reading the glTF buffers.
+// - Draws are sorted like the other backends (makeDrawKey, DrawListSorter).
+// - The transforms of the frame are in one uniform buffer, bound per draw.
+class GlRenderer : public Renderer
+{
+public:
+  // Throws std::runtime_error if no OpenGL 4.4 context can be created or the
+  // shaders cannot be compiled from options.shadersPath
+  explicit GlRenderer(const RendererOptions &options);
+  ~GlRenderer() override;
+
+  GlRenderer(const GlRenderer &) = delete;
+  GlRenderer &operator=(const GlRenderer &) = delete;
+
+  const std::string &deviceName() const override { return m_deviceName; }
+  int addModel(const tinygltf::Model &model, std::string &error) override;
+  void addModelInstance(int modelIdx, const glm::mat4 &rootTransform) override;
+  bool renderImage(const RenderView &view, uint32_t width, uint32_t height,
+      unsigned char *pixels, std::string &error) override;
+
+private:
+  // Draw of a primitive of a mesh node, resolved on load
+  struct DrawItem
+  {
+    int nodeIdx;
+    int material; // Of the model, -1 for the default material
+    DrawPass pass;
+    uint32_t materialIdx; // In m_materials
+    GLuint vertexArrayObject;
+    GLenum mode;
+    bool isIndexed;
+    GLenum indexType;
+    size_t indexOffset;
+    GLsizei count; // Of indices, or of vertices
+    GLsizei instanceCount; // 1 for nodes that are not instanced
+  };
+
+  // Factors and textures of a material, 0 for the white texture
+  struct Material
+  {
+    MaterialFactors factors;
+    GLuint baseColorTexture;
+    GLuint metallicRoughnessTexture;
+    GLuint emissiveTexture;
+    GLuint occlusionTexture;
+  };
+
+  struct Model
+  {
+    std::vector<GLuint> bufferObjects; // One per glTF buffer
+    std::vector<GLuint> textureObjects; // One per glTF texture, or 0
+    std::vector<GLuint> vertexArrayObjects;
+    std::vector<glm::mat4> nodeMatrices;
+    std::vector<BoundingBox> nodeBounds;
+    std::vector<DrawItem> draws; // Parents before children
+  };
+
+  struct ModelInstance
+  {
+    int modelIdx;
+    std::vector<glm::mat4> nodeWorldMatrices;
+    std::vector<glm::mat4> nodeNormalMatrices;
+    std::vector<glm::vec3> nodeWorldCenters; // Of the node bounds
+    uint32_t firstTransforms; // In the transforms buffer, during a frame
+  };
+
+  // A draw of a frame
+  struct FrameDraw
+  {
+    const DrawItem *item;
+    uint32_t transformsIndex;
+  };
+
+  std::vector<GLuint> createTextureObjects(const tinygltf::Model &model);
+  // VAO of a draw of primitive by node nodeIdx. Returns 0 with the reason in
+  // warning if it cannot be drawn.
+  GLuint createVertexArrayObject(const tinygltf::Model &model,
+      const Model &glModel, int nodeIdx, const tinygltf::Primitive &primitive,
+      DrawItem &item, std::string &warning);
+  void bindMaterial(const Material &material);
+  void drawScene(const RenderView &view, uint32_t width, uint32_t height);
+
+  // First member: its context is current until all the others are destroyed
+  GLFWHandle m_glfwHandle;
+  RendererOptions m_options;
+  std::string m_deviceName;
+
+  GLProgram m_program;
+  GLint m_lightDirectionLocation;
+  GLint m_lightIntensityLocation;
+  GLint m_baseColorFactorLocation;
+  GLint m_alphaCutoffLocation;
+  GLint m_metallicFactorLocation;
+  GLint m_roughnessFactorLocation;
+  GLint m_emissiveFactorLocation;
+  GLint m_occlusionStrengthLocation;
+
+  GLuint m_whiteTexture = 0;
+  GLuint m_transformsBuffer = 0;
+  size_t m_transformsStride = 0; // Of the uniform buffer offset alignment
+  std::vector<unsigned char> m_transforms; // Of the nodes of the frame
+
+  std::vector<Material> m_materials;
+  std::vector<Model> m_models;
+  std::vector<ModelInstance> m_instances;
+
+  FrameArena m_frameArena;
+  DrawListSorter m_drawSorter;
+};
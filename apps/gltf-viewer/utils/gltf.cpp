@@ -1,9 +1,16 @@
 #include "gltf.hpp"
+#include "parallel.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <numeric>
+#include <tuple>
 
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix)
@@ -35,119 +42,823 @@ glm::mat4 getLocalToWorldMatrix(
                                                  node.scale[1], node.scale[2]));
 };
 
+void visitScene(const tinygltf::Model &model,
+    const std::function<void(int, const glm::mat4 &)> &visitor)
+{
+  if (model.defaultScene < 0) {
+    return;
+  }
+  const std::function<void(int, const glm::mat4 &)> visitNode =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix) {
+        const auto &node = model.nodes[nodeIdx];
+        const glm::mat4 modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        visitor(nodeIdx, modelMatrix);
+        for (const auto childNodeIdx : node.children) {
+          visitNode(childNodeIdx, modelMatrix);
+        }
+      };
+  for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+    visitNode(nodeIdx, glm::mat4(1));
+  }
+}
+
+std::vector<glm::mat4> computeNodeWorldMatrices(const tinygltf::Model &model)
+{
+  std::vector<glm::mat4> worldMatrices(model.nodes.size(), glm::mat4(1));
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &worldMatrix) {
+    worldMatrices[nodeIdx] = worldMatrix;
+  });
+  return worldMatrices;
+}
+
+BoundingBox transformBoundingBox(
+    const glm::mat4 &matrix, const BoundingBox &box)
+{
+  BoundingBox result;
+  if (box.isEmpty()) {
+    return result;
+  }
+  for (auto corner = 0; corner < 8; ++corner) {
+    const auto point = glm::vec3(corner & 1 ? box.max.x : box.min.x,
+        corner & 2 ? box.max.y : box.min.y, corner & 4 ? box.max.z : box.min.z);
+    result.extend(glm::vec3(matrix * glm::vec4(point, 1.f)));
+  }
+  return result;
+}
+
+namespace
+{
+
+// Returns a pointer to the first byte of [byteOffset, byteOffset + byteLength)
+// in the bufferView, or nullptr if the range does not fit in the buffer
+const uint8_t *getBufferViewData(const tinygltf::Model &model,
+    int bufferViewIdx, size_t byteOffset, size_t byteLength)
+{
+  if (bufferViewIdx < 0 || size_t(bufferViewIdx) >= model.bufferViews.size()) {
+    return nullptr;
+  }
+  const auto &bufferView = model.bufferViews[bufferViewIdx];
+  if (bufferView.buffer < 0 ||
+      size_t(bufferView.buffer) >= model.buffers.size()) {
+    return nullptr;
+  }
+  const auto &buffer = model.buffers[bufferView.buffer];
+  const auto begin = bufferView.byteOffset + byteOffset;
+  if (byteOffset + byteLength > bufferView.byteLength ||
+      begin + byteLength > buffer.data.size()) {
+    return nullptr;
+  }
+  return buffer.data.data() + begin;
+}
+
+// Extend bounds with the positions of a primitive transformed by modelMatrix.
+// Only the vertices referenced by the index buffer, if any, are considered.
+void accumulatePrimitiveBounds(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, const glm::mat4 &modelMatrix,
+    BoundingBox &bounds)
+{
+  const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+  if (positionAttrIdxIt == end(primitive.attributes)) {
+    return;
+  }
+  const auto &positionAccessor = model.accessors[(*positionAttrIdxIt).second];
+  if (positionAccessor.type != 3) {
+    std::cerr << "Position accessor with type != VEC3, skipping" << std::endl;
+    return;
+  }
+  const auto &positionBufferView =
+      model.bufferViews[positionAccessor.bufferView];
+  const auto byteOffset =
+      positionAccessor.byteOffset + positionBufferView.byteOffset;
+  const auto &positionBuffer = model.buffers[positionBufferView.buffer];
+  const auto positionByteStride = positionBufferView.byteStride
+                                      ? positionBufferView.byteStride
+                                      : 3 * sizeof(float);
+
+  const auto addPosition = [&](size_t vertexIdx) {
+    const auto &localPosition =
+        *((const glm::vec3 *)&positionBuffer
+                .data[byteOffset + positionByteStride * vertexIdx]);
+    bounds.extend(glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f)));
+  };
+
+  if (primitive.indices < 0) {
+    for (size_t i = 0; i < positionAccessor.count; ++i) {
+      addPosition(i);
+    }
+    return;
+  }
+
+  const auto &indexAccessor = model.accessors[primitive.indices];
+  const auto &indexBufferView = model.bufferViews[indexAccessor.bufferView];
+  const auto indexByteOffset =
+      indexAccessor.byteOffset + indexBufferView.byteOffset;
+  const auto &indexBuffer = model.buffers[indexBufferView.buffer];
+  auto indexByteStride = indexBufferView.byteStride;
+
+  switch (indexAccessor.componentType) {
+  default:
+    std::cerr << "Primitive index accessor with bad componentType "
+              << indexAccessor.componentType << ", skipping it." << std::endl;
+    return;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    indexByteStride = indexByteStride ? indexByteStride : sizeof(uint8_t);
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    indexByteStride = indexByteStride ? indexByteStride : sizeof(uint16_t);
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    indexByteStride = indexByteStride ? indexByteStride : sizeof(uint32_t);
+    break;
+  }
+
+  for (size_t i = 0; i < indexAccessor.count; ++i) {
+    const auto *indexPtr =
+        &indexBuffer.data[indexByteOffset + indexByteStride * i];
+    uint32_t index = 0;
+    switch (indexAccessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      index = *((const uint8_t *)indexPtr);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      index = *((const uint16_t *)indexPtr);
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      index = *((const uint32_t *)indexPtr);
+      break;
+    }
+    addPosition(index);
+  }
+}
+
+} // namespace
+
+BoundingBox computeMeshLocalBounds(const tinygltf::Model &model, int meshIdx)
+{
+  BoundingBox bounds;
+  for (const auto &primitive : model.meshes[meshIdx].primitives) {
+    accumulatePrimitiveBounds(model, primitive, glm::mat4(1), bounds);
+  }
+  return bounds;
+}
+
+std::vector<BoundingBox> computeNodeWorldBounds(const tinygltf::Model &model)
+{
+  std::vector<std::pair<int, glm::mat4>> meshNodes;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &worldMatrix) {
+    if (model.nodes[nodeIdx].mesh >= 0) {
+      meshNodes.emplace_back(nodeIdx, worldMatrix);
+    }
+  });
+
+  std::vector<BoundingBox> nodeBounds(model.nodes.size());
+  parallelFor(meshNodes.size(), [&](size_t i) {
+    const auto nodeIdx = meshNodes[i].first;
+    const auto &worldMatrix = meshNodes[i].second;
+    const auto &node = model.nodes[nodeIdx];
+    auto &bounds = nodeBounds[nodeIdx];
+
+    NodeInstancing instancing;
+    if (getNodeInstancing(model, node, instancing)) {
+      // Transforming every vertex of every instance would be too slow for
+      // large instance counts: transform the local bounds of the mesh
+      const auto localBounds = computeMeshLocalBounds(model, node.mesh);
+      for (const auto &instanceMatrix :
+          getNodeInstanceMatrices(model, instancing)) {
+        bounds.extend(
+            transformBoundingBox(worldMatrix * instanceMatrix, localBounds));
+      }
+      return;
+    }
+
+    for (const auto &primitive : model.meshes[node.mesh].primitives) {
+      accumulatePrimitiveBounds(model, primitive, worldMatrix, bounds);
+    }
+  });
+  return nodeBounds;
+}
+
+std::vector<BoundingBox> computeInstanceWorldBounds(
+    const tinygltf::Model &model, std::vector<size_t> &nodeOffsets)
+{
+  std::vector<std::pair<int, glm::mat4>> instancedNodes;
+  std::vector<NodeInstancing> nodeInstancing(model.nodes.size());
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &worldMatrix) {
+    if (getNodeInstancing(
+            model, model.nodes[nodeIdx], nodeInstancing[nodeIdx])) {
+      instancedNodes.emplace_back(nodeIdx, worldMatrix);
+    } else {
+      nodeInstancing[nodeIdx] = NodeInstancing{};
+    }
+  });
+
+  nodeOffsets.assign(model.nodes.size() + 1, 0);
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    nodeOffsets[nodeIdx + 1] =
+        nodeOffsets[nodeIdx] + nodeInstancing[nodeIdx].instanceCount;
+  }
+
+  std::vector<BoundingBox> instanceBounds(nodeOffsets.back());
+  parallelFor(instancedNodes.size(), [&](size_t i) {
+    const auto nodeIdx = instancedNodes[i].first;
+    const auto &worldMatrix = instancedNodes[i].second;
+    const auto localBounds =
+        computeMeshLocalBounds(model, model.nodes[nodeIdx].mesh);
+    auto *bounds = instanceBounds.data() + nodeOffsets[nodeIdx];
+    for (const auto &instanceMatrix :
+        getNodeInstanceMatrices(model, nodeInstancing[nodeIdx])) {
+      *bounds++ =
+          transformBoundingBox(worldMatrix * instanceMatrix, localBounds);
+    }
+  });
+  return instanceBounds;
+}
+
 void computeSceneBounds(
     const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
 {
-  // Compute scene bounding box
-  // todo refactor with scene drawing
-  // todo need a visitScene generic function that takes a accept() functor
-  bboxMin = glm::vec3(std::numeric_limits<float>::max());
-  bboxMax = glm::vec3(std::numeric_limits<float>::lowest());
-  if (model.defaultScene >= 0) {
-    const std::function<void(int, const glm::mat4 &)> updateBounds =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          const auto &node = model.nodes[nodeIdx];
-          const glm::mat4 modelMatrix =
-              getLocalToWorldMatrix(node, parentMatrix);
-          if (node.mesh >= 0) {
-            const auto &mesh = model.meshes[node.mesh];
-            for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-              const auto &primitive = mesh.primitives[pIdx];
-              const auto positionAttrIdxIt =
-                  primitive.attributes.find("POSITION");
-              if (positionAttrIdxIt == end(primitive.attributes)) {
-                continue;
-              }
-              const auto &positionAccessor =
-                  model.accessors[(*positionAttrIdxIt).second];
-              if (positionAccessor.type != 3) {
-                std::cerr << "Position accessor with type != VEC3, skipping"
-                          << std::endl;
-                continue;
-              }
-              const auto &positionBufferView =
-                  model.bufferViews[positionAccessor.bufferView];
-              const auto byteOffset =
-                  positionAccessor.byteOffset + positionBufferView.byteOffset;
-              const auto &positionBuffer =
-                  model.buffers[positionBufferView.buffer];
-              const auto positionByteStride =
-                  positionBufferView.byteStride ? positionBufferView.byteStride
-                                                : 3 * sizeof(float);
-
-              if (primitive.indices >= 0) {
-                const auto &indexAccessor = model.accessors[primitive.indices];
-                const auto &indexBufferView =
-                    model.bufferViews[indexAccessor.bufferView];
-                const auto indexByteOffset =
-                    indexAccessor.byteOffset + indexBufferView.byteOffset;
-                const auto &indexBuffer = model.buffers[indexBufferView.buffer];
-                auto indexByteStride = indexBufferView.byteStride;
-
-                switch (indexAccessor.componentType) {
-                default:
-                  std::cerr
-                      << "Primitive index accessor with bad componentType "
-                      << indexAccessor.componentType << ", skipping it."
-                      << std::endl;
-                  continue;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint8_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint16_t);
-                  break;
-                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                  indexByteStride =
-                      indexByteStride ? indexByteStride : sizeof(uint32_t);
-                  break;
-                }
-
-                for (size_t i = 0; i < indexAccessor.count; ++i) {
-                  uint32_t index = 0;
-                  switch (indexAccessor.componentType) {
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-                    index = *((const uint8_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-                    index = *((const uint16_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-                    index = *((const uint32_t *)&indexBuffer
-                                  .data[indexByteOffset + indexByteStride * i]);
-                    break;
-                  }
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * index]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              } else {
-                for (size_t i = 0; i < positionAccessor.count; ++i) {
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * i]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
-                }
-              }
-            }
-          }
-          for (const auto childNodeIdx : node.children) {
-            updateBounds(childNodeIdx, modelMatrix);
-          }
-        };
-    for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
-      updateBounds(nodeIdx, glm::mat4(1));
-    }
-  }
-}
\ No newline at end of file
+  BoundingBox sceneBounds;
+  for (const auto &bounds : computeNodeWorldBounds(model)) {
+    sceneBounds.extend(bounds);
+  }
+  bboxMin = sceneBounds.min;
+  bboxMax = sceneBounds.max;
+}
+
+bool readAccessorAsVec4(const tinygltf::Model &model, int accessorIdx,
+    std::vector<glm::vec4> &values, const glm::vec4 &defaultValue)
+{
+  if (accessorIdx < 0 || size_t(accessorIdx) >= model.accessors.size()) {
+    return false;
+  }
+  const auto &accessor = model.accessors[accessorIdx];
+  const auto componentCount =
+      tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+  const auto componentSize = tinygltf::GetComponentSizeInBytes(
+      static_cast<uint32_t>(accessor.componentType));
+  if (componentCount <= 0 || componentCount > 4 || componentSize <= 0) {
+    return false;
+  }
+  const auto elementSize = size_t(componentCount * componentSize);
+
+  values.assign(accessor.count, defaultValue);
+  if (accessor.bufferView < 0) {
+    // All zeros (sparse accessors have already been resolved)
+    for (auto &value : values) {
+      for (auto c = 0; c < componentCount; ++c) {
+        value[c] = 0.f;
+      }
+    }
+    return true;
+  }
+
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto stride =
+      bufferView.byteStride ? bufferView.byteStride : elementSize;
+  const auto *data = getBufferViewData(model, accessor.bufferView,
+      accessor.byteOffset,
+      accessor.count ? (accessor.count - 1) * stride + elementSize : 0);
+  if (!data) {
+    return false;
+  }
+
+  // Conversion rules of the glTF specification for normalized integers
+  const auto readComponent = [&](const uint8_t *ptr) -> float {
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+      float value;
+      std::memcpy(&value, ptr, sizeof(value));
+      return value;
+    }
+    case TINYGLTF_COMPONENT_TYPE_BYTE: {
+      const auto value = float(int8_t(*ptr));
+      return accessor.normalized ? std::max(value / 127.f, -1.f) : value;
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+      const auto value = float(*ptr);
+      return accessor.normalized ? value / 255.f : value;
+    }
+    case TINYGLTF_COMPONENT_TYPE_SHORT: {
+      int16_t value;
+      std::memcpy(&value, ptr, sizeof(value));
+      return accessor.normalized ? std::max(value / 32767.f, -1.f)
+                                 : float(value);
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      uint16_t value;
+      std::memcpy(&value, ptr, sizeof(value));
+      return accessor.normalized ? value / 65535.f : float(value);
+    }
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+      uint32_t value;
+      std::memcpy(&value, ptr, sizeof(value));
+      return float(value);
+    }
+    }
+    return 0.f;
+  };
+
+  for (size_t i = 0; i < accessor.count; ++i) {
+    const auto *element = data + i * stride;
+    for (auto c = 0; c < componentCount; ++c) {
+      values[i][c] = readComponent(element + c * componentSize);
+    }
+  }
+  return true;
+}
+
+bool readPrimitiveIndices(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<uint32_t> &indices)
+{
+  if (primitive.indices < 0) {
+    const auto positionAttrIdxIt = primitive.attributes.find("POSITION");
+    if (positionAttrIdxIt == end(primitive.attributes)) {
+      return false;
+    }
+    indices.resize(model.accessors[(*positionAttrIdxIt).second].count);
+    std::iota(begin(indices), end(indices), 0u);
+    return true;
+  }
+
+  const auto &accessor = model.accessors[primitive.indices];
+  const auto componentSize = tinygltf::GetComponentSizeInBytes(
+      static_cast<uint32_t>(accessor.componentType));
+  if (componentSize != 1 && componentSize != 2 && componentSize != 4) {
+    return false;
+  }
+  const auto stride =
+      accessor.bufferView >= 0 &&
+              model.bufferViews[accessor.bufferView].byteStride
+          ? model.bufferViews[accessor.bufferView].byteStride
+          : size_t(componentSize);
+  const auto *data = getBufferViewData(model, accessor.bufferView,
+      accessor.byteOffset,
+      accessor.count ? (accessor.count - 1) * stride + componentSize : 0);
+  if (!data) {
+    return false;
+  }
+
+  indices.resize(accessor.count);
+  for (size_t i = 0; i < accessor.count; ++i) {
+    const auto *ptr = data + i * stride;
+    switch (componentSize) {
+    case 1:
+      indices[i] = *ptr;
+      break;
+    case 2: {
+      uint16_t index;
+      std::memcpy(&index, ptr, sizeof(index));
+      indices[i] = index;
+      break;
+    }
+    case 4:
+      std::memcpy(&indices[i], ptr, sizeof(uint32_t));
+      break;
+    }
+  }
+  return true;
+}
+
+int convertToListMode(int mode, std::vector<uint32_t> &indices)
+{
+  std::vector<uint32_t> list;
+  switch (mode) {
+  case TINYGLTF_MODE_LINE_LOOP:
+  case TINYGLTF_MODE_LINE_STRIP:
+    for (size_t i = 0; i + 1 < indices.size(); ++i) {
+      list.insert(end(list), {indices[i], indices[i + 1]});
+    }
+    if (mode == TINYGLTF_MODE_LINE_LOOP && indices.size() > 2) {
+      list.insert(end(list), {indices.back(), indices.front()});
+    }
+    indices = std::move(list);
+    return TINYGLTF_MODE_LINE;
+  case TINYGLTF_MODE_TRIANGLE_STRIP:
+    for (size_t i = 0; i + 2 < indices.size(); ++i) {
+      // Keep the winding of odd triangles
+      if (i % 2) {
+        list.insert(end(list), {indices[i + 1], indices[i], indices[i + 2]});
+      } else {
+        list.insert(end(list), {indices[i], indices[i + 1], indices[i + 2]});
+      }
+    }
+    indices = std::move(list);
+    return TINYGLTF_MODE_TRIANGLES;
+  case TINYGLTF_MODE_TRIANGLE_FAN:
+    for (size_t i = 1; i + 1 < indices.size(); ++i) {
+      list.insert(end(list), {indices[0], indices[i], indices[i + 1]});
+    }
+    indices = std::move(list);
+    return TINYGLTF_MODE_TRIANGLES;
+  }
+  return mode;
+}
+
+MaterialFactors getMaterialFactors(
+    const tinygltf::Model &model, int materialIdx)
+{
+  // Primitives without material use the default material of the spec
+  const tinygltf::Material defaultMaterial;
+  const auto &material =
+      materialIdx >= 0 ? model.materials[materialIdx] : defaultMaterial;
+  const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+  MaterialFactors factors{};
+  for (int c = 0; c < 4; ++c) {
+    factors.baseColorFactor[c] =
+        pbrMetallicRoughness.baseColorTexture.index >= 0
+            ? float(pbrMetallicRoughness.baseColorFactor[c])
+            : 1.f;
+  }
+  if (pbrMetallicRoughness.metallicRoughnessTexture.index >= 0) {
+    factors.metallicFactor = float(pbrMetallicRoughness.metallicFactor);
+    factors.roughnessFactor = float(pbrMetallicRoughness.roughnessFactor);
+  }
+  if (material.emissiveTexture.index >= 0) {
+    for (int c = 0; c < 3; ++c) {
+      factors.emissiveFactor[c] = float(material.emissiveFactor[c]);
+    }
+  }
+  if (material.occlusionTexture.index >= 0) {
+    factors.occlusionStrength = float(material.occlusionTexture.strength);
+  }
+  if (material.alphaMode == "MASK") {
+    factors.alphaCutoff = float(material.alphaCutoff);
+  }
+  return factors;
+}
+
+DrawPass getMaterialDrawPass(const tinygltf::Model &model, int materialIdx)
+{
+  if (materialIdx < 0) {
+    return DRAW_PASS_OPAQUE;
+  }
+  const auto &alphaMode = model.materials[materialIdx].alphaMode;
+  return alphaMode == "BLEND"  ? DRAW_PASS_BLEND
+         : alphaMode == "MASK" ? DRAW_PASS_MASK
+                               : DRAW_PASS_OPAQUE;
+}
+
+glm::vec4 computeMaterialAverageColor(
+    const tinygltf::Model &model, int materialIdx)
+{
+  if (materialIdx < 0) {
+    return glm::vec4(1);
+  }
+  const auto &pbr = model.materials[materialIdx].pbrMetallicRoughness;
+  auto color = glm::vec4(float(pbr.baseColorFactor[0]),
+      float(pbr.baseColorFactor[1]), float(pbr.baseColorFactor[2]),
+      float(pbr.baseColorFactor[3]));
+
+  const auto textureIdx = pbr.baseColorTexture.index;
+  if (textureIdx < 0 || model.textures[textureIdx].source < 0) {
+    return color;
+  }
+  const auto &image = model.images[model.textures[textureIdx].source];
+  const auto componentCount = size_t(image.component);
+  const auto bytesPerComponent = image.bits == 16 ? 2 : 1;
+  const auto texelCount = size_t(image.width) * size_t(image.height);
+  if (!texelCount || componentCount < 1 || componentCount > 4 ||
+      image.image.size() < texelCount * componentCount * bytesPerComponent) {
+    return color;
+  }
+  // Every 7th texel is enough for an average, and keeps it cheap for large
+  // textures (7 is prime so that it does not alias with power of two sizes)
+  glm::dvec4 sum(0);
+  size_t sampleCount = 0;
+  for (size_t texel = 0; texel < texelCount; texel += 7, ++sampleCount) {
+    glm::dvec4 texelColor(0, 0, 0, 1);
+    for (size_t c = 0; c < componentCount; ++c) {
+      const auto offset = (texel * componentCount + c) * bytesPerComponent;
+      if (bytesPerComponent == 2) {
+        uint16_t value;
+        std::memcpy(&value, &image.image[offset], sizeof(value));
+        texelColor[c] = value / 65535.;
+      } else {
+        texelColor[c] = image.image[offset] / 255.;
+      }
+    }
+    if (componentCount <= 2) {
+      // Grey (+ alpha)
+      texelColor = glm::dvec4(glm::dvec3(texelColor.r),
+          componentCount == 2 ? texelColor.g : 1.);
+    }
+    sum += texelColor;
+  }
+  return color * glm::vec4(sum / double(sampleCount));
+}
+
+bool getNodeInstancing(const tinygltf::Model &model,
+    const tinygltf::Node &node, NodeInstancing &instancing)
+{
+  const auto extension = node.extensions.find("EXT_mesh_gpu_instancing");
+  if (extension == end(node.extensions) || node.mesh < 0 ||
+      !(*extension).second.Has("attributes")) {
+    return false;
+  }
+  const auto &attributes = (*extension).second.Get("attributes");
+  const auto getAccessor = [&](const char *name) {
+    if (!attributes.Has(name) || !attributes.Get(name).IsNumber()) {
+      return -1;
+    }
+    const auto accessorIdx = int(attributes.Get(name).GetNumberAsInt());
+    return accessorIdx >= 0 && size_t(accessorIdx) < model.accessors.size()
+               ? accessorIdx
+               : -1;
+  };
+
+  instancing = NodeInstancing{};
+  instancing.translationAccessor = getAccessor("TRANSLATION");
+  instancing.rotationAccessor = getAccessor("ROTATION");
+  instancing.scaleAccessor = getAccessor("SCALE");
+
+  // All attribute accessors must have the same count
+  for (const auto accessorIdx : {instancing.translationAccessor,
+           instancing.rotationAccessor, instancing.scaleAccessor}) {
+    if (accessorIdx < 0) {
+      continue;
+    }
+    const auto count = model.accessors[accessorIdx].count;
+    if (instancing.instanceCount && instancing.instanceCount != count) {
+      std::cerr << "EXT_mesh_gpu_instancing attributes with different counts, "
+                   "ignoring the extension"
+                << std::endl;
+      return false;
+    }
+    instancing.instanceCount = count;
+  }
+  return instancing.instanceCount > 0;
+}
+
+std::vector<glm::mat4> getNodeInstanceMatrices(
+    const tinygltf::Model &model, const NodeInstancing &instancing)
+{
+  std::vector<glm::vec4> translations, rotations, scales;
+  if (!readAccessorAsVec4(model, instancing.translationAccessor, translations,
+          glm::vec4(0))) {
+    translations.assign(instancing.instanceCount, glm::vec4(0));
+  }
+  if (!readAccessorAsVec4(model, instancing.rotationAccessor, rotations,
+          glm::vec4(0, 0, 0, 1))) {
+    rotations.assign(instancing.instanceCount, glm::vec4(0, 0, 0, 1));
+  }
+  if (!readAccessorAsVec4(
+          model, instancing.scaleAccessor, scales, glm::vec4(1))) {
+    scales.assign(instancing.instanceCount, glm::vec4(1));
+  }
+
+  std::vector<glm::mat4> matrices(instancing.instanceCount);
+  for (size_t i = 0; i < instancing.instanceCount; ++i) {
+    const auto &r = rotations[i];
+    const auto T = glm::translate(glm::mat4(1), glm::vec3(translations[i]));
+    const auto TR = T * glm::mat4_cast(glm::quat(r.w, r.x, r.y, r.z));
+    matrices[i] = glm::scale(TR, glm::vec3(scales[i]));
+  }
+  return matrices;
+}
+
+namespace
+{
+
+// Copy `count` elements of ElementSize bytes from values to
+// dest[indices[i] * ElementSize]. The fixed element size lets the compiler
+// turn each copy into a single (possibly SIMD) load/store pair.
+template <size_t ElementSize>
+void scatterElements(uint8_t *dest, const uint32_t *indices,
+    const uint8_t *values, size_t count)
+{
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(dest + size_t(indices[i]) * ElementSize,
+        values + i * ElementSize, ElementSize);
+  }
+}
+
+void scatterElements(uint8_t *dest, const uint32_t *indices,
+    const uint8_t *values, size_t count, size_t elementSize)
+{
+  switch (elementSize) {
+  case 4:
+    return scatterElements<4>(dest, indices, values, count);
+  case 8:
+    return scatterElements<8>(dest, indices, values, count);
+  case 12:
+    return scatterElements<12>(dest, indices, values, count);
+  case 16:
+    return scatterElements<16>(dest, indices, values, count);
+  default:
+    for (size_t i = 0; i < count; ++i) {
+      std::memcpy(dest + size_t(indices[i]) * elementSize,
+          values + i * elementSize, elementSize);
+    }
+  }
+}
+
+// Widen sparse indices to uint32_t so that the scatter loop has no branch on
+// the index component type
+template <typename IndexType>
+void widenIndices(const uint8_t *src, size_t count, uint32_t *dest)
+{
+  for (size_t i = 0; i < count; ++i) {
+    IndexType index;
+    std::memcpy(&index, src + i * sizeof(IndexType), sizeof(IndexType));
+    dest[i] = index;
+  }
+}
+
+struct SparseResolveJob
+{
+  int accessorIdx; // First accessor using this job, describes the layout
+  size_t elementSize;
+  size_t outputOffset; // Byte offset in the resolved buffer
+  bool succeeded;
+};
+
+// Fill dest[0 : accessor.count * elementSize] with the dense data of the
+// sparse accessor
+bool resolveSparseAccessor(const tinygltf::Model &model,
+    const tinygltf::Accessor &accessor, size_t elementSize, uint8_t *dest)
+{
+  const auto denseSize = accessor.count * elementSize;
+
+  // Base data: the bufferView if any, zeros otherwise
+  if (accessor.bufferView >= 0) {
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto stride =
+        bufferView.byteStride ? bufferView.byteStride : elementSize;
+    const auto baseSize =
+        accessor.count ? (accessor.count - 1) * stride + elementSize : 0;
+    const auto *src = getBufferViewData(
+        model, accessor.bufferView, accessor.byteOffset, baseSize);
+    if (!src) {
+      std::cerr << "Sparse accessor base out of its bufferView bounds"
+                << std::endl;
+      return false;
+    }
+    if (stride == elementSize) {
+      std::memcpy(dest, src, denseSize);
+    } else {
+      for (size_t i = 0; i < accessor.count; ++i) {
+        std::memcpy(dest + i * elementSize, src + i * stride, elementSize);
+      }
+    }
+  } else {
+    std::memset(dest, 0, denseSize);
+  }
+
+  const auto &sparse = accessor.sparse;
+  const auto sparseCount = size_t(sparse.count);
+  const auto indexType = sparse.indices.componentType;
+  if (indexType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE &&
+      indexType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+      indexType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
+    std::cerr << "Sparse accessor with bad index componentType " << indexType
+              << std::endl;
+    return false;
+  }
+  const auto indexSize = size_t(
+      tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(indexType)));
+  const auto *indicesData = getBufferViewData(model,
+      sparse.indices.bufferView, size_t(sparse.indices.byteOffset),
+      sparseCount * indexSize);
+  const auto *valuesData = getBufferViewData(model, sparse.values.bufferView,
+      size_t(sparse.values.byteOffset), sparseCount * elementSize);
+  if (!indicesData || !valuesData) {
+    std::cerr << "Sparse accessor indices or values out of bounds"
+              << std::endl;
+    return false;
+  }
+
+  std::vector<uint32_t> indices(sparseCount);
+  switch (indexType) {
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    widenIndices<uint8_t>(indicesData, sparseCount, indices.data());
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    widenIndices<uint16_t>(indicesData, sparseCount, indices.data());
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    widenIndices<uint32_t>(indicesData, sparseCount, indices.data());
+    break;
+  }
+
+  const auto maxIndex = sparseCount
+                            ? *std::max_element(begin(indices), end(indices))
+                            : 0u;
+  if (sparseCount && maxIndex >= accessor.count) {
+    std::cerr << "Sparse accessor index " << maxIndex
+              << " out of range (count = " << accessor.count << ")"
+              << std::endl;
+    return false;
+  }
+
+  scatterElements(dest, indices.data(), valuesData, sparseCount, elementSize);
+  return true;
+}
+
+} // namespace
+
+size_t resolveSparseAccessors(tinygltf::Model &model)
+{
+  // Layout and substitutions of a sparse accessor; two accessors with the same
+  // key resolve to the same dense data. The substitutions are part of the key:
+  // the dense stream of each accessor is bound as one vertex buffer range, so
+  // a base cannot be shared by accessors whose substitutions differ.
+  const auto getResolveKey = [](const tinygltf::Accessor &accessor) {
+    const auto &sparse = accessor.sparse;
+    return std::make_tuple(accessor.bufferView, accessor.byteOffset,
+        accessor.componentType, accessor.type, accessor.count, sparse.count,
+        sparse.indices.bufferView, sparse.indices.byteOffset,
+        sparse.indices.componentType, sparse.values.bufferView,
+        sparse.values.byteOffset);
+  };
+  using ResolveKey = decltype(getResolveKey(tinygltf::Accessor{}));
+
+  std::vector<SparseResolveJob> jobs;
+  std::map<ResolveKey, size_t> keyToJob;
+  std::vector<std::pair<int, size_t>> accessorToJob;
+  size_t resolvedBufferSize = 0;
+
+  for (size_t accessorIdx = 0; accessorIdx < model.accessors.size();
+       ++accessorIdx) {
+    const auto &accessor = model.accessors[accessorIdx];
+    if (!accessor.sparse.isSparse) {
+      continue;
+    }
+    const auto componentSize = tinygltf::GetComponentSizeInBytes(
+        static_cast<uint32_t>(accessor.componentType));
+    const auto componentCount =
+        tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+    if (componentSize <= 0 || componentCount <= 0) {
+      std::cerr << "Sparse accessor " << accessorIdx
+                << " has an invalid type, skipping it." << std::endl;
+      continue;
+    }
+
+    const auto insertion =
+        keyToJob.emplace(getResolveKey(accessor), jobs.size());
+    if (insertion.second) {
+      const auto elementSize = size_t(componentSize * componentCount);
+      jobs.push_back(SparseResolveJob{
+          int(accessorIdx), elementSize, resolvedBufferSize, false});
+      // Keep each stream 4-bytes aligned, as required for vertex attributes
+      resolvedBufferSize += (accessor.count * elementSize + 3) & ~size_t(3);
+    }
+    accessorToJob.emplace_back(int(accessorIdx), (*insertion.first).second);
+  }
+
+  if (jobs.empty()) {
+    return 0;
+  }
+
+  tinygltf::Buffer resolvedBuffer;
+  resolvedBuffer.name = "resolved sparse accessors";
+  resolvedBuffer.data.resize(resolvedBufferSize);
+
+  parallelFor(jobs.size(), [&](size_t jobIdx) {
+    auto &job = jobs[jobIdx];
+    job.succeeded = resolveSparseAccessor(model,
+        model.accessors[job.accessorIdx], job.elementSize,
+        resolvedBuffer.data.data() + job.outputOffset);
+  });
+
+  const auto resolvedBufferIdx = int(model.buffers.size());
+  model.buffers.emplace_back(std::move(resolvedBuffer));
+
+  // One bufferView per job, shared by all accessors resolved by that job
+  std::vector<int> jobToBufferView(jobs.size(), -1);
+  for (size_t jobIdx = 0; jobIdx < jobs.size(); ++jobIdx) {
+    const auto &job = jobs[jobIdx];
+    if (!job.succeeded) {
+      continue;
+    }
+    const auto &accessor = model.accessors[job.accessorIdx];
+    tinygltf::BufferView bufferView;
+    bufferView.buffer = resolvedBufferIdx;
+    bufferView.byteOffset = job.outputOffset;
+    bufferView.byteLength = accessor.count * job.elementSize;
+    bufferView.byteStride = 0; // tightly packed
+    bufferView.target = accessor.bufferView >= 0
+                            ? model.bufferViews[accessor.bufferView].target
+                            : TINYGLTF_TARGET_ARRAY_BUFFER;
+    jobToBufferView[jobIdx] = int(model.bufferViews.size());
+    model.bufferViews.emplace_back(std::move(bufferView));
+  }
+
+  size_t resolvedCount = 0;
+  for (const auto &accessorAndJob : accessorToJob) {
+    const auto bufferViewIdx = jobToBufferView[accessorAndJob.second];
+    if (bufferViewIdx < 0) {
+      continue;
+    }
+    auto &accessor = model.accessors[accessorAndJob.first];
+    accessor.bufferView = bufferViewIdx;
+    accessor.byteOffset = 0;
+    accessor.sparse.isSparse = false;
+    ++resolvedCount;
+  }
+
+  std::clog << "Resolved " << resolvedCount << " sparse accessors into "
+            << jobs.size() << " dense streams (" << resolvedBufferSize
+            << " bytes)" << std::endl;
+
+  return resolvedCount;
+}
@@ -1,10 +1,138 @@
 #pragma once
 
+#include "draw_sort.hpp"
+
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
 
+#include <functional>
+#include <limits>
+
+// Axis aligned bounding box, empty by default
+struct BoundingBox
+{
+  glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+  bool isEmpty() const { return min.x > max.x; }
+
+  void extend(const glm::vec3 &point)
+  {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void extend(const BoundingBox &box)
+  {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+};
+
+// Bounding box of the 8 transformed corners of box
+BoundingBox transformBoundingBox(
+    const glm::mat4 &matrix, const BoundingBox &box);
+
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix);
 
+// Call visitor(nodeIdx, localToWorldMatrix) for each node of the default scene,
+// parents before children
+void visitScene(const tinygltf::Model &model,
+    const std::function<void(int, const glm::mat4 &)> &visitor);
+
+// Local to world matrix of each node of the default scene (identity for nodes
+// not in the default scene)
+std::vector<glm::mat4> computeNodeWorldMatrices(const tinygltf::Model &model);
+
 void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
\ No newline at end of file
+    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
+
+// World space bounds of the mesh of each node of the default scene, including
+// all its EXT_mesh_gpu_instancing instances. Empty for nodes without mesh.
+std::vector<BoundingBox> computeNodeWorldBounds(const tinygltf::Model &model);
+
+// World space bounds of each EXT_mesh_gpu_instancing instance of the nodes of
+// the default scene, for culling instances one by one: those of node i are
+// in [nodeOffsets[i], nodeOffsets[i + 1]), an empty range for other nodes.
+std::vector<BoundingBox> computeInstanceWorldBounds(
+    const tinygltf::Model &model, std::vector<size_t> &nodeOffsets);
+
+// Local space bounds of all the positions of a mesh
+BoundingBox computeMeshLocalBounds(const tinygltf::Model &model, int meshIdx);
+
+// Read the elements of an accessor as vec4, converting components to float
+// (normalized integers are mapped to [0, 1] or [-1, 1]). Components not
+// present in the accessor type are taken from defaultValue.
+bool readAccessorAsVec4(const tinygltf::Model &model, int accessorIdx,
+    std::vector<glm::vec4> &values,
+    const glm::vec4 &defaultValue = glm::vec4(0, 0, 0, 1));
+
+// Read the vertex indices of a primitive, or 0..n-1 for non indexed
+// primitives (n being the count of the POSITION accessor)
+bool readPrimitiveIndices(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive, std::vector<uint32_t> &indices);
+
+// Convert the indices of a strip, loop or fan primitive to the corresponding
+// list (triangle strips keep their winding). Returns the list mode:
+// TINYGLTF_MODE_LINE, TINYGLTF_MODE_TRIANGLES or mode itself for lists and
+// points.
+int convertToListMode(int mode, std::vector<uint32_t> &indices);
+
+// Average color of a material: base color factor multiplied by the mean texel
+// of its base color texture, if any. White for materialIdx < 0.
+glm::vec4 computeMaterialAverageColor(
+    const tinygltf::Model &model, int materialIdx);
+
+// Factors of a material as applied by the PBR shaders, laid out like the
+// first members of the std430 material structs of the storage buffer paths
+// (PooledMaterial, BindlessMaterial). Factors are only used along with their
+// texture: white base color and 0 for the others without texture.
+struct MaterialFactors
+{
+  float baseColorFactor[4];
+  float emissiveFactor[4]; // w unused
+  float metallicFactor;
+  float roughnessFactor;
+  float occlusionStrength;
+  // MASK materials only, 0 otherwise: fragments with a lower alpha are
+  // discarded
+  float alphaCutoff;
+};
+
+// materialIdx < 0 for the default material
+MaterialFactors getMaterialFactors(
+    const tinygltf::Model &model, int materialIdx);
+
+// Pass of the draws of a material from its alphaMode, materialIdx < 0 for
+// the default material (opaque)
+DrawPass getMaterialDrawPass(const tinygltf::Model &model, int materialIdx);
+
+// Accessors of the EXT_mesh_gpu_instancing attributes of a node, -1 for the
+// ones that are not specified
+struct NodeInstancing
+{
+  int translationAccessor = -1;
+  int rotationAccessor = -1;
+  int scaleAccessor = -1;
+  size_t instanceCount = 0;
+};
+
+// Returns false if the node does not use EXT_mesh_gpu_instancing
+bool getNodeInstancing(const tinygltf::Model &model,
+    const tinygltf::Node &node, NodeInstancing &instancing);
+
+// Local transform of each instance (translation * rotation * scale), to be
+// applied before the node matrix
+std::vector<glm::mat4> getNodeInstanceMatrices(
+    const tinygltf::Model &model, const NodeInstancing &instancing);
+
+// Replace every sparse accessor of the model by a dense accessor pointing to a
+// new buffer holding the resolved data (base bufferView, or zeros, with the
+// sparse substitutions applied). Accessors are resolved in parallel. Only
+// sparse accessors with identical base and substitutions share their dense
+// data: accessors sharing a base but with other substitutions each get a full
+// copy of it, since a vertex attribute is fetched from a single contiguous
+// range. Non-sparse accessors are left untouched.
+// Returns the number of accessors that have been resolved.
+size_t resolveSparseAccessors(tinygltf::Model &model);
@@ -0,0 +1,406 @@
+#include "gltf_loader.hpp"
+#include "file_reader.hpp"
+#include "gltf.hpp"
+#include "image_decoders.hpp"
+#include "images.hpp"
+#include "job_system.hpp"
+
+#include <json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Same rule as tinygltf uses to locate external files, so that paths we
+// prefetch match the paths requested through the fs callbacks
+std::string joinPath(const std::string &baseDir, const std::string &uri)
+{
+  if (baseDir.empty()) {
+    return uri;
+  }
+  return baseDir.back() == '/' ? baseDir + uri : baseDir + "/" + uri;
+}
+
+// Decode an image and downscale it to maxTextureSize if needed
+bool decodeImageForUpload(const unsigned char *bytes, size_t size,
+    int maxTextureSize, tinygltf::Image &image, std::string &error,
+    std::atomic<size_t> &downscaledImageCount)
+{
+  if (!decodeImage(bytes, size, image, error)) {
+    return false;
+  }
+  if (limitImageSize(image.image, image.width, image.height, image.component,
+          image.bits, maxTextureSize)) {
+    ++downscaledImageCount;
+  }
+  return true;
+}
+
+// Decodes images as jobs of the shared JobSystem, in the order they are pushed
+class ImageDecodeQueue
+{
+public:
+  explicit ImageDecodeQueue(int maxTextureSize) :
+      m_maxTextureSize(maxTextureSize)
+  {
+  }
+
+  ~ImageDecodeQueue() { JobSystem::instance().wait(m_decodeJobs); }
+
+  ImageDecodeQueue(const ImageDecodeQueue &) = delete;
+  ImageDecodeQueue &operator=(const ImageDecodeQueue &) = delete;
+
+  void push(const std::string &path, std::vector<unsigned char> &&bytes)
+  {
+    const Work *work;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_results[path];
+      m_work.push_back(Work{this, path, std::move(bytes)});
+      work = &m_work.back();
+    }
+    JobSystem::instance().submit(
+        Job{&decodeJob, work, 0, 1, 1, &m_decodeJobs});
+  }
+
+  bool contains(const std::string &path) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_results.count(path) != 0;
+  }
+
+  // Wait for the image at path to be decoded and copy it into image, running
+  // queued jobs meanwhile. Accumulates the time spent blocked in waitSeconds.
+  bool take(const std::string &path, tinygltf::Image &image, std::string &err,
+      double &waitSeconds)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto &result = m_results[path];
+    if (!result.done) {
+      const auto waitStart = Clock::now();
+      while (!result.done) {
+        lock.unlock();
+        const auto ranJob = JobSystem::instance().runQueuedJob();
+        lock.lock();
+        if (!ranJob) {
+          // The image is being decoded by a worker
+          m_decodeDone.wait(lock, [&]() { return result.done; });
+        }
+      }
+      waitSeconds += secondsSince(waitStart);
+    }
+    if (!result.succeeded) {
+      err += result.error;
+      return false;
+    }
+    image.width = result.image.width;
+    image.height = result.image.height;
+    image.component = result.image.component;
+    image.bits = result.image.bits;
+    image.pixel_type = result.image.pixel_type;
+    image.image = result.image.image;
+    return true;
+  }
+
+  std::atomic<size_t> downscaledImageCount{0};
+
+private:
+  struct Result
+  {
+    bool done = false;
+    bool succeeded = false;
+    tinygltf::Image image;
+    std::string error;
+  };
+
+  struct Work
+  {
+    ImageDecodeQueue *queue;
+    std::string path;
+    std::vector<unsigned char> bytes;
+  };
+
+  static void decodeJob(const void *context, size_t, size_t)
+  {
+    auto &work = *const_cast<Work *>(static_cast<const Work *>(context));
+    auto &queue = *work.queue;
+
+    Result result;
+    result.succeeded =
+        !work.bytes.empty() &&
+        decodeImageForUpload(work.bytes.data(), work.bytes.size(),
+            queue.m_maxTextureSize, result.image, result.error,
+            queue.downscaledImageCount);
+    if (!result.succeeded && result.error.empty()) {
+      result.error = "Unable to read image " + work.path + "\n";
+    }
+    result.done = true;
+
+    {
+      std::lock_guard<std::mutex> lock(queue.m_mutex);
+      queue.m_results[work.path] = std::move(result);
+      // Encoded bytes are not needed anymore
+      std::vector<unsigned char>().swap(work.bytes);
+    }
+    queue.m_decodeDone.notify_all();
+  }
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_decodeDone;
+  // Contexts of the decode jobs, a deque keeps their address stable
+  std::deque<Work> m_work;
+  std::unordered_map<std::string, Result> m_results;
+  const int m_maxTextureSize;
+  JobCounter m_decodeJobs;
+};
+
+// State shared with the tinygltf callbacks through their user_data pointer
+struct LoaderContext
+{
+  explicit LoaderContext(const GltfLoadOptions &options) :
+      options(options), decodeQueue(options.maxTextureSize)
+  {
+  }
+
+  const GltfLoadOptions options;
+  std::unordered_map<std::string, std::vector<unsigned char>> prefetchedFiles;
+  std::unordered_map<int, std::string> imageIdxToPath;
+  ImageDecodeQueue decodeQueue;
+  double decodeWaitSeconds = 0.;
+};
+
+bool fileExists(const std::string &path, void *userData)
+{
+  const auto &context = *static_cast<LoaderContext *>(userData);
+  return context.prefetchedFiles.count(path) ||
+         context.decodeQueue.contains(path) ||
+         tinygltf::FileExists(path, nullptr);
+}
+
+std::string expandFilePath(const std::string &path, void *userData)
+{
+  const auto &context = *static_cast<LoaderContext *>(userData);
+  if (context.prefetchedFiles.count(path) ||
+      context.decodeQueue.contains(path)) {
+    return path;
+  }
+  return tinygltf::ExpandFilePath(path, nullptr);
+}
+
+bool readWholeFile(std::vector<unsigned char> *out, std::string *err,
+    const std::string &path, void *userData)
+{
+  auto &context = *static_cast<LoaderContext *>(userData);
+  const auto it = context.prefetchedFiles.find(path);
+  if (it != end(context.prefetchedFiles)) {
+    *out = std::move((*it).second);
+    context.prefetchedFiles.erase(it);
+    return true;
+  }
+  if (context.decodeQueue.contains(path)) {
+    // The image is already being decoded from the bytes we read; tinygltf
+    // only needs a non-empty buffer to call loadImageData, which ignores it
+    out->assign(1, 0);
+    return true;
+  }
+  return tinygltf::ReadWholeFile(out, err, path, nullptr);
+}
+
+bool loadImageData(tinygltf::Image *image, const int imageIdx,
+    std::string *err, std::string * /* warn */, int /* reqWidth */,
+    int /* reqHeight */, const unsigned char *bytes, int size, void *userData)
+{
+  auto &context = *static_cast<LoaderContext *>(userData);
+  const auto it = context.imageIdxToPath.find(imageIdx);
+  if (it != end(context.imageIdxToPath) &&
+      context.decodeQueue.contains((*it).second)) {
+    std::string decodeError;
+    if (!context.decodeQueue.take(
+            (*it).second, *image, decodeError, context.decodeWaitSeconds)) {
+      if (err) {
+        *err += decodeError;
+      }
+      return false;
+    }
+    return true;
+  }
+  // Embedded image (data URI or bufferView): decode it here
+  std::string decodeError;
+  if (!decodeImageForUpload(bytes, size_t(size),
+          context.options.maxTextureSize, *image, decodeError,
+          context.decodeQueue.downscaledImageCount)) {
+    if (err) {
+      *err += "Unable to decode image[" + std::to_string(imageIdx) +
+              "]: " + decodeError;
+    }
+    return false;
+  }
+  return true;
+}
+
+// Read all external files of a .gltf in one batch. Images are handed to the
+// decode queue as soon as they arrive, buffers are kept for readWholeFile.
+void prefetchExternalFiles(const std::vector<unsigned char> &gltfJson,
+    const std::string &baseDir, LoaderContext &context, GltfLoadStats &stats)
+{
+  const auto json =
+      nlohmann::json::parse(begin(gltfJson), end(gltfJson), nullptr, false);
+  if (json.is_discarded() || !json.is_object()) {
+    return; // tinygltf will report the parse error
+  }
+
+  const auto getExternalUri = [](const nlohmann::json &object) {
+    const auto uri = object.find("uri");
+    if (uri == object.end() || !(*uri).is_string()) {
+      return std::string();
+    }
+    const auto &str = (*uri).get_ref<const std::string &>();
+    return tinygltf::IsDataURI(str) ? std::string() : str;
+  };
+
+  std::vector<std::string> paths;
+  std::unordered_set<std::string> imagePaths;
+  std::unordered_set<std::string> seenPaths;
+
+  const auto buffers = json.find("buffers");
+  if (buffers != json.end() && (*buffers).is_array()) {
+    for (const auto &buffer : *buffers) {
+      const auto uri = getExternalUri(buffer);
+      if (!uri.empty()) {
+        const auto path = joinPath(baseDir, uri);
+        if (seenPaths.insert(path).second) {
+          paths.push_back(path);
+        }
+      }
+    }
+  }
+
+  const auto images = json.find("images");
+  if (images != json.end() && (*images).is_array()) {
+    for (size_t imageIdx = 0; imageIdx < (*images).size(); ++imageIdx) {
+      const auto uri = getExternalUri((*images)[imageIdx]);
+      if (!uri.empty()) {
+        const auto path = joinPath(baseDir, uri);
+        context.imageIdxToPath[int(imageIdx)] = path;
+        imagePaths.insert(path);
+        if (seenPaths.insert(path).second) {
+          paths.push_back(path);
+        }
+      }
+    }
+  }
+
+  const auto readStats = readFiles(paths,
+      [&](size_t fileIdx, std::vector<unsigned char> &data, bool succeeded) {
+        const auto &path = paths[fileIdx];
+        if (!succeeded) {
+          return; // Let tinygltf report the missing file
+        }
+        if (imagePaths.count(path)) {
+          context.decodeQueue.push(path, std::move(data));
+        } else {
+          context.prefetchedFiles[path] = std::move(data);
+        }
+      });
+
+  stats.fileCount += readStats.fileCount;
+  stats.byteCount += readStats.byteCount;
+  stats.ioWaitSeconds += readStats.ioWaitSeconds;
+}
+
+} // namespace
+
+std::ostream &operator<<(std::ostream &out, const GltfLoadStats &stats)
+{
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+  out << std::fixed << std::setprecision(2) << "Load breakdown: "
+      << stats.fileCount << " files, " << stats.byteCount / 1024
+      << " KiB read with " << (stats.usedIoUring ? "io_uring" : "thread pool")
+      << ", " << stats.downscaledImageCount << " images downscaled"
+      << "\n  I/O wait     " << 1000. * stats.ioWaitSeconds << " ms"
+      << "\n  parse        " << 1000. * stats.parseSeconds << " ms"
+      << "\n  decode wait  " << 1000. * stats.decodeWaitSeconds << " ms"
+      << "\n  sparse       " << 1000. * stats.sparseSeconds << " ms"
+      << "\n  total        " << 1000. * stats.totalSeconds << " ms";
+  out.flags(flags);
+  out.precision(precision);
+  return out;
+}
+
+bool loadGltfModel(const fs::path &path, const GltfLoadOptions &options,
+    tinygltf::Model &model, std::string &error, std::string &warning,
+    GltfLoadStats &stats)
+{
+  const auto loadStart = Clock::now();
+  stats = GltfLoadStats{};
+
+  const auto pathString = path.string();
+  std::vector<unsigned char> mainFile;
+  bool mainFileRead = false;
+  const auto readStats = readFiles({pathString},
+      [&](size_t, std::vector<unsigned char> &data, bool succeeded) {
+        mainFile = std::move(data);
+        mainFileRead = succeeded;
+      });
+  stats.fileCount = readStats.fileCount;
+  stats.byteCount = readStats.byteCount;
+  stats.ioWaitSeconds = readStats.ioWaitSeconds;
+  stats.usedIoUring = readStats.usedIoUring;
+  if (!mainFileRead || mainFile.empty()) {
+    error = "Unable to read file " + pathString;
+    return false;
+  }
+
+  const auto baseDir = path.parent_path().string();
+  const auto isBinary = path.extension() == ".glb";
+
+  LoaderContext context(options);
+  if (!isBinary) {
+    prefetchExternalFiles(mainFile, baseDir, context, stats);
+  }
+
+  tinygltf::TinyGLTF loader;
+  loader.SetFsCallbacks(tinygltf::FsCallbacks{fileExists, expandFilePath,
+      readWholeFile, tinygltf::WriteWholeFile, &context});
+  loader.SetImageLoader(loadImageData, &context);
+
+  const auto parseStart = Clock::now();
+  const auto parsed =
+      isBinary ? loader.LoadBinaryFromMemory(&model, &error, &warning,
+                     mainFile.data(), unsigned(mainFile.size()), baseDir)
+               : loader.LoadASCIIFromString(&model, &error, &warning,
+                     reinterpret_cast<const char *>(mainFile.data()),
+                     unsigned(mainFile.size()), baseDir);
+  stats.decodeWaitSeconds = context.decodeWaitSeconds;
+  stats.downscaledImageCount = context.decodeQueue.downscaledImageCount;
+  stats.parseSeconds = secondsSince(parseStart) - stats.decodeWaitSeconds;
+
+  if (parsed) {
+    // Bounds computation and VAO creation read accessors through their
+    // bufferView, so sparse accessors are made dense once here
+    const auto sparseStart = Clock::now();
+    resolveSparseAccessors(model);
+    stats.sparseSeconds = secondsSince(sparseStart);
+  }
+
+  stats.totalSeconds = secondsSince(loadStart);
+  return parsed;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <tiny_gltf.h>
+
+#include <iosfwd>
+
+struct GltfLoadOptions
+{
+  // Images larger than this are downscaled right after decoding, before
+  // anything else sees them. 0 means no limit.
+  int maxTextureSize = 0;
+};
+
+// Time spent in each stage of loadGltfModel, in seconds
+struct GltfLoadStats
+{
+  size_t fileCount = 0;
+  size_t byteCount = 0;
+  bool usedIoUring = false;
+  size_t downscaledImageCount = 0;
+
+  double ioWaitSeconds = 0.; // Blocked waiting for file reads
+  double parseSeconds = 0.; // JSON parsing and model construction
+  double decodeWaitSeconds = 0.; // Blocked waiting for image decoding
+  double sparseSeconds = 0.; // Sparse accessor resolution
+  double totalSeconds = 0.;
+};
+
+std::ostream &operator<<(std::ostream &out, const GltfLoadStats &stats);
+
+// Load a .gltf or .glb file. All external buffers and images referenced by a
+// .gltf are read in one batch (see readFiles) and each image starts decoding
+// on a worker thread as soon as its file has been read, while the other reads
+// are still in flight. Sparse accessors are resolved before returning.
+bool loadGltfModel(const fs::path &path, const GltfLoadOptions &options,
+    tinygltf::Model &model, std::string &error, std::string &warning,
+    GltfLoadStats &stats);
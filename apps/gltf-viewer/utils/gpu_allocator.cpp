@@ -0,0 +1,519 @@
+#include "gpu_allocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+
+uint32_t findLastSet(uint32_t value)
+{
+  assert(value);
+  uint32_t bit = 31;
+  while (!(value & (uint32_t(1) << bit))) {
+    --bit;
+  }
+  return bit;
+}
+
+uint32_t findFirstSet(uint32_t value)
+{
+  assert(value);
+  uint32_t bit = 0;
+  while (!(value & (uint32_t(1) << bit))) {
+    ++bit;
+  }
+  return bit;
+}
+
+// Bin of a block size: sizes below 2^secondLevelBits have a bin each (first
+// level 0), larger sizes are split by their highest bit (first level) and the
+// next secondLevelBits bits (second level)
+void getBin(uint32_t size, uint32_t secondLevelBits,
+    uint32_t &firstLevel, uint32_t &secondLevel)
+{
+  if (size < (uint32_t(1) << secondLevelBits)) {
+    firstLevel = 0;
+    secondLevel = size;
+    return;
+  }
+  const auto highestBit = findLastSet(size);
+  firstLevel = highestBit - secondLevelBits + 1;
+  secondLevel = (size >> (highestBit - secondLevelBits)) &
+                ((uint32_t(1) << secondLevelBits) - 1);
+}
+
+} // namespace
+
+OffsetAllocator::OffsetAllocator(uint32_t unitCount) : m_unitCount(unitCount)
+{
+  std::fill(std::begin(m_bins), std::end(m_bins), invalidNode);
+  if (unitCount) {
+    insertFreeNode(createNode(0, unitCount));
+  }
+}
+
+uint32_t OffsetAllocator::createNode(uint32_t offset, uint32_t size)
+{
+  uint32_t node;
+  if (!m_unusedNodes.empty()) {
+    node = m_unusedNodes.back();
+    m_unusedNodes.pop_back();
+    m_nodes[node] = Node{};
+  } else {
+    node = uint32_t(m_nodes.size());
+    m_nodes.emplace_back();
+  }
+  m_nodes[node].offset = offset;
+  m_nodes[node].size = size;
+  return node;
+}
+
+void OffsetAllocator::insertFreeNode(uint32_t node)
+{
+  uint32_t firstLevel, secondLevel;
+  getBin(m_nodes[node].size, secondLevelBits, firstLevel, secondLevel);
+  auto &head = m_bins[firstLevel * secondLevelCount + secondLevel];
+  m_nodes[node].isFree = true;
+  m_nodes[node].prevFree = invalidNode;
+  m_nodes[node].nextFree = head;
+  if (head != invalidNode) {
+    m_nodes[head].prevFree = node;
+  }
+  head = node;
+  m_firstLevelBitmap |= uint32_t(1) << firstLevel;
+  m_secondLevelBitmaps[firstLevel] |= uint8_t(1 << secondLevel);
+  ++m_freeBlockCount;
+}
+
+void OffsetAllocator::removeFreeNode(uint32_t node)
+{
+  auto &freeNode = m_nodes[node];
+  if (freeNode.prevFree != invalidNode) {
+    m_nodes[freeNode.prevFree].nextFree = freeNode.nextFree;
+  } else {
+    uint32_t firstLevel, secondLevel;
+    getBin(freeNode.size, secondLevelBits, firstLevel, secondLevel);
+    auto &head = m_bins[firstLevel * secondLevelCount + secondLevel];
+    head = freeNode.nextFree;
+    if (head == invalidNode) {
+      m_secondLevelBitmaps[firstLevel] &= uint8_t(~(1 << secondLevel));
+      if (!m_secondLevelBitmaps[firstLevel]) {
+        m_firstLevelBitmap &= ~(uint32_t(1) << firstLevel);
+      }
+    }
+  }
+  if (freeNode.nextFree != invalidNode) {
+    m_nodes[freeNode.nextFree].prevFree = freeNode.prevFree;
+  }
+  freeNode.isFree = false;
+  --m_freeBlockCount;
+}
+
+OffsetAllocator::Allocation OffsetAllocator::allocate(uint32_t unitCount)
+{
+  Allocation allocation;
+  if (!unitCount || unitCount > m_unitCount) {
+    return allocation;
+  }
+  // Round the size up to the next bin so that any block of the bin found is
+  // large enough (good fit instead of first fit in the exact bin)
+  auto node = invalidNode;
+  const auto roundBit = unitCount >= secondLevelCount
+                            ? findLastSet(unitCount) - secondLevelBits
+                            : 0;
+  const auto roundedSize = uint64_t(unitCount) + (uint32_t(1) << roundBit) - 1;
+  if (roundedSize <= m_unitCount) {
+    uint32_t firstLevel, secondLevel;
+    getBin(uint32_t(roundedSize), secondLevelBits, firstLevel, secondLevel);
+    auto secondLevelMask = uint32_t(m_secondLevelBitmaps[firstLevel]) &
+                           (~uint32_t(0) << secondLevel);
+    if (!secondLevelMask && firstLevel + 1 < firstLevelCount) {
+      const auto firstLevelMask =
+          m_firstLevelBitmap & (~uint32_t(0) << (firstLevel + 1));
+      if (firstLevelMask) {
+        firstLevel = findFirstSet(firstLevelMask);
+        secondLevelMask = m_secondLevelBitmaps[firstLevel];
+      }
+    }
+    if (secondLevelMask) {
+      secondLevel = findFirstSet(secondLevelMask);
+      node = m_bins[firstLevel * secondLevelCount + secondLevel];
+    }
+  }
+  if (node == invalidNode) {
+    // Only the bin of unitCount itself may still hold a large enough block
+    uint32_t firstLevel, secondLevel;
+    getBin(unitCount, secondLevelBits, firstLevel, secondLevel);
+    node = m_bins[firstLevel * secondLevelCount + secondLevel];
+    while (node != invalidNode && m_nodes[node].size < unitCount) {
+      node = m_nodes[node].nextFree;
+    }
+    if (node == invalidNode) {
+      return allocation;
+    }
+  }
+  removeFreeNode(node);
+
+  // Return the end of the block to the free lists
+  if (m_nodes[node].size > unitCount) {
+    const auto remainder = createNode(m_nodes[node].offset + unitCount,
+        m_nodes[node].size - unitCount);
+    auto &block = m_nodes[node];
+    block.size = unitCount;
+    m_nodes[remainder].prevPhysical = node;
+    m_nodes[remainder].nextPhysical = block.nextPhysical;
+    if (block.nextPhysical != invalidNode) {
+      m_nodes[block.nextPhysical].prevPhysical = remainder;
+    }
+    block.nextPhysical = remainder;
+    insertFreeNode(remainder);
+  }
+  m_usedUnitCount += unitCount;
+  ++m_allocationCount;
+  allocation.offset = m_nodes[node].offset;
+  allocation.node = node;
+  return allocation;
+}
+
+void OffsetAllocator::free(Allocation allocation)
+{
+  auto node = allocation.node;
+  if (node == invalidNode) {
+    return;
+  }
+  assert(!m_nodes[node].isFree);
+  m_usedUnitCount -= m_nodes[node].size;
+  --m_allocationCount;
+
+  // Merge with the free neighbours, the merged nodes are recycled
+  const auto prev = m_nodes[node].prevPhysical;
+  if (prev != invalidNode && m_nodes[prev].isFree) {
+    removeFreeNode(prev);
+    m_nodes[prev].size += m_nodes[node].size;
+    m_nodes[prev].nextPhysical = m_nodes[node].nextPhysical;
+    if (m_nodes[node].nextPhysical != invalidNode) {
+      m_nodes[m_nodes[node].nextPhysical].prevPhysical = prev;
+    }
+    m_unusedNodes.push_back(node);
+    node = prev;
+  }
+  const auto next = m_nodes[node].nextPhysical;
+  if (next != invalidNode && m_nodes[next].isFree) {
+    removeFreeNode(next);
+    m_nodes[node].size += m_nodes[next].size;
+    m_nodes[node].nextPhysical = m_nodes[next].nextPhysical;
+    if (m_nodes[next].nextPhysical != invalidNode) {
+      m_nodes[m_nodes[next].nextPhysical].prevPhysical = node;
+    }
+    m_unusedNodes.push_back(next);
+  }
+  insertFreeNode(node);
+}
+
+uint32_t OffsetAllocator::largestFreeBlock() const
+{
+  if (!m_firstLevelBitmap) {
+    return 0;
+  }
+  // The largest block is in the highest non empty bin
+  const auto firstLevel = findLastSet(m_firstLevelBitmap);
+  const auto secondLevel = findLastSet(m_secondLevelBitmaps[firstLevel]);
+  uint32_t largest = 0;
+  for (auto node = m_bins[firstLevel * secondLevelCount + secondLevel];
+       node != invalidNode; node = m_nodes[node].nextFree) {
+    largest = std::max(largest, m_nodes[node].size);
+  }
+  return largest;
+}
+
+GLuint GlBufferBackend::createBuffer(size_t byteCount)
+{
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferStorage(
+      GL_COPY_WRITE_BUFFER, byteCount, nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return buffer;
+}
+
+void GlBufferBackend::deleteBuffer(GLuint buffer)
+{
+  glDeleteBuffers(1, &buffer);
+}
+
+void GlBufferBackend::writeBuffer(
+    GLuint buffer, size_t offset, const void *data, size_t byteCount)
+{
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, byteCount, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GlBufferBackend::copyBuffer(GLuint source, size_t sourceOffset,
+    GLuint destination, size_t destinationOffset, size_t byteCount)
+{
+  glBindBuffer(GL_COPY_READ_BUFFER, source);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset,
+      destinationOffset, byteCount);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GLuint CpuBufferBackend::createBuffer(size_t byteCount)
+{
+  const auto buffer = m_nextBuffer++;
+  m_buffers[buffer].resize(byteCount);
+  return buffer;
+}
+
+void CpuBufferBackend::deleteBuffer(GLuint buffer) { m_buffers.erase(buffer); }
+
+void CpuBufferBackend::writeBuffer(
+    GLuint buffer, size_t offset, const void *data, size_t byteCount)
+{
+  auto &bufferData = m_buffers.at(buffer);
+  assert(offset + byteCount <= bufferData.size());
+  std::memcpy(bufferData.data() + offset, data, byteCount);
+}
+
+void CpuBufferBackend::copyBuffer(GLuint source, size_t sourceOffset,
+    GLuint destination, size_t destinationOffset, size_t byteCount)
+{
+  const auto &sourceData = m_buffers.at(source);
+  auto &destinationData = m_buffers.at(destination);
+  assert(sourceOffset + byteCount <= sourceData.size());
+  assert(destinationOffset + byteCount <= destinationData.size());
+  std::memcpy(destinationData.data() + destinationOffset,
+      sourceData.data() + sourceOffset, byteCount);
+}
+
+GpuMemoryPool::GpuMemoryPool(
+    GpuBufferBackend &backend, const GpuMemoryPoolOptions &options) :
+    m_backend(backend),
+    m_options(options)
+{
+}
+
+GpuMemoryPool::~GpuMemoryPool()
+{
+  for (size_t pageIdx = 0; pageIdx < m_pages.size(); ++pageIdx) {
+    if (m_pages[pageIdx].allocator) {
+      deletePage(pageIdx);
+    }
+  }
+}
+
+uint32_t GpuMemoryPool::getUnitCount(size_t byteCount) const
+{
+  return uint32_t((byteCount + m_options.granularity - 1) /
+                  m_options.granularity);
+}
+
+size_t GpuMemoryPool::createPage(uint32_t unitCount, bool isDedicated)
+{
+  Page page{
+      m_backend.createBuffer(size_t(unitCount) * m_options.granularity),
+      std::make_unique<OffsetAllocator>(unitCount), isDedicated};
+  // Reuse the slot of a deleted page
+  for (size_t pageIdx = 0; pageIdx < m_pages.size(); ++pageIdx) {
+    if (!m_pages[pageIdx].allocator) {
+      m_pages[pageIdx] = std::move(page);
+      return pageIdx;
+    }
+  }
+  m_pages.push_back(std::move(page));
+  return m_pages.size() - 1;
+}
+
+void GpuMemoryPool::deletePage(size_t pageIdx)
+{
+  m_backend.deleteBuffer(m_pages[pageIdx].buffer);
+  m_pages[pageIdx].buffer = 0;
+  m_pages[pageIdx].allocator.reset();
+}
+
+GpuMemoryPool::AllocationId GpuMemoryPool::allocate(
+    size_t byteCount, const void *data)
+{
+  const auto unitCount = std::max(getUnitCount(byteCount), uint32_t(1));
+  const auto pageUnitCount = getUnitCount(m_options.pageByteCount);
+
+  Entry entry;
+  entry.byteCount = byteCount;
+  if (unitCount > pageUnitCount) {
+    entry.page = createPage(unitCount, true);
+    entry.allocation = m_pages[entry.page].allocator->allocate(unitCount);
+  } else {
+    for (size_t pageIdx = 0; pageIdx < m_pages.size(); ++pageIdx) {
+      const auto &page = m_pages[pageIdx];
+      if (!page.allocator || page.isDedicated) {
+        continue;
+      }
+      entry.allocation = page.allocator->allocate(unitCount);
+      if (entry.allocation.node != OffsetAllocator::invalidNode) {
+        entry.page = pageIdx;
+        break;
+      }
+    }
+    if (entry.allocation.node == OffsetAllocator::invalidNode) {
+      entry.page = createPage(pageUnitCount, false);
+      entry.allocation = m_pages[entry.page].allocator->allocate(unitCount);
+    }
+  }
+  assert(entry.allocation.node != OffsetAllocator::invalidNode);
+
+  AllocationId id;
+  if (!m_unusedEntries.empty()) {
+    id = m_unusedEntries.back();
+    m_unusedEntries.pop_back();
+    m_entries[id] = entry;
+  } else {
+    id = AllocationId(m_entries.size());
+    m_entries.push_back(entry);
+  }
+  if (data && byteCount) {
+    const auto allocationRange = range(id);
+    m_backend.writeBuffer(
+        allocationRange.buffer, allocationRange.offset, data, byteCount);
+  }
+  return id;
+}
+
+void GpuMemoryPool::free(AllocationId allocation)
+{
+  if (allocation == invalidAllocation) {
+    return;
+  }
+  auto &entry = m_entries[allocation];
+  auto &page = m_pages[entry.page];
+  page.allocator->free(entry.allocation);
+  if (!page.allocator->allocationCount()) {
+    deletePage(entry.page);
+  }
+  entry = Entry{};
+  m_unusedEntries.push_back(allocation);
+}
+
+GpuBufferRange GpuMemoryPool::range(AllocationId allocation) const
+{
+  const auto &entry = m_entries[allocation];
+  return GpuBufferRange{m_pages[entry.page].buffer,
+      GLintptr(entry.allocation.offset) * GLintptr(m_options.granularity)};
+}
+
+size_t GpuMemoryPool::defragment()
+{
+  std::vector<size_t> pages;
+  for (size_t pageIdx = 0; pageIdx < m_pages.size(); ++pageIdx) {
+    if (m_pages[pageIdx].allocator && !m_pages[pageIdx].isDedicated) {
+      pages.push_back(pageIdx);
+    }
+  }
+  const auto usedUnitCount = [&](size_t pageIdx) {
+    return m_pages[pageIdx].allocator->usedUnitCount();
+  };
+  std::sort(begin(pages), end(pages), [&](size_t lhs, size_t rhs) {
+    return usedUnitCount(lhs) < usedUnitCount(rhs);
+  });
+
+  // Allocations of each page, the largest first so that they get the largest
+  // free blocks of the other pages
+  std::vector<std::vector<AllocationId>> pageEntries(m_pages.size());
+  for (AllocationId id = 0; id < m_entries.size(); ++id) {
+    if (m_entries[id].allocation.node != OffsetAllocator::invalidNode) {
+      pageEntries[m_entries[id].page].push_back(id);
+    }
+  }
+
+  // Evacuate the least used pages whose allocations fit in the free space of
+  // the others. Allocations only move to pages that are kept.
+  size_t sourceCount = 0;
+  size_t sourceUnitCount = 0;
+  size_t destinationFreeUnitCount = 0;
+  for (const auto pageIdx : pages) {
+    const auto &allocator = *m_pages[pageIdx].allocator;
+    destinationFreeUnitCount +=
+        allocator.unitCount() - allocator.usedUnitCount();
+  }
+  while (sourceCount + 1 < pages.size()) {
+    const auto &allocator = *m_pages[pages[sourceCount]].allocator;
+    const auto freeUnitCount =
+        destinationFreeUnitCount -
+        (allocator.unitCount() - allocator.usedUnitCount());
+    if (sourceUnitCount + allocator.usedUnitCount() > freeUnitCount) {
+      break;
+    }
+    sourceUnitCount += allocator.usedUnitCount();
+    destinationFreeUnitCount = freeUnitCount;
+    ++sourceCount;
+  }
+
+  size_t movedCount = 0;
+  for (size_t sourceIdx = 0; sourceIdx < sourceCount; ++sourceIdx) {
+    const auto sourcePage = pages[sourceIdx];
+    auto &entries = pageEntries[sourcePage];
+    std::sort(begin(entries), end(entries),
+        [&](AllocationId lhs, AllocationId rhs) {
+          return m_entries[lhs].byteCount > m_entries[rhs].byteCount;
+        });
+    for (const auto id : entries) {
+      auto &entry = m_entries[id];
+      const auto unitCount =
+          std::max(getUnitCount(entry.byteCount), uint32_t(1));
+      // Fill the most used pages first
+      for (auto pageIdx = pages.size(); pageIdx-- > sourceCount;) {
+        const auto destinationPage = pages[pageIdx];
+        const auto allocation =
+            m_pages[destinationPage].allocator->allocate(unitCount);
+        if (allocation.node == OffsetAllocator::invalidNode) {
+          continue;
+        }
+        const auto source = range(id);
+        m_backend.copyBuffer(source.buffer, source.offset,
+            m_pages[destinationPage].buffer,
+            size_t(allocation.offset) * m_options.granularity,
+            entry.byteCount);
+        m_pages[sourcePage].allocator->free(entry.allocation);
+        entry.page = destinationPage;
+        entry.allocation = allocation;
+        m_movedByteCount += entry.byteCount;
+        ++movedCount;
+        break;
+      }
+    }
+    if (!m_pages[sourcePage].allocator->allocationCount()) {
+      deletePage(sourcePage);
+    }
+  }
+  return movedCount;
+}
+
+GpuMemoryPoolStats GpuMemoryPool::stats() const
+{
+  GpuMemoryPoolStats stats;
+  const auto granularity = m_options.granularity;
+  for (const auto &page : m_pages) {
+    if (!page.allocator) {
+      continue;
+    }
+    ++stats.pageCount;
+    const auto &allocator = *page.allocator;
+    stats.capacityByteCount += size_t(allocator.unitCount()) * granularity;
+    stats.usedByteCount += size_t(allocator.usedUnitCount()) * granularity;
+    stats.allocationCount += allocator.allocationCount();
+    stats.freeBlockCount += allocator.freeBlockCount();
+    stats.largestFreeBlockByteCount = std::max(stats.largestFreeBlockByteCount,
+        size_t(allocator.largestFreeBlock()) * granularity);
+  }
+  for (const auto &entry : m_entries) {
+    if (entry.allocation.node != OffsetAllocator::invalidNode) {
+      stats.requestedByteCount += entry.byteCount;
+    }
+  }
+  stats.movedByteCount = m_movedByteCount;
+  return stats;
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Two-level segregated fit (TLSF) allocator of offsets in a range of
+// `unitCount` units. It only does the bookkeeping: the memory itself lives
+// elsewhere (a GPU buffer in GpuMemoryPool). Free blocks are kept in bins
+// indexed by a power of two and 8 linear subdivisions of it, with bitmaps of
+// the non empty bins, so allocate() and free() run in constant time. Freed
+// blocks are merged with their free neighbours.
+class OffsetAllocator
+{
+public:
+  static constexpr uint32_t invalidNode = ~uint32_t(0);
+
+  struct Allocation
+  {
+    uint32_t offset = 0; // In units
+    uint32_t node = invalidNode; // invalidNode if the allocation failed
+  };
+
+  explicit OffsetAllocator(uint32_t unitCount);
+
+  // The returned block is at least unitCount units
+  Allocation allocate(uint32_t unitCount);
+  void free(Allocation allocation);
+
+  uint32_t unitCount() const { return m_unitCount; }
+  uint32_t usedUnitCount() const { return m_usedUnitCount; }
+  uint32_t allocationCount() const { return m_allocationCount; }
+  uint32_t freeBlockCount() const { return m_freeBlockCount; }
+  uint32_t largestFreeBlock() const;
+
+private:
+  static constexpr uint32_t secondLevelBits = 3;
+  static constexpr uint32_t secondLevelCount = 1 << secondLevelBits;
+  static constexpr uint32_t firstLevelCount = 32;
+
+  struct Node
+  {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    bool isFree = false;
+    // Neighbours in memory and in the free list of the bin
+    uint32_t prevPhysical = invalidNode;
+    uint32_t nextPhysical = invalidNode;
+    uint32_t prevFree = invalidNode;
+    uint32_t nextFree = invalidNode;
+  };
+
+  uint32_t createNode(uint32_t offset, uint32_t size);
+  void insertFreeNode(uint32_t node);
+  void removeFreeNode(uint32_t node);
+
+  const uint32_t m_unitCount;
+  std::vector<Node> m_nodes;
+  std::vector<uint32_t> m_unusedNodes;
+  uint32_t m_firstLevelBitmap = 0;
+  uint8_t m_secondLevelBitmaps[firstLevelCount] = {};
+  uint32_t m_bins[firstLevelCount * secondLevelCount];
+  uint32_t m_usedUnitCount = 0;
+  uint32_t m_allocationCount = 0;
+  uint32_t m_freeBlockCount = 0;
+};
+
+// Storage of the buffers of a GpuMemoryPool. GlBufferBackend creates GL
+// buffer objects, CpuBufferBackend keeps the buffers in memory so that the
+// pool can be exercised without a GL context.
+class GpuBufferBackend
+{
+public:
+  virtual ~GpuBufferBackend() = default;
+
+  virtual GLuint createBuffer(size_t byteCount) = 0;
+  virtual void deleteBuffer(GLuint buffer) = 0;
+  virtual void writeBuffer(
+      GLuint buffer, size_t offset, const void *data, size_t byteCount) = 0;
+  // Source and destination ranges do not overlap
+  virtual void copyBuffer(GLuint source, size_t sourceOffset,
+      GLuint destination, size_t destinationOffset, size_t byteCount) = 0;
+};
+
+// Immutable buffers (glBufferStorage) updated with glBufferSubData
+class GlBufferBackend : public GpuBufferBackend
+{
+public:
+  GLuint createBuffer(size_t byteCount) override;
+  void deleteBuffer(GLuint buffer) override;
+  void writeBuffer(GLuint buffer, size_t offset, const void *data,
+      size_t byteCount) override;
+  void copyBuffer(GLuint source, size_t sourceOffset, GLuint destination,
+      size_t destinationOffset, size_t byteCount) override;
+};
+
+class CpuBufferBackend : public GpuBufferBackend
+{
+public:
+  GLuint createBuffer(size_t byteCount) override;
+  void deleteBuffer(GLuint buffer) override;
+  void writeBuffer(GLuint buffer, size_t offset, const void *data,
+      size_t byteCount) override;
+  void copyBuffer(GLuint source, size_t sourceOffset, GLuint destination,
+      size_t destinationOffset, size_t byteCount) override;
+
+  const std::vector<unsigned char> &data(GLuint buffer) const
+  {
+    return m_buffers.at(buffer);
+  }
+  size_t bufferCount() const { return m_buffers.size(); }
+
+private:
+  std::map<GLuint, std::vector<unsigned char>> m_buffers;
+  GLuint m_nextBuffer = 1;
+};
+
+// A range of a buffer object
+struct GpuBufferRange
+{
+  GLuint buffer = 0;
+  GLintptr offset = 0;
+};
+
+struct GpuMemoryPoolOptions
+{
+  // Size of the buffers (pages) allocations are carved from. Larger
+  // allocations get a page of their own.
+  size_t pageByteCount = size_t(64) << 20;
+  // Allocations start on multiples of granularity, which covers the offset
+  // alignment of vertex, index, uniform and storage buffers
+  size_t granularity = 256;
+};
+
+struct GpuMemoryPoolStats
+{
+  size_t pageCount = 0;
+  size_t capacityByteCount = 0; // Size of all the pages
+  size_t usedByteCount = 0; // Allocations rounded to the granularity
+  size_t requestedByteCount = 0;
+  size_t allocationCount = 0;
+  size_t freeBlockCount = 0;
+  size_t largestFreeBlockByteCount = 0;
+  size_t movedByteCount = 0; // By defragment(), since the pool creation
+
+  // 0 when all the free memory is in one block, close to 1 when it is split
+  // in many small blocks
+  float fragmentation() const
+  {
+    const auto freeByteCount = capacityByteCount - usedByteCount;
+    return freeByteCount
+               ? 1.f - float(largestFreeBlockByteCount) / freeByteCount
+               : 0.f;
+  }
+  float utilization() const
+  {
+    return capacityByteCount ? float(usedByteCount) / capacityByteCount : 0.f;
+  }
+};
+
+// Carves allocations out of a few large buffers instead of creating a buffer
+// object per allocation. Allocations are referenced by id: their range is
+// stable until the next defragment(), which moves them.
+class GpuMemoryPool
+{
+public:
+  using AllocationId = uint32_t;
+  static constexpr AllocationId invalidAllocation = ~AllocationId(0);
+
+  GpuMemoryPool(
+      GpuBufferBackend &backend, const GpuMemoryPoolOptions &options = {});
+  ~GpuMemoryPool();
+
+  GpuMemoryPool(const GpuMemoryPool &) = delete;
+  GpuMemoryPool &operator=(const GpuMemoryPool &) = delete;
+
+  // Allocate byteCount bytes, initialized with data if not null
+  AllocationId allocate(size_t byteCount, const void *data = nullptr);
+  // Pages left empty are deleted
+  void free(AllocationId allocation);
+
+  GpuBufferRange range(AllocationId allocation) const;
+
+  // Move the allocations of the least used pages to the free space of the
+  // others, starting with the least used page, and delete the pages left
+  // empty. Returns the number of moved allocations: their ranges must be
+  // read again.
+  size_t defragment();
+
+  GpuMemoryPoolStats stats() const;
+
+private:
+  struct Page
+  {
+    GLuint buffer;
+    std::unique_ptr<OffsetAllocator> allocator;
+    bool isDedicated; // Holds a single allocation larger than a page
+  };
+
+  struct Entry
+  {
+    size_t page = 0;
+    OffsetAllocator::Allocation allocation;
+    size_t byteCount = 0;
+  };
+
+  uint32_t getUnitCount(size_t byteCount) const;
+  size_t createPage(uint32_t unitCount, bool isDedicated);
+  void deletePage(size_t pageIdx);
+
+  GpuBufferBackend &m_backend;
+  const GpuMemoryPoolOptions m_options;
+  std::vector<Page> m_pages; // Deleted pages have a null allocator
+  std::vector<Entry> m_entries;
+  std::vector<AllocationId> m_unusedEntries;
+  size_t m_movedByteCount = 0;
+};
@@ -0,0 +1,26 @@
+#include "gpu_timer.hpp"
+
+GpuPassTimer::GpuPassTimer() { glGenQueries(2 * frameCount, m_queries); }
+
+GpuPassTimer::~GpuPassTimer() { glDeleteQueries(2 * frameCount, m_queries); }
+
+void GpuPassTimer::begin()
+{
+  auto *queries = m_queries + 2 * m_frameIdx;
+  if (m_isPending[m_frameIdx]) {
+    // Only waits if the GPU is frameCount frames behind
+    GLuint64 start = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+    m_seconds = (end - start) * 1e-9;
+  }
+  glQueryCounter(queries[0], GL_TIMESTAMP);
+}
+
+void GpuPassTimer::end()
+{
+  glQueryCounter(m_queries[2 * m_frameIdx + 1], GL_TIMESTAMP);
+  m_isPending[m_frameIdx] = true;
+  m_frameIdx = (m_frameIdx + 1) % frameCount;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// GPU duration of a pass of each frame, measured with a pair of timestamp
+// queries (GL_TIME_ELAPSED queries cannot nest in the frame query of the
+// benchmark). The queries of a frame are read frameCount frames later, when
+// the GPU is normally done with them, so that measuring never stalls the
+// CPU: seconds() lags the passes by a few frames.
+class GpuPassTimer
+{
+public:
+  static const size_t frameCount = 4;
+
+  GpuPassTimer();
+  ~GpuPassTimer();
+
+  GpuPassTimer(const GpuPassTimer &) = delete;
+  GpuPassTimer &operator=(const GpuPassTimer &) = delete;
+
+  // Around the GL commands of the pass, once per frame
+  void begin();
+  void end();
+
+  // Duration of the last pass whose queries were read
+  double seconds() const { return m_seconds; }
+
+private:
+  GLuint m_queries[2 * frameCount]; // Start and end of each frame
+  bool m_isPending[frameCount] = {};
+  size_t m_frameIdx = 0;
+  double m_seconds = 0;
+};
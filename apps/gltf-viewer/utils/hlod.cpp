@@ -0,0 +1,307 @@
+#include "hlod.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+
+struct ProxyMesh
+{
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<uint32_t> indices; // Triangles
+  glm::dvec4 colorSum = glm::dvec4(0); // Weighted by triangle area
+  double area = 0.;
+  float error = 0.f;
+};
+
+void appendTriangleColor(ProxyMesh &mesh, const glm::vec3 &a,
+    const glm::vec3 &b, const glm::vec3 &c, const glm::vec4 &color)
+{
+  const auto area = 0.5 * double(glm::length(glm::cross(b - a, c - a)));
+  mesh.colorSum += area * glm::dvec4(color);
+  mesh.area += area;
+}
+
+// Append the triangles of a node, transformed by matrix
+void appendNodeGeometry(const tinygltf::Model &model, int nodeIdx,
+    const glm::mat4 &matrix, const std::vector<glm::vec4> &materialColors,
+    ProxyMesh &proxy)
+{
+  const auto normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+  std::vector<glm::vec4> positions, normals;
+  std::vector<uint32_t> indices;
+  const auto &mesh = model.meshes[model.nodes[nodeIdx].mesh];
+  for (const auto &primitive : mesh.primitives) {
+    const auto positionIt = primitive.attributes.find("POSITION");
+    if (positionIt == end(primitive.attributes) ||
+        !readAccessorAsVec4(model, (*positionIt).second, positions) ||
+        positions.empty() || !readPrimitiveIndices(model, primitive, indices) ||
+        convertToListMode(primitive.mode, indices) !=
+            TINYGLTF_MODE_TRIANGLES) {
+      continue;
+    }
+    const auto normalIt = primitive.attributes.find("NORMAL");
+    if (normalIt == end(primitive.attributes) ||
+        !readAccessorAsVec4(model, (*normalIt).second, normals)) {
+      normals.clear();
+    }
+    normals.resize(positions.size(), glm::vec4(0));
+
+    const auto baseVertex = uint32_t(proxy.positions.size());
+    for (size_t v = 0; v < positions.size(); ++v) {
+      proxy.positions.push_back(
+          glm::vec3(matrix * glm::vec4(glm::vec3(positions[v]), 1.f)));
+      proxy.normals.push_back(normalMatrix * glm::vec3(normals[v]));
+    }
+    const auto &color = primitive.material >= 0
+                            ? materialColors[primitive.material]
+                            : glm::vec4(1);
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      uint32_t triangle[3];
+      for (auto k = 0; k < 3; ++k) {
+        triangle[k] = std::min(indices[i + k], uint32_t(positions.size() - 1));
+        proxy.indices.push_back(baseVertex + triangle[k]);
+      }
+      appendTriangleColor(proxy, proxy.positions[baseVertex + triangle[0]],
+          proxy.positions[baseVertex + triangle[1]],
+          proxy.positions[baseVertex + triangle[2]], color);
+    }
+  }
+}
+
+// Vertex clustering: merge the vertices falling in the same cell of a grid of
+// resolution cells along the largest side of bounds, drop degenerate
+// triangles.
+ProxyMesh simplifyByClustering(
+    const ProxyMesh &mesh, const BoundingBox &bounds, int resolution)
+{
+  ProxyMesh result;
+  result.colorSum = mesh.colorSum;
+  result.area = mesh.area;
+
+  const auto extent = bounds.max - bounds.min;
+  const auto maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+  const auto cellSize = std::max(maxExtent / float(resolution), 1e-6f);
+  const auto gridSize = glm::uvec3(extent / cellSize) + glm::uvec3(1);
+  // Any vertex of a cell moves by at most the diagonal of the cell
+  result.error = mesh.error + cellSize * std::sqrt(3.f);
+
+  std::unordered_map<uint64_t, uint32_t> cellToVertex;
+  std::vector<uint32_t> vertexRemap(mesh.positions.size());
+  std::vector<uint32_t> vertexCounts;
+  for (size_t v = 0; v < mesh.positions.size(); ++v) {
+    const auto cell = glm::min(
+        glm::uvec3(glm::max((mesh.positions[v] - bounds.min) / cellSize, 0.f)),
+        gridSize - glm::uvec3(1));
+    const auto key = cell.x + uint64_t(gridSize.x) *
+                                  (cell.y + uint64_t(gridSize.y) * cell.z);
+    const auto it = cellToVertex.find(key);
+    if (it == end(cellToVertex)) {
+      vertexRemap[v] = uint32_t(result.positions.size());
+      cellToVertex.emplace(key, vertexRemap[v]);
+      result.positions.push_back(mesh.positions[v]);
+      result.normals.push_back(mesh.normals[v]);
+      vertexCounts.push_back(1);
+    } else {
+      const auto newVertex = (*it).second;
+      vertexRemap[v] = newVertex;
+      result.positions[newVertex] += mesh.positions[v];
+      result.normals[newVertex] += mesh.normals[v];
+      ++vertexCounts[newVertex];
+    }
+  }
+  for (size_t v = 0; v < result.positions.size(); ++v) {
+    result.positions[v] /= float(vertexCounts[v]);
+    const auto &normal = result.normals[v];
+    result.normals[v] = glm::dot(normal, normal) > 0.f ? glm::normalize(normal)
+                                                       : glm::vec3(0, 1, 0);
+  }
+
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    const auto a = vertexRemap[mesh.indices[i]];
+    const auto b = vertexRemap[mesh.indices[i + 1]];
+    const auto c = vertexRemap[mesh.indices[i + 2]];
+    if (a != b && b != c && a != c) {
+      result.indices.insert(end(result.indices), {a, b, c});
+    }
+  }
+  return result;
+}
+
+struct HlodBuilder
+{
+  const tinygltf::Model &model;
+  const std::vector<BoundingBox> &nodeWorldBounds;
+  const HlodOptions &options;
+  std::vector<HlodCluster> clusters;
+
+  // Clusters are created in pre-order: children always have a larger index
+  // than their parent
+  int buildCluster(std::vector<int> nodes, BoundingBox region, int depth)
+  {
+    std::vector<int> childNodes[8];
+    BoundingBox childRegions[8];
+    for (;; ++depth) {
+      if (nodes.size() <= options.maxNodesPerLeaf ||
+          depth >= options.maxDepth) {
+        return createCluster(std::move(nodes));
+      }
+      splitRegion(nodes, region, childNodes, childRegions);
+      const auto childIt = std::find_if(begin(childNodes), end(childNodes),
+          [&](const std::vector<int> &child) { return !child.empty(); });
+      if ((*childIt).size() != nodes.size()) {
+        break;
+      }
+      // Everything on the same side: refine the region without adding a level
+      // to the hierarchy
+      region = childRegions[childIt - begin(childNodes)];
+      (*childIt).clear();
+    }
+
+    const auto clusterIdx = createCluster({});
+    for (auto child = 0; child < 8; ++child) {
+      if (childNodes[child].empty()) {
+        continue;
+      }
+      const auto childIdx = buildCluster(
+          std::move(childNodes[child]), childRegions[child], depth + 1);
+      clusters[clusterIdx].bounds.extend(clusters[childIdx].bounds);
+      clusters[clusterIdx].children.push_back(childIdx);
+    }
+    return clusterIdx;
+  }
+
+  int createCluster(std::vector<int> nodes)
+  {
+    HlodCluster cluster;
+    for (const auto nodeIdx : nodes) {
+      cluster.bounds.extend(nodeWorldBounds[nodeIdx]);
+    }
+    cluster.nodes = std::move(nodes);
+    clusters.push_back(std::move(cluster));
+    return int(clusters.size()) - 1;
+  }
+
+  // Distribute the nodes in the octants of region by their center
+  void splitRegion(const std::vector<int> &nodes, const BoundingBox &region,
+      std::vector<int> (&childNodes)[8], BoundingBox (&childRegions)[8]) const
+  {
+    const auto center = 0.5f * (region.min + region.max);
+    for (const auto nodeIdx : nodes) {
+      const auto &bounds = nodeWorldBounds[nodeIdx];
+      const auto nodeCenter = 0.5f * (bounds.min + bounds.max);
+      childNodes[(nodeCenter.x > center.x ? 1 : 0) |
+                 (nodeCenter.y > center.y ? 2 : 0) |
+                 (nodeCenter.z > center.z ? 4 : 0)]
+          .push_back(nodeIdx);
+    }
+    for (auto child = 0; child < 8; ++child) {
+      childRegions[child].min = glm::vec3(child & 1 ? center.x : region.min.x,
+          child & 2 ? center.y : region.min.y,
+          child & 4 ? center.z : region.min.z);
+      childRegions[child].max = glm::vec3(child & 1 ? region.max.x : center.x,
+          child & 2 ? region.max.y : center.y,
+          child & 4 ? region.max.z : center.z);
+    }
+  }
+};
+
+} // namespace
+
+HlodHierarchy buildHlodHierarchy(const tinygltf::Model &model,
+    const std::vector<glm::mat4> &nodeWorldMatrices,
+    const std::vector<BoundingBox> &nodeWorldBounds,
+    const HlodOptions &options)
+{
+  std::vector<int> nodes;
+  BoundingBox sceneBounds;
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    NodeInstancing instancing;
+    if (model.nodes[nodeIdx].mesh >= 0 &&
+        !nodeWorldBounds[nodeIdx].isEmpty() &&
+        !getNodeInstancing(model, model.nodes[nodeIdx], instancing)) {
+      nodes.push_back(int(nodeIdx));
+      sceneBounds.extend(nodeWorldBounds[nodeIdx]);
+    }
+  }
+
+  HlodHierarchy hierarchy;
+  if (nodes.empty()) {
+    return hierarchy;
+  }
+
+  HlodBuilder builder{model, nodeWorldBounds, options, {}};
+  builder.buildCluster(std::move(nodes), sceneBounds, 0);
+  hierarchy.clusters = std::move(builder.clusters);
+  auto &clusters = hierarchy.clusters;
+
+  std::vector<glm::vec4> materialColors(model.materials.size());
+  parallelFor(materialColors.size(), [&](size_t i) {
+    materialColors[i] = computeMaterialAverageColor(model, int(i));
+  });
+
+  // Leaves from the nodes, in parallel, then inner clusters from their
+  // children (which have larger indices)
+  std::vector<ProxyMesh> proxies(clusters.size());
+  std::vector<size_t> leaves;
+  for (size_t clusterIdx = 0; clusterIdx < clusters.size(); ++clusterIdx) {
+    if (clusters[clusterIdx].children.empty()) {
+      leaves.push_back(clusterIdx);
+    }
+  }
+  parallelFor(leaves.size(), [&](size_t i) {
+    const auto &cluster = clusters[leaves[i]];
+    ProxyMesh mesh;
+    for (const auto nodeIdx : cluster.nodes) {
+      appendNodeGeometry(
+          model, nodeIdx, nodeWorldMatrices[nodeIdx], materialColors, mesh);
+    }
+    proxies[leaves[i]] =
+        simplifyByClustering(mesh, cluster.bounds, options.proxyResolution);
+  });
+  for (auto clusterIdx = clusters.size(); clusterIdx-- > 0;) {
+    const auto &cluster = clusters[clusterIdx];
+    if (cluster.children.empty()) {
+      continue;
+    }
+    ProxyMesh mesh;
+    for (const auto childIdx : cluster.children) {
+      const auto &child = proxies[childIdx];
+      const auto baseVertex = uint32_t(mesh.positions.size());
+      mesh.positions.insert(
+          end(mesh.positions), begin(child.positions), end(child.positions));
+      mesh.normals.insert(
+          end(mesh.normals), begin(child.normals), end(child.normals));
+      for (const auto index : child.indices) {
+        mesh.indices.push_back(baseVertex + index);
+      }
+      mesh.colorSum += child.colorSum;
+      mesh.area += child.area;
+      mesh.error = std::max(mesh.error, child.error);
+    }
+    proxies[clusterIdx] =
+        simplifyByClustering(mesh, cluster.bounds, options.proxyResolution);
+  }
+
+  for (size_t clusterIdx = 0; clusterIdx < clusters.size(); ++clusterIdx) {
+    auto &cluster = clusters[clusterIdx];
+    const auto &proxy = proxies[clusterIdx];
+    cluster.geometricError = proxy.error;
+    cluster.color = proxy.area > 0. ? glm::vec4(proxy.colorSum / proxy.area)
+                                    : glm::vec4(1);
+    cluster.firstIndex = uint32_t(hierarchy.indices.size());
+    cluster.indexCount = uint32_t(proxy.indices.size());
+    const auto baseVertex = uint32_t(hierarchy.vertices.size());
+    for (size_t v = 0; v < proxy.positions.size(); ++v) {
+      hierarchy.vertices.push_back(
+          HlodVertex{proxy.positions[v], proxy.normals[v]});
+    }
+    for (const auto index : proxy.indices) {
+      hierarchy.indices.push_back(baseVertex + index);
+    }
+  }
+  return hierarchy;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Hierarchical LOD: mesh nodes are grouped by an octree over their bounds and
+// every cluster of the hierarchy gets a proxy, a single mesh approximating all
+// the nodes below it with one averaged material. A cluster can then be drawn
+// with one draw call instead of one per node and primitive when its proxy is
+// accurate enough for the camera.
+//
+// Proxies are simplified by vertex clustering: vertices are snapped to a grid
+// covering the cluster and merged per grid cell. Leaf proxies are built from
+// the nodes, inner proxies from the proxies of their children.
+
+struct HlodVertex
+{
+  glm::vec3 position;
+  glm::vec3 normal;
+};
+
+struct HlodCluster
+{
+  BoundingBox bounds; // In the space of the scene root
+  std::vector<int> nodes; // Leaf clusters only: the mesh nodes of the cluster
+  std::vector<int> children; // Inner clusters only
+  // Maximum distance between the proxy and the geometry it replaces
+  float geometricError = 0.f;
+  glm::vec4 color = glm::vec4(1); // Averaged material of the proxy
+  uint32_t firstIndex = 0; // Proxy triangles in HlodHierarchy::indices
+  uint32_t indexCount = 0;
+};
+
+struct HlodOptions
+{
+  size_t maxNodesPerLeaf = 8;
+  int maxDepth = 10;
+  // Number of grid cells along the largest side of a cluster used to
+  // simplify its proxy
+  int proxyResolution = 16;
+};
+
+struct HlodHierarchy
+{
+  std::vector<HlodCluster> clusters; // clusters[0] is the root
+  std::vector<HlodVertex> vertices; // Proxies of all the clusters
+  std::vector<uint32_t> indices;
+};
+
+// Build the HLOD hierarchy of the mesh nodes of the default scene.
+// Nodes using EXT_mesh_gpu_instancing are left out (they are a single draw
+// call already). nodeWorldMatrices and nodeWorldBounds are indexed by node.
+// The hierarchy has no cluster if the scene has no node to cluster.
+HlodHierarchy buildHlodHierarchy(const tinygltf::Model &model,
+    const std::vector<glm::mat4> &nodeWorldMatrices,
+    const std::vector<BoundingBox> &nodeWorldBounds,
+    const HlodOptions &options);
+
+// Screen space size in pixels of a world space length at a distance, for a
+// perspective projection with vertical field of view fovY
+inline float computeScreenSpaceError(
+    float length, float distance, float fovY, float viewportHeight)
+{
+  return length * viewportHeight /
+         (2.f * std::max(distance, 1e-6f) * std::tan(0.5f * fovY));
+}
+
+// Distance from point to the box, 0 inside
+inline float computeDistanceToBox(
+    const glm::vec3 &point, const BoundingBox &box)
+{
+  return glm::length(glm::max(glm::max(box.min - point, point - box.max), 0.f));
+}
@@ -0,0 +1,484 @@
+#include "image_decoders.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#endif
+
+namespace
+{
+
+const unsigned char pngSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+uint32_t readBigEndian32(const unsigned char *bytes)
+{
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+         (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+enum PngColorType
+{
+  PNG_GRAY = 0,
+  PNG_RGB = 2,
+  PNG_PALETTE = 3,
+  PNG_GRAY_ALPHA = 4,
+  PNG_RGBA = 6
+};
+
+enum PngFilter
+{
+  PNG_FILTER_NONE = 0,
+  PNG_FILTER_SUB = 1,
+  PNG_FILTER_UP = 2,
+  PNG_FILTER_AVG = 3,
+  PNG_FILTER_PAETH = 4
+};
+
+uint8_t paethPredictor(int a, int b, int c)
+{
+  const auto p = a + b - c;
+  const auto pa = std::abs(p - a);
+  const auto pb = std::abs(p - b);
+  const auto pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return uint8_t(a);
+  }
+  return uint8_t(pb <= pc ? b : c);
+}
+
+// Reference implementation, used for 1 and 2 bytes per pixel and on targets
+// without SSE2
+void unfilterRowScalar(
+    int filter, uint8_t *row, const uint8_t *prev, size_t rowBytes, size_t bpp)
+{
+  switch (filter) {
+  case PNG_FILTER_SUB:
+    for (size_t i = bpp; i < rowBytes; ++i) {
+      row[i] = uint8_t(row[i] + row[i - bpp]);
+    }
+    break;
+  case PNG_FILTER_UP:
+    for (size_t i = 0; i < rowBytes; ++i) {
+      row[i] = uint8_t(row[i] + prev[i]);
+    }
+    break;
+  case PNG_FILTER_AVG:
+    for (size_t i = 0; i < bpp; ++i) {
+      row[i] = uint8_t(row[i] + (prev[i] >> 1));
+    }
+    for (size_t i = bpp; i < rowBytes; ++i) {
+      row[i] = uint8_t(row[i] + ((row[i - bpp] + prev[i]) >> 1));
+    }
+    break;
+  case PNG_FILTER_PAETH:
+    for (size_t i = 0; i < bpp; ++i) {
+      row[i] = uint8_t(row[i] + prev[i]);
+    }
+    for (size_t i = bpp; i < rowBytes; ++i) {
+      row[i] = uint8_t(
+          row[i] + paethPredictor(row[i - bpp], prev[i], prev[i - bpp]));
+    }
+    break;
+  }
+}
+
+#ifdef USE_SSE2
+
+// Sub, Avg and Paeth depend on the previous pixel of the same row, so they
+// are vectorized across the channels of a pixel (the approach of libpng's
+// SSE2 filters). Up has no such dependency and works on 16 bytes at a time.
+
+template <size_t Bpp> __m128i loadPixel(const uint8_t *p)
+{
+  int32_t value = 0;
+  std::memcpy(&value, p, Bpp);
+  return _mm_cvtsi32_si128(value);
+}
+
+template <size_t Bpp> void storePixel(uint8_t *p, __m128i pixel)
+{
+  const int32_t value = _mm_cvtsi128_si32(pixel);
+  std::memcpy(p, &value, Bpp);
+}
+
+void unfilterUpSse2(uint8_t *row, const uint8_t *prev, size_t rowBytes)
+{
+  size_t i = 0;
+  for (; i + 16 <= rowBytes; i += 16) {
+    auto *x = reinterpret_cast<__m128i *>(row + i);
+    const auto *b = reinterpret_cast<const __m128i *>(prev + i);
+    _mm_storeu_si128(x, _mm_add_epi8(_mm_loadu_si128(x), _mm_loadu_si128(b)));
+  }
+  for (; i < rowBytes; ++i) {
+    row[i] = uint8_t(row[i] + prev[i]);
+  }
+}
+
+template <size_t Bpp> void unfilterSubSse2(uint8_t *row, size_t rowBytes)
+{
+  auto a = _mm_setzero_si128();
+  for (size_t i = 0; i < rowBytes; i += Bpp) {
+    a = _mm_add_epi8(a, loadPixel<Bpp>(row + i));
+    storePixel<Bpp>(row + i, a);
+  }
+}
+
+template <size_t Bpp>
+void unfilterAvgSse2(uint8_t *row, const uint8_t *prev, size_t rowBytes)
+{
+  const auto one = _mm_set1_epi8(1);
+  auto a = _mm_setzero_si128();
+  for (size_t i = 0; i < rowBytes; i += Bpp) {
+    const auto b = loadPixel<Bpp>(prev + i);
+    // _mm_avg_epu8 rounds up, PNG wants (a + b) >> 1
+    auto average = _mm_avg_epu8(a, b);
+    average =
+        _mm_sub_epi8(average, _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(loadPixel<Bpp>(row + i), average);
+    storePixel<Bpp>(row + i, a);
+  }
+}
+
+template <size_t Bpp>
+void unfilterPaethSse2(uint8_t *row, const uint8_t *prev, size_t rowBytes)
+{
+  const auto zero = _mm_setzero_si128();
+  const auto lowByteMask = _mm_set1_epi16(0xFF);
+  const auto abs16 = [&](__m128i x) {
+    return _mm_max_epi16(x, _mm_sub_epi16(zero, x));
+  };
+  const auto select = [](__m128i mask, __m128i x, __m128i y) {
+    return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+  };
+
+  // Work on 16-bit lanes: a = left, b = up, c = up-left
+  auto a = zero;
+  auto c = zero;
+  for (size_t i = 0; i < rowBytes; i += Bpp) {
+    const auto b = _mm_unpacklo_epi8(loadPixel<Bpp>(prev + i), zero);
+    const auto x = _mm_unpacklo_epi8(loadPixel<Bpp>(row + i), zero);
+
+    // With p = a + b - c: p - a = b - c, p - b = a - c, p - c = sum of both
+    auto pa = _mm_sub_epi16(b, c);
+    auto pb = _mm_sub_epi16(a, c);
+    auto pc = _mm_add_epi16(pa, pb);
+    pa = abs16(pa);
+    pb = abs16(pb);
+    pc = abs16(pc);
+    const auto smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    const auto nearest = select(_mm_cmpeq_epi16(pa, smallest), a,
+        select(_mm_cmpeq_epi16(pb, smallest), b, c));
+
+    a = _mm_and_si128(_mm_add_epi16(x, nearest), lowByteMask);
+    storePixel<Bpp>(row + i, _mm_packus_epi16(a, a));
+    c = b;
+  }
+}
+
+template <size_t Bpp>
+void unfilterRowSse2(
+    int filter, uint8_t *row, const uint8_t *prev, size_t rowBytes)
+{
+  switch (filter) {
+  case PNG_FILTER_SUB:
+    return unfilterSubSse2<Bpp>(row, rowBytes);
+  case PNG_FILTER_UP:
+    return unfilterUpSse2(row, prev, rowBytes);
+  case PNG_FILTER_AVG:
+    return unfilterAvgSse2<Bpp>(row, prev, rowBytes);
+  case PNG_FILTER_PAETH:
+    return unfilterPaethSse2<Bpp>(row, prev, rowBytes);
+  }
+}
+
+#endif
+
+void unfilterRow(
+    int filter, uint8_t *row, const uint8_t *prev, size_t rowBytes, size_t bpp)
+{
+#ifdef USE_SSE2
+  if (bpp == 4) {
+    return unfilterRowSse2<4>(filter, row, prev, rowBytes);
+  }
+  if (bpp == 3) {
+    return unfilterRowSse2<3>(filter, row, prev, rowBytes);
+  }
+  if (filter == PNG_FILTER_UP) {
+    return unfilterUpSse2(row, prev, rowBytes);
+  }
+#endif
+  unfilterRowScalar(filter, row, prev, rowBytes, bpp);
+}
+
+bool canDecodePng(const unsigned char *bytes, size_t size)
+{
+  return size >= 8 && std::memcmp(bytes, pngSignature, 8) == 0;
+}
+
+bool decodePng(const unsigned char *bytes, size_t size,
+    tinygltf::Image &image, std::string &error)
+{
+  if (!canDecodePng(bytes, size)) {
+    return false;
+  }
+
+  uint32_t width = 0, height = 0;
+  int colorType = -1;
+  bool hasTransparencyChunk = false;
+  uint8_t palette[256][4];
+  size_t paletteSize = 0;
+  std::vector<char> compressed;
+
+  size_t offset = 8;
+  while (offset + 12 <= size) {
+    const auto chunkLength = readBigEndian32(bytes + offset);
+    const auto *chunkType = bytes + offset + 4;
+    const auto *chunkData = bytes + offset + 8;
+    if (chunkLength > size - offset - 12) {
+      error += "Truncated PNG chunk\n";
+      return false;
+    }
+    offset += 12 + size_t(chunkLength);
+
+    if (std::memcmp(chunkType, "IHDR", 4) == 0) {
+      if (chunkLength < 13) {
+        return false;
+      }
+      width = readBigEndian32(chunkData);
+      height = readBigEndian32(chunkData + 4);
+      const auto bitDepth = chunkData[8];
+      colorType = chunkData[9];
+      const auto interlace = chunkData[12];
+      // Leave the uncommon variants to stb_image
+      if (bitDepth != 8 || interlace != 0) {
+        return false;
+      }
+    } else if (std::memcmp(chunkType, "PLTE", 4) == 0) {
+      paletteSize = std::min<size_t>(chunkLength / 3, 256);
+      for (size_t i = 0; i < paletteSize; ++i) {
+        palette[i][0] = chunkData[3 * i];
+        palette[i][1] = chunkData[3 * i + 1];
+        palette[i][2] = chunkData[3 * i + 2];
+        palette[i][3] = 255;
+      }
+    } else if (std::memcmp(chunkType, "tRNS", 4) == 0) {
+      hasTransparencyChunk = true;
+      if (colorType == PNG_PALETTE) {
+        for (size_t i = 0; i < std::min<size_t>(chunkLength, paletteSize);
+             ++i) {
+          palette[i][3] = chunkData[i];
+        }
+      }
+    } else if (std::memcmp(chunkType, "IDAT", 4) == 0) {
+      compressed.insert(end(compressed),
+          reinterpret_cast<const char *>(chunkData),
+          reinterpret_cast<const char *>(chunkData) + chunkLength);
+    } else if (std::memcmp(chunkType, "IEND", 4) == 0) {
+      break;
+    }
+  }
+
+  size_t channelCount = 0;
+  switch (colorType) {
+  case PNG_GRAY:
+  case PNG_PALETTE:
+    channelCount = 1;
+    break;
+  case PNG_GRAY_ALPHA:
+    channelCount = 2;
+    break;
+  case PNG_RGB:
+    channelCount = 3;
+    break;
+  case PNG_RGBA:
+    channelCount = 4;
+    break;
+  default:
+    return false;
+  }
+  // Color-key transparency is left to stb_image
+  if (hasTransparencyChunk && colorType != PNG_PALETTE) {
+    return false;
+  }
+  if (colorType == PNG_PALETTE && paletteSize == 0) {
+    error += "PNG palette image without PLTE chunk\n";
+    return false;
+  }
+
+  const auto rowBytes = size_t(width) * channelCount;
+  const auto inflatedSize = (rowBytes + 1) * size_t(height);
+  if (width == 0 || height == 0 || width > (1u << 24) ||
+      height > (1u << 24) || inflatedSize > size_t(INT32_MAX)) {
+    error += "Unsupported PNG dimensions\n";
+    return false;
+  }
+
+  // The inflated size is known from the header, so decompress in one go into
+  // an exactly sized buffer instead of growing the output. The inflate itself
+  // is stb's.
+  std::vector<uint8_t> inflated(inflatedSize);
+  const auto inflatedBytes =
+      stbi_zlib_decode_buffer(reinterpret_cast<char *>(inflated.data()),
+          int(inflatedSize), compressed.data(), int(compressed.size()));
+  if (inflatedBytes != int(inflatedSize)) {
+    error += "Corrupt PNG image data\n";
+    return false;
+  }
+
+  image.width = int(width);
+  image.height = int(height);
+  image.component = 4;
+  image.bits = 8;
+  image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+  image.image.resize(size_t(width) * height * 4);
+
+  const std::vector<uint8_t> zeroRow(rowBytes, 0);
+  const uint8_t *prev = zeroRow.data();
+  for (size_t y = 0; y < height; ++y) {
+    auto *filteredRow = inflated.data() + y * (rowBytes + 1);
+    const auto filter = filteredRow[0];
+    auto *row = filteredRow + 1;
+    if (filter > PNG_FILTER_PAETH) {
+      error += "Invalid PNG filter type\n";
+      return false;
+    }
+    if (filter != PNG_FILTER_NONE) {
+      unfilterRow(filter, row, prev, rowBytes, channelCount);
+    }
+    prev = row;
+
+    auto *out = image.image.data() + y * size_t(width) * 4;
+    switch (colorType) {
+    case PNG_RGBA:
+      std::memcpy(out, row, rowBytes);
+      break;
+    case PNG_RGB:
+      for (size_t x = 0; x < width; ++x) {
+        out[4 * x] = row[3 * x];
+        out[4 * x + 1] = row[3 * x + 1];
+        out[4 * x + 2] = row[3 * x + 2];
+        out[4 * x + 3] = 255;
+      }
+      break;
+    case PNG_GRAY:
+      for (size_t x = 0; x < width; ++x) {
+        out[4 * x] = out[4 * x + 1] = out[4 * x + 2] = row[x];
+        out[4 * x + 3] = 255;
+      }
+      break;
+    case PNG_GRAY_ALPHA:
+      for (size_t x = 0; x < width; ++x) {
+        out[4 * x] = out[4 * x + 1] = out[4 * x + 2] = row[2 * x];
+        out[4 * x + 3] = row[2 * x + 1];
+      }
+      break;
+    case PNG_PALETTE:
+      for (size_t x = 0; x < width; ++x) {
+        const auto index = row[x];
+        if (index < paletteSize) {
+          std::memcpy(out + 4 * x, palette[index], 4);
+        } else {
+          std::memset(out + 4 * x, 0, 4);
+        }
+      }
+      break;
+    }
+  }
+
+  return true;
+}
+
+bool canDecodeWithStb(const unsigned char *bytes, size_t size)
+{
+  int width, height, components;
+  return stbi_info_from_memory(
+             bytes, int(size), &width, &height, &components) != 0;
+}
+
+bool decodeWithStb(const unsigned char *bytes, size_t size,
+    tinygltf::Image &image, std::string &error)
+{
+  std::string warning;
+  return tinygltf::LoadImageData(
+      &image, -1, &error, &warning, 0, 0, bytes, int(size), nullptr);
+}
+
+std::vector<ImageDecoder> &imageDecoders()
+{
+  static std::vector<ImageDecoder> decoders = {
+      fastPngDecoder, stbImageDecoder};
+  return decoders;
+}
+
+} // namespace
+
+const ImageDecoder fastPngDecoder = {
+#ifdef USE_SSE2
+    "png-sse2",
+#else
+    "png-scalar",
+#endif
+    canDecodePng, decodePng};
+
+const ImageDecoder stbImageDecoder = {"stb", canDecodeWithStb, decodeWithStb};
+
+const std::vector<ImageDecoder> &getImageDecoders() { return imageDecoders(); }
+
+void setImageDecoders(std::vector<ImageDecoder> decoders)
+{
+  imageDecoders() = std::move(decoders);
+}
+
+bool decodeImage(const unsigned char *bytes, size_t size,
+    tinygltf::Image &image, std::string &error, const char **decoderName)
+{
+  // Errors of decoders that gave up are only reported if no decoder succeeds
+  std::string decodeErrors;
+  bool stbTried = false;
+  for (const auto &decoder : getImageDecoders()) {
+    stbTried = stbTried || decoder.decode == stbImageDecoder.decode;
+    if (decoder.canDecode(bytes, size) &&
+        decoder.decode(bytes, size, image, decodeErrors)) {
+      if (decoderName) {
+        *decoderName = decoder.name;
+      }
+      return true;
+    }
+  }
+  if (!stbTried && stbImageDecoder.decode(bytes, size, image, decodeErrors)) {
+    if (decoderName) {
+      *decoderName = stbImageDecoder.name;
+    }
+    return true;
+  }
+  error += decodeErrors;
+  return false;
+}
+
+const char *getImageFormatName(const unsigned char *bytes, size_t size)
+{
+  if (canDecodePng(bytes, size)) {
+    return "png";
+  }
+  if (size >= 3 && bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF) {
+    return "jpeg";
+  }
+  if (size >= 6 && std::memcmp(bytes, "GIF8", 4) == 0) {
+    return "gif";
+  }
+  if (size >= 2 && std::memcmp(bytes, "BM", 2) == 0) {
+    return "bmp";
+  }
+  if (size >= 2 && std::memcmp(bytes, "#?", 2) == 0) {
+    return "hdr";
+  }
+  return "unknown";
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <tiny_gltf.h>
+
+#include <string>
+#include <vector>
+
+// An image decoder producing images in the layout tinygltf::LoadImageData
+// produces: 4 components, 8 or 16 bits per component.
+// decode() may return false for inputs it does not support (e.g. an
+// interlaced PNG), the next decoder of the chain is then tried.
+struct ImageDecoder
+{
+  const char *name;
+  bool (*canDecode)(const unsigned char *bytes, size_t size);
+  bool (*decode)(const unsigned char *bytes, size_t size,
+      tinygltf::Image &image, std::string &error);
+};
+
+// PNG decoder with SSE2 unfiltering (scalar on other targets). Handles 8-bit
+// non-interlaced gray, gray+alpha, RGB, RGBA and palette images. It inflates
+// with stb_image's zlib decoder: only the unfiltering and the expansion to
+// RGBA are faster than stb, inflate-bound images decode at stb's speed.
+extern const ImageDecoder fastPngDecoder;
+
+// stb_image, used by tinygltf by default. There is no faster JPEG decoder:
+// stb's JPEG IDCT and YCbCr->RGB conversion already use SSE2 on x86 and NEON
+// on ARM, its Huffman decoding is scalar.
+extern const ImageDecoder stbImageDecoder;
+
+// The chain of decoders tried by decodeImage, in order. The default chain is
+// {fastPngDecoder, stbImageDecoder}. stb_image is always tried last, even if
+// not in the chain, so that every format it knows is still supported.
+const std::vector<ImageDecoder> &getImageDecoders();
+void setImageDecoders(std::vector<ImageDecoder> decoders);
+
+// Decode with the first decoder of the chain that accepts the input.
+// decoderName, if not null, receives the name of the decoder that succeeded.
+bool decodeImage(const unsigned char *bytes, size_t size,
+    tinygltf::Image &image, std::string &error,
+    const char **decoderName = nullptr);
+
+// Image format name from its signature ("png", "jpeg", ... or "unknown")
+const char *getImageFormatName(const unsigned char *bytes, size_t size);
@@ -1,8 +1,19 @@
 #include "images.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <glad/glad.h>
 #include <iostream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#endif
 
 void renderToImage(size_t width, size_t height, size_t numComponents,
     unsigned char *outPixels, std::function<void()> drawScene)
@@ -75,4 +86,353 @@ void renderToImage(size_t width, size_t height, size_t numComponents,
 
   glBindTexture(GL_TEXTURE_2D, previousTextureObject);
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previousFramebufferObject);
-}
\ No newline at end of file
+}
+
+namespace
+{
+
+// Average each 2x2 block of an image of even width and height
+template <typename ComponentType>
+void halveImage(const ComponentType *src, size_t width, size_t height,
+    size_t componentCount, ComponentType *dest)
+{
+  const auto halfWidth = width / 2;
+  for (size_t y = 0; y < height / 2; ++y) {
+    const auto *row0 = src + 2 * y * width * componentCount;
+    const auto *row1 = row0 + width * componentCount;
+    auto *out = dest + y * halfWidth * componentCount;
+    for (size_t x = 0; x < halfWidth; ++x) {
+      for (size_t c = 0; c < componentCount; ++c) {
+        const auto i = 2 * x * componentCount + c;
+        const auto sum = uint32_t(row0[i]) + row0[i + componentCount] +
+                         row1[i] + row1[i + componentCount];
+        out[x * componentCount + c] = ComponentType((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+#ifdef USE_SSE2
+// Same as halveImage<uint8_t> with 4 components, 4 output pixels at a time
+void halveImageRgba8(
+    const uint8_t *src, size_t width, size_t height, uint8_t *dest)
+{
+  const auto halfWidth = width / 2;
+  const auto zero = _mm_setzero_si128();
+  const auto two = _mm_set1_epi16(2);
+  // Sum of two horizontally adjacent pixels held in a register as 2 x 4 u16
+  const auto sumPairs = [](__m128i pixels) {
+    return _mm_add_epi16(pixels, _mm_srli_si128(pixels, 8));
+  };
+  for (size_t y = 0; y < height / 2; ++y) {
+    const auto *row0 = src + 2 * y * width * 4;
+    const auto *row1 = row0 + width * 4;
+    auto *out = dest + y * halfWidth * 4;
+    size_t x = 0;
+    for (; x + 4 <= halfWidth; x += 4) {
+      const auto *p0 = reinterpret_cast<const __m128i *>(row0 + 8 * x);
+      const auto *p1 = reinterpret_cast<const __m128i *>(row1 + 8 * x);
+      const auto a0 = _mm_loadu_si128(p0), b0 = _mm_loadu_si128(p0 + 1);
+      const auto a1 = _mm_loadu_si128(p1), b1 = _mm_loadu_si128(p1 + 1);
+      // Vertical sums, pixels 0-1, 2-3, 4-5, 6-7 of the 8 source pixels
+      const auto s01 = _mm_add_epi16(
+          _mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(a1, zero));
+      const auto s23 = _mm_add_epi16(
+          _mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(a1, zero));
+      const auto s45 = _mm_add_epi16(
+          _mm_unpacklo_epi8(b0, zero), _mm_unpacklo_epi8(b1, zero));
+      const auto s67 = _mm_add_epi16(
+          _mm_unpackhi_epi8(b0, zero), _mm_unpackhi_epi8(b1, zero));
+      auto out01 = _mm_unpacklo_epi64(sumPairs(s01), sumPairs(s23));
+      auto out23 = _mm_unpacklo_epi64(sumPairs(s45), sumPairs(s67));
+      out01 = _mm_srli_epi16(_mm_add_epi16(out01, two), 2);
+      out23 = _mm_srli_epi16(_mm_add_epi16(out23, two), 2);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4 * x),
+          _mm_packus_epi16(out01, out23));
+    }
+    for (; x < halfWidth; ++x) {
+      for (size_t c = 0; c < 4; ++c) {
+        const auto i = 8 * x + c;
+        const auto sum =
+            uint32_t(row0[i]) + row0[i + 4] + row1[i] + row1[i + 4];
+        out[4 * x + c] = uint8_t((sum + 2) / 4);
+      }
+    }
+  }
+}
+#endif
+
+// Mitchell-Netravali cubic with B = C = 1/3, support [-2, 2]: sharper than a
+// box or a tent, with little ringing
+float mitchellFilter(float x)
+{
+  const auto B = 1.f / 3.f;
+  const auto C = 1.f / 3.f;
+  x = std::abs(x);
+  if (x < 1.f) {
+    return ((12 - 9 * B - 6 * C) * x * x * x +
+               (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) /
+           6;
+  }
+  if (x < 2.f) {
+    return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x +
+               (-12 * B - 48 * C) * x + (8 * B + 24 * C)) /
+           6;
+  }
+  return 0.f;
+}
+
+// For each destination index along one axis, the source indices it reads
+// and their weights (summing to 1)
+struct FilterWeights
+{
+  std::vector<size_t> firstSource; // size destSize + 1, offsets in weights
+  std::vector<size_t> sourceIndices;
+  std::vector<float> weights;
+};
+
+// Weights of the Mitchell filter stretched over the source pixels covered by
+// each destination pixel, with edge pixels repeated. A single tap of weight
+// 1 per pixel if the size does not change.
+FilterWeights computeFilterWeights(size_t srcSize, size_t destSize)
+{
+  FilterWeights result;
+  const auto scale = float(srcSize) / float(destSize);
+  const auto filterScale = std::max(scale, 1.f);
+  const auto radius = 2.f * filterScale;
+  for (size_t d = 0; d < destSize; ++d) {
+    result.firstSource.push_back(result.weights.size());
+    if (srcSize == destSize) {
+      result.sourceIndices.push_back(d);
+      result.weights.push_back(1.f);
+      continue;
+    }
+    const auto center = (float(d) + 0.5f) * scale - 0.5f;
+    const auto first = result.weights.size();
+    auto sum = 0.f;
+    for (auto s = int(std::ceil(center - radius));
+         float(s) <= center + radius; ++s) {
+      const auto weight = mitchellFilter((float(s) - center) / filterScale);
+      if (weight == 0.f) {
+        continue;
+      }
+      result.sourceIndices.push_back(
+          size_t(std::min(std::max(s, 0), int(srcSize) - 1)));
+      result.weights.push_back(weight);
+      sum += weight;
+    }
+    for (auto w = first; w < result.weights.size(); ++w) {
+      result.weights[w] /= sum;
+    }
+  }
+  result.firstSource.push_back(result.weights.size());
+  return result;
+}
+
+// Horizontal pass: each row of src filtered to destWidth float pixels
+template <typename ComponentType>
+void filterRows(const ComponentType *src, size_t width, size_t height,
+    size_t componentCount, const FilterWeights &weights, size_t destWidth,
+    float *dest)
+{
+  for (size_t y = 0; y < height; ++y) {
+    const auto *srcRow = src + y * width * componentCount;
+    auto *destRow = dest + y * destWidth * componentCount;
+    for (size_t x = 0; x < destWidth; ++x) {
+      auto *out = destRow + x * componentCount;
+      std::fill(out, out + componentCount, 0.f);
+      for (auto w = weights.firstSource[x]; w < weights.firstSource[x + 1];
+           ++w) {
+        const auto *pixel = srcRow + weights.sourceIndices[w] * componentCount;
+        for (size_t c = 0; c < componentCount; ++c) {
+          out[c] += weights.weights[w] * float(pixel[c]);
+        }
+      }
+    }
+  }
+}
+
+#ifdef USE_SSE2
+// Same as filterRows<uint8_t> with 4 components, a pixel per register
+void filterRowsRgba8(const uint8_t *src, size_t width, size_t height,
+    const FilterWeights &weights, size_t destWidth, float *dest)
+{
+  const auto zero = _mm_setzero_si128();
+  for (size_t y = 0; y < height; ++y) {
+    const auto *srcRow = src + y * width * 4;
+    auto *destRow = dest + y * destWidth * 4;
+    for (size_t x = 0; x < destWidth; ++x) {
+      auto sum = _mm_setzero_ps();
+      for (auto w = weights.firstSource[x]; w < weights.firstSource[x + 1];
+           ++w) {
+        int32_t texel;
+        std::memcpy(&texel, srcRow + weights.sourceIndices[w] * 4, 4);
+        const auto pixel = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(texel), zero), zero));
+        sum = _mm_add_ps(
+            sum, _mm_mul_ps(pixel, _mm_set1_ps(weights.weights[w])));
+      }
+      _mm_storeu_ps(destRow + 4 * x, sum);
+    }
+  }
+}
+#endif
+
+// Vertical pass: rows of size rowSize of src weighted in dest
+void filterColumns(const float *src, size_t rowSize,
+    const FilterWeights &weights, size_t destRow, float *dest)
+{
+  std::fill(dest, dest + rowSize, 0.f);
+  for (auto w = weights.firstSource[destRow];
+       w < weights.firstSource[destRow + 1]; ++w) {
+    const auto *srcRow = src + weights.sourceIndices[w] * rowSize;
+    const auto weight = weights.weights[w];
+    size_t i = 0;
+#ifdef USE_SSE2
+    const auto weights4 = _mm_set1_ps(weight);
+    for (; i + 4 <= rowSize; i += 4) {
+      _mm_storeu_ps(dest + i,
+          _mm_add_ps(_mm_loadu_ps(dest + i),
+              _mm_mul_ps(_mm_loadu_ps(srcRow + i), weights4)));
+    }
+#endif
+    for (; i < rowSize; ++i) {
+      dest[i] += weight * srcRow[i];
+    }
+  }
+}
+
+// Round and clamp the filtered values, negative lobes of the filter can
+// overshoot
+template <typename ComponentType>
+void storeRow(const float *values, size_t count, ComponentType *dest)
+{
+  const auto maxValue = float(std::numeric_limits<ComponentType>::max());
+  for (size_t i = 0; i < count; ++i) {
+    dest[i] = ComponentType(
+        std::min(maxValue, std::max(0.f, std::round(values[i]))));
+  }
+}
+
+#ifdef USE_SSE2
+template <> void storeRow(const float *values, size_t count, uint8_t *dest)
+{
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    // Saturating packs clamp to [0, 255]
+    const auto a = _mm_packs_epi32(_mm_cvtps_epi32(_mm_loadu_ps(values + i)),
+        _mm_cvtps_epi32(_mm_loadu_ps(values + i + 4)));
+    const auto b =
+        _mm_packs_epi32(_mm_cvtps_epi32(_mm_loadu_ps(values + i + 8)),
+            _mm_cvtps_epi32(_mm_loadu_ps(values + i + 12)));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(dest + i), _mm_packus_epi16(a, b));
+  }
+  for (; i < count; ++i) {
+    dest[i] = uint8_t(std::min(255.f, std::max(0.f, std::round(values[i]))));
+  }
+}
+#endif
+
+// Separable Mitchell filter resampling to any smaller size
+template <typename ComponentType>
+void resampleImage(const ComponentType *src, size_t width, size_t height,
+    size_t componentCount, ComponentType *dest, size_t destWidth,
+    size_t destHeight)
+{
+  const auto horizontal = computeFilterWeights(width, destWidth);
+  const auto vertical = computeFilterWeights(height, destHeight);
+
+  // Horizontal pass, kept in float to avoid rounding twice
+  std::vector<float> tmp(destWidth * height * componentCount);
+#ifdef USE_SSE2
+  if (sizeof(ComponentType) == 1 && componentCount == 4) {
+    filterRowsRgba8(reinterpret_cast<const uint8_t *>(src), width, height,
+        horizontal, destWidth, tmp.data());
+  } else
+#endif
+  {
+    filterRows(src, width, height, componentCount, horizontal, destWidth,
+        tmp.data());
+  }
+
+  const auto rowSize = destWidth * componentCount;
+  std::vector<float> row(rowSize);
+  for (size_t y = 0; y < destHeight; ++y) {
+    filterColumns(tmp.data(), rowSize, vertical, y, row.data());
+    storeRow(row.data(), rowSize, dest + y * rowSize);
+  }
+}
+
+template <typename ComponentType>
+void downscaleImage(std::vector<unsigned char> &pixels, size_t width,
+    size_t height, size_t componentCount, size_t destWidth, size_t destHeight)
+{
+  std::vector<unsigned char> scratch;
+  // Exact 2x2 averaging while the image is at least 4 times the target size,
+  // the filter does the rest with at most 16 taps per axis
+  while (width % 2 == 0 && height % 2 == 0 && width >= 4 * destWidth &&
+         height >= 4 * destHeight) {
+    scratch.resize(width / 2 * height / 2 * componentCount *
+                   sizeof(ComponentType));
+    const auto *src = reinterpret_cast<const ComponentType *>(pixels.data());
+    auto *dest = reinterpret_cast<ComponentType *>(scratch.data());
+#ifdef USE_SSE2
+    if (sizeof(ComponentType) == 1 && componentCount == 4) {
+      halveImageRgba8(pixels.data(), width, height, scratch.data());
+    } else
+#endif
+    {
+      halveImage(src, width, height, componentCount, dest);
+    }
+    std::swap(pixels, scratch);
+    width /= 2;
+    height /= 2;
+  }
+
+  if (width != destWidth || height != destHeight) {
+    scratch.resize(
+        destWidth * destHeight * componentCount * sizeof(ComponentType));
+    resampleImage(reinterpret_cast<const ComponentType *>(pixels.data()),
+        width, height, componentCount,
+        reinterpret_cast<ComponentType *>(scratch.data()), destWidth,
+        destHeight);
+    std::swap(pixels, scratch);
+  }
+}
+
+} // namespace
+
+bool limitImageSize(std::vector<unsigned char> &pixels, int &width,
+    int &height, int componentCount, int bitsPerComponent, int maxSize)
+{
+  if (maxSize <= 0 || width <= 0 || height <= 0 ||
+      std::max(width, height) <= maxSize || componentCount <= 0) {
+    return false;
+  }
+  if (bitsPerComponent != 8 && bitsPerComponent != 16) {
+    return false;
+  }
+  const auto expectedSize =
+      size_t(width) * height * componentCount * (bitsPerComponent / 8);
+  if (pixels.size() != expectedSize) {
+    return false;
+  }
+
+  const auto scale = double(maxSize) / std::max(width, height);
+  const auto destWidth =
+      std::max(1, std::min(maxSize, int(std::lround(width * scale))));
+  const auto destHeight =
+      std::max(1, std::min(maxSize, int(std::lround(height * scale))));
+
+  if (bitsPerComponent == 8) {
+    downscaleImage<uint8_t>(pixels, width, height, componentCount, destWidth,
+        destHeight);
+  } else {
+    downscaleImage<uint16_t>(pixels, width, height, componentCount, destWidth,
+        destHeight);
+  }
+  width = destWidth;
+  height = destHeight;
+  return true;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 
 template <typename ComponentType>
 void flipImageYAxis(
@@ -27,4 +28,15 @@ void renderToImage(size_t width, size_t height, size_t numComponents,
 // GL_DRAW_FRAMEBUFFER.
 // It means that if drawScene change GL_DRAW_FRAMEBUFFER, in must restore it
 // before doing final rendering (for example for deferred rendering,
-// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
\ No newline at end of file
+// GL_DRAW_FRAMEBUFFER must be restored before the shading pass).
+
+// Downscale an image so that its largest side is at most maxSize, keeping its
+// aspect ratio. pixels holds width * height * componentCount components of
+// bitsPerComponent bits (8 or 16). Even sizes are first halved by averaging
+// 2x2 blocks down to 4 times the target size, then the image is resampled
+// with a separable Mitchell-Netravali filter. Halving and the filter use SSE2
+// (the horizontal pass of the filter for 8-bit RGBA only).
+// Returns false, leaving the image untouched, if it is already small enough
+// or if its format is not supported.
+bool limitImageSize(std::vector<unsigned char> &pixels, int &width,
+    int &height, int componentCount, int bitsPerComponent, int maxSize);
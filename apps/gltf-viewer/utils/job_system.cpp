@@ -0,0 +1,174 @@
+#include "job_system.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+// Queue of the worker running on this thread, if any
+thread_local const JobSystem *currentJobSystem = nullptr;
+thread_local size_t currentWorkerIdx = 0;
+
+} // namespace
+
+JobSystem::JobSystem(size_t workerCount)
+{
+  for (size_t queueIdx = 0; queueIdx <= workerCount; ++queueIdx) {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+  for (size_t workerIdx = 0; workerIdx < workerCount; ++workerIdx) {
+    m_threads.emplace_back([this, workerIdx]() { workerLoop(workerIdx); });
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_isStopping = true;
+  }
+  m_jobAvailable.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+JobSystem &JobSystem::instance()
+{
+  static JobSystem jobSystem(std::max(workerThreadCount(), size_t(2)) - 1);
+  return jobSystem;
+}
+
+size_t JobSystem::currentQueue() const
+{
+  return currentJobSystem == this ? currentWorkerIdx : m_threads.size();
+}
+
+void JobSystem::submit(const Job &job)
+{
+  ++job.counter->m_pendingJobCount;
+  if (!push(currentQueue(), job)) {
+    run(currentQueue(), job);
+  }
+}
+
+bool JobSystem::push(size_t queueIdx, const Job &job)
+{
+  auto &queue = *m_queues[queueIdx];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.count == queueCapacity) {
+      return false;
+    }
+    queue.jobs[(queue.first + queue.count) % queueCapacity] = job;
+    ++queue.count;
+  }
+  // Pairs with the sleeping worker count and queued job count checks of
+  // workerLoop: either the worker sees the job or it is counted as sleeping
+  ++m_queuedJobCount;
+  if (m_sleepingWorkerCount.load()) {
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_jobAvailable.notify_one();
+  }
+  return true;
+}
+
+bool JobSystem::popNewest(size_t queueIdx, Job &job)
+{
+  auto &queue = *m_queues[queueIdx];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (!queue.count) {
+    return false;
+  }
+  --queue.count;
+  job = queue.jobs[(queue.first + queue.count) % queueCapacity];
+  --m_queuedJobCount;
+  return true;
+}
+
+bool JobSystem::popOldest(size_t queueIdx, Job &job)
+{
+  auto &queue = *m_queues[queueIdx];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (!queue.count) {
+    return false;
+  }
+  job = queue.jobs[queue.first];
+  queue.first = (queue.first + 1) % queueCapacity;
+  --queue.count;
+  --m_queuedJobCount;
+  return true;
+}
+
+bool JobSystem::runNextJob(size_t queueIdx)
+{
+  Job job;
+  if (popNewest(queueIdx, job)) {
+    run(queueIdx, job);
+    return true;
+  }
+  if (!m_queuedJobCount.load()) {
+    return false;
+  }
+  // Steal from the next queues first, so that thieves spread over victims
+  const auto queueCount = m_queues.size();
+  for (size_t offset = 1; offset < queueCount; ++offset) {
+    const auto victimIdx = (queueIdx + offset) % queueCount;
+    if (popOldest(victimIdx, job)) {
+      ++m_stolenJobCount;
+      run(queueIdx, job);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool JobSystem::runQueuedJob() { return runNextJob(currentQueue()); }
+
+void JobSystem::run(size_t queueIdx, Job job)
+{
+  while (job.end - job.begin > job.grainSize) {
+    const auto middle = job.begin + (job.end - job.begin) / 2;
+    auto secondHalf = job;
+    secondHalf.begin = middle;
+    job.end = middle;
+    ++job.counter->m_pendingJobCount;
+    if (!push(queueIdx, secondHalf)) {
+      run(queueIdx, secondHalf);
+    }
+  }
+  job.function(job.context, job.begin, job.end);
+  // Last access to the job: its counter may be destroyed once it is done
+  --job.counter->m_pendingJobCount;
+}
+
+void JobSystem::wait(const JobCounter &counter)
+{
+  const auto queueIdx = currentQueue();
+  while (!counter.isDone()) {
+    if (!runNextJob(queueIdx)) {
+      // The remaining jobs of the group are running on other threads
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::workerLoop(size_t workerIdx)
+{
+  currentJobSystem = this;
+  currentWorkerIdx = workerIdx;
+  for (;;) {
+    if (runNextJob(workerIdx)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_sleepMutex);
+    ++m_sleepingWorkerCount;
+    m_jobAvailable.wait(
+        lock, [&]() { return m_isStopping || m_queuedJobCount.load(); });
+    --m_sleepingWorkerCount;
+    if (m_isStopping) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of jobs of a group that have not completed. Jobs are submitted with
+// the counter of their group and signal it when they complete. Waiting on a
+// counter runs other jobs until it reaches 0, so a job can wait for the jobs
+// it submits, and stages that depend on others wait on their counters.
+class JobCounter
+{
+public:
+  JobCounter() = default;
+  JobCounter(const JobCounter &) = delete;
+  JobCounter &operator=(const JobCounter &) = delete;
+
+  bool isDone() const { return !m_pendingJobCount.load(); }
+
+private:
+  friend class JobSystem;
+  std::atomic<size_t> m_pendingJobCount{0};
+};
+
+// Runs function(context, i, end) over the range [begin, end). Ranges larger
+// than grainSize are split in halves when the job runs: one half is queued
+// for idle workers to steal, the other one is split again, down to ranges of
+// at most grainSize items.
+struct Job
+{
+  void (*function)(const void *context, size_t begin, size_t end) = nullptr;
+  const void *context = nullptr;
+  size_t begin = 0;
+  size_t end = 1;
+  size_t grainSize = 1;
+  JobCounter *counter = nullptr;
+};
+
+// Work-stealing job scheduler. Each worker thread has its own queue of jobs:
+// it runs the last job it queued first (depth first, its data is still in
+// cache), and when its queue is empty it steals the oldest job of another
+// queue (the largest remaining range). Other threads (main thread, render
+// thread) queue their jobs in a shared queue and run jobs while they wait on
+// a counter. Queues have a fixed capacity: submitting and running jobs does
+// not allocate, and a job that does not fit is run right away.
+class JobSystem
+{
+public:
+  explicit JobSystem(size_t workerCount);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  // Shared by the whole application, with workerThreadCount() - 1 workers
+  // (at least one): the thread waiting on a counter takes part in the work
+  static JobSystem &instance();
+
+  size_t workerCount() const { return m_threads.size(); }
+
+  // Index of the calling thread for per thread resources: its worker index
+  // for the workers, workerCount() for all the other threads (which must not
+  // use these resources concurrently)
+  size_t threadIndex() const { return currentQueue(); }
+
+  // The counter and the context of job must outlive its completion
+  void submit(const Job &job);
+
+  // Run queued jobs until counter reaches 0
+  void wait(const JobCounter &counter);
+
+  // Run one queued job if there is one, for threads waiting on something
+  // else than a counter. Returns false if no job was queued.
+  bool runQueuedJob();
+
+  // Submit a job calling function(), which must outlive its completion
+  template <typename Function>
+  void submit(JobCounter &counter, const Function &function)
+  {
+    submit(Job{&callFunction<Function>, &function, 0, 1, 1, &counter});
+  }
+
+  // Submit jobs calling body(begin, end) over sub-ranges of [0, count) of at
+  // most grainSize items. body must outlive their completion.
+  template <typename Body>
+  void submitRange(
+      JobCounter &counter, size_t count, size_t grainSize, const Body &body)
+  {
+    if (count) {
+      submit(Job{&callBody<Body>, &body, 0, count, grainSize, &counter});
+    }
+  }
+
+  // Call body(begin, end) over sub-ranges of [0, count) of at most grainSize
+  // items and wait for all of them to complete
+  template <typename Body>
+  void parallelFor(size_t count, size_t grainSize, const Body &body)
+  {
+    JobCounter counter;
+    submitRange(counter, count, grainSize, body);
+    wait(counter);
+  }
+
+  size_t stolenJobCount() const { return m_stolenJobCount.load(); }
+
+private:
+  static const size_t queueCapacity = 4096;
+
+  struct Queue
+  {
+    std::mutex mutex;
+    Job jobs[queueCapacity]; // Ring, oldest job at first
+    size_t first = 0;
+    size_t count = 0;
+  };
+
+  template <typename Function>
+  static void callFunction(const void *context, size_t, size_t)
+  {
+    (*static_cast<const Function *>(context))();
+  }
+
+  template <typename Body>
+  static void callBody(const void *context, size_t begin, size_t end)
+  {
+    (*static_cast<const Body *>(context))(begin, end);
+  }
+
+  size_t currentQueue() const;
+  bool push(size_t queueIdx, const Job &job);
+  bool popNewest(size_t queueIdx, Job &job);
+  bool popOldest(size_t queueIdx, Job &job);
+  // Take a job from queueIdx or steal one, then run it
+  bool runNextJob(size_t queueIdx);
+  void run(size_t queueIdx, Job job);
+  void workerLoop(size_t workerIdx);
+
+  // One queue per worker, then the shared queue
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_threads;
+
+  std::atomic<size_t> m_queuedJobCount{0};
+  std::atomic<size_t> m_sleepingWorkerCount{0};
+  std::atomic<size_t> m_stolenJobCount{0};
+  std::mutex m_sleepMutex;
+  std::condition_variable m_jobAvailable;
+  bool m_isStopping = false;
+};
@@ -0,0 +1,307 @@
+#include "lights.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#if defined(__SSE__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define USE_SSE 1
+#endif
+
+namespace
+{
+
+// Radiance under which a light is cut off, for lights without a range
+const float lightCutoff = 1.f / 256;
+
+// Distance at which the inverse square falloff of color goes under
+// lightCutoff
+float computeLightRange(const glm::vec3 &color)
+{
+  const auto maxComponent = std::max(color.r, std::max(color.g, color.b));
+  return std::sqrt(std::max(maxComponent, 0.f) / lightCutoff);
+}
+
+// Index of the light of a node in model.lights, -1 if it has none
+int getNodeLight(const tinygltf::Node &node)
+{
+  const auto extension = node.extensions.find("KHR_lights_punctual");
+  if (extension == end(node.extensions) || !extension->second.Has("light")) {
+    return -1;
+  }
+  return int(extension->second.Get("light").GetNumberAsInt());
+}
+
+} // namespace
+
+void appendPunctualLights(const tinygltf::Model &model,
+    const std::vector<glm::mat4> &nodeMatrices,
+    std::vector<PunctualLight> &lights)
+{
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    const auto lightIdx = getNodeLight(model.nodes[nodeIdx]);
+    if (lightIdx < 0 || size_t(lightIdx) >= model.lights.size()) {
+      continue;
+    }
+    const auto &gltfLight = model.lights[lightIdx];
+    const auto &matrix = nodeMatrices[nodeIdx];
+    PunctualLight light;
+    if (gltfLight.type == "directional") {
+      light.type = LIGHT_DIRECTIONAL;
+    } else if (gltfLight.type == "spot") {
+      light.type = LIGHT_SPOT;
+      light.innerConeCos = float(std::cos(gltfLight.spot.innerConeAngle));
+      light.outerConeCos = float(std::cos(gltfLight.spot.outerConeAngle));
+    }
+    // Lights point down the -Z axis of their node
+    light.position = glm::vec3(matrix[3]);
+    light.direction =
+        glm::normalize(glm::vec3(matrix * glm::vec4(0, 0, -1, 0)));
+    if (gltfLight.color.size() == 3) {
+      light.color = glm::vec3(float(gltfLight.color[0]),
+          float(gltfLight.color[1]), float(gltfLight.color[2]));
+    }
+    light.color *= float(gltfLight.intensity);
+    light.range = gltfLight.range > 0 ? float(gltfLight.range)
+                                      : computeLightRange(light.color);
+    lights.push_back(light);
+  }
+}
+
+void appendRandomLights(const glm::vec3 &min, const glm::vec3 &max,
+    float range, size_t count, uint32_t seed,
+    std::vector<PunctualLight> &lights)
+{
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  for (size_t lightIdx = 0; lightIdx < count; ++lightIdx) {
+    PunctualLight light;
+    light.position = min + (max - min) * glm::vec3(unit(generator),
+                                             unit(generator), unit(generator));
+    // Bright enough to be seen up to its range
+    light.color = glm::vec3(unit(generator), unit(generator), unit(generator)) *
+                  (range * range * lightCutoff);
+    light.range = range;
+    lights.push_back(light);
+  }
+}
+
+LightClusters::LightClusters(const LightClusterOptions &options) :
+    m_options(options),
+    m_slices(size_t(options.sliceCount))
+{
+}
+
+size_t LightClusters::clusterCount() const
+{
+  return size_t(m_options.tileCountX) * m_options.tileCountY *
+         m_options.sliceCount;
+}
+
+void LightClusters::build(const PunctualLight *lights, size_t count,
+    const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix, float nearDepth,
+    float farDepth)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  // A view space point at depth d projects to x_ndc = projMatrix[0][0] * x / d
+  const auto tileCountX = m_options.tileCountX;
+  const auto tileCountY = m_options.tileCountY;
+  const auto sliceCount = m_options.sliceCount;
+  m_tanX.resize(size_t(tileCountX + 1));
+  for (auto i = 0; i <= tileCountX; ++i) {
+    m_tanX[i] = (-1.f + 2.f * i / tileCountX) / projMatrix[0][0];
+  }
+  m_tanY.resize(size_t(tileCountY + 1));
+  for (auto j = 0; j <= tileCountY; ++j) {
+    m_tanY[j] = (-1.f + 2.f * j / tileCountY) / projMatrix[1][1];
+  }
+  const auto logDepthRatio = std::log(farDepth / nearDepth);
+  m_sliceDepths.resize(size_t(sliceCount + 1));
+  for (auto k = 0; k <= sliceCount; ++k) {
+    m_sliceDepths[k] = nearDepth * std::exp(logDepthRatio * k / sliceCount);
+  }
+  m_depthScale = sliceCount / logDepthRatio;
+  m_depthBias = -std::log(nearDepth) * m_depthScale;
+
+  // Lights in view space, directional lights first
+  m_gpuLights.clear();
+  for (auto isDirectional : {true, false}) {
+    for (size_t lightIdx = 0; lightIdx < count; ++lightIdx) {
+      const auto &light = lights[lightIdx];
+      if ((light.type == LIGHT_DIRECTIONAL) != isDirectional) {
+        continue;
+      }
+      GpuLight gpuLight;
+      gpuLight.position = glm::vec3(viewMatrix * glm::vec4(light.position, 1));
+      gpuLight.range = light.range;
+      gpuLight.color = light.color;
+      gpuLight.type = uint32_t(light.type);
+      gpuLight.direction = glm::normalize(
+          glm::vec3(viewMatrix * glm::vec4(light.direction, 0)));
+      if (light.type == LIGHT_SPOT) {
+        gpuLight.spotScale =
+            1.f / std::max(light.innerConeCos - light.outerConeCos, 1e-3f);
+        gpuLight.spotOffset = -light.outerConeCos * gpuLight.spotScale;
+      } else {
+        gpuLight.spotScale = 0;
+        gpuLight.spotOffset = 1;
+      }
+      m_gpuLights.push_back(gpuLight);
+    }
+    if (isDirectional) {
+      m_directionalLightCount = m_gpuLights.size();
+    }
+  }
+
+  JobSystem::instance().parallelFor(
+      size_t(sliceCount), 1, [&](size_t sliceBegin, size_t sliceEnd) {
+        for (auto sliceIdx = sliceBegin; sliceIdx < sliceEnd; ++sliceIdx) {
+          binSlice(int(sliceIdx));
+        }
+      });
+
+  const auto tileCount = size_t(tileCountX) * tileCountY;
+  m_clusterRanges.resize(2 * clusterCount());
+  m_lightIndices.clear();
+  m_stats.maxClusterLightCount = 0;
+  for (size_t sliceIdx = 0; sliceIdx < m_slices.size(); ++sliceIdx) {
+    const auto &slice = m_slices[sliceIdx];
+    auto *ranges = m_clusterRanges.data() + 2 * sliceIdx * tileCount;
+    for (size_t tileIdx = 0; tileIdx < tileCount; ++tileIdx) {
+      const auto clusterLightCount = slice.clusterCounts[tileIdx];
+      ranges[2 * tileIdx] = uint32_t(m_lightIndices.size());
+      ranges[2 * tileIdx + 1] = clusterLightCount;
+      m_lightIndices.insert(end(m_lightIndices),
+          begin(slice.lightIndices) + slice.clusterOffsets[tileIdx],
+          begin(slice.lightIndices) + slice.clusterOffsets[tileIdx] +
+              clusterLightCount);
+      m_stats.maxClusterLightCount =
+          std::max(m_stats.maxClusterLightCount, size_t(clusterLightCount));
+    }
+  }
+
+  m_stats.lightCount = m_gpuLights.size();
+  m_stats.directionalLightCount = m_directionalLightCount;
+  m_stats.lightIndexCount = m_lightIndices.size();
+  m_stats.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start)
+                        .count();
+}
+
+void LightClusters::binSlice(int sliceIdx)
+{
+  auto &slice = m_slices[sliceIdx];
+  const auto tileCountX = m_options.tileCountX;
+  const auto tileCountY = m_options.tileCountY;
+  // View space bounds of the clusters of the slice: x bounds of the columns
+  // (padded to a multiple of 4 with empty bounds), y bounds of the rows, and
+  // depth bounds
+  const auto nearDepth = m_sliceDepths[sliceIdx];
+  const auto farDepth = m_sliceDepths[sliceIdx + 1];
+  const auto paddedCountX = size_t(tileCountX + 3) / 4 * 4;
+  slice.minX.assign(paddedCountX, std::numeric_limits<float>::max());
+  slice.maxX.assign(paddedCountX, std::numeric_limits<float>::lowest());
+  for (auto i = 0; i < tileCountX; ++i) {
+    const float bounds[] = {m_tanX[i] * nearDepth, m_tanX[i] * farDepth,
+        m_tanX[i + 1] * nearDepth, m_tanX[i + 1] * farDepth};
+    slice.minX[i] = *std::min_element(bounds, bounds + 4);
+    slice.maxX[i] = *std::max_element(bounds, bounds + 4);
+  }
+  slice.minY.resize(size_t(tileCountY));
+  slice.maxY.resize(size_t(tileCountY));
+  for (auto j = 0; j < tileCountY; ++j) {
+    const float bounds[] = {m_tanY[j] * nearDepth, m_tanY[j] * farDepth,
+        m_tanY[j + 1] * nearDepth, m_tanY[j + 1] * farDepth};
+    slice.minY[j] = *std::min_element(bounds, bounds + 4);
+    slice.maxY[j] = *std::max_element(bounds, bounds + 4);
+  }
+
+  // (cluster, light) pairs, in light order
+  slice.clusterLights.clear();
+  const auto squared = [](float value) { return value * value; };
+  for (auto lightIdx = m_directionalLightCount; lightIdx < m_gpuLights.size();
+       ++lightIdx) {
+    const auto &light = m_gpuLights[lightIdx];
+    const auto depth = -light.position.z;
+    const auto range = light.range;
+    if (depth + range < nearDepth || depth - range > farDepth) {
+      continue;
+    }
+    const auto distanceZ =
+        std::max(std::max(nearDepth - depth, depth - farDepth), 0.f);
+    const auto rangeXY2 = squared(range) - squared(distanceZ);
+    for (auto j = 0; j < tileCountY; ++j) {
+      const auto distanceY = std::max(
+          std::max(slice.minY[j] - light.position.y,
+              light.position.y - slice.maxY[j]),
+          0.f);
+      const auto rangeX2 = rangeXY2 - squared(distanceY);
+      if (rangeX2 < 0) {
+        continue;
+      }
+      const auto tileBegin = uint32_t(j * tileCountX);
+#if defined(USE_SSE)
+      // Squared distances from the light to 4 columns at a time
+      const auto x = _mm_set1_ps(light.position.x);
+      const auto maxDistance2 = _mm_set1_ps(rangeX2);
+      const auto zero = _mm_setzero_ps();
+      for (size_t i = 0; i < paddedCountX; i += 4) {
+        const auto distance =
+            _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&slice.minX[i]), x),
+                           _mm_sub_ps(x, _mm_loadu_ps(&slice.maxX[i]))),
+                zero);
+        const auto mask = _mm_movemask_ps(
+            _mm_cmple_ps(_mm_mul_ps(distance, distance), maxDistance2));
+        for (auto lane = 0; mask >> lane; ++lane) {
+          if (mask & (1 << lane)) {
+            slice.clusterLights.push_back(tileBegin + uint32_t(i + lane));
+            slice.clusterLights.push_back(uint32_t(lightIdx));
+          }
+        }
+      }
+#else
+      for (auto i = 0; i < tileCountX; ++i) {
+        const auto distanceX = std::max(
+            std::max(slice.minX[i] - light.position.x,
+                light.position.x - slice.maxX[i]),
+            0.f);
+        if (squared(distanceX) <= rangeX2) {
+          slice.clusterLights.push_back(tileBegin + uint32_t(i));
+          slice.clusterLights.push_back(uint32_t(lightIdx));
+        }
+      }
+#endif
+    }
+  }
+
+  // Counting sort of the pairs by cluster, stable so that the lights of a
+  // cluster stay in order
+  const auto tileCount = size_t(tileCountX) * tileCountY;
+  slice.clusterCounts.assign(tileCount, 0);
+  for (size_t pairIdx = 0; pairIdx < slice.clusterLights.size();
+       pairIdx += 2) {
+    ++slice.clusterCounts[slice.clusterLights[pairIdx]];
+  }
+  slice.clusterOffsets.resize(tileCount);
+  uint32_t offset = 0;
+  for (size_t tileIdx = 0; tileIdx < tileCount; ++tileIdx) {
+    slice.clusterOffsets[tileIdx] = offset;
+    offset += slice.clusterCounts[tileIdx];
+  }
+  slice.lightIndices.resize(offset);
+  for (size_t pairIdx = 0; pairIdx < slice.clusterLights.size();
+       pairIdx += 2) {
+    auto &position = slice.clusterOffsets[slice.clusterLights[pairIdx]];
+    slice.lightIndices[position++] = slice.clusterLights[pairIdx + 1];
+  }
+  // Back to the first light of each cluster
+  for (size_t tileIdx = 0; tileIdx < tileCount; ++tileIdx) {
+    slice.clusterOffsets[tileIdx] -= slice.clusterCounts[tileIdx];
+  }
+}
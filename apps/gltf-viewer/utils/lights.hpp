@@ -0,0 +1,144 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Types of KHR_lights_punctual
+enum PunctualLightType
+{
+  LIGHT_DIRECTIONAL = 0,
+  LIGHT_POINT = 1,
+  LIGHT_SPOT = 2
+};
+
+// A KHR_lights_punctual light placed in the scene
+struct PunctualLight
+{
+  PunctualLightType type = LIGHT_POINT;
+  glm::vec3 position = glm::vec3(0);
+  glm::vec3 direction = glm::vec3(0, 0, -1); // Where the light points to
+  glm::vec3 color = glm::vec3(1); // Multiplied by the intensity
+  // Distance at which the light is cut off, derived from the intensity for
+  // lights without a range. Ignored for directional lights.
+  float range = 0;
+  float innerConeCos = 1; // Spot lights only
+  float outerConeCos = 0;
+};
+
+// Append the lights of the nodes of model, placed by the matrices of the
+// nodes (see computeNodeWorldMatrices)
+void appendPunctualLights(const tinygltf::Model &model,
+    const std::vector<glm::mat4> &nodeMatrices,
+    std::vector<PunctualLight> &lights);
+
+// Append count point lights of random colors scattered in the box [min, max],
+// reaching range, for testing
+void appendRandomLights(const glm::vec3 &min, const glm::vec3 &max,
+    float range, size_t count, uint32_t seed,
+    std::vector<PunctualLight> &lights);
+
+// std430 layout of a light in the Lights storage buffer of
+// pbr_clustered_lights.fs.glsl, in view space
+struct GpuLight
+{
+  glm::vec3 position;
+  float range;
+  glm::vec3 color;
+  uint32_t type;
+  glm::vec3 direction;
+  // Spot attenuation: clamp(dot(direction, -L) * spotScale + spotOffset, 0, 1)
+  float spotScale;
+  float spotOffset;
+  float padding[3];
+};
+
+struct LightClusterOptions
+{
+  // Screen tiles and depth slices of the grid. Slices are spaced on a log
+  // scale between the near and far planes, so that clusters are roughly
+  // cubic.
+  int tileCountX = 16;
+  int tileCountY = 9;
+  int sliceCount = 24;
+};
+
+struct LightClusterStats
+{
+  size_t lightCount = 0;
+  size_t directionalLightCount = 0;
+  size_t lightIndexCount = 0; // Sum of the light counts of the clusters
+  size_t maxClusterLightCount = 0;
+  double seconds = 0; // Of the last build()
+};
+
+// Clustered forward shading: the view frustum is split in a grid of clusters
+// and the lights are binned in the clusters they reach, so that a fragment
+// only shades the lights of its cluster. build() runs each frame: the slices
+// are binned by jobs of the shared JobSystem, testing each light against 4
+// clusters at a time with SSE when available. Directional lights reach all
+// the clusters: they come first in gpuLights() and are not binned.
+class LightClusters
+{
+public:
+  explicit LightClusters(const LightClusterOptions &options = {});
+
+  // Bin lights, in world space, for a perspective projection with the given
+  // near and far planes. Storage is reused from frame to frame.
+  void build(const PunctualLight *lights, size_t count,
+      const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+      float nearDepth, float farDepth);
+
+  const LightClusterOptions &options() const { return m_options; }
+  size_t clusterCount() const;
+
+  // Directional lights first
+  const std::vector<GpuLight> &gpuLights() const { return m_gpuLights; }
+  // Offset in lightIndices() and light count of each cluster, x first,
+  // then y (bottom to top), then slices (near to far)
+  const std::vector<uint32_t> &clusterRanges() const
+  {
+    return m_clusterRanges;
+  }
+  // Indices in gpuLights()
+  const std::vector<uint32_t> &lightIndices() const { return m_lightIndices; }
+
+  // Slice of a depth: floor(log(depth) * depthScale + depthBias)
+  float depthScale() const { return m_depthScale; }
+  float depthBias() const { return m_depthBias; }
+
+  const LightClusterStats &stats() const { return m_stats; }
+
+private:
+  // Clusters of a depth slice, binned by one job
+  struct Slice
+  {
+    // View space bounds of the columns (padded to a multiple of 4 with
+    // empty bounds) and of the rows
+    std::vector<float> minX, maxX, minY, maxY;
+    std::vector<uint32_t> clusterLights; // (cluster, light) pairs
+    std::vector<uint32_t> clusterCounts; // Of each cluster of the slice
+    std::vector<uint32_t> clusterOffsets; // In lightIndices
+    std::vector<uint32_t> lightIndices; // Grouped by cluster
+  };
+
+  void binSlice(int sliceIdx);
+
+  LightClusterOptions m_options;
+  std::vector<GpuLight> m_gpuLights;
+  size_t m_directionalLightCount = 0;
+  std::vector<Slice> m_slices;
+  std::vector<uint32_t> m_clusterRanges;
+  std::vector<uint32_t> m_lightIndices;
+  // Tan of the sides of the tiles: x = tanX[i] * depth at the left of tile
+  // i, y = tanY[j] * depth at the bottom of tile j
+  std::vector<float> m_tanX;
+  std::vector<float> m_tanY;
+  std::vector<float> m_sliceDepths; // sliceCount + 1 boundaries
+  float m_depthScale = 0;
+  float m_depthBias = 0;
+  LightClusterStats m_stats;
+};
@@ -0,0 +1,19 @@
+#include "parallel.hpp"
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <thread>
+
+size_t workerThreadCount()
+{
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void parallelFor(size_t count, const std::function<void(size_t)> &body)
+{
+  JobSystem::instance().parallelFor(count, 1, [&](size_t begin, size_t end) {
+    for (auto i = begin; i < end; ++i) {
+      body(i);
+    }
+  });
+}
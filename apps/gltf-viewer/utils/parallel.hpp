@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Number of hardware threads (at least 1). The shared JobSystem runs one
+// worker less, the thread waiting for the jobs taking part in the work.
+size_t workerThreadCount();
+
+// Call body(i) for every i in [0, count) as jobs of JobSystem::instance() and
+// wait for all of them to complete. Items are split in single-item jobs that
+// idle workers steal, so it is fine for items to have very different costs,
+// and body can itself call parallelFor.
+// body must be safe to call concurrently for distinct indices.
+void parallelFor(size_t count, const std::function<void(size_t)> &body);
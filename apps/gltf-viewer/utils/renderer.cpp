@@ -0,0 +1,63 @@
+#include "renderer.hpp"
+
+#include "gl_renderer.hpp"
+
+#ifdef GLMLV_USE_VULKAN
+#include "vulkan_renderer.hpp"
+#endif
+
+#include <stdexcept>
+
+bool parseRendererBackend(const std::string &name, RendererBackend &backend)
+{
+  if (name == "gl") {
+    backend = RENDERER_BACKEND_GL;
+    return true;
+  }
+  if (name == "vulkan") {
+    backend = RENDERER_BACKEND_VULKAN;
+    return true;
+  }
+  return false;
+}
+
+const char *getRendererBackendName(RendererBackend backend)
+{
+  switch (backend) {
+  case RENDERER_BACKEND_GL:
+    return "gl";
+  case RENDERER_BACKEND_VULKAN:
+    return "vulkan";
+  }
+  return "unknown";
+}
+
+std::unique_ptr<Renderer> createRenderer(RendererBackend backend,
+    const RendererOptions &options, std::string &error)
+{
+  switch (backend) {
+  case RENDERER_BACKEND_GL:
+    try {
+      return std::make_unique<GlRenderer>(options);
+    } catch (const std::runtime_error &e) {
+      error = std::string("Unable to create the OpenGL renderer: ") + e.what();
+      return nullptr;
+    }
+  case RENDERER_BACKEND_VULKAN:
+#ifdef GLMLV_USE_VULKAN
+    try {
+      return std::make_unique<VulkanRenderer>(options);
+    } catch (const std::runtime_error &e) {
+      error = std::string("Unable to create the Vulkan renderer: ") + e.what();
+      return nullptr;
+    }
+#else
+    (void)options;
+    error = "The viewer was built without Vulkan (the Vulkan SDK was not "
+            "found at configure time)";
+    return nullptr;
+#endif
+  }
+  error = "Unknown renderer backend";
+  return nullptr;
+}
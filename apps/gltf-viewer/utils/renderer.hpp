@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Graphics API drawing the scene through Renderer, selected at runtime
+// (--renderer). All the backends draw the forward shading path (one
+// directional light, no shadows nor image based lighting) to an image, for
+// -o. Without --renderer, the window loop of ViewerApplication draws with
+// OpenGL and all the features of the viewer.
+enum RendererBackend
+{
+  RENDERER_BACKEND_GL = 0,
+  RENDERER_BACKEND_VULKAN
+};
+
+// "gl" or "vulkan". Returns false for other names.
+bool parseRendererBackend(const std::string &name, RendererBackend &backend);
+
+const char *getRendererBackendName(RendererBackend backend);
+
+// Camera and light of a rendered image. projMatrix is an OpenGL projection
+// (depth in [-1, 1]), converted by the backends that need it.
+struct RenderView
+{
+  glm::mat4 viewMatrix;
+  glm::mat4 projMatrix;
+  float nearDepth; // Of projMatrix
+  float farDepth;
+  glm::vec3 lightDirection; // View space, towards the light
+  glm::vec3 lightIntensity;
+};
+
+struct RendererOptions
+{
+  std::string shadersPath; // Directory holding the shaders of the backend
+  // If false, samplers using mipmaps fall back to their non-mipmap filter
+  bool generateMipmaps = true;
+};
+
+class Renderer
+{
+public:
+  virtual ~Renderer() = default;
+
+  // Name of the device rendering the images
+  virtual const std::string &deviceName() const = 0;
+
+  // Upload the buffers, textures and materials of model, which is not
+  // referenced afterwards. Returns its index for addModelInstance, or -1 in
+  // case of failure with a message in error.
+  virtual int addModel(const tinygltf::Model &model, std::string &error) = 0;
+
+  // Add the default scene of model modelIdx to the scene, transformed by
+  // rootTransform
+  virtual void addModelInstance(
+      int modelIdx, const glm::mat4 &rootTransform) = 0;
+
+  // Draw the scene in width * height RGB pixels, top row first
+  // @return false in case of failure, with a message in error
+  virtual bool renderImage(const RenderView &view, uint32_t width,
+      uint32_t height, unsigned char *pixels, std::string &error) = 0;
+};
+
+// Renderer of backend. nullptr with a message in error if the backend was not
+// built (Vulkan requires the SDK at configure time) or has no suitable device.
+std::unique_ptr<Renderer> createRenderer(RendererBackend backend,
+    const RendererOptions &options, std::string &error);
@@ -0,0 +1,56 @@
+#include "scene_file.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <fstream>
+#include <sstream>
+
+bool loadSceneFile(const fs::path &path, std::vector<AssetPlacement> &assets,
+    std::string &error)
+{
+  std::ifstream file(path.string());
+  if (!file) {
+    error = "Unable to open scene file " + path.string();
+    return false;
+  }
+
+  std::string line;
+  for (auto lineNumber = 1; std::getline(file, line); ++lineNumber) {
+    std::istringstream tokens(line);
+    std::string assetPath;
+    if (!(tokens >> assetPath) || assetPath[0] == '#') {
+      continue;
+    }
+
+    std::vector<float> values;
+    for (float value; tokens >> value;) {
+      values.push_back(value);
+    }
+    if (!tokens.eof() ||
+        (values.size() != 0 && values.size() != 3 && values.size() != 7 &&
+            values.size() != 10)) {
+      error = path.string() + ":" + std::to_string(lineNumber) +
+              ": expected path [tx ty tz [qx qy qz qw [sx sy sz]]]";
+      return false;
+    }
+    // Identity for the omitted components
+    static const float defaultValues[] = {0, 0, 0, 0, 0, 0, 1, 1, 1, 1};
+    for (auto i = values.size(); i < 10; ++i) {
+      values.push_back(defaultValues[i]);
+    }
+
+    AssetPlacement placement;
+    placement.path = fs::path(assetPath).is_absolute()
+                         ? fs::path(assetPath)
+                         : path.parent_path() / assetPath;
+    const auto T = glm::translate(
+        glm::mat4(1), glm::vec3(values[0], values[1], values[2]));
+    const auto R = glm::mat4_cast(
+        glm::quat(values[6], values[3], values[4], values[5]));
+    placement.rootTransform =
+        glm::scale(T * R, glm::vec3(values[7], values[8], values[9]));
+    assets.push_back(placement);
+  }
+  return true;
+}
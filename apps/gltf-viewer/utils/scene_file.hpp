@@ -0,0 +1,23 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+// A glTF file placed in the scene
+struct AssetPlacement
+{
+  fs::path path;
+  glm::mat4 rootTransform = glm::mat4(1);
+};
+
+// Read a scene description: one asset per line,
+//   path [tx ty tz [qx qy qz qw [sx sy sz]]]
+// with the translation, rotation quaternion and scale of the asset root using
+// the conventions of glTF nodes. Relative paths are relative to the directory
+// of the scene file. Empty lines and lines starting with '#' are ignored.
+bool loadSceneFile(const fs::path &path, std::vector<AssetPlacement> &assets,
+    std::string &error);
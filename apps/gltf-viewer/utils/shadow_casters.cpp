@@ -0,0 +1,61 @@
+#include "shadow_casters.hpp"
+
+#include "transforms.hpp"
+
+#include <algorithm>
+
+size_t drawShadowCasters(const GltfAsset &asset,
+    const glm::mat4 *nodeWorldMatrices, const uint8_t *nodeShadowMasks,
+    int cascadeIdx, const glm::mat4 &lightViewProjMatrix,
+    UniformRingBuffer &transformRing, GLuint transformsBinding,
+    VertexInputState &vertexInput)
+{
+  const auto &model = asset.model;
+  if (asset.streamer) {
+    return 0;
+  }
+  size_t drawCallCount = 0;
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    if (!(nodeShadowMasks[nodeIdx] & (1u << cascadeIdx))) {
+      continue;
+    }
+    DrawTransforms transforms;
+    transforms.modelViewProjMatrix =
+        lightViewProjMatrix * nodeWorldMatrices[nodeIdx];
+    const auto offset = transformRing.push(transforms);
+    glBindBufferRange(GL_UNIFORM_BUFFER, transformsBinding,
+        transformRing.glId(), offset, sizeof(DrawTransforms));
+
+    const auto &node = model.nodes[nodeIdx];
+    const auto &mesh = model.meshes[node.mesh];
+    const auto instanceCount =
+        GLsizei(asset.nodeInstancing[nodeIdx].instanceCount);
+    const auto &vaoRange = instanceCount
+                               ? asset.nodeIndexToInstancedVaoRange[nodeIdx]
+                               : asset.meshIndexToVaoRange[node.mesh];
+    for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+      const auto &primitive = mesh.primitives[primIdx];
+      if (primitive.material >= 0 &&
+          asset.materialPasses[primitive.material] == DRAW_PASS_BLEND) {
+        continue;
+      }
+      vertexInput.bindVertexInput(asset, vaoRange.begin + primIdx);
+      ++drawCallCount;
+      if (primitive.indices >= 0) {
+        const auto &accessor = model.accessors[primitive.indices];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        const auto byteOffset = asset.bufferRanges[bufferView.buffer].offset +
+                                accessor.byteOffset + bufferView.byteOffset;
+        glDrawElementsInstanced(GLenum(primitive.mode),
+            GLsizei(accessor.count), GLenum(accessor.componentType),
+            (const GLvoid *)byteOffset, std::max(instanceCount, 1));
+      } else {
+        const auto accessorIdx = (*std::begin(primitive.attributes)).second;
+        glDrawArraysInstanced(GLenum(primitive.mode), 0,
+            GLsizei(model.accessors[accessorIdx].count),
+            std::max(instanceCount, 1));
+      }
+    }
+  }
+  return drawCallCount;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "asset_cache.hpp"
+#include "draw_commands.hpp"
+#include "uniform_ring.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Draw the nodes of asset casting shadows in the cascade cascadeIdx of the
+// bound shadow map: those with bit cascadeIdx set in nodeShadowMasks, with
+// nodeWorldMatrices their local to world matrices. The casters are drawn with
+// their VAOs and no material, their transforms pushed to transformRing and
+// bound to transformsBinding of GL_UNIFORM_BUFFER. Streamed assets have no
+// VAOs and do not cast shadows, HLOD and batched nodes cast them with their
+// own meshes. Blended materials do not cast shadows, alpha tested ones cast
+// them as if opaque. All the instances of instanced nodes are drawn. Returns
+// the number of draw calls.
+size_t drawShadowCasters(const GltfAsset &asset,
+    const glm::mat4 *nodeWorldMatrices, const uint8_t *nodeShadowMasks,
+    int cascadeIdx, const glm::mat4 &lightViewProjMatrix,
+    UniformRingBuffer &transformRing, GLuint transformsBinding,
+    VertexInputState &vertexInput);
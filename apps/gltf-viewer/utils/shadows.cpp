@@ -0,0 +1,140 @@
+#include "shadows.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void fitShadowCascades(const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+    float nearDepth, float farDepth, const glm::vec3 &lightDirection,
+    const BoundingBox &sceneBounds, const ShadowOptions &options,
+    ShadowCascade *cascades)
+{
+  // Light space looks along -lightDirection
+  const auto isVertical =
+      std::abs(lightDirection.y) > 0.99f * glm::length(lightDirection);
+  const auto up = isVertical ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+  const auto lightView = glm::lookAt(glm::vec3(0), -lightDirection, up);
+  auto minZ = std::numeric_limits<float>::max();
+  auto maxZ = std::numeric_limits<float>::lowest();
+  for (int cornerIdx = 0; cornerIdx < 8; ++cornerIdx) {
+    const auto corner = glm::vec3(cornerIdx & 1 ? sceneBounds.max.x
+                                                : sceneBounds.min.x,
+        cornerIdx & 2 ? sceneBounds.max.y : sceneBounds.min.y,
+        cornerIdx & 4 ? sceneBounds.max.z : sceneBounds.min.z);
+    const auto z = (lightView * glm::vec4(corner, 1)).z;
+    minZ = std::min(minZ, z);
+    maxZ = std::max(maxZ, z);
+  }
+  // Casters right on the bounds are not clipped
+  const auto padding = 0.01f * (maxZ - minZ) + 1e-4f;
+
+  // Squared tangent of the half diagonal of the field of view: a slice
+  // corner at depth d is at distance d * sqrt(cornerTan2) from the view axis
+  const auto tanX = 1.f / projMatrix[0][0];
+  const auto tanY = 1.f / projMatrix[1][1];
+  const auto cornerTan2 = tanX * tanX + tanY * tanY;
+  const auto cameraToWorld = glm::inverse(viewMatrix);
+  const auto cascadeCount =
+      std::min(std::max(options.cascadeCount, 1), maxShadowCascadeCount);
+  auto sliceNear = nearDepth;
+  for (int cascadeIdx = 0; cascadeIdx < cascadeCount; ++cascadeIdx) {
+    const auto ratio = float(cascadeIdx + 1) / cascadeCount;
+    const auto logSplit = nearDepth * std::pow(farDepth / nearDepth, ratio);
+    const auto uniformSplit = nearDepth + (farDepth - nearDepth) * ratio;
+    const auto sliceFar =
+        glm::mix(uniformSplit, logSplit, options.splitLambda);
+    // Center depth at the same distance from the near and far corners, or
+    // the far plane if the far corners are the farthest anyway. Only depends
+    // on the projection, so the radius does not change from frame to frame.
+    const auto centerDepth =
+        std::min(0.5f * (sliceNear + sliceFar) * (1 + cornerTan2), sliceFar);
+    const auto radius =
+        std::sqrt((sliceFar - centerDepth) * (sliceFar - centerDepth) +
+                  sliceFar * sliceFar * cornerTan2);
+    const auto texelSize = 2 * radius / options.resolution;
+    auto center = glm::vec3(
+        lightView * (cameraToWorld * glm::vec4(0, 0, -centerDepth, 1)));
+    center.x = std::floor(center.x / texelSize) * texelSize;
+    center.y = std::floor(center.y / texelSize) * texelSize;
+
+    const auto lightProj =
+        glm::ortho(center.x - radius, center.x + radius, center.y - radius,
+            center.y + radius, -maxZ - padding, -minZ + padding);
+    cascades[cascadeIdx].viewProjMatrix = lightProj * lightView;
+    cascades[cascadeIdx].texelSize = texelSize;
+    sliceNear = sliceFar;
+  }
+}
+
+ShadowMaps::ShadowMaps(const ShadowOptions &options) :
+    m_options(options),
+    m_framebuffers(size_t(options.cascadeCount)),
+    m_cascades(size_t(options.cascadeCount)),
+    m_isRendered(size_t(options.cascadeCount), 0)
+{
+  glGenTextures(1, &m_texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F,
+      options.resolution, options.resolution, options.cascadeCount);
+  // Linear filtering of the comparisons: each lookup is a 2x2 PCF
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+      GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  // glReadBuffer() applies to the read framebuffer: both are bound
+  GLint previousDrawFramebuffer = 0;
+  GLint previousReadFramebuffer = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousDrawFramebuffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousReadFramebuffer);
+  glGenFramebuffers(GLsizei(m_framebuffers.size()), m_framebuffers.data());
+  for (size_t layer = 0; layer < m_framebuffers.size(); ++layer) {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffers[layer]);
+    glFramebufferTextureLayer(
+        GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0, GLint(layer));
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  }
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(previousDrawFramebuffer));
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(previousReadFramebuffer));
+}
+
+ShadowMaps::~ShadowMaps()
+{
+  glDeleteFramebuffers(GLsizei(m_framebuffers.size()), m_framebuffers.data());
+  glDeleteTextures(1, &m_texture);
+}
+
+bool ShadowMaps::needsUpdate(int cascadeIdx, const ShadowCascade &cascade,
+    size_t frameIdx, bool isCachingEnabled) const
+{
+  if (!m_isRendered[cascadeIdx]) {
+    return true;
+  }
+  const auto interval = size_t(std::max(m_options.distantCascadeInterval, 1));
+  if (cascadeIdx >= 2 && frameIdx % interval != size_t(cascadeIdx) % interval) {
+    return false;
+  }
+  return !isCachingEnabled ||
+         cascade.viewProjMatrix != m_cascades[cascadeIdx].viewProjMatrix;
+}
+
+void ShadowMaps::beginUpdate(int cascadeIdx, const ShadowCascade &cascade)
+{
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffers[cascadeIdx]);
+  glViewport(0, 0, m_options.resolution, m_options.resolution);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  m_cascades[cascadeIdx] = cascade;
+  m_isRendered[cascadeIdx] = 1;
+}
+
+void ShadowMaps::invalidate()
+{
+  std::fill(begin(m_isRendered), end(m_isRendered), uint8_t(0));
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Size of the arrays of cascades of the shaders
+const int maxShadowCascadeCount = 4;
+
+struct ShadowOptions
+{
+  int cascadeCount = 4; // At most maxShadowCascadeCount
+  int resolution = 2048; // Width and height of the map of each cascade
+  // Cascade splits blend uniform (0) and logarithmic (1) splits of the view
+  // depth range
+  float splitLambda = 0.75f;
+  // Cascades from the third on, which cover most of the view depth range
+  // but few pixels, are updated on one frame out of this many (staggered)
+  int distantCascadeInterval = 1;
+  // Render a cascade again only when its bounds change or the casters of
+  // the scene change (see ShadowMaps::invalidate). Can be toggled in the GUI
+  // to measure the cost of the maps.
+  bool cacheStaticDepth = true;
+};
+
+// Orthographic light projection of a slice of the view frustum
+struct ShadowCascade
+{
+  glm::mat4 viewProjMatrix = glm::mat4(0); // World to light clip space
+  float texelSize = 0; // Side of a texel of the map, in world units
+};
+
+struct ShadowStats
+{
+  int renderedCascadeCount = 0; // Of the last frame
+  int cachedCascadeCount = 0;
+  size_t drawCallCount = 0;
+  double seconds = 0; // CPU time of the shadow pass
+  double gpuSeconds = 0; // A few frames late, see GpuPassTimer
+};
+
+// Fit the cascades of a directional light shining along -lightDirection (in
+// world space) to the slices of the view frustum between nearDepth and
+// farDepth. Each slice is bounded by a sphere centered on the view axis, so
+// that the size of a cascade does not change when the camera turns, and the
+// center is snapped to the texels of the map, so that the casters are
+// rasterized the same way (no shimmering, cached maps stay valid) when the
+// camera moves by less than a texel. The depth range covers the whole
+// sceneBounds: casters outside of the view frustum still shadow it.
+void fitShadowCascades(const glm::mat4 &viewMatrix, const glm::mat4 &projMatrix,
+    float nearDepth, float farDepth, const glm::vec3 &lightDirection,
+    const BoundingBox &sceneBounds, const ShadowOptions &options,
+    ShadowCascade *cascades);
+
+// Depth maps of the cascades, in the layers of a depth texture array sampled
+// with depth comparison (sampler2DArrayShadow). Each layer keeps the cascade
+// it was last rendered for: with a static scene it only needs rendering
+// again when the fitted cascade moves.
+class ShadowMaps
+{
+public:
+  explicit ShadowMaps(const ShadowOptions &options);
+  ~ShadowMaps();
+
+  ShadowMaps(const ShadowMaps &) = delete;
+  ShadowMaps &operator=(const ShadowMaps &) = delete;
+
+  const ShadowOptions &options() const { return m_options; }
+  int cascadeCount() const { return m_options.cascadeCount; }
+  GLuint texture() const { return m_texture; }
+
+  // Whether the map of cascadeIdx must be rendered on frame frameIdx for the
+  // newly fitted cascade: never rendered, rendered for other bounds (each
+  // frame if caching is disabled), and for distant cascades only on their
+  // frames of options().distantCascadeInterval
+  bool needsUpdate(int cascadeIdx, const ShadowCascade &cascade,
+      size_t frameIdx, bool isCachingEnabled) const;
+
+  // Bind the framebuffer of the layer of cascadeIdx, with its viewport, and
+  // clear its depth: the map now holds cascade
+  void beginUpdate(int cascadeIdx, const ShadowCascade &cascade);
+
+  // Render every map again on its next needsUpdate(): the cached maps are
+  // stale once casters are added to or removed from the scene, even if the
+  // cascades do not move
+  void invalidate();
+
+  // Cascade held by the map of cascadeIdx, to sample it
+  const ShadowCascade &cascade(int cascadeIdx) const
+  {
+    return m_cascades[cascadeIdx];
+  }
+
+private:
+  ShadowOptions m_options;
+  GLuint m_texture = 0;
+  std::vector<GLuint> m_framebuffers; // One per layer
+  std::vector<ShadowCascade> m_cascades;
+  std::vector<uint8_t> m_isRendered;
+};
@@ -0,0 +1,300 @@
+#include "static_batching.hpp"
+#include "parallel.hpp"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+namespace
+{
+
+// Vertex attributes of a primitive besides POSITION
+enum VertexFormatBits
+{
+  VERTEX_FORMAT_NORMAL = 1,
+  VERTEX_FORMAT_TEXCOORD0 = 2
+};
+
+// Primitives of a batch share material, mode (once converted to a list) and
+// vertex format
+using BatchKey = std::tuple<int, int, int>;
+
+// A primitive of a static node placed in the space of the scene root
+struct BatchItem
+{
+  int meshIdx;
+  int primitiveIdx;
+  glm::mat4 matrix;
+  BoundingBox bounds;
+  size_t vertexCount;
+};
+
+int getListMode(int mode)
+{
+  switch (mode) {
+  case TINYGLTF_MODE_LINE:
+  case TINYGLTF_MODE_LINE_LOOP:
+  case TINYGLTF_MODE_LINE_STRIP:
+    return GL_LINES;
+  case TINYGLTF_MODE_TRIANGLES:
+  case TINYGLTF_MODE_TRIANGLE_STRIP:
+  case TINYGLTF_MODE_TRIANGLE_FAN:
+    return GL_TRIANGLES;
+  default:
+    return GL_POINTS;
+  }
+}
+
+int getVertexFormat(const tinygltf::Primitive &primitive)
+{
+  return (primitive.attributes.count("NORMAL") ? VERTEX_FORMAT_NORMAL : 0) |
+         (primitive.attributes.count("TEXCOORD_0") ? VERTEX_FORMAT_TEXCOORD0
+                                                   : 0);
+}
+
+// Nodes whose transform or geometry can change, and must keep their own
+// draw calls
+std::vector<bool> findDynamicNodes(const tinygltf::Model &model)
+{
+  std::vector<bool> isDynamic(model.nodes.size(), false);
+  for (const auto &animation : model.animations) {
+    for (const auto &channel : animation.channels) {
+      if (channel.target_node >= 0 &&
+          size_t(channel.target_node) < isDynamic.size()) {
+        isDynamic[channel.target_node] = true;
+      }
+    }
+  }
+  for (size_t nodeIdx = 0; nodeIdx < model.nodes.size(); ++nodeIdx) {
+    const auto &node = model.nodes[nodeIdx];
+    NodeInstancing instancing;
+    if (node.skin >= 0 || getNodeInstancing(model, node, instancing)) {
+      isDynamic[nodeIdx] = true;
+    } else if (node.mesh >= 0) {
+      for (const auto &primitive : model.meshes[node.mesh].primitives) {
+        if (!primitive.targets.empty()) {
+          isDynamic[nodeIdx] = true;
+        }
+      }
+    }
+  }
+  // Children of animated nodes move with them
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &) {
+    if (isDynamic[nodeIdx]) {
+      for (const auto childIdx : model.nodes[nodeIdx].children) {
+        isDynamic[childIdx] = true;
+      }
+    }
+  });
+  return isDynamic;
+}
+
+// Split items along the longest side of their bounds until chunks are small
+// enough, appending the chunks to chunkItems
+void partitionItems(const std::vector<BatchItem> &items,
+    std::vector<size_t> itemIndices, int depth,
+    const StaticBatchOptions &options,
+    std::vector<std::vector<size_t>> &chunkItems)
+{
+  const auto vertexCount = std::accumulate(begin(itemIndices),
+      end(itemIndices), size_t(0),
+      [&](size_t sum, size_t i) { return sum + items[i].vertexCount; });
+  if (itemIndices.size() <= 1 || vertexCount <= options.maxChunkVertexCount ||
+      depth >= options.maxDepth) {
+    chunkItems.push_back(std::move(itemIndices));
+    return;
+  }
+
+  BoundingBox bounds;
+  for (const auto i : itemIndices) {
+    bounds.extend(items[i].bounds);
+  }
+  const auto extent = bounds.max - bounds.min;
+  const auto axis =
+      extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z;
+  // Median split on the centers: both halves get items
+  const auto middle = begin(itemIndices) + itemIndices.size() / 2;
+  const auto center = [&](size_t i) {
+    return items[i].bounds.min[axis] + items[i].bounds.max[axis];
+  };
+  std::nth_element(begin(itemIndices), middle, end(itemIndices),
+      [&](size_t lhs, size_t rhs) { return center(lhs) < center(rhs); });
+  partitionItems(items, std::vector<size_t>(begin(itemIndices), middle),
+      depth + 1, options, chunkItems);
+  partitionItems(items, std::vector<size_t>(middle, end(itemIndices)),
+      depth + 1, options, chunkItems);
+}
+
+// Merged geometry of the items of a chunk
+struct ChunkData
+{
+  BoundingBox bounds;
+  std::vector<CachedVertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+void buildChunkData(const tinygltf::Model &model,
+    const std::vector<BatchItem> &items, const std::vector<size_t> &itemIndices,
+    ChunkData &data)
+{
+  std::vector<glm::vec4> positions, normals, texCoords;
+  std::vector<uint32_t> indices;
+  for (const auto i : itemIndices) {
+    const auto &item = items[i];
+    const auto &primitive =
+        model.meshes[item.meshIdx].primitives[item.primitiveIdx];
+    const auto attributeAccessor = [&](const char *name) {
+      const auto it = primitive.attributes.find(name);
+      return it == end(primitive.attributes) ? -1 : (*it).second;
+    };
+    if (!readAccessorAsVec4(
+            model, attributeAccessor("POSITION"), positions, glm::vec4(1)) ||
+        positions.empty() || !readPrimitiveIndices(model, primitive, indices)) {
+      continue;
+    }
+    if (!readAccessorAsVec4(
+            model, attributeAccessor("NORMAL"), normals, glm::vec4(0))) {
+      normals.clear();
+    }
+    if (!readAccessorAsVec4(
+            model, attributeAccessor("TEXCOORD_0"), texCoords, glm::vec4(0))) {
+      texCoords.clear();
+    }
+    normals.resize(positions.size(), glm::vec4(0));
+    texCoords.resize(positions.size(), glm::vec4(0));
+    convertToListMode(primitive.mode, indices);
+
+    const auto baseVertex = uint32_t(data.vertices.size());
+    const auto normalMatrix =
+        glm::transpose(glm::inverse(glm::mat3(item.matrix)));
+    for (size_t v = 0; v < positions.size(); ++v) {
+      const auto position =
+          glm::vec3(item.matrix * glm::vec4(glm::vec3(positions[v]), 1.f));
+      auto normal = normalMatrix * glm::vec3(normals[v]);
+      if (glm::dot(normal, normal) > 0.f) {
+        normal = glm::normalize(normal);
+      }
+      data.bounds.extend(position);
+      data.vertices.push_back(CachedVertex{{position.x, position.y, position.z},
+          {normal.x, normal.y, normal.z}, {texCoords[v].x, texCoords[v].y}});
+    }
+    for (const auto index : indices) {
+      data.indices.push_back(baseVertex + std::min(index,
+                                              uint32_t(positions.size() - 1)));
+    }
+  }
+}
+
+} // namespace
+
+StaticBatches buildStaticBatches(
+    const tinygltf::Model &model, const StaticBatchOptions &options)
+{
+  StaticBatches batches;
+  batches.isBatchedNode.assign(model.nodes.size(), false);
+
+  const auto isDynamic = findDynamicNodes(model);
+  std::vector<BatchItem> items;
+  std::map<BatchKey, std::vector<size_t>> batchItems;
+  visitScene(model, [&](int nodeIdx, const glm::mat4 &matrix) {
+    const auto &node = model.nodes[nodeIdx];
+    if (node.mesh < 0 || isDynamic[nodeIdx]) {
+      return;
+    }
+    const auto &mesh = model.meshes[node.mesh];
+    size_t vertexCount = 0;
+    for (const auto &primitive : mesh.primitives) {
+      const auto it = primitive.attributes.find("POSITION");
+      if (it != end(primitive.attributes)) {
+        vertexCount += model.accessors[(*it).second].count;
+      }
+    }
+    if (!vertexCount || vertexCount > options.maxNodeVertexCount) {
+      return;
+    }
+    batches.isBatchedNode[nodeIdx] = true;
+    ++batches.batchedNodeCount;
+
+    for (size_t primIdx = 0; primIdx < mesh.primitives.size(); ++primIdx) {
+      const auto &primitive = mesh.primitives[primIdx];
+      const auto it = primitive.attributes.find("POSITION");
+      if (it == end(primitive.attributes)) {
+        continue;
+      }
+      const auto &accessor = model.accessors[(*it).second];
+      // min and max are required for POSITION accessors, but not always set
+      BoundingBox localBounds;
+      if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+        localBounds.min = glm::vec3(accessor.minValues[0],
+            accessor.minValues[1], accessor.minValues[2]);
+        localBounds.max = glm::vec3(accessor.maxValues[0],
+            accessor.maxValues[1], accessor.maxValues[2]);
+      } else {
+        std::vector<glm::vec4> positions;
+        readAccessorAsVec4(model, (*it).second, positions);
+        for (const auto &position : positions) {
+          localBounds.extend(glm::vec3(position));
+        }
+      }
+      if (localBounds.isEmpty()) {
+        localBounds.extend(glm::vec3(0));
+      }
+      const auto key = BatchKey{primitive.material,
+          getListMode(primitive.mode), getVertexFormat(primitive)};
+      batchItems[key].push_back(items.size());
+      items.push_back(BatchItem{node.mesh, int(primIdx), matrix,
+          transformBoundingBox(matrix, localBounds), accessor.count});
+
+      ++batches.batchedPrimitiveCount;
+      for (const auto &attribute : primitive.attributes) {
+        const auto &attributeAccessor = model.accessors[attribute.second];
+        batches.sourceByteCount +=
+            attributeAccessor.count *
+            tinygltf::GetComponentSizeInBytes(attributeAccessor.componentType) *
+            tinygltf::GetNumComponentsInType(attributeAccessor.type);
+      }
+      if (primitive.indices >= 0) {
+        const auto &indexAccessor = model.accessors[primitive.indices];
+        batches.sourceByteCount +=
+            indexAccessor.count *
+            tinygltf::GetComponentSizeInBytes(indexAccessor.componentType);
+      }
+    }
+  });
+
+  // std::map keeps the batches sorted by material
+  std::vector<std::pair<BatchKey, std::vector<size_t>>> chunkItems;
+  for (auto &batch : batchItems) {
+    std::vector<std::vector<size_t>> chunks;
+    partitionItems(items, std::move(batch.second), 0, options, chunks);
+    for (auto &chunk : chunks) {
+      chunkItems.emplace_back(batch.first, std::move(chunk));
+    }
+  }
+
+  std::vector<ChunkData> chunkData(chunkItems.size());
+  parallelFor(chunkItems.size(), [&](size_t i) {
+    buildChunkData(model, items, chunkItems[i].second, chunkData[i]);
+  });
+
+  for (size_t i = 0; i < chunkItems.size(); ++i) {
+    auto &data = chunkData[i];
+    if (data.indices.empty()) {
+      continue;
+    }
+    const auto baseVertex = uint32_t(batches.vertices.size());
+    batches.chunks.push_back(StaticBatchChunk{data.bounds,
+        std::get<0>(chunkItems[i].first), std::get<1>(chunkItems[i].first),
+        uint32_t(batches.indices.size()), uint32_t(data.indices.size())});
+    batches.vertices.insert(
+        end(batches.vertices), begin(data.vertices), end(data.vertices));
+    for (const auto index : data.indices) {
+      batches.indices.push_back(baseVertex + index);
+    }
+    data = ChunkData{};
+  }
+  return batches;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "geometry_cache.hpp"
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Static batching: the primitives of small static nodes sharing a material and
+// a vertex format are merged into shared vertex and index buffers, with their
+// vertices pre-transformed to the space of the scene root. Each batch is split
+// spatially into chunks so that it can still be frustum culled, and each chunk
+// is drawn with a single draw call instead of one per node and primitive.
+//
+// Static nodes are the nodes of the default scene that are not instanced,
+// skinned, morphed or targeted by an animation.
+
+struct StaticBatchOptions
+{
+  // Only nodes whose mesh has at most this many vertices are batched
+  size_t maxNodeVertexCount = 4096;
+  // Chunks holding more vertices are split, unless maxDepth is reached
+  size_t maxChunkVertexCount = 1 << 16;
+  int maxDepth = 8;
+};
+
+struct StaticBatchChunk
+{
+  BoundingBox bounds; // In the space of the scene root
+  int material; // -1 for the default material
+  int mode; // GL_POINTS, GL_LINES or GL_TRIANGLES
+  uint32_t firstIndex; // In StaticBatches::indices
+  uint32_t indexCount;
+};
+
+struct StaticBatches
+{
+  // Sorted by material so that consecutive chunks can share bindMaterial
+  std::vector<StaticBatchChunk> chunks;
+  std::vector<CachedVertex> vertices;
+  std::vector<uint32_t> indices; // Relative to the start of vertices
+  std::vector<bool> isBatchedNode; // Nodes drawn through the chunks only
+
+  size_t batchedNodeCount = 0;
+  // Draw calls the batched nodes would need without batching
+  size_t batchedPrimitiveCount = 0;
+  // Size of the source vertex and index data of the batched primitives, to be
+  // compared with the size of the batches (instances of a mesh are copied)
+  size_t sourceByteCount = 0;
+
+  size_t byteCount() const
+  {
+    return vertices.size() * sizeof(CachedVertex) +
+           indices.size() * sizeof(uint32_t);
+  }
+};
+
+StaticBatches buildStaticBatches(
+    const tinygltf::Model &model, const StaticBatchOptions &options);
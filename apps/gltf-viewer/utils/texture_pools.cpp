@@ -0,0 +1,276 @@
+#include "texture_pools.hpp"
+#include "images.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+
+namespace
+{
+
+// Size groups: width, height, bits
+using PoolKey = std::tuple<int, int, int>;
+
+size_t getBytesPerPixel(int bits) { return 4 * size_t(bits / 8); }
+
+// Images are decoded to RGBA, 8 or 16 bits per component
+bool hasPoolableData(const tinygltf::Image &image)
+{
+  return (image.bits == 8 || image.bits == 16) && image.width > 0 &&
+         image.height > 0 &&
+         image.image.size() == size_t(image.width) * image.height *
+                                   getBytesPerPixel(image.bits);
+}
+
+// Shelf packing of images in atlas pages, images sorted by decreasing height
+void packAtlas(const tinygltf::Model &model, const TexturePoolOptions &options,
+    int poolIdx, TexturePools &pools)
+{
+  auto &pool = pools.pools[poolIdx];
+  std::sort(begin(pool.images), end(pool.images), [&](int lhs, int rhs) {
+    return model.images[lhs].height > model.images[rhs].height;
+  });
+  const auto pageSize = options.atlasPageSize;
+  const auto padding = options.atlasPadding;
+  int x = 0;
+  int y = 0;
+  int shelfHeight = 0;
+  for (const auto imageIdx : pool.images) {
+    const auto &image = model.images[imageIdx];
+    const auto cellWidth = image.width + 2 * padding;
+    const auto cellHeight = image.height + 2 * padding;
+    if (x + cellWidth > pageSize) {
+      x = 0;
+      y += shelfHeight;
+      shelfHeight = 0;
+    }
+    if (!pool.layerCount || y + cellHeight > pageSize) {
+      ++pool.layerCount;
+      x = 0;
+      y = 0;
+      shelfHeight = 0;
+    }
+    auto &entry = pools.images[imageIdx];
+    entry.pool = poolIdx;
+    entry.layer = pool.layerCount - 1;
+    entry.x = x + padding;
+    entry.y = y + padding;
+    entry.scale[0] = float(image.width) / pageSize;
+    entry.scale[1] = float(image.height) / pageSize;
+    entry.offset[0] = float(entry.x) / pageSize;
+    entry.offset[1] = float(entry.y) / pageSize;
+    x += cellWidth;
+    shelfHeight = std::max(shelfHeight, cellHeight);
+  }
+}
+
+PooledTextureRef getPooledTextureRef(const tinygltf::Model &model,
+    const TexturePools &pools, int textureIdx)
+{
+  PooledTextureRef ref;
+  if (textureIdx < 0 || model.textures[textureIdx].source < 0) {
+    return ref;
+  }
+  const auto &entry = pools.images[model.textures[textureIdx].source];
+  if (entry.pool < 0) {
+    return ref;
+  }
+  ref.pool = entry.pool;
+  ref.layer = float(entry.layer);
+  ref.isAtlased = pools.pools[entry.pool].isAtlas ? 1 : 0;
+  ref.scaleOffset[0] = entry.scale[0];
+  ref.scaleOffset[1] = entry.scale[1];
+  ref.scaleOffset[2] = entry.offset[0];
+  ref.scaleOffset[3] = entry.offset[1];
+  return ref;
+}
+
+} // namespace
+
+size_t TexturePools::layerCount() const
+{
+  size_t count = 0;
+  for (const auto &pool : pools) {
+    count += pool.layerCount;
+  }
+  return count;
+}
+
+size_t TexturePools::byteCount(bool generateMipmaps) const
+{
+  // A full mipmap chain adds a third of the base level
+  const auto mipmapFactor = generateMipmaps ? 4. / 3. : 1.;
+  size_t byteCount = 0;
+  for (const auto &pool : pools) {
+    byteCount += size_t(mipmapFactor * pool.width * pool.height *
+                        pool.layerCount * getBytesPerPixel(pool.bits));
+  }
+  return byteCount;
+}
+
+TexturePools buildTexturePools(
+    tinygltf::Model &model, const TexturePoolOptions &options)
+{
+  TexturePools pools;
+  pools.images.resize(model.images.size());
+
+  std::set<int> usedImages;
+  for (const auto &texture : model.textures) {
+    if (texture.source >= 0 && hasPoolableData(model.images[texture.source])) {
+      usedImages.insert(texture.source);
+    }
+  }
+  // Atlased images must fit in a page with their padding
+  const auto atlasMaxImageSize = std::min(options.atlasMaxImageSize,
+      options.atlasPageSize - 2 * options.atlasPadding);
+
+  std::map<PoolKey, std::vector<int>> sizeGroups;
+  std::map<int, std::vector<int>> atlasedImages; // By bits
+  std::set<int> usedBits;
+  for (const auto imageIdx : usedImages) {
+    const auto &image = model.images[imageIdx];
+    usedBits.insert(image.bits);
+    if (std::max(image.width, image.height) <= atlasMaxImageSize) {
+      atlasedImages[image.bits].push_back(imageIdx);
+    } else {
+      sizeGroups[PoolKey{image.width, image.height, image.bits}].push_back(
+          imageIdx);
+    }
+  }
+
+  // The largest groups get a pool, keeping room for an atlas per format in
+  // case the other groups need to be downscaled
+  std::vector<std::vector<int> *> groups;
+  for (auto &group : sizeGroups) {
+    groups.push_back(&group.second);
+  }
+  std::stable_sort(begin(groups), end(groups),
+      [](const std::vector<int> *lhs, const std::vector<int> *rhs) {
+        return lhs->size() > rhs->size();
+      });
+  const auto reservedPoolCount = groups.size() + atlasedImages.size() >
+                                         size_t(options.maxPoolCount)
+                                     ? usedBits.size()
+                                     : atlasedImages.size();
+  const auto sizePoolCount = std::min(groups.size(),
+      size_t(std::max(options.maxPoolCount - int(reservedPoolCount), 0)));
+  for (size_t groupIdx = 0; groupIdx < groups.size(); ++groupIdx) {
+    const auto &group = *groups[groupIdx];
+    if (groupIdx >= sizePoolCount) {
+      for (const auto imageIdx : group) {
+        auto &image = model.images[imageIdx];
+        limitImageSize(image.image, image.width, image.height, 4, image.bits,
+            atlasMaxImageSize);
+        if (std::max(image.width, image.height) > atlasMaxImageSize) {
+          continue; // Format not supported by limitImageSize, not pooled
+        }
+        atlasedImages[image.bits].push_back(imageIdx);
+        ++pools.downscaledImageCount;
+      }
+      continue;
+    }
+    const auto &first = model.images[group.front()];
+    TexturePool pool{first.width, first.height, first.bits, false, 0,
+        int(group.size()), group};
+    for (size_t layer = 0; layer < group.size(); ++layer) {
+      pools.images[group[layer]].pool = int(pools.pools.size());
+      pools.images[group[layer]].layer = int(layer);
+    }
+    pools.pools.push_back(std::move(pool));
+  }
+
+  for (auto &atlas : atlasedImages) {
+    if (pools.pools.size() >= size_t(options.maxPoolCount)) {
+      break; // maxPoolCount smaller than the number of formats
+    }
+    pools.atlasedImageCount += atlas.second.size();
+    pools.pools.push_back(TexturePool{options.atlasPageSize,
+        options.atlasPageSize, atlas.first, true, options.atlasPadding, 0,
+        std::move(atlas.second)});
+    packAtlas(model, options, int(pools.pools.size()) - 1, pools);
+  }
+
+  for (const auto &entry : pools.images) {
+    if (entry.pool >= 0) {
+      ++pools.pooledImageCount;
+    }
+  }
+  return pools;
+}
+
+std::vector<unsigned char> composeAtlasPage(const tinygltf::Model &model,
+    const TexturePools &pools, int poolIdx, int layer)
+{
+  const auto &pool = pools.pools[poolIdx];
+  const auto bytesPerPixel = getBytesPerPixel(pool.bits);
+  const auto pageWidth = size_t(pool.width);
+  std::vector<unsigned char> pixels(
+      pageWidth * pool.height * bytesPerPixel, 0);
+  for (const auto imageIdx : pool.images) {
+    const auto &entry = pools.images[imageIdx];
+    if (entry.layer != layer) {
+      continue;
+    }
+    const auto &image = model.images[imageIdx];
+    // The padding repeats the image, as the shader does for texture
+    // coordinates outside [0, 1]
+    for (int y = -pool.padding; y < image.height + pool.padding; ++y) {
+      const auto sourceY = (y + image.height) % image.height;
+      for (int x = -pool.padding; x < image.width + pool.padding; ++x) {
+        const auto sourceX = (x + image.width) % image.width;
+        std::memcpy(&pixels[((entry.y + y) * pageWidth + entry.x + x) *
+                             bytesPerPixel],
+            &image.image[(size_t(sourceY) * image.width + sourceX) *
+                         bytesPerPixel],
+            bytesPerPixel);
+      }
+    }
+  }
+  return pixels;
+}
+
+int getTexturePoolLevelCount(const TexturePool &pool, bool generateMipmaps)
+{
+  if (!generateMipmaps) {
+    return 1;
+  }
+  const auto levelCount =
+      int(std::log2(std::max(pool.width, pool.height))) + 1;
+  if (!pool.isAtlas) {
+    return levelCount;
+  }
+  // Level i shrinks the padding to padding >> i texels
+  return std::min(
+      levelCount, int(std::log2(std::max(pool.padding, 1))) + 1);
+}
+
+std::vector<PooledMaterial> getPooledMaterials(
+    const tinygltf::Model &model, const TexturePools &pools)
+{
+  // Primitives without material use the default material of the spec
+  const tinygltf::Material defaultMaterial;
+  std::vector<PooledMaterial> materials;
+  for (size_t materialIdx = 0; materialIdx <= model.materials.size();
+       ++materialIdx) {
+    const auto &material = materialIdx < model.materials.size()
+                               ? model.materials[materialIdx]
+                               : defaultMaterial;
+    const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+    PooledMaterial pooled;
+    pooled.factors = getMaterialFactors(model,
+        materialIdx < model.materials.size() ? int(materialIdx) : -1);
+    pooled.baseColorTexture = getPooledTextureRef(
+        model, pools, pbrMetallicRoughness.baseColorTexture.index);
+    pooled.metallicRoughnessTexture = getPooledTextureRef(
+        model, pools, pbrMetallicRoughness.metallicRoughnessTexture.index);
+    pooled.emissiveTexture =
+        getPooledTextureRef(model, pools, material.emissiveTexture.index);
+    pooled.occlusionTexture =
+        getPooledTextureRef(model, pools, material.occlusionTexture.index);
+    materials.push_back(pooled);
+  }
+  return materials;
+}
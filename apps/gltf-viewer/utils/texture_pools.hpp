@@ -0,0 +1,114 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Texture pools: the images of a model are grouped by size and format into a
+// few GL_TEXTURE_2D_ARRAY textures, so that all the materials of the model
+// can be sampled without binding textures between draws. A material only
+// references a pool and a layer (see PooledMaterial), and draws with
+// different materials can share a multi-draw call.
+//
+// Small images are packed into atlas pages instead of getting a pool per
+// size. Atlased images are surrounded by a padding of wrapped texels, so that
+// bilinear filtering and the first mipmap levels do not bleed between
+// neighbours, and the shader wraps their texture coordinates itself.
+//
+// Pools use a single sampler: the sampler of each glTF texture is replaced
+// by linear filtering with mipmaps and repeat wrapping.
+
+struct TexturePoolOptions
+{
+  // Texture units used by the pools, at most the POOL_COUNT of
+  // pbr_directional_light_pooled.fs.glsl
+  int maxPoolCount = 12;
+  // Images whose largest side is at most this size are atlased
+  int atlasMaxImageSize = 256;
+  int atlasPageSize = 2048;
+  int atlasPadding = 8; // Texels, also limits the mipmap levels of atlases
+};
+
+struct TexturePool
+{
+  int width;
+  int height;
+  int bits; // 8 or 16 bits per component, RGBA
+  bool isAtlas;
+  int padding; // Atlases only, see TexturePoolOptions::atlasPadding
+  int layerCount;
+  // Images of the pool: the image of each layer for size pools, all the
+  // images of the pool for atlases
+  std::vector<int> images;
+};
+
+// Location of an image in the pools
+struct TexturePoolEntry
+{
+  int pool = -1; // -1 if the image could not be pooled (no data)
+  int layer = 0;
+  // Atlases only: position of the image in its page, in texels
+  int x = 0;
+  int y = 0;
+  // Atlases only: texture coordinates in the page are
+  // fract(uv) * scale + offset
+  float scale[2] = {1.f, 1.f};
+  float offset[2] = {0.f, 0.f};
+};
+
+struct TexturePools
+{
+  std::vector<TexturePool> pools;
+  std::vector<TexturePoolEntry> images; // One per image of the model
+  size_t pooledImageCount = 0;
+  size_t atlasedImageCount = 0;
+  // Images whose size group did not get a pool, downscaled into an atlas
+  size_t downscaledImageCount = 0;
+
+  size_t layerCount() const;
+  // GPU memory of the pools, mipmaps included
+  size_t byteCount(bool generateMipmaps) const;
+};
+
+// Group the images used by the textures of model into at most
+// options.maxPoolCount pools. The largest size groups get their own pool.
+// The images of the other groups are downscaled in place to fit in an atlas.
+TexturePools buildTexturePools(
+    tinygltf::Model &model, const TexturePoolOptions &options);
+
+// Pixels of an atlas page: the atlased images at their place, wrapped in
+// their padding, and black elsewhere
+std::vector<unsigned char> composeAtlasPage(const tinygltf::Model &model,
+    const TexturePools &pools, int poolIdx, int layer);
+
+// Number of mipmap levels of a pool: a full chain, or for atlases the levels
+// whose texels stay within the padding
+int getTexturePoolLevelCount(const TexturePool &pool, bool generateMipmaps);
+
+// std430 layout of TextureRef in pbr_directional_light_pooled.fs.glsl
+struct PooledTextureRef
+{
+  int32_t pool = -1; // -1 for no texture (the shader samples 1)
+  float layer = 0.f;
+  uint32_t isAtlased = 0;
+  uint32_t padding = 0;
+  float scaleOffset[4] = {1.f, 1.f, 0.f, 0.f};
+};
+
+// std430 layout of Material in pbr_directional_light_pooled.fs.glsl
+struct PooledMaterial
+{
+  MaterialFactors factors;
+  PooledTextureRef baseColorTexture;
+  PooledTextureRef metallicRoughnessTexture;
+  PooledTextureRef emissiveTexture;
+  PooledTextureRef occlusionTexture;
+};
+static_assert(sizeof(PooledMaterial) % 16 == 0, "std430 array stride");
+
+// One PooledMaterial per material of model, followed by the default material
+std::vector<PooledMaterial> getPooledMaterials(
+    const tinygltf::Model &model, const TexturePools &pools);
@@ -0,0 +1,101 @@
+#include "transforms.hpp"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define USE_AVX 1
+#elif defined(__SSE__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define USE_SSE 1
+#endif
+
+namespace
+{
+
+// result = lhs * rhs, column major. result must not alias the operands.
+void multiply(const float *lhs, const float *rhs, float *result)
+{
+#if defined(USE_AVX)
+  // Two columns of the result per iteration: the columns of lhs are
+  // duplicated in both lanes and weighted by two columns of rhs
+  const auto col0 = _mm256_broadcast_ps((const __m128 *)(lhs + 0));
+  const auto col1 = _mm256_broadcast_ps((const __m128 *)(lhs + 4));
+  const auto col2 = _mm256_broadcast_ps((const __m128 *)(lhs + 8));
+  const auto col3 = _mm256_broadcast_ps((const __m128 *)(lhs + 12));
+  for (auto j = 0; j < 4; j += 2) {
+    const auto *r = rhs + 4 * j;
+    auto sum = _mm256_mul_ps(col0, _mm256_setr_ps(r[0], r[0], r[0], r[0],
+                                       r[4], r[4], r[4], r[4]));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(col1,
+                                 _mm256_setr_ps(r[1], r[1], r[1], r[1], r[5],
+                                     r[5], r[5], r[5])));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(col2,
+                                 _mm256_setr_ps(r[2], r[2], r[2], r[2], r[6],
+                                     r[6], r[6], r[6])));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(col3,
+                                 _mm256_setr_ps(r[3], r[3], r[3], r[3], r[7],
+                                     r[7], r[7], r[7])));
+    _mm256_storeu_ps(result + 4 * j, sum);
+  }
+#elif defined(USE_SSE)
+  const auto col0 = _mm_loadu_ps(lhs + 0);
+  const auto col1 = _mm_loadu_ps(lhs + 4);
+  const auto col2 = _mm_loadu_ps(lhs + 8);
+  const auto col3 = _mm_loadu_ps(lhs + 12);
+  for (auto j = 0; j < 4; ++j) {
+    const auto *r = rhs + 4 * j;
+    auto sum = _mm_mul_ps(col0, _mm_set1_ps(r[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(col1, _mm_set1_ps(r[1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(col2, _mm_set1_ps(r[2])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(col3, _mm_set1_ps(r[3])));
+    _mm_storeu_ps(result + 4 * j, sum);
+  }
+#else
+  for (auto j = 0; j < 4; ++j) {
+    for (auto i = 0; i < 4; ++i) {
+      result[4 * j + i] = lhs[i] * rhs[4 * j] + lhs[4 + i] * rhs[4 * j + 1] +
+                          lhs[8 + i] * rhs[4 * j + 2] +
+                          lhs[12 + i] * rhs[4 * j + 3];
+    }
+  }
+#endif
+}
+
+} // namespace
+
+glm::mat4 computeNormalMatrix(const glm::mat4 &matrix)
+{
+  const auto linear = glm::mat3(matrix);
+  const auto scale2 = glm::dot(linear[0], linear[0]);
+  // Relative tolerance on the squared lengths and the dot products
+  const auto epsilon = 1e-5f * scale2;
+  const auto isConformal =
+      scale2 > 0.f &&
+      std::abs(glm::dot(linear[1], linear[1]) - scale2) <= epsilon &&
+      std::abs(glm::dot(linear[2], linear[2]) - scale2) <= epsilon &&
+      std::abs(glm::dot(linear[0], linear[1])) <= epsilon &&
+      std::abs(glm::dot(linear[0], linear[2])) <= epsilon &&
+      std::abs(glm::dot(linear[1], linear[2])) <= epsilon;
+  // For A = s R, inverse(A)^T = R / s = A / s^2
+  return glm::mat4(
+      isConformal ? linear / scale2 : glm::transpose(glm::inverse(linear)));
+}
+
+void computeDrawTransforms(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const glm::mat4 *modelMatrices,
+    const glm::mat4 *modelNormalMatrices, size_t count,
+    DrawTransforms *transforms)
+{
+  const auto viewProjMatrix = projMatrix * viewMatrix;
+  const auto viewNormalMatrix = computeNormalMatrix(viewMatrix);
+  for (size_t i = 0; i < count; ++i) {
+    const auto *model = &modelMatrices[i][0][0];
+    auto &result = transforms[i];
+    multiply(&viewProjMatrix[0][0], model, &result.modelViewProjMatrix[0][0]);
+    multiply(&viewMatrix[0][0], model, &result.modelViewMatrix[0][0]);
+    multiply(&viewNormalMatrix[0][0], &modelNormalMatrices[i][0][0],
+        &result.normalMatrix[0][0]);
+  }
+}
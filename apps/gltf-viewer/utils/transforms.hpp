@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// std140 layout of the Transforms uniform block of the vertex shaders
+struct DrawTransforms
+{
+  glm::mat4 modelViewProjMatrix;
+  glm::mat4 modelViewMatrix;
+  glm::mat4 normalMatrix;
+};
+
+// Inverse transpose of the linear part of matrix, as a mat4 without
+// translation. Rigid and uniform scale transforms (orthogonal columns of equal
+// length) take a cheap path that skips the general inverse.
+glm::mat4 computeNormalMatrix(const glm::mat4 &matrix);
+
+// Compute the transforms of count draws from their model matrices and their
+// normal matrices (from computeNormalMatrix, cached by the caller):
+//   modelViewMatrix = viewMatrix * modelMatrix
+//   modelViewProjMatrix = projMatrix * viewMatrix * modelMatrix
+//   normalMatrix = computeNormalMatrix(viewMatrix) * modelNormalMatrix
+// Uses AVX or SSE when the build targets them, plain C++ otherwise.
+void computeDrawTransforms(const glm::mat4 &viewMatrix,
+    const glm::mat4 &projMatrix, const glm::mat4 *modelMatrices,
+    const glm::mat4 *modelNormalMatrices, size_t count,
+    DrawTransforms *transforms);
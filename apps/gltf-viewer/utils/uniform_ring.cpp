@@ -0,0 +1,131 @@
+#include "uniform_ring.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+UniformRingBuffer::UniformRingBuffer(
+    GLenum target, size_t frameByteCount, size_t frameCount) :
+    m_target(target),
+    m_frameCount(std::min(frameCount, sizeof(m_fences) / sizeof(GLsync)))
+{
+  assert(frameCount >= 1 && frameCount <= 4);
+  GLint alignment = 0;
+  glGetIntegerv(target == GL_SHADER_STORAGE_BUFFER
+                    ? GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT
+                    : GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,
+      &alignment);
+  if (alignment > 0) {
+    m_alignment = size_t(alignment);
+  }
+  allocate(frameByteCount);
+}
+
+UniformRingBuffer::~UniformRingBuffer() { release(); }
+
+void UniformRingBuffer::beginFrame()
+{
+  if (m_hasOverflowed) {
+    // Every section may be in use: wait for all of them before reallocating
+    glFinish();
+    const auto frameByteCount = 2 * m_frameByteCount;
+    release();
+    allocate(frameByteCount);
+    m_hasOverflowed = false;
+  }
+
+  auto &fence = m_fences[m_frameIdx];
+  if (fence) {
+    auto status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      ++m_stats.blockedFrameCount;
+      while (status == GL_TIMEOUT_EXPIRED) {
+        status = glClientWaitSync(
+            fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+      }
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  m_offset = 0;
+}
+
+void UniformRingBuffer::endFrame()
+{
+  m_fences[m_frameIdx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_stats.usedByteCount = m_offset;
+  m_frameIdx = (m_frameIdx + 1) % m_frameCount;
+}
+
+GLintptr UniformRingBuffer::push(const void *data, size_t byteCount)
+{
+  assert(byteCount <= m_frameByteCount);
+  if (m_offset + byteCount > m_frameByteCount) {
+    if (!m_hasOverflowed) {
+      ++m_stats.overflowCount;
+    }
+    m_hasOverflowed = true;
+    glFinish();
+    m_offset = 0;
+  }
+  const auto offset = m_frameIdx * m_frameByteCount + m_offset;
+  std::memcpy(m_mappedData + offset, data, byteCount);
+  m_offset += alignedSize(byteCount);
+  return GLintptr(offset);
+}
+
+GLintptr UniformRingBuffer::reserve(size_t byteCount)
+{
+  if (m_offset + byteCount > m_frameByteCount) {
+    if (!m_hasOverflowed) {
+      ++m_stats.overflowCount;
+    }
+    m_hasOverflowed = true;
+    return -1;
+  }
+  const auto offset = m_frameIdx * m_frameByteCount + m_offset;
+  m_offset += alignedSize(byteCount);
+  return GLintptr(offset);
+}
+
+UniformRingStats UniformRingBuffer::stats() const
+{
+  auto stats = m_stats;
+  stats.frameByteCount = m_frameByteCount;
+  return stats;
+}
+
+void UniformRingBuffer::allocate(size_t frameByteCount)
+{
+  // Sections start on an aligned offset
+  m_frameByteCount =
+      std::max((frameByteCount + m_alignment - 1) / m_alignment, size_t(1)) *
+      m_alignment;
+  const auto byteCount = GLsizeiptr(m_frameCount * m_frameByteCount);
+  // Coherent mapping: writes are visible to the GPU without explicit flushes
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &m_buffer);
+  glBindBuffer(m_target, m_buffer);
+  glBufferStorage(m_target, byteCount, nullptr, flags);
+  m_mappedData =
+      static_cast<char *>(glMapBufferRange(m_target, 0, byteCount, flags));
+  glBindBuffer(m_target, 0);
+  m_frameIdx = 0;
+  m_offset = 0;
+}
+
+void UniformRingBuffer::release()
+{
+  for (auto &fence : m_fences) {
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+  }
+  glBindBuffer(m_target, m_buffer);
+  glUnmapBuffer(m_target);
+  glBindBuffer(m_target, 0);
+  glDeleteBuffers(1, &m_buffer);
+  m_buffer = 0;
+  m_mappedData = nullptr;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstring>
+
+struct UniformRingStats
+{
+  size_t frameByteCount = 0; // Capacity of one frame
+  size_t usedByteCount = 0; // By the last completed frame
+  size_t blockedFrameCount = 0; // Frames that waited for the GPU
+  size_t overflowCount = 0; // Frames that did not fit, see push()
+};
+
+// Per-draw uniform data written by the CPU straight into a persistently
+// mapped buffer, split in frameCount sections used in turn. A fence is
+// inserted after the draws of each frame, and the CPU only waits on it when
+// it comes back to the same section frameCount frames later, so there is
+// normally no wait at all.
+//
+// Draws reference their data with glBindBufferRange() on the offset returned
+// by push(), one binding change per draw instead of one glUniform* call per
+// uniform.
+class UniformRingBuffer
+{
+public:
+  // target is GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER, frameCount at
+  // most 4
+  UniformRingBuffer(
+      GLenum target, size_t frameByteCount, size_t frameCount = 3);
+  ~UniformRingBuffer();
+
+  UniformRingBuffer(const UniformRingBuffer &) = delete;
+  UniformRingBuffer &operator=(const UniformRingBuffer &) = delete;
+
+  GLuint glId() const { return m_buffer; }
+
+  // Wait until the GPU is done with the next section. The buffer is
+  // reallocated twice as large if the previous frame overflowed.
+  void beginFrame();
+  // Fence the draws of the frame
+  void endFrame();
+
+  // Copy byteCount bytes to the current section and return their offset in
+  // the buffer, aligned for glBindBufferRange(). A frame larger than its
+  // section waits for the GPU to complete all previous draws and starts the
+  // section over (slow, but the next frames get a larger buffer).
+  GLintptr push(const void *data, size_t byteCount);
+
+  template <typename T> GLintptr push(const T &value)
+  {
+    return push(&value, sizeof(T));
+  }
+
+  // Reserve byteCount bytes of the current section, to be written later
+  // through data(), from any thread until endFrame(). Returns their aligned
+  // offset, or -1 if they do not fit: the caller falls back to push(), and
+  // the next frames get a larger buffer.
+  GLintptr reserve(size_t byteCount);
+  char *data(GLintptr offset) const { return m_mappedData + offset; }
+
+  // Size of an element of an array of reserved elements, each bound with
+  // glBindBufferRange()
+  size_t alignedSize(size_t byteCount) const
+  {
+    return (byteCount + m_alignment - 1) / m_alignment * m_alignment;
+  }
+
+  UniformRingStats stats() const;
+
+private:
+  void allocate(size_t frameByteCount);
+  void release();
+
+  const GLenum m_target;
+  const size_t m_frameCount;
+  size_t m_alignment = 256;
+
+  GLuint m_buffer = 0;
+  char *m_mappedData = nullptr;
+  size_t m_frameByteCount = 0;
+  GLsync m_fences[4] = {};
+
+  size_t m_frameIdx = 0; // Current section
+  size_t m_offset = 0; // In the current section
+  bool m_hasOverflowed = false;
+
+  UniformRingStats m_stats;
+};
@@ -0,0 +1,94 @@
+#include "vertex_pulling.hpp"
+
+namespace
+{
+
+// Same order as PulledDrawRecord::attributes
+enum PulledAttributeIndex
+{
+  PULLED_POSITION = 0,
+  PULLED_NORMAL = 1,
+  PULLED_TEXCOORD0 = 2,
+  PULLED_INSTANCE_TRANSLATION = 3,
+  PULLED_INSTANCE_ROTATION = 4,
+  PULLED_INSTANCE_SCALE = 5
+};
+
+bool getPulledAttribute(const tinygltf::Model &model,
+    const PulledGeometryLayout &layout, int accessorIdx,
+    PulledAttribute &attribute)
+{
+  if (accessorIdx < 0) {
+    return false;
+  }
+  const auto &accessor = model.accessors[accessorIdx];
+  if (accessor.bufferView < 0) {
+    return false;
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  attribute.offset = uint32_t(layout.bufferOffsets[bufferView.buffer] +
+                              bufferView.byteOffset + accessor.byteOffset);
+  attribute.stride = uint32_t(accessor.ByteStride(bufferView));
+  attribute.componentType = uint32_t(accessor.componentType);
+  attribute.componentCount =
+      uint32_t(tinygltf::GetNumComponentsInType(accessor.type)) |
+      (accessor.normalized ? 1u << 8 : 0u);
+  return true;
+}
+
+} // namespace
+
+PulledGeometryLayout computePulledGeometryLayout(const tinygltf::Model &model)
+{
+  PulledGeometryLayout layout;
+  for (const auto &buffer : model.buffers) {
+    layout.bufferOffsets.push_back(layout.byteCount);
+    layout.byteCount += (buffer.data.size() + 3) / 4 * 4;
+  }
+  return layout;
+}
+
+bool getPulledPrimitive(const tinygltf::Model &model,
+    const PulledGeometryLayout &layout, const tinygltf::Primitive &primitive,
+    const NodeInstancing *instancing, PulledPrimitive &pulledPrimitive)
+{
+  pulledPrimitive = PulledPrimitive{};
+  pulledPrimitive.mode = primitive.mode;
+  auto &record = pulledPrimitive.record;
+  const auto attributeAccessor = [&](const char *name) {
+    const auto it = primitive.attributes.find(name);
+    return it == end(primitive.attributes) ? -1 : (*it).second;
+  };
+  const auto positionAccessorIdx = attributeAccessor("POSITION");
+  if (!getPulledAttribute(model, layout, positionAccessorIdx,
+          record.attributes[PULLED_POSITION])) {
+    return false;
+  }
+  getPulledAttribute(model, layout, attributeAccessor("NORMAL"),
+      record.attributes[PULLED_NORMAL]);
+  getPulledAttribute(model, layout, attributeAccessor("TEXCOORD_0"),
+      record.attributes[PULLED_TEXCOORD0]);
+  if (instancing) {
+    getPulledAttribute(model, layout, instancing->translationAccessor,
+        record.attributes[PULLED_INSTANCE_TRANSLATION]);
+    getPulledAttribute(model, layout, instancing->rotationAccessor,
+        record.attributes[PULLED_INSTANCE_ROTATION]);
+    getPulledAttribute(model, layout, instancing->scaleAccessor,
+        record.attributes[PULLED_INSTANCE_SCALE]);
+  }
+
+  if (primitive.indices >= 0) {
+    PulledAttribute indices;
+    if (!getPulledAttribute(model, layout, primitive.indices, indices)) {
+      return false;
+    }
+    record.indexOffset = indices.offset;
+    record.indexType = indices.componentType;
+    pulledPrimitive.vertexCount =
+        uint32_t(model.accessors[primitive.indices].count);
+  } else {
+    pulledPrimitive.vertexCount =
+        uint32_t(model.accessors[positionAccessorIdx].count);
+  }
+  return true;
+}
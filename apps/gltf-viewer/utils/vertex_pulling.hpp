@@ -0,0 +1,73 @@
+#pragma once
+
+#include "gltf.hpp"
+#include "transforms.hpp"
+
+#include <tiny_gltf.h>
+
+#include <cstdint>
+#include <vector>
+
+// Programmable vertex pulling: the vertex shader (forward_pulling.vs.glsl)
+// reads the vertices of a draw from a single buffer holding all the buffers
+// of the asset, described by a PulledDrawRecord. The records of the draws are
+// stored in a shader storage buffer and draws are submitted with
+// glMultiDrawArraysIndirect, gl_VertexID indexing the index list of the
+// primitive.
+
+// std430 layout of Attribute in forward_pulling.vs.glsl
+struct PulledAttribute
+{
+  uint32_t offset = 0; // In bytes in the geometry buffer
+  uint32_t stride = 0;
+  uint32_t componentType = 0; // 0 if the attribute is missing
+  uint32_t componentCount = 0; // | normalized << 8
+};
+
+// std430 layout of Draw in forward_pulling.vs.glsl
+struct PulledDrawRecord
+{
+  DrawTransforms transforms;
+  // Same order as the vertex attribute locations of forward.vs.glsl
+  PulledAttribute attributes[6];
+  uint32_t indexOffset = 0;
+  uint32_t indexType = 0; // 0 for non indexed draws
+  // Material of the draw in the material buffer, with texture pools
+  uint32_t materialIndex = 0;
+  uint32_t padding = 0;
+};
+static_assert(sizeof(PulledDrawRecord) % 16 == 0, "std430 array stride");
+
+// Layout of the commands read by glMultiDrawArraysIndirect
+struct DrawArraysIndirectCommand
+{
+  uint32_t count;
+  uint32_t instanceCount;
+  uint32_t first;
+  uint32_t baseInstance;
+};
+
+// A primitive ready to be pulled: its record (without transforms) and the
+// parameters of its draw command
+struct PulledPrimitive
+{
+  PulledDrawRecord record;
+  int mode; // glTF mode, same value as the GL mode
+  uint32_t vertexCount; // Number of indices for indexed primitives
+};
+
+// Layout of the geometry buffer of an asset: the glTF buffers one after the
+// other, each starting on a 4 bytes boundary
+struct PulledGeometryLayout
+{
+  std::vector<size_t> bufferOffsets;
+  size_t byteCount = 0;
+};
+
+PulledGeometryLayout computePulledGeometryLayout(const tinygltf::Model &model);
+
+// instancing may be null for non instanced draws. Returns false if the
+// primitive has no position to read.
+bool getPulledPrimitive(const tinygltf::Model &model,
+    const PulledGeometryLayout &layout, const tinygltf::Primitive &primitive,
+    const NodeInstancing *instancing, PulledPrimitive &pulledPrimitive);
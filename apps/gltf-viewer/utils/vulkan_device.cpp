@@ -0,0 +1,337 @@
+#ifdef GLMLV_USE_VULKAN
+
+#include "vulkan_device.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+
+// Features required from the device, chained from features.pNext
+struct RequiredFeatures
+{
+  VkPhysicalDeviceFeatures2 features{};
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphore{};
+  VkPhysicalDeviceDescriptorIndexingFeatures descriptorIndexing{};
+
+  RequiredFeatures()
+  {
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    timelineSemaphore.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    descriptorIndexing.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    features.pNext = &timelineSemaphore;
+    timelineSemaphore.pNext = &descriptorIndexing;
+  }
+  RequiredFeatures(const RequiredFeatures &) = delete;
+  RequiredFeatures &operator=(const RequiredFeatures &) = delete;
+
+  bool isSupported() const
+  {
+    return timelineSemaphore.timelineSemaphore &&
+           descriptorIndexing.runtimeDescriptorArray &&
+           descriptorIndexing.descriptorBindingPartiallyBound &&
+           descriptorIndexing.descriptorBindingVariableDescriptorCount &&
+           descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind;
+  }
+
+  void enable()
+  {
+    features.features = VkPhysicalDeviceFeatures{};
+    timelineSemaphore.timelineSemaphore = VK_TRUE;
+    auto *pNext = descriptorIndexing.pNext;
+    descriptorIndexing = VkPhysicalDeviceDescriptorIndexingFeatures{};
+    descriptorIndexing.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    descriptorIndexing.pNext = pNext;
+    descriptorIndexing.runtimeDescriptorArray = VK_TRUE;
+    descriptorIndexing.descriptorBindingPartiallyBound = VK_TRUE;
+    descriptorIndexing.descriptorBindingVariableDescriptorCount = VK_TRUE;
+    descriptorIndexing.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  }
+};
+
+int getDeviceTypeScore(VkPhysicalDeviceType type)
+{
+  switch (type) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    return 3;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    return 2;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+} // namespace
+
+void checkVkResult(VkResult result, const char *call)
+{
+  if (result < 0) {
+    throw std::runtime_error(
+        std::string(call) + " failed (VkResult " + std::to_string(result) +
+        ")");
+  }
+}
+
+VulkanDevice::VulkanDevice()
+{
+  uint32_t instanceVersion = 0;
+  checkVkResult(vkEnumerateInstanceVersion(&instanceVersion),
+      "vkEnumerateInstanceVersion");
+  if (instanceVersion < VK_API_VERSION_1_2) {
+    throw std::runtime_error("The Vulkan loader does not support Vulkan 1.2");
+  }
+  VkApplicationInfo applicationInfo{};
+  applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  applicationInfo.pApplicationName = "glTF Viewer";
+  applicationInfo.apiVersion = VK_API_VERSION_1_2;
+  VkInstanceCreateInfo instanceInfo{};
+  instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  instanceInfo.pApplicationInfo = &applicationInfo;
+  checkVkResult(vkCreateInstance(&instanceInfo, nullptr, &m_instance),
+      "vkCreateInstance");
+
+  try {
+    uint32_t deviceCount = 0;
+    checkVkResult(vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr),
+        "vkEnumeratePhysicalDevices");
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    checkVkResult(
+        vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data()),
+        "vkEnumeratePhysicalDevices");
+
+    auto bestScore = -1;
+    for (const auto device : devices) {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(device, &properties);
+      RequiredFeatures features;
+      vkGetPhysicalDeviceFeatures2(device, &features.features);
+      if (properties.apiVersion < VK_API_VERSION_1_2 ||
+          !features.isSupported()) {
+        continue;
+      }
+      uint32_t familyCount = 0;
+      vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+      std::vector<VkQueueFamilyProperties> families(familyCount);
+      vkGetPhysicalDeviceQueueFamilyProperties(
+          device, &familyCount, families.data());
+      for (uint32_t familyIdx = 0; familyIdx < familyCount; ++familyIdx) {
+        const auto score = getDeviceTypeScore(properties.deviceType);
+        if ((families[familyIdx].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+            score > bestScore) {
+          bestScore = score;
+          m_physicalDevice = device;
+          m_graphicsFamily = familyIdx;
+        }
+      }
+    }
+    if (!m_physicalDevice) {
+      throw std::runtime_error("No Vulkan 1.2 device supports timeline "
+                               "semaphores and descriptor indexing");
+    }
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &m_properties);
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_memoryProperties);
+    m_name = m_properties.deviceName;
+
+    // Transfer only family, or a second queue of the graphics family
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        m_physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        m_physicalDevice, &familyCount, families.data());
+    m_transferFamily = m_graphicsFamily;
+    for (uint32_t familyIdx = 0; familyIdx < familyCount; ++familyIdx) {
+      const auto flags = families[familyIdx].queueFlags;
+      if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+          !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+        m_transferFamily = familyIdx;
+        break;
+      }
+    }
+    const auto graphicsQueueCount =
+        m_transferFamily == m_graphicsFamily
+            ? std::min(families[m_graphicsFamily].queueCount, 2u)
+            : 1u;
+
+    const float priorities[] = {1.f, 1.f};
+    VkDeviceQueueCreateInfo queueInfos[2] = {};
+    queueInfos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfos[0].queueFamilyIndex = m_graphicsFamily;
+    queueInfos[0].queueCount = graphicsQueueCount;
+    queueInfos[0].pQueuePriorities = priorities;
+    queueInfos[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfos[1].queueFamilyIndex = m_transferFamily;
+    queueInfos[1].queueCount = 1;
+    queueInfos[1].pQueuePriorities = priorities;
+
+    RequiredFeatures features;
+    features.enable();
+    VkDeviceCreateInfo deviceInfo{};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = &features.features;
+    deviceInfo.queueCreateInfoCount =
+        m_transferFamily == m_graphicsFamily ? 1 : 2;
+    deviceInfo.pQueueCreateInfos = queueInfos;
+    checkVkResult(
+        vkCreateDevice(m_physicalDevice, &deviceInfo, nullptr, &m_device),
+        "vkCreateDevice");
+
+    vkGetDeviceQueue(m_device, m_graphicsFamily, 0, &m_graphicsQueue);
+    vkGetDeviceQueue(m_device, m_transferFamily,
+        m_transferFamily == m_graphicsFamily ? graphicsQueueCount - 1 : 0,
+        &m_transferQueue);
+  } catch (...) {
+    vkDestroyInstance(m_instance, nullptr);
+    throw;
+  }
+}
+
+VulkanDevice::~VulkanDevice()
+{
+  vkDeviceWaitIdle(m_device);
+  vkDestroyDevice(m_device, nullptr);
+  vkDestroyInstance(m_instance, nullptr);
+}
+
+void VulkanDevice::submit(VkQueue queue, const VkSubmitInfo &submitInfo)
+{
+  std::lock_guard<std::mutex> lock(queue == m_graphicsQueue
+                                       ? m_graphicsQueueMutex
+                                       : m_transferQueueMutex);
+  checkVkResult(
+      vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE), "vkQueueSubmit");
+}
+
+VulkanBuffer VulkanDevice::createBuffer(VkDeviceSize size,
+    VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties)
+{
+  const uint32_t families[] = {m_graphicsFamily, m_transferFamily};
+  VkBufferCreateInfo bufferInfo{};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  if (m_graphicsFamily != m_transferFamily) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = 2;
+    bufferInfo.pQueueFamilyIndices = families;
+  }
+  VulkanBuffer buffer;
+  buffer.size = size;
+  checkVkResult(vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer.buffer),
+      "vkCreateBuffer");
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(m_device, buffer.buffer, &requirements);
+  try {
+    buffer.memory = allocateMemory(requirements, memoryProperties);
+    checkVkResult(vkBindBufferMemory(m_device, buffer.buffer, buffer.memory, 0),
+        "vkBindBufferMemory");
+    if (memoryProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      checkVkResult(vkMapMemory(m_device, buffer.memory, 0, VK_WHOLE_SIZE, 0,
+                        &buffer.mapped),
+          "vkMapMemory");
+    }
+  } catch (...) {
+    destroyBuffer(buffer);
+    throw;
+  }
+  return buffer;
+}
+
+void VulkanDevice::destroyBuffer(VulkanBuffer &buffer)
+{
+  vkDestroyBuffer(m_device, buffer.buffer, nullptr);
+  vkFreeMemory(m_device, buffer.memory, nullptr); // Unmaps it
+  buffer = VulkanBuffer{};
+}
+
+VulkanImage VulkanDevice::createImage(
+    VkImageCreateInfo info, VkImageAspectFlags aspect)
+{
+  const uint32_t families[] = {m_graphicsFamily, m_transferFamily};
+  if (m_graphicsFamily != m_transferFamily) {
+    info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    info.queueFamilyIndexCount = 2;
+    info.pQueueFamilyIndices = families;
+  }
+  VulkanImage image;
+  checkVkResult(
+      vkCreateImage(m_device, &info, nullptr, &image.image), "vkCreateImage");
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(m_device, image.image, &requirements);
+  try {
+    image.memory =
+        allocateMemory(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    checkVkResult(vkBindImageMemory(m_device, image.image, image.memory, 0),
+        "vkBindImageMemory");
+
+    VkImageViewCreateInfo viewInfo{};
+
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = info.format;
+    viewInfo.subresourceRange = {aspect, 0, info.mipLevels, 0, 1};
+    checkVkResult(vkCreateImageView(m_device, &viewInfo, nullptr, &image.view),
+        "vkCreateImageView");
+  } catch (...) {
+    destroyImage(image);
+    throw;
+  }
+  return image;
+}
+
+void VulkanDevice::destroyImage(VulkanImage &image)
+{
+  vkDestroyImageView(m_device, image.view, nullptr);
+  vkDestroyImage(m_device, image.image, nullptr);
+  vkFreeMemory(m_device, image.memory, nullptr);
+  image = VulkanImage{};
+}
+
+bool VulkanDevice::supportsVertexFormat(VkFormat format) const
+{
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &properties);
+  return properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT;
+}
+
+uint32_t VulkanDevice::findMemoryType(
+    uint32_t typeBits, VkMemoryPropertyFlags properties) const
+{
+  for (uint32_t typeIdx = 0; typeIdx < m_memoryProperties.memoryTypeCount;
+       ++typeIdx) {
+    if ((typeBits & (1u << typeIdx)) &&
+        (m_memoryProperties.memoryTypes[typeIdx].propertyFlags & properties) ==
+            properties) {
+      return typeIdx;
+    }
+  }
+  throw std::runtime_error("No suitable Vulkan memory type");
+}
+
+VkDeviceMemory VulkanDevice::allocateMemory(
+    const VkMemoryRequirements &requirements, VkMemoryPropertyFlags properties)
+{
+  // Mapped memory is always coherent: no flushes
+  if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    properties |= VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  }
+  VkMemoryAllocateInfo allocateInfo{};
+  allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocateInfo.allocationSize = requirements.size;
+  allocateInfo.memoryTypeIndex =
+      findMemoryType(requirements.memoryTypeBits, properties);
+  VkDeviceMemory memory;
+  checkVkResult(vkAllocateMemory(m_device, &allocateInfo, nullptr, &memory),
+      "vkAllocateMemory");
+  return memory;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Vulkan 1.2 instance and device of the Vulkan renderer. The helpers throw
+// std::runtime_error on failure: the renderer catches them at its interface
+// and reports them like the other errors of the viewer.
+
+// Throws std::runtime_error naming call if result is an error
+void checkVkResult(VkResult result, const char *call);
+
+// A buffer and its memory, mapped if host visible
+struct VulkanBuffer
+{
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr;
+};
+
+// An image, its memory and a view of all its levels
+struct VulkanImage
+{
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+};
+
+// Picks the first device supporting Vulkan 1.2 with timeline semaphores and
+// descriptor indexing (runtime arrays of sampled images, partially bound and
+// updated after bind), preferring discrete GPUs. Uploads go through a
+// transfer queue: a queue of a transfer only family if there is one (DMA
+// engine), a second graphics queue otherwise, or the graphics queue itself.
+class VulkanDevice
+{
+public:
+  // Throws std::runtime_error if no device is suitable
+  VulkanDevice();
+  ~VulkanDevice();
+
+  VulkanDevice(const VulkanDevice &) = delete;
+  VulkanDevice &operator=(const VulkanDevice &) = delete;
+
+  VkPhysicalDevice physicalDevice() const { return m_physicalDevice; }
+  VkDevice device() const { return m_device; }
+  const VkPhysicalDeviceProperties &properties() const { return m_properties; }
+  const std::string &name() const { return m_name; }
+
+  uint32_t graphicsFamily() const { return m_graphicsFamily; }
+  VkQueue graphicsQueue() const { return m_graphicsQueue; }
+  uint32_t transferFamily() const { return m_transferFamily; }
+  VkQueue transferQueue() const { return m_transferQueue; }
+
+  // Submit to queue (graphicsQueue() or transferQueue()), which is externally
+  // synchronized: both share a lock when they are the same queue
+  void submit(VkQueue queue, const VkSubmitInfo &submitInfo);
+
+  // Buffers and images are shared by the two queue families without
+  // ownership transfers (VK_SHARING_MODE_CONCURRENT) when they differ
+  VulkanBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+      VkMemoryPropertyFlags memoryProperties);
+  void destroyBuffer(VulkanBuffer &buffer);
+
+  // Device local image described by info (its sharing mode is set here),
+  // with a view of aspect
+  VulkanImage createImage(VkImageCreateInfo info, VkImageAspectFlags aspect);
+  void destroyImage(VulkanImage &image);
+
+  bool supportsVertexFormat(VkFormat format) const;
+
+private:
+  uint32_t findMemoryType(
+      uint32_t typeBits, VkMemoryPropertyFlags properties) const;
+  VkDeviceMemory allocateMemory(const VkMemoryRequirements &requirements,
+      VkMemoryPropertyFlags properties);
+
+  VkInstance m_instance = VK_NULL_HANDLE;
+  VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties m_properties;
+  VkPhysicalDeviceMemoryProperties m_memoryProperties;
+  std::string m_name;
+
+  uint32_t m_graphicsFamily = 0;
+  uint32_t m_transferFamily = 0;
+  VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+  VkQueue m_transferQueue = VK_NULL_HANDLE;
+  std::mutex m_graphicsQueueMutex;
+  std::mutex m_transferQueueMutex;
+};
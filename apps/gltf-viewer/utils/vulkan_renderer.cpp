@@ -0,0 +1,1351 @@
+#ifdef GLMLV_USE_VULKAN
+
+#include "vulkan_renderer.hpp"
+
+#include "job_system.hpp"
+#include "transforms.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+
+// Draws recorded in each secondary command buffer, like the chunks of draw
+// commands of the OpenGL path
+const size_t secondaryDrawCount = 1024;
+
+// Upper bound of the bindless texture array, lowered to the limits of the
+// device
+const uint32_t maxTextureCount = 16384;
+
+// Index buffer and topology of a primitive. Indices Vulkan cannot read
+// (8-bit, an extension) and line loops (converted to lists) are converted to
+// 32-bit indices stored after the glTF buffers.
+struct PrimitiveIndices
+{
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  bool isIndexed = false;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  VkDeviceSize offset = 0;
+  uint32_t count = 0; // Of indices, or of vertices
+};
+
+VkPrimitiveTopology getTopology(int mode)
+{
+  switch (mode) {
+  case TINYGLTF_MODE_POINTS:
+    return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+  case TINYGLTF_MODE_LINE:
+  case TINYGLTF_MODE_LINE_LOOP:
+    return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+  case TINYGLTF_MODE_LINE_STRIP:
+    return VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+  case TINYGLTF_MODE_TRIANGLE_STRIP:
+    return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+  case TINYGLTF_MODE_TRIANGLE_FAN:
+    return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
+  default:
+    return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  }
+}
+
+VkDeviceSize alignOffset(VkDeviceSize offset, VkDeviceSize alignment)
+{
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+PrimitiveIndices getPrimitiveIndices(const tinygltf::Model &model,
+    const tinygltf::Primitive &primitive,
+    const std::vector<VkDeviceSize> &bufferOffsets,
+    VkDeviceSize convertedOffset, std::vector<uint32_t> &convertedIndices)
+{
+  PrimitiveIndices result;
+  result.topology = getTopology(primitive.mode);
+  const auto isLineLoop = primitive.mode == TINYGLTF_MODE_LINE_LOOP;
+  if (primitive.indices < 0 && !isLineLoop) {
+    const auto position = primitive.attributes.find("POSITION");
+    if (position != end(primitive.attributes)) {
+      result.count = uint32_t(model.accessors[position->second].count);
+    }
+    return result;
+  }
+  result.isIndexed = true;
+  if (!isLineLoop) {
+    const auto &accessor = model.accessors[primitive.indices];
+    if (accessor.bufferView >= 0 &&
+        accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+      const auto &bufferView = model.bufferViews[accessor.bufferView];
+      result.indexType =
+          accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT
+              ? VK_INDEX_TYPE_UINT16
+              : VK_INDEX_TYPE_UINT32;
+      result.offset = bufferOffsets[bufferView.buffer] +
+                      bufferView.byteOffset + accessor.byteOffset;
+      result.count = uint32_t(accessor.count);
+      return result;
+    }
+  }
+  std::vector<uint32_t> indices;
+  if (!readPrimitiveIndices(model, primitive, indices)) {
+    return result;
+  }
+  if (isLineLoop) {
+    convertToListMode(primitive.mode, indices);
+  }
+  result.indexType = VK_INDEX_TYPE_UINT32;
+  result.offset = convertedOffset + convertedIndices.size() * sizeof(uint32_t);
+  result.count = uint32_t(indices.size());
+  convertedIndices.insert(end(convertedIndices), begin(indices), end(indices));
+  return result;
+}
+
+// Format of the vertex attributes read from an accessor, VK_FORMAT_UNDEFINED
+// if the vertex shader cannot read it as float. Integers that are not
+// normalized are converted to float (scaled formats), like with
+// glVertexAttribFormat.
+VkFormat getVertexFormat(int componentType, int componentCount, bool normalized)
+{
+  if (componentCount < 1 || componentCount > 4) {
+    return VK_FORMAT_UNDEFINED;
+  }
+  const auto index = size_t(componentCount - 1);
+  switch (componentType) {
+  case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+    const VkFormat formats[] = {VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+        VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+    return formats[index];
+  }
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+    const VkFormat unorm[] = {VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM,
+        VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8A8_UNORM};
+    const VkFormat uscaled[] = {VK_FORMAT_R8_USCALED, VK_FORMAT_R8G8_USCALED,
+        VK_FORMAT_R8G8B8_USCALED, VK_FORMAT_R8G8B8A8_USCALED};
+    return normalized ? unorm[index] : uscaled[index];
+  }
+  case TINYGLTF_COMPONENT_TYPE_BYTE: {
+    const VkFormat snorm[] = {VK_FORMAT_R8_SNORM, VK_FORMAT_R8G8_SNORM,
+        VK_FORMAT_R8G8B8_SNORM, VK_FORMAT_R8G8B8A8_SNORM};
+    const VkFormat sscaled[] = {VK_FORMAT_R8_SSCALED, VK_FORMAT_R8G8_SSCALED,
+        VK_FORMAT_R8G8B8_SSCALED, VK_FORMAT_R8G8B8A8_SSCALED};
+    return normalized ? snorm[index] : sscaled[index];
+  }
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+    const VkFormat unorm[] = {VK_FORMAT_R16_UNORM, VK_FORMAT_R16G16_UNORM,
+        VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16A16_UNORM};
+    const VkFormat uscaled[] = {VK_FORMAT_R16_USCALED,
+        VK_FORMAT_R16G16_USCALED, VK_FORMAT_R16G16B16_USCALED,
+        VK_FORMAT_R16G16B16A16_USCALED};
+    return normalized ? unorm[index] : uscaled[index];
+  }
+  case TINYGLTF_COMPONENT_TYPE_SHORT: {
+    const VkFormat snorm[] = {VK_FORMAT_R16_SNORM, VK_FORMAT_R16G16_SNORM,
+        VK_FORMAT_R16G16B16_SNORM, VK_FORMAT_R16G16B16A16_SNORM};
+    const VkFormat sscaled[] = {VK_FORMAT_R16_SSCALED,
+        VK_FORMAT_R16G16_SSCALED, VK_FORMAT_R16G16B16_SSCALED,
+        VK_FORMAT_R16G16B16A16_SSCALED};
+    return normalized ? snorm[index] : sscaled[index];
+  }
+  default:
+    return VK_FORMAT_UNDEFINED;
+  }
+}
+
+bool isMipmapFilter(int filter)
+{
+  return filter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_NEAREST ||
+         filter == TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_NEAREST ||
+         filter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR ||
+         filter == TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR;
+}
+
+VkSamplerAddressMode getAddressMode(int wrap)
+{
+  switch (wrap) {
+  case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE:
+    return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  case TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT:
+    return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+  default:
+    return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  }
+}
+
+// RGBA8 texels of a glTF image: 16-bit images are reduced to 8 bits, like
+// the unsized GL_RGBA textures of the OpenGL path
+std::vector<unsigned char> getImageTexels(const tinygltf::Image &image)
+{
+  if (image.bits != 16) {
+    return image.image;
+  }
+  std::vector<unsigned char> texels(image.image.size() / 2);
+  for (size_t i = 0; i < texels.size(); ++i) {
+    uint16_t value;
+    std::memcpy(&value, &image.image[2 * i], sizeof(value));
+    texels[i] = (unsigned char)((uint32_t(value) * 255 + 32767) / 65535);
+  }
+  return texels;
+}
+
+// Next mipmap level of RGBA8 texels, each texel the average of the 2x2
+// texels it covers (edge texels are repeated on odd sizes)
+std::vector<unsigned char> downsampleLevel(
+    const std::vector<unsigned char> &texels, uint32_t width, uint32_t height)
+{
+  const auto levelWidth = std::max(width / 2, 1u);
+  const auto levelHeight = std::max(height / 2, 1u);
+  std::vector<unsigned char> level(size_t(levelWidth) * levelHeight * 4);
+  for (uint32_t y = 0; y < levelHeight; ++y) {
+    const auto y0 = std::min(2 * y, height - 1);
+    const auto y1 = std::min(2 * y + 1, height - 1);
+    for (uint32_t x = 0; x < levelWidth; ++x) {
+      const auto x0 = std::min(2 * x, width - 1);
+      const auto x1 = std::min(2 * x + 1, width - 1);
+      for (uint32_t c = 0; c < 4; ++c) {
+        const auto sum = texels[(size_t(y0) * width + x0) * 4 + c] +
+                         texels[(size_t(y0) * width + x1) * 4 + c] +
+                         texels[(size_t(y1) * width + x0) * 4 + c] +
+                         texels[(size_t(y1) * width + x1) * 4 + c];
+        level[(size_t(y) * levelWidth + x) * 4 + c] =
+            (unsigned char)((sum + 2) / 4);
+      }
+    }
+  }
+  return level;
+}
+
+unsigned char toUnorm8(float value)
+{
+  return (unsigned char)std::lround(std::min(std::max(value, 0.f), 1.f) * 255);
+}
+
+} // namespace
+
+bool VulkanRenderer::PipelineKey::operator<(const PipelineKey &other) const
+{
+  static_assert(sizeof(PipelineKey) ==
+                    sizeof(topology) + sizeof(pass) + sizeof(formats) +
+                        sizeof(strides) + sizeof(inputRates),
+      "no padding in the compared bytes");
+  return std::memcmp(this, &other, sizeof(PipelineKey)) < 0;
+}
+
+VulkanRenderer::VulkanRenderer(const RendererOptions &options) :
+    m_options(options),
+    m_device(std::make_unique<VulkanDevice>()),
+    m_uploads(std::make_unique<VulkanUploadQueue>(*m_device))
+{
+  try {
+    createObjects();
+  } catch (...) {
+    destroyObjects();
+    throw;
+  }
+}
+
+VulkanRenderer::~VulkanRenderer() { destroyObjects(); }
+
+void VulkanRenderer::createObjects()
+{
+  const auto device = m_device->device();
+  const auto physicalDevice = m_device->physicalDevice();
+
+  m_vertexShader =
+      loadShaderModule(m_options.shadersPath + "/vulkan_forward.vs.spv");
+  m_fragmentShader = loadShaderModule(
+      m_options.shadersPath + "/vulkan_pbr_directional_light.fs.spv");
+
+  // Float color target like the OpenGL path, half floats if 32-bit floats
+  // cannot be blended
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(
+      physicalDevice, m_colorFormat, &formatProperties);
+  if (!(formatProperties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT)) {
+    m_colorFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+  }
+  vkGetPhysicalDeviceFormatProperties(
+      physicalDevice, m_depthFormat, &formatProperties);
+  if (!(formatProperties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+    m_depthFormat = VK_FORMAT_X8_D24_UNORM_PACK32;
+  }
+
+  VkAttachmentDescription attachments[2] = {};
+  attachments[0].format = m_colorFormat;
+  attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+  attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  attachments[1] = attachments[0];
+  attachments[1].format = m_depthFormat;
+  attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  const VkAttachmentReference colorReference{
+      0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+  const VkAttachmentReference depthReference{
+      1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+  VkSubpassDescription subpass{};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &colorReference;
+  subpass.pDepthStencilAttachment = &depthReference;
+  // The color target is copied to the readback buffer after the pass
+  VkSubpassDependency dependency{};
+  dependency.srcSubpass = 0;
+  dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  VkRenderPassCreateInfo renderPassInfo{};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = 2;
+  renderPassInfo.pAttachments = attachments;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 1;
+  renderPassInfo.pDependencies = &dependency;
+  checkVkResult(
+      vkCreateRenderPass(device, &renderPassInfo, nullptr, &m_renderPass),
+      "vkCreateRenderPass");
+
+  createDescriptorSets();
+
+  const VkDescriptorSetLayout setLayouts[] = {
+      m_bufferSetLayout, m_textureSetLayout};
+  const VkPushConstantRange pushConstantRange{
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+      sizeof(VulkanDrawConstants)};
+  VkPipelineLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 2;
+  layoutInfo.pSetLayouts = setLayouts;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &pushConstantRange;
+  checkVkResult(
+      vkCreatePipelineLayout(device, &layoutInfo, nullptr, &m_pipelineLayout),
+      "vkCreatePipelineLayout");
+
+  const float defaultAttributes[] = {0, 0, 0, 1, 1, 1, 1, 1};
+  m_defaultAttributes = m_device->createBuffer(sizeof(defaultAttributes),
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  m_uploads->uploadBuffer(m_defaultAttributes.buffer, 0, defaultAttributes,
+      sizeof(defaultAttributes));
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = m_device->graphicsFamily();
+  checkVkResult(vkCreateCommandPool(device, &poolInfo, nullptr, &m_commandPool),
+      "vkCreateCommandPool");
+  VkCommandBufferAllocateInfo allocateInfo{};
+  allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocateInfo.commandPool = m_commandPool;
+  allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocateInfo.commandBufferCount = 1;
+  checkVkResult(
+      vkAllocateCommandBuffers(device, &allocateInfo, &m_commandBuffer),
+      "vkAllocateCommandBuffers");
+  m_threadCommands.resize(JobSystem::instance().workerCount() + 1);
+  for (auto &thread : m_threadCommands) {
+    checkVkResult(
+        vkCreateCommandPool(device, &poolInfo, nullptr, &thread.commandPool),
+        "vkCreateCommandPool");
+  }
+
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+  checkVkResult(
+      vkCreateSemaphore(device, &semaphoreInfo, nullptr, &m_frameSemaphore),
+      "vkCreateSemaphore");
+}
+
+void VulkanRenderer::destroyObjects()
+{
+  const auto device = m_device->device();
+  vkDeviceWaitIdle(device);
+  vkDestroySemaphore(device, m_frameSemaphore, nullptr);
+  for (const auto &thread : m_threadCommands) {
+    vkDestroyCommandPool(device, thread.commandPool, nullptr);
+  }
+  vkDestroyCommandPool(device, m_commandPool, nullptr);
+  destroyTargets();
+  for (auto &model : m_models) {
+    m_device->destroyBuffer(model.buffer);
+    for (auto &texture : model.textures) {
+      m_device->destroyImage(texture);
+    }
+  }
+  m_device->destroyBuffer(m_transforms);
+  m_device->destroyBuffer(m_materialBuffer);
+  m_device->destroyBuffer(m_defaultAttributes);
+  for (const auto &sampler : m_samplers) {
+    vkDestroySampler(device, sampler.second, nullptr);
+  }
+  for (const auto pipeline : m_pipelines) {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  vkDestroyDescriptorPool(device, m_texturePool, nullptr);
+  vkDestroyDescriptorPool(device, m_bufferPool, nullptr);
+  vkDestroyPipelineLayout(device, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, m_textureSetLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, m_bufferSetLayout, nullptr);
+  vkDestroyRenderPass(device, m_renderPass, nullptr);
+  vkDestroyShaderModule(device, m_fragmentShader, nullptr);
+  vkDestroyShaderModule(device, m_vertexShader, nullptr);
+}
+
+VkShaderModule VulkanRenderer::loadShaderModule(const std::string &path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    throw std::runtime_error("Unable to open " + path);
+  }
+  std::vector<uint32_t> code(size_t(file.tellg()) / sizeof(uint32_t));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(code.data()),
+      std::streamsize(code.size() * sizeof(uint32_t)));
+  if (!file || code.empty()) {
+    throw std::runtime_error("Unable to read " + path);
+  }
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size() * sizeof(uint32_t);
+  moduleInfo.pCode = code.data();
+  VkShaderModule module;
+  checkVkResult(
+      vkCreateShaderModule(m_device->device(), &moduleInfo, nullptr, &module),
+      "vkCreateShaderModule");
+  return module;
+}
+
+void VulkanRenderer::createDescriptorSets()
+{
+  const auto device = m_device->device();
+
+  VkDescriptorSetLayoutBinding bufferBindings[2] = {};
+  bufferBindings[0].binding = 0;
+  bufferBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bufferBindings[0].descriptorCount = 1;
+  bufferBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  bufferBindings[1] = bufferBindings[0];
+  bufferBindings[1].binding = 1;
+  bufferBindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = bufferBindings;
+  checkVkResult(vkCreateDescriptorSetLayout(
+                    device, &layoutInfo, nullptr, &m_bufferSetLayout),
+      "vkCreateDescriptorSetLayout");
+
+  // The texture array is as large as the device allows: textures are written
+  // to it as models are added, the slots after them are never read
+  VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+  indexingProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &indexingProperties;
+  vkGetPhysicalDeviceProperties2(m_device->physicalDevice(), &properties);
+  m_textureCapacity = std::min({maxTextureCount,
+      indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+      indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+      indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+      indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+  VkDescriptorSetLayoutBinding textureBinding{};
+  textureBinding.binding = 0;
+  textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  textureBinding.descriptorCount = m_textureCapacity;
+  textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  const VkDescriptorBindingFlags textureBindingFlags =
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+      VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+  bindingFlagsInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  bindingFlagsInfo.bindingCount = 1;
+  bindingFlagsInfo.pBindingFlags = &textureBindingFlags;
+  layoutInfo.pNext = &bindingFlagsInfo;
+  layoutInfo.flags =
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &textureBinding;
+  checkVkResult(vkCreateDescriptorSetLayout(
+                    device, &layoutInfo, nullptr, &m_textureSetLayout),
+      "vkCreateDescriptorSetLayout");
+
+  const VkDescriptorPoolSize bufferPoolSize{
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2};
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &bufferPoolSize;
+  checkVkResult(
+      vkCreateDescriptorPool(device, &poolInfo, nullptr, &m_bufferPool),
+      "vkCreateDescriptorPool");
+  const VkDescriptorPoolSize texturePoolSize{
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_textureCapacity};
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.pPoolSizes = &texturePoolSize;
+  checkVkResult(
+      vkCreateDescriptorPool(device, &poolInfo, nullptr, &m_texturePool),
+      "vkCreateDescriptorPool");
+
+  VkDescriptorSetAllocateInfo allocateInfo{};
+  allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocateInfo.descriptorPool = m_bufferPool;
+  allocateInfo.descriptorSetCount = 1;
+  allocateInfo.pSetLayouts = &m_bufferSetLayout;
+  checkVkResult(vkAllocateDescriptorSets(device, &allocateInfo, &m_bufferSet),
+      "vkAllocateDescriptorSets");
+  VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo{};
+  countInfo.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+  countInfo.descriptorSetCount = 1;
+  countInfo.pDescriptorCounts = &m_textureCapacity;
+  allocateInfo.pNext = &countInfo;
+  allocateInfo.descriptorPool = m_texturePool;
+  allocateInfo.pSetLayouts = &m_textureSetLayout;
+  checkVkResult(vkAllocateDescriptorSets(device, &allocateInfo, &m_textureSet),
+      "vkAllocateDescriptorSets");
+}
+
+uint32_t VulkanRenderer::getPipeline(const PipelineKey &key)
+{
+  const auto found = m_pipelineIndices.find(key);
+  if (found != end(m_pipelineIndices)) {
+    return found->second;
+  }
+
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = m_vertexShader;
+  stages[0].pName = "main";
+  stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = m_fragmentShader;
+  stages[1].pName = "main";
+
+  VkVertexInputBindingDescription bindings[vertexInputCount];
+  VkVertexInputAttributeDescription attributes[vertexInputCount];
+  for (uint32_t location = 0; location < vertexInputCount; ++location) {
+    bindings[location] = {
+        location, key.strides[location], key.inputRates[location]};
+    attributes[location] = {location, location, key.formats[location], 0};
+  }
+  VkPipelineVertexInputStateCreateInfo vertexInput{};
+  vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInput.vertexBindingDescriptionCount = vertexInputCount;
+  vertexInput.pVertexBindingDescriptions = bindings;
+  vertexInput.vertexAttributeDescriptionCount = vertexInputCount;
+  vertexInput.pVertexAttributeDescriptions = attributes;
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  inputAssembly.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = key.topology;
+
+  VkPipelineViewportStateCreateInfo viewport{};
+  viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport.viewportCount = 1;
+  viewport.scissorCount = 1;
+
+  // No culling, like the OpenGL path
+  VkPipelineRasterizationStateCreateInfo rasterization{};
+  rasterization.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterization.cullMode = VK_CULL_MODE_NONE;
+  rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  rasterization.lineWidth = 1.f;
+
+  VkPipelineMultisampleStateCreateInfo multisample{};
+  multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  // Blended draws come last, back to front, without writing depth
+  const auto isBlended = key.pass == DRAW_PASS_BLEND;
+  VkPipelineDepthStencilStateCreateInfo depthStencil{};
+  depthStencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencil.depthTestEnable = VK_TRUE;
+  depthStencil.depthWriteEnable = isBlended ? VK_FALSE : VK_TRUE;
+  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+  VkPipelineColorBlendAttachmentState blendAttachment{};
+  blendAttachment.blendEnable = isBlended ? VK_TRUE : VK_FALSE;
+  blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+  blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+  blendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  VkPipelineColorBlendStateCreateInfo colorBlend{};
+  colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlend.attachmentCount = 1;
+  colorBlend.pAttachments = &blendAttachment;
+
+  const VkDynamicState dynamicStates[] = {
+      VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = 2;
+  pipelineInfo.pStages = stages;
+  pipelineInfo.pVertexInputState = &vertexInput;
+  pipelineInfo.pInputAssemblyState = &inputAssembly;
+  pipelineInfo.pViewportState = &viewport;
+  pipelineInfo.pRasterizationState = &rasterization;
+  pipelineInfo.pMultisampleState = &multisample;
+  pipelineInfo.pDepthStencilState = &depthStencil;
+  pipelineInfo.pColorBlendState = &colorBlend;
+  pipelineInfo.pDynamicState = &dynamicState;
+  pipelineInfo.layout = m_pipelineLayout;
+  pipelineInfo.renderPass = m_renderPass;
+  pipelineInfo.subpass = 0;
+  VkPipeline pipeline;
+  checkVkResult(vkCreateGraphicsPipelines(m_device->device(), VK_NULL_HANDLE,
+                    1, &pipelineInfo, nullptr, &pipeline),
+      "vkCreateGraphicsPipelines");
+  m_pipelines.push_back(pipeline);
+  const auto pipelineIdx = uint32_t(m_pipelines.size() - 1);
+  m_pipelineIndices[key] = pipelineIdx;
+  return pipelineIdx;
+}
+
+VkSampler VulkanRenderer::getSampler(
+    const tinygltf::Sampler &sampler, bool hasMipmaps)
+{
+  const auto minFilter = sampler.minFilter != -1
+                             ? sampler.minFilter
+                             : TINYGLTF_TEXTURE_FILTER_LINEAR;
+  const auto magFilter = sampler.magFilter != -1
+                             ? sampler.magFilter
+                             : TINYGLTF_TEXTURE_FILTER_LINEAR;
+  const std::array<int, 5> key = {
+      minFilter, magFilter, sampler.wrapS, sampler.wrapT, hasMipmaps};
+  const auto found = m_samplers.find(key);
+  if (found != end(m_samplers)) {
+    return found->second;
+  }
+
+  VkSamplerCreateInfo samplerInfo{};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = magFilter == TINYGLTF_TEXTURE_FILTER_NEAREST
+                              ? VK_FILTER_NEAREST
+                              : VK_FILTER_LINEAR;
+  samplerInfo.minFilter =
+      minFilter == TINYGLTF_TEXTURE_FILTER_NEAREST ||
+              minFilter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_NEAREST ||
+              minFilter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR
+          ? VK_FILTER_NEAREST
+          : VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode =
+      minFilter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR ||
+              minFilter == TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR
+          ? VK_SAMPLER_MIPMAP_MODE_LINEAR
+          : VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = getAddressMode(sampler.wrapS);
+  samplerInfo.addressModeV = getAddressMode(sampler.wrapT);
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  // Without mipmaps the level of detail is clamped to 0.25, so that the
+  // minification filter is still selected (see the Vulkan specification)
+  samplerInfo.maxLod = hasMipmaps ? VK_LOD_CLAMP_NONE : 0.25f;
+  VkSampler vkSampler;
+  checkVkResult(
+      vkCreateSampler(m_device->device(), &samplerInfo, nullptr, &vkSampler),
+      "vkCreateSampler");
+  m_samplers[key] = vkSampler;
+  return vkSampler;
+}
+
+void VulkanRenderer::uploadTextures(
+    const tinygltf::Model &model, Model &vkModel)
+{
+  std::vector<VkDescriptorImageInfo> imageInfos;
+  for (const auto &texture : model.textures) {
+    if (texture.source < 0) {
+      // Keep the indices of the textures: a slot that is never written
+      imageInfos.push_back(VkDescriptorImageInfo{});
+      continue;
+    }
+    const auto &image = model.images[texture.source];
+    const auto sampler =
+        texture.sampler >= 0 ? model.samplers[texture.sampler]
+                             : tinygltf::Sampler{};
+    const auto hasMipmaps =
+        isMipmapFilter(sampler.minFilter) && m_options.generateMipmaps;
+
+    auto width = uint32_t(image.width);
+    auto height = uint32_t(image.height);
+    std::vector<std::vector<unsigned char>> levels;
+    levels.push_back(getImageTexels(image));
+    while (hasMipmaps && (width > 1 || height > 1)) {
+      levels.push_back(downsampleLevel(levels.back(), width, height));
+      width = std::max(width / 2, 1u);
+      height = std::max(height / 2, 1u);
+    }
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageInfo.extent = {uint32_t(image.width), uint32_t(image.height), 1};
+    imageInfo.mipLevels = uint32_t(levels.size());
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage =
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    vkModel.textures.push_back(
+        m_device->createImage(imageInfo, VK_IMAGE_ASPECT_COLOR_BIT));
+    m_uploads->uploadImage(vkModel.textures.back().image, uint32_t(image.width),
+        uint32_t(image.height), 4, levels);
+
+    imageInfos.push_back(VkDescriptorImageInfo{getSampler(sampler, hasMipmaps),
+        vkModel.textures.back().view,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL});
+  }
+
+  // Updated after bind: the array can be written while it is bound by
+  // command buffers that have not been submitted
+  std::vector<VkWriteDescriptorSet> writes;
+  for (size_t textureIdx = 0; textureIdx < imageInfos.size(); ++textureIdx) {
+    if (!imageInfos[textureIdx].imageView) {
+      continue;
+    }
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = m_textureSet;
+    write.dstBinding = 0;
+    write.dstArrayElement = m_textureCount + uint32_t(textureIdx);
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfos[textureIdx];
+    writes.push_back(write);
+  }
+  vkUpdateDescriptorSets(m_device->device(), uint32_t(writes.size()),
+      writes.data(), 0, nullptr);
+}
+
+bool VulkanRenderer::resolveDraw(const tinygltf::Model &model,
+    const Model &vkModel, int nodeIdx, const tinygltf::Primitive &primitive,
+    VkPrimitiveTopology topology,
+    const std::vector<VkDeviceSize> &bufferOffsets, DrawItem &item,
+    std::string &warning)
+{
+  // Accessor of the attribute at each location, -1 for the default value
+  int accessors[vertexInputCount] = {-1, -1, -1, -1, -1, -1};
+  const char *attributeNames[] = {"POSITION", "NORMAL", "TEXCOORD_0"};
+  for (size_t location = 0; location < 3; ++location) {
+    const auto found = primitive.attributes.find(attributeNames[location]);
+    if (found != end(primitive.attributes)) {
+      accessors[location] = found->second;
+    }
+  }
+  if (accessors[0] < 0) {
+    warning = "primitive without POSITION";
+    return false;
+  }
+  NodeInstancing instancing;
+  if (getNodeInstancing(model, model.nodes[nodeIdx], instancing)) {
+    accessors[3] = instancing.translationAccessor;
+    accessors[4] = instancing.rotationAccessor;
+    accessors[5] = instancing.scaleAccessor;
+    item.instanceCount = uint32_t(instancing.instanceCount);
+  } else {
+    item.instanceCount = 1;
+  }
+
+  PipelineKey key{};
+  key.topology = topology;
+  key.pass = getMaterialDrawPass(model, primitive.material);
+  // Default values: (0, 0, 0, 1) for all but the instance scale, (1, 1, 1)
+  const VkFormat defaultFormats[] = {VK_FORMAT_R32G32B32_SFLOAT,
+      VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+      VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT,
+      VK_FORMAT_R32G32B32_SFLOAT};
+  for (uint32_t location = 0; location < vertexInputCount; ++location) {
+    const auto accessorIdx = accessors[location];
+    if (accessorIdx < 0 || model.accessors[accessorIdx].bufferView < 0) {
+      key.formats[location] = defaultFormats[location];
+      key.strides[location] = 0;
+      key.inputRates[location] = VK_VERTEX_INPUT_RATE_INSTANCE;
+      item.vertexBuffers[location] = m_defaultAttributes.buffer;
+      item.vertexOffsets[location] = location == 5 ? 4 * sizeof(float) : 0;
+      continue;
+    }
+    const auto &accessor = model.accessors[accessorIdx];
+    const auto &bufferView = model.bufferViews[accessor.bufferView];
+    const auto format = getVertexFormat(accessor.componentType,
+        tinygltf::GetNumComponentsInType(uint32_t(accessor.type)),
+        accessor.normalized);
+    if (format == VK_FORMAT_UNDEFINED ||
+        !m_device->supportsVertexFormat(format)) {
+      warning = "unsupported vertex format of accessor " +
+                std::to_string(accessorIdx);
+      return false;
+    }
+    key.formats[location] = format;
+    key.strides[location] = uint32_t(accessor.ByteStride(bufferView));
+    key.inputRates[location] =
+        location >= 3 ? VK_VERTEX_INPUT_RATE_INSTANCE
+                      : VK_VERTEX_INPUT_RATE_VERTEX;
+    item.vertexBuffers[location] = vkModel.buffer.buffer;
+    item.vertexOffsets[location] = bufferOffsets[bufferView.buffer] +
+                                   bufferView.byteOffset + accessor.byteOffset;
+  }
+  item.nodeIdx = nodeIdx;
+  item.material = primitive.material;
+  item.pass = key.pass;
+  item.pipelineIdx = getPipeline(key);
+  return true;
+}
+
+int VulkanRenderer::addModel(const tinygltf::Model &model, std::string &error)
+{
+  if (m_textureCount + model.textures.size() > m_textureCapacity) {
+    error = "The bindless texture array of the device is full (" +
+            std::to_string(m_textureCapacity) + " textures)";
+    return -1;
+  }
+  try {
+    Model vkModel;
+    vkModel.nodeMatrices = computeNodeWorldMatrices(model);
+    vkModel.nodeBounds = computeNodeWorldBounds(model);
+
+    // The glTF buffers, then the converted indices, in one buffer
+    std::vector<VkDeviceSize> bufferOffsets;
+    VkDeviceSize byteCount = 0;
+    for (const auto &buffer : model.buffers) {
+      bufferOffsets.push_back(byteCount);
+      byteCount = alignOffset(byteCount + buffer.data.size(), 16);
+    }
+    std::vector<std::vector<PrimitiveIndices>> meshIndices;
+    std::vector<uint32_t> convertedIndices;
+    for (const auto &mesh : model.meshes) {
+      meshIndices.emplace_back();
+      for (const auto &primitive : mesh.primitives) {
+        meshIndices.back().push_back(getPrimitiveIndices(
+            model, primitive, bufferOffsets, byteCount, convertedIndices));
+      }
+    }
+    const auto convertedOffset = byteCount;
+    byteCount += convertedIndices.size() * sizeof(uint32_t);
+    vkModel.buffer = m_device->createBuffer(
+        std::max(byteCount, VkDeviceSize(4)),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    for (size_t bufferIdx = 0; bufferIdx < model.buffers.size(); ++bufferIdx) {
+      const auto &data = model.buffers[bufferIdx].data;
+      m_uploads->uploadBuffer(vkModel.buffer.buffer, bufferOffsets[bufferIdx],
+          data.data(), data.size());
+    }
+    m_uploads->uploadBuffer(vkModel.buffer.buffer, convertedOffset,
+        convertedIndices.data(), convertedIndices.size() * sizeof(uint32_t));
+
+    uploadTextures(model, vkModel);
+
+    // Materials of the model, then its default material
+    const auto materialBase = uint32_t(m_materials.size());
+    const auto getTextureIndex = [&](int textureIdx) {
+      return textureIdx >= 0 && model.textures[textureIdx].source >= 0
+                 ? int32_t(m_textureCount) + textureIdx
+                 : -1;
+    };
+    const tinygltf::Material defaultMaterial;
+    for (size_t materialIdx = 0; materialIdx <= model.materials.size();
+         ++materialIdx) {
+      const auto isDefault = materialIdx == model.materials.size();
+      const auto &material =
+          isDefault ? defaultMaterial : model.materials[materialIdx];
+      const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+      VulkanMaterial vkMaterial;
+      vkMaterial.factors =
+          getMaterialFactors(model, isDefault ? -1 : int(materialIdx));
+      vkMaterial.baseColorTexture =
+          getTextureIndex(pbrMetallicRoughness.baseColorTexture.index);
+      vkMaterial.metallicRoughnessTexture =
+          getTextureIndex(pbrMetallicRoughness.metallicRoughnessTexture.index);
+      vkMaterial.emissiveTexture =
+          getTextureIndex(material.emissiveTexture.index);
+      vkMaterial.occlusionTexture =
+          getTextureIndex(material.occlusionTexture.index);
+      m_materials.push_back(vkMaterial);
+    }
+    m_textureCount += uint32_t(model.textures.size());
+
+    // The materials of all the models are in one buffer, replaced when
+    // models are added (after the copies to the previous one)
+    if (m_materialBuffer.buffer) {
+      m_uploads->wait(m_uploads->flush());
+      m_device->destroyBuffer(m_materialBuffer);
+    }
+    const auto materialByteCount = m_materials.size() * sizeof(VulkanMaterial);
+    m_materialBuffer = m_device->createBuffer(materialByteCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_uploads->uploadBuffer(m_materialBuffer.buffer, 0, m_materials.data(),
+        materialByteCount);
+    const VkDescriptorBufferInfo materialBufferInfo{
+        m_materialBuffer.buffer, 0, VK_WHOLE_SIZE};
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = m_bufferSet;
+    write.dstBinding = 1;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &materialBufferInfo;
+    vkUpdateDescriptorSets(m_device->device(), 1, &write, 0, nullptr);
+
+    // Draws of the primitives of the mesh nodes, in the order of the OpenGL
+    // path so that draws with equal keys are sorted the same way
+    size_t skippedCount = 0;
+    std::string warning;
+    visitScene(model, [&](int nodeIdx, const glm::mat4 &) {
+      const auto &node = model.nodes[nodeIdx];
+      if (node.mesh < 0) {
+        return;
+      }
+      const auto &primitives = model.meshes[node.mesh].primitives;
+      for (size_t primIdx = 0; primIdx < primitives.size(); ++primIdx) {
+        const auto &primitive = primitives[primIdx];
+        const auto &indices = meshIndices[node.mesh][primIdx];
+        DrawItem item;
+        if (!indices.count ||
+            !resolveDraw(model, vkModel, nodeIdx, primitive, indices.topology,
+                bufferOffsets, item, warning)) {
+          ++skippedCount;
+          continue;
+        }
+        const auto materialIdx = primitive.material >= 0
+                                     ? size_t(primitive.material)
+                                     : model.materials.size();
+        item.materialIdx = materialBase + uint32_t(materialIdx);
+        item.isIndexed = indices.isIndexed;
+        item.indexBuffer = vkModel.buffer.buffer;
+        item.indexType = indices.indexType;
+        item.indexOffset = indices.offset;
+        item.count = indices.count;
+        vkModel.draws.push_back(item);
+      }
+    });
+    if (skippedCount) {
+      std::cerr << "Warn: " << skippedCount
+                << " primitives are not drawn by the Vulkan renderer"
+                << (warning.empty() ? "" : " (" + warning + ")") << std::endl;
+    }
+
+    m_models.push_back(std::move(vkModel));
+    return int(m_models.size() - 1);
+  } catch (const std::runtime_error &e) {
+    error = e.what();
+    return -1;
+  }
+}
+
+void VulkanRenderer::addModelInstance(
+    int modelIdx, const glm::mat4 &rootTransform)
+{
+  const auto &model = m_models[modelIdx];
+  ModelInstance instance;
+  instance.modelIdx = modelIdx;
+  for (size_t nodeIdx = 0; nodeIdx < model.nodeMatrices.size(); ++nodeIdx) {
+    instance.nodeWorldMatrices.push_back(
+        rootTransform * model.nodeMatrices[nodeIdx]);
+    instance.nodeNormalMatrices.push_back(
+        computeNormalMatrix(instance.nodeWorldMatrices.back()));
+    const auto bounds =
+        transformBoundingBox(rootTransform, model.nodeBounds[nodeIdx]);
+    instance.nodeWorldCenters.push_back(0.5f * (bounds.min + bounds.max));
+  }
+  instance.firstTransforms = 0;
+  m_instances.push_back(std::move(instance));
+}
+
+void VulkanRenderer::createTargets(uint32_t width, uint32_t height)
+{
+  destroyTargets();
+  VkImageCreateInfo imageInfo{};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = m_colorFormat;
+  imageInfo.extent = {width, height, 1};
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  m_colorTarget = m_device->createImage(imageInfo, VK_IMAGE_ASPECT_COLOR_BIT);
+  imageInfo.format = m_depthFormat;
+  imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  m_depthTarget = m_device->createImage(imageInfo, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+  const VkImageView views[] = {m_colorTarget.view, m_depthTarget.view};
+  VkFramebufferCreateInfo framebufferInfo{};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = m_renderPass;
+  framebufferInfo.attachmentCount = 2;
+  framebufferInfo.pAttachments = views;
+  framebufferInfo.width = width;
+  framebufferInfo.height = height;
+  framebufferInfo.layers = 1;
+  checkVkResult(vkCreateFramebuffer(
+                    m_device->device(), &framebufferInfo, nullptr,
+                    &m_framebuffer),
+      "vkCreateFramebuffer");
+
+  const auto texelSize =
+      m_colorFormat == VK_FORMAT_R32G32B32A32_SFLOAT ? 16 : 8;
+  m_readback = m_device->createBuffer(VkDeviceSize(width) * height * texelSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  m_width = width;
+  m_height = height;
+}
+
+void VulkanRenderer::destroyTargets()
+{
+  vkDestroyFramebuffer(m_device->device(), m_framebuffer, nullptr);
+  m_framebuffer = VK_NULL_HANDLE;
+  m_device->destroyImage(m_colorTarget);
+  m_device->destroyImage(m_depthTarget);
+  m_device->destroyBuffer(m_readback);
+  m_width = 0;
+  m_height = 0;
+}
+
+void VulkanRenderer::reserveTransforms(size_t count)
+{
+  const auto byteCount = VkDeviceSize(count * sizeof(DrawTransforms));
+  if (m_transforms.size >= byteCount) {
+    return;
+  }
+  // The previous frame has completed: the buffer is not in use
+  m_device->destroyBuffer(m_transforms);
+  m_transforms = m_device->createBuffer(byteCount,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  const VkDescriptorBufferInfo bufferInfo{
+      m_transforms.buffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = m_bufferSet;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(m_device->device(), 1, &write, 0, nullptr);
+}
+
+VkCommandBuffer VulkanRenderer::recordDraws(const FrameDraw *draws,
+    const uint32_t *order, size_t begin, size_t end,
+    const VulkanDrawConstants &constants)
+{
+  const auto device = m_device->device();
+  auto &thread = m_threadCommands[JobSystem::instance().threadIndex()];
+  if (thread.usedCount == thread.commandBuffers.size()) {
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = thread.commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocateInfo.commandBufferCount = 1;
+    VkCommandBuffer commandBuffer;
+    checkVkResult(
+        vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer),
+        "vkAllocateCommandBuffers");
+    thread.commandBuffers.push_back(commandBuffer);
+  }
+  const auto commandBuffer = thread.commandBuffers[thread.usedCount++];
+
+  VkCommandBufferInheritanceInfo inheritanceInfo{};
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.renderPass = m_renderPass;
+  inheritanceInfo.subpass = 0;
+  inheritanceInfo.framebuffer = m_framebuffer;
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT |
+                    VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+  checkVkResult(vkBeginCommandBuffer(commandBuffer, &beginInfo),
+      "vkBeginCommandBuffer");
+
+  // Secondary command buffers inherit no state: the viewport is flipped so
+  // that the first row of the target is the top of the image, like the
+  // OpenGL image once flipped
+  const VkViewport viewport{
+      0, float(m_height), float(m_width), -float(m_height), 0, 1};
+  const VkRect2D scissor{{0, 0}, {m_width, m_height}};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+  const VkDescriptorSet sets[] = {m_bufferSet, m_textureSet};
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+      m_pipelineLayout, 0, 2, sets, 0, nullptr);
+  const auto stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  vkCmdPushConstants(commandBuffer, m_pipelineLayout, stages, 0,
+      offsetof(VulkanDrawConstants, transformsIndex), &constants);
+
+  const DrawItem *previous = nullptr;
+  for (auto drawIdx = begin; drawIdx < end; ++drawIdx) {
+    const auto &draw = draws[order[drawIdx]];
+    const auto &item = *draw.item;
+    if (!previous || previous->pipelineIdx != item.pipelineIdx) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+          m_pipelines[item.pipelineIdx]);
+    }
+    if (!previous ||
+        !std::equal(item.vertexBuffers, item.vertexBuffers + vertexInputCount,
+            previous->vertexBuffers) ||
+        !std::equal(item.vertexOffsets, item.vertexOffsets + vertexInputCount,
+            previous->vertexOffsets)) {
+      vkCmdBindVertexBuffers(commandBuffer, 0, vertexInputCount,
+          item.vertexBuffers, item.vertexOffsets);
+    }
+    if (item.isIndexed) {
+      vkCmdBindIndexBuffer(
+          commandBuffer, item.indexBuffer, item.indexOffset, item.indexType);
+    }
+    const uint32_t indices[] = {draw.transformsIndex, item.materialIdx};
+    vkCmdPushConstants(commandBuffer, m_pipelineLayout, stages,
+        offsetof(VulkanDrawConstants, transformsIndex), sizeof(indices),
+        indices);
+    if (item.isIndexed) {
+      vkCmdDrawIndexed(commandBuffer, item.count, item.instanceCount, 0, 0, 0);
+    } else {
+      vkCmdDraw(commandBuffer, item.count, item.instanceCount, 0, 0);
+    }
+    previous = &item;
+  }
+  checkVkResult(vkEndCommandBuffer(commandBuffer), "vkEndCommandBuffer");
+  return commandBuffer;
+}
+
+bool VulkanRenderer::renderImage(const RenderView &view, uint32_t width,
+    uint32_t height, unsigned char *pixels, std::string &error)
+{
+  try {
+    const auto device = m_device->device();
+    if (width != m_width || height != m_height) {
+      createTargets(width, height);
+    }
+    // Copies of the models added since the last frame
+    const auto uploadValue = m_uploads->flush();
+
+    // Transforms of the nodes of all the instances, for a projection with
+    // the depth range of Vulkan ([0, 1] instead of [-1, 1])
+    glm::mat4 clipMatrix(1);
+    clipMatrix[2][2] = 0.5f;
+    clipMatrix[3][2] = 0.5f;
+    const auto projMatrix = clipMatrix * view.projMatrix;
+    size_t transformsCount = 0;
+    for (auto &instance : m_instances) {
+      instance.firstTransforms = uint32_t(transformsCount);
+      transformsCount += instance.nodeWorldMatrices.size();
+    }
+    reserveTransforms(std::max(transformsCount, size_t(1)));
+    auto *transforms = static_cast<DrawTransforms *>(m_transforms.mapped);
+    for (const auto &instance : m_instances) {
+      computeDrawTransforms(view.viewMatrix, projMatrix,
+          instance.nodeWorldMatrices.data(),
+          instance.nodeNormalMatrices.data(),
+          instance.nodeWorldMatrices.size(),
+          transforms + instance.firstTransforms);
+    }
+
+    // Draws sorted on the keys of the OpenGL path: opaque, alpha tested,
+    // then blended back to front
+    m_frameArena.reset();
+    size_t drawCount = 0;
+    for (const auto &instance : m_instances) {
+      drawCount += m_models[instance.modelIdx].draws.size();
+    }
+    auto *draws = m_frameArena.allocateArray<FrameDraw>(drawCount);
+    auto *drawKeys = m_frameArena.allocateArray<uint64_t>(drawCount);
+    size_t drawIdx = 0;
+    for (const auto &instance : m_instances) {
+      for (const auto &item : m_models[instance.modelIdx].draws) {
+        const auto depth =
+            -(view.viewMatrix *
+                glm::vec4(instance.nodeWorldCenters[item.nodeIdx], 1.f))
+                 .z;
+        drawKeys[drawIdx] = makeDrawKey(item.pass, depth, view.nearDepth,
+            view.farDepth, 0,
+            (uint32_t(instance.modelIdx) << 20) | uint32_t(item.material + 1));
+        draws[drawIdx] = FrameDraw{
+            &item, instance.firstTransforms + uint32_t(item.nodeIdx)};
+        ++drawIdx;
+      }
+    }
+    const auto &drawOrder =
+        m_drawSorter.sort(drawKeys, drawCount, m_frameArena);
+
+    // Secondary command buffers recorded by jobs, from the pool of their
+    // thread
+    for (auto &thread : m_threadCommands) {
+      checkVkResult(vkResetCommandPool(device, thread.commandPool, 0),
+          "vkResetCommandPool");
+      thread.usedCount = 0;
+    }
+    VulkanDrawConstants constants{};
+    constants.lightDirection = glm::vec4(view.lightDirection, 0);
+    constants.lightIntensity = glm::vec4(view.lightIntensity, 0);
+    const auto chunkCount =
+        (drawCount + secondaryDrawCount - 1) / secondaryDrawCount;
+    std::vector<VkCommandBuffer> secondaries(chunkCount);
+    std::mutex errorMutex;
+    std::string recordError;
+    JobSystem::instance().parallelFor(
+        chunkCount, 1, [&](size_t chunkBegin, size_t chunkEnd) {
+          for (auto chunkIdx = chunkBegin; chunkIdx < chunkEnd; ++chunkIdx) {
+            try {
+              secondaries[chunkIdx] = recordDraws(draws, drawOrder.data(),
+                  chunkIdx * secondaryDrawCount,
+                  std::min(drawCount, (chunkIdx + 1) * secondaryDrawCount),
+                  constants);
+            } catch (const std::runtime_error &e) {
+              std::lock_guard<std::mutex> lock(errorMutex);
+              recordError = e.what();
+            }
+          }
+        });
+    if (!recordError.empty()) {
+      throw std::runtime_error(recordError);
+    }
+
+    checkVkResult(vkResetCommandPool(device, m_commandPool, 0),
+        "vkResetCommandPool");
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    checkVkResult(vkBeginCommandBuffer(m_commandBuffer, &beginInfo),
+        "vkBeginCommandBuffer");
+    VkClearValue clearValues[2];
+    clearValues[0].color = VkClearColorValue{{0, 0, 0, 0}};
+    clearValues[1].depthStencil = VkClearDepthStencilValue{1, 0};
+    VkRenderPassBeginInfo renderPassBegin{};
+    renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBegin.renderPass = m_renderPass;
+    renderPassBegin.framebuffer = m_framebuffer;
+    renderPassBegin.renderArea = {{0, 0}, {width, height}};
+    renderPassBegin.clearValueCount = 2;
+    renderPassBegin.pClearValues = clearValues;
+    vkCmdBeginRenderPass(m_commandBuffer, &renderPassBegin,
+        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (!secondaries.empty()) {
+      vkCmdExecuteCommands(
+          m_commandBuffer, uint32_t(secondaries.size()), secondaries.data());
+    }
+    vkCmdEndRenderPass(m_commandBuffer);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {width, height, 1};
+    vkCmdCopyImageToBuffer(m_commandBuffer, m_colorTarget.image,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_readback.buffer, 1, &region);
+    VkBufferMemoryBarrier readbackBarrier{};
+    readbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    readbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    readbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    readbackBarrier.buffer = m_readback.buffer;
+    readbackBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &readbackBarrier, 0,
+        nullptr);
+    checkVkResult(vkEndCommandBuffer(m_commandBuffer), "vkEndCommandBuffer");
+
+    // Wait for the uploads, signal the frame
+    const auto uploadSemaphore = m_uploads->semaphore();
+    const VkPipelineStageFlags waitStage =
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    const auto frameValue = m_frameValue + 1;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &uploadValue;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &frameValue;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &uploadSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &m_commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &m_frameSemaphore;
+    m_device->submit(m_device->graphicsQueue(), submitInfo);
+    m_frameValue = frameValue;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &m_frameSemaphore;
+    waitInfo.pValues = &frameValue;
+    checkVkResult(vkWaitSemaphores(
+                      device, &waitInfo, std::numeric_limits<uint64_t>::max()),
+        "vkWaitSemaphores");
+
+    // Read like glReadPixels reads a float target to unsigned bytes
+    const auto texelCount = size_t(width) * height;
+    if (m_colorFormat == VK_FORMAT_R32G32B32A32_SFLOAT) {
+      const auto *texels = static_cast<const float *>(m_readback.mapped);
+      for (size_t texelIdx = 0; texelIdx < texelCount; ++texelIdx) {
+        for (size_t c = 0; c < 3; ++c) {
+          pixels[texelIdx * 3 + c] = toUnorm8(texels[texelIdx * 4 + c]);
+        }
+      }
+    } else {
+      const auto *texels = static_cast<const uint16_t *>(m_readback.mapped);
+      for (size_t texelIdx = 0; texelIdx < texelCount; ++texelIdx) {
+        for (size_t c = 0; c < 3; ++c) {
+          pixels[texelIdx * 3 + c] =
+              toUnorm8(glm::unpackHalf1x16(texels[texelIdx * 4 + c]));
+        }
+      }
+    }
+    return true;
+  } catch (const std::runtime_error &e) {
+    error = e.what();
+    return false;
+  }
+}
+
+#endif
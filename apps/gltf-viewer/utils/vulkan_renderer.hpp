@@ -0,0 +1,224 @@
+#pragma once
+
+#include "draw_sort.hpp"
+#include "frame_arena.hpp"
+#include "gltf.hpp"
+#include "renderer.hpp"
+#include "vulkan_device.hpp"
+#include "vulkan_upload.hpp"
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Push constants of vulkan_forward.vs.glsl and
+// vulkan_pbr_directional_light.fs.glsl: the light is pushed once per command
+// buffer, the indices with each draw
+struct VulkanDrawConstants
+{
+  glm::vec4 lightDirection; // View space, w unused
+  glm::vec4 lightIntensity; // w unused
+  uint32_t transformsIndex;
+  uint32_t materialIndex;
+};
+
+// std430 layout of Material in vulkan_pbr_directional_light.fs.glsl
+struct VulkanMaterial
+{
+  MaterialFactors factors;
+  // In the bindless texture array, -1 for no texture (the shader samples 1)
+  int32_t baseColorTexture = -1;
+  int32_t metallicRoughnessTexture = -1;
+  int32_t emissiveTexture = -1;
+  int32_t occlusionTexture = -1;
+};
+static_assert(sizeof(VulkanMaterial) % 16 == 0, "std430 array stride");
+
+// Offscreen forward renderer on Vulkan 1.2, drawing the same images as the
+// default OpenGL path (vulkan_forward.vs.glsl and
+// vulkan_pbr_directional_light.fs.glsl are ports of forward.vs.glsl and
+// pbr_directional_light_bindless.fs.glsl):
+// - Geometry, textures and materials are uploaded by a VulkanUploadQueue,
+//   the frames wait on its timeline semaphore.
+// - The textures of all the models are in one runtime sized array of
+//   combined image samplers (descriptor indexing: partially bound, variable
+//   count, updated after bind), indexed by the materials of a storage buffer.
+//   Draws only push their transforms and material indices.
+// - Draws are sorted like the OpenGL ones (makeDrawKey, DrawListSorter), then
+//   recorded by jobs in chunks, each in a secondary command buffer allocated
+//   from the command pool of its thread, and executed in order in the render
+//   pass of the frame.
+class VulkanRenderer : public Renderer
+{
+public:
+  // Throws std::runtime_error if no device is suitable or the SPIR-V of the
+  // shaders cannot be read from options.shadersPath
+  explicit VulkanRenderer(const RendererOptions &options);
+  ~VulkanRenderer() override;
+
+  VulkanRenderer(const VulkanRenderer &) = delete;
+  VulkanRenderer &operator=(const VulkanRenderer &) = delete;
+
+  const std::string &deviceName() const override { return m_device->name(); }
+  int addModel(const tinygltf::Model &model, std::string &error) override;
+  void addModelInstance(int modelIdx, const glm::mat4 &rootTransform) override;
+  bool renderImage(const RenderView &view, uint32_t width, uint32_t height,
+      unsigned char *pixels, std::string &error) override;
+
+private:
+  // One binding per attribute of vulkan_forward.vs.glsl, at its location
+  static const uint32_t vertexInputCount = 6;
+
+  // Pipelines differ by vertex input, topology and pass
+  struct PipelineKey
+  {
+    VkPrimitiveTopology topology;
+    DrawPass pass;
+    VkFormat formats[vertexInputCount];
+    uint32_t strides[vertexInputCount];
+    VkVertexInputRate inputRates[vertexInputCount];
+
+    bool operator<(const PipelineKey &other) const;
+  };
+
+  // Draw of a primitive of a mesh node, resolved on load
+  struct DrawItem
+  {
+    int nodeIdx;
+    int material; // Of the model, -1 for the default material
+    DrawPass pass;
+    uint32_t pipelineIdx; // In m_pipelines
+    uint32_t materialIdx; // In m_materials
+    VkBuffer vertexBuffers[vertexInputCount];
+    VkDeviceSize vertexOffsets[vertexInputCount];
+    bool isIndexed;
+    VkBuffer indexBuffer;
+    VkIndexType indexType;
+    VkDeviceSize indexOffset;
+    uint32_t count; // Of indices, or of vertices
+    uint32_t instanceCount; // 1 for nodes that are not instanced
+  };
+
+  struct Model
+  {
+    VulkanBuffer buffer; // The glTF buffers, then the converted indices
+    std::vector<VulkanImage> textures;
+    std::vector<glm::mat4> nodeMatrices;
+    std::vector<BoundingBox> nodeBounds;
+    std::vector<DrawItem> draws; // Parents before children
+  };
+
+  struct ModelInstance
+  {
+    int modelIdx;
+    std::vector<glm::mat4> nodeWorldMatrices;
+    std::vector<glm::mat4> nodeNormalMatrices;
+    std::vector<glm::vec3> nodeWorldCenters; // Of the node bounds
+    uint32_t firstTransforms; // In m_transforms, during a frame
+  };
+
+  // A draw of a frame
+  struct FrameDraw
+  {
+    const DrawItem *item;
+    uint32_t transformsIndex;
+  };
+
+  // Secondary command buffers of a thread, allocated from its own pool and
+  // reused each frame
+  struct ThreadCommands
+  {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;
+    size_t usedCount = 0;
+  };
+
+  // Objects of the device, all destroyed by destroyObjects (also after a
+  // failure of createObjects)
+  void createObjects();
+  void destroyObjects();
+  VkShaderModule loadShaderModule(const std::string &path);
+  void createDescriptorSets();
+  uint32_t getPipeline(const PipelineKey &key);
+  VkSampler getSampler(const tinygltf::Sampler &sampler, bool hasMipmaps);
+  // Upload the textures of model and write them to the texture array, from
+  // m_textureCount
+  void uploadTextures(const tinygltf::Model &model, Model &vkModel);
+  // Vertex input, pass and pipeline of a draw of primitive by node nodeIdx.
+  // Returns false with the reason in warning if it cannot be drawn.
+  bool resolveDraw(const tinygltf::Model &model, const Model &vkModel,
+      int nodeIdx, const tinygltf::Primitive &primitive,
+      VkPrimitiveTopology topology,
+      const std::vector<VkDeviceSize> &bufferOffsets, DrawItem &item,
+      std::string &warning);
+  void createTargets(uint32_t width, uint32_t height);
+  void destroyTargets();
+  void reserveTransforms(size_t count);
+  // Record the draws [begin, end) of order in a secondary command buffer of
+  // the calling thread
+  VkCommandBuffer recordDraws(const FrameDraw *draws, const uint32_t *order,
+      size_t begin, size_t end, const VulkanDrawConstants &constants);
+
+  RendererOptions m_options;
+  std::unique_ptr<VulkanDevice> m_device;
+  std::unique_ptr<VulkanUploadQueue> m_uploads;
+
+  VkShaderModule m_vertexShader = VK_NULL_HANDLE;
+  VkShaderModule m_fragmentShader = VK_NULL_HANDLE;
+  VkFormat m_colorFormat = VK_FORMAT_R32G32B32A32_SFLOAT;
+  VkFormat m_depthFormat = VK_FORMAT_D32_SFLOAT;
+  VkRenderPass m_renderPass = VK_NULL_HANDLE;
+
+  // Set 0: transforms of the nodes (binding 0) and materials (binding 1),
+  // set 1: the bindless texture array
+  VkDescriptorSetLayout m_bufferSetLayout = VK_NULL_HANDLE;
+  VkDescriptorSetLayout m_textureSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  VkDescriptorPool m_bufferPool = VK_NULL_HANDLE;
+  VkDescriptorPool m_texturePool = VK_NULL_HANDLE;
+  VkDescriptorSet m_bufferSet = VK_NULL_HANDLE;
+  VkDescriptorSet m_textureSet = VK_NULL_HANDLE;
+  uint32_t m_textureCapacity = 0;
+  uint32_t m_textureCount = 0;
+
+  std::map<PipelineKey, uint32_t> m_pipelineIndices;
+  std::vector<VkPipeline> m_pipelines;
+  // By minification and magnification filters, wrap modes and mipmaps
+  std::map<std::array<int, 5>, VkSampler> m_samplers;
+
+  // Vertex attributes of the draws that do not have them: (0, 0, 0, 1), then
+  // (1, 1, 1, 1) for the instance scales
+  VulkanBuffer m_defaultAttributes;
+  std::vector<VulkanMaterial> m_materials;
+  VulkanBuffer m_materialBuffer; // Device local copy of m_materials
+  VulkanBuffer m_transforms; // Host visible, of the nodes of the frame
+
+  std::vector<Model> m_models;
+  std::vector<ModelInstance> m_instances;
+
+  // Render targets of the current size, and the buffer they are read in
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+  VulkanImage m_colorTarget;
+  VulkanImage m_depthTarget;
+  VkFramebuffer m_framebuffer = VK_NULL_HANDLE;
+  VulkanBuffer m_readback;
+
+  VkCommandPool m_commandPool = VK_NULL_HANDLE; // Of the primary buffer
+  VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+  std::vector<ThreadCommands> m_threadCommands; // See JobSystem::threadIndex
+  // Signaled by each frame, waited on by the CPU
+  VkSemaphore m_frameSemaphore = VK_NULL_HANDLE;
+  uint64_t m_frameValue = 0;
+
+  FrameArena m_frameArena;
+  DrawListSorter m_drawSorter;
+};
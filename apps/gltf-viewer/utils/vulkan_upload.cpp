@@ -0,0 +1,284 @@
+#ifdef GLMLV_USE_VULKAN
+
+#include "vulkan_upload.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+
+// Offsets of copies in staging memory: a multiple of the texel size of the
+// images and of the optimal copy alignment of most devices
+const VkDeviceSize stagingAlignment = 16;
+
+VkDeviceSize alignStaging(VkDeviceSize size)
+{
+  return (size + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+}
+
+} // namespace
+
+VulkanUploadQueue::VulkanUploadQueue(
+    VulkanDevice &device, VkDeviceSize stagingCapacity) :
+    m_device(device)
+{
+  VkSemaphoreTypeCreateInfo typeInfo{};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+  checkVkResult(vkCreateSemaphore(
+                    device.device(), &semaphoreInfo, nullptr, &m_semaphore),
+      "vkCreateSemaphore");
+  try {
+    m_staging = device.createBuffer(alignStaging(stagingCapacity),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  } catch (...) {
+    vkDestroySemaphore(device.device(), m_semaphore, nullptr);
+    throw;
+  }
+}
+
+VulkanUploadQueue::~VulkanUploadQueue()
+{
+  const auto device = m_device.device();
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &m_semaphore;
+  waitInfo.pValues = &m_submittedValue;
+  vkWaitSemaphores(device, &waitInfo, std::numeric_limits<uint64_t>::max());
+  if (m_isRecording) {
+    vkEndCommandBuffer(m_current.commandBuffer);
+    m_pending.push_back(std::move(m_current));
+  }
+  for (auto &batch : m_pending) {
+    m_freeBatches.push_back(std::move(batch));
+  }
+  for (auto &batch : m_freeBatches) {
+    for (auto &staging : batch.dedicatedStaging) {
+      m_device.destroyBuffer(staging);
+    }
+    vkDestroyCommandPool(device, batch.commandPool, nullptr);
+  }
+  m_device.destroyBuffer(m_staging);
+  vkDestroySemaphore(device, m_semaphore, nullptr);
+}
+
+void VulkanUploadQueue::uploadBuffer(VkBuffer buffer, VkDeviceSize offset,
+    const void *data, VkDeviceSize size)
+{
+  if (!size) {
+    return;
+  }
+  VkBuffer staging;
+  VkDeviceSize stagingOffset;
+  auto *mapped = allocateStaging(size, staging, stagingOffset);
+  std::memcpy(mapped, data, size_t(size));
+  const VkBufferCopy region{stagingOffset, offset, size};
+  vkCmdCopyBuffer(m_current.commandBuffer, staging, buffer, 1, &region);
+}
+
+void VulkanUploadQueue::uploadImage(VkImage image, uint32_t width,
+    uint32_t height, size_t texelSize,
+    const std::vector<std::vector<unsigned char>> &levels)
+{
+  VkDeviceSize stagingSize = 0;
+  for (const auto &level : levels) {
+    stagingSize += alignStaging(level.size());
+  }
+  VkBuffer staging;
+  VkDeviceSize stagingOffset;
+  auto *mapped = allocateStaging(stagingSize, staging, stagingOffset);
+
+  std::vector<VkBufferImageCopy> regions;
+  for (uint32_t levelIdx = 0; levelIdx < levels.size(); ++levelIdx) {
+    const auto &level = levels[levelIdx];
+    std::memcpy(mapped, level.data(), level.size());
+    VkBufferImageCopy region{};
+    region.bufferOffset = stagingOffset;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, levelIdx, 0, 1};
+    region.imageExtent = {std::max(width >> levelIdx, 1u),
+        std::max(height >> levelIdx, 1u), 1};
+    regions.push_back(region);
+    assert(level.size() == size_t(region.imageExtent.width) *
+                               region.imageExtent.height * texelSize);
+    mapped += alignStaging(level.size());
+    stagingOffset += alignStaging(level.size());
+  }
+
+  // The layout transitions only order the copies: the submissions sampling
+  // the image wait on the semaphore, which makes the copies visible
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {
+      VK_IMAGE_ASPECT_COLOR_BIT, 0, uint32_t(levels.size()), 0, 1};
+  const auto commandBuffer = m_current.commandBuffer;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+  vkCmdCopyBufferToImage(commandBuffer, staging, image,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(regions.size()),
+      regions.data());
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1,
+      &barrier);
+}
+
+uint64_t VulkanUploadQueue::flush()
+{
+  if (!m_isRecording) {
+    return m_submittedValue;
+  }
+  checkVkResult(
+      vkEndCommandBuffer(m_current.commandBuffer), "vkEndCommandBuffer");
+  m_isRecording = false;
+  m_current.value = m_submittedValue + 1;
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.signalSemaphoreValueCount = 1;
+  timelineInfo.pSignalSemaphoreValues = &m_current.value;
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &m_current.commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &m_semaphore;
+  m_device.submit(m_device.transferQueue(), submitInfo);
+
+  m_submittedValue = m_current.value;
+  m_pending.push_back(std::move(m_current));
+  m_current = Batch{};
+  reclaim(false);
+  return m_submittedValue;
+}
+
+void VulkanUploadQueue::wait(uint64_t value)
+{
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &m_semaphore;
+  waitInfo.pValues = &value;
+  checkVkResult(vkWaitSemaphores(m_device.device(), &waitInfo,
+                    std::numeric_limits<uint64_t>::max()),
+      "vkWaitSemaphores");
+}
+
+unsigned char *VulkanUploadQueue::allocateStaging(
+    VkDeviceSize size, VkBuffer &buffer, VkDeviceSize &offset)
+{
+  size = alignStaging(size);
+  const auto capacity = m_staging.size;
+  if (size > capacity) {
+    auto &batch = currentBatch();
+    batch.dedicatedStaging.push_back(m_device.createBuffer(size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT));
+    buffer = batch.dedicatedStaging.back().buffer;
+    offset = 0;
+    return static_cast<unsigned char *>(batch.dedicatedStaging.back().mapped);
+  }
+
+  // Copies that do not fit before the end of the ring wrap to its start,
+  // the bytes skipped are released with the batch
+  VkDeviceSize padding = 0;
+  for (;;) {
+    if (!m_stagingUsedByteCount) {
+      m_stagingHead = 0;
+    }
+    padding = m_stagingHead + size > capacity ? capacity - m_stagingHead : 0;
+    if (m_stagingUsedByteCount + padding + size <= capacity) {
+      break;
+    }
+    // Full: submit the current batch if it holds all the staging memory in
+    // use, and wait for the oldest batch
+    if (m_pending.empty()) {
+      flush();
+    }
+    reclaim(true);
+  }
+  auto &batch = currentBatch();
+  offset = padding ? 0 : m_stagingHead;
+  m_stagingHead = offset + size;
+  m_stagingUsedByteCount += padding + size;
+  batch.stagingByteCount += padding + size;
+  buffer = m_staging.buffer;
+  return static_cast<unsigned char *>(m_staging.mapped) + offset;
+}
+
+VulkanUploadQueue::Batch &VulkanUploadQueue::currentBatch()
+{
+  if (m_isRecording) {
+    return m_current;
+  }
+  const auto device = m_device.device();
+  if (!m_freeBatches.empty()) {
+    m_current = std::move(m_freeBatches.back());
+    m_freeBatches.pop_back();
+    checkVkResult(vkResetCommandPool(device, m_current.commandPool, 0),
+        "vkResetCommandPool");
+  } else {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_device.transferFamily();
+    checkVkResult(vkCreateCommandPool(
+                      device, &poolInfo, nullptr, &m_current.commandPool),
+        "vkCreateCommandPool");
+    VkCommandBufferAllocateInfo allocateInfo{};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocateInfo.commandPool = m_current.commandPool;
+    allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocateInfo.commandBufferCount = 1;
+    checkVkResult(vkAllocateCommandBuffers(
+                      device, &allocateInfo, &m_current.commandBuffer),
+        "vkAllocateCommandBuffers");
+  }
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  checkVkResult(vkBeginCommandBuffer(m_current.commandBuffer, &beginInfo),
+      "vkBeginCommandBuffer");
+  m_isRecording = true;
+  return m_current;
+}
+
+void VulkanUploadQueue::reclaim(bool waitForOne)
+{
+  if (waitForOne && !m_pending.empty()) {
+    wait(m_pending.front().value);
+  }
+  uint64_t completedValue = 0;
+  checkVkResult(vkGetSemaphoreCounterValue(
+                    m_device.device(), m_semaphore, &completedValue),
+      "vkGetSemaphoreCounterValue");
+  while (!m_pending.empty() && m_pending.front().value <= completedValue) {
+    auto &batch = m_pending.front();
+    m_stagingUsedByteCount -= batch.stagingByteCount;
+    batch.stagingByteCount = 0;
+    for (auto &staging : batch.dedicatedStaging) {
+      m_device.destroyBuffer(staging);
+    }
+    batch.dedicatedStaging.clear();
+    m_freeBatches.push_back(std::move(batch));
+    m_pending.pop_front();
+  }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "vulkan_device.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Copies data to device local buffers and images on the transfer queue of
+// the device. Copies are recorded in batches: flush() submits the current
+// batch, which signals the next value of a timeline semaphore when it
+// completes. Submissions reading the uploaded resources wait on that value
+// (no fence, no ownership transfer: the resources of the device are shared by
+// its queue families), and the CPU reclaims the staging memory of the
+// batches whose value is reached.
+//
+// Staging memory is a persistently mapped ring: a copy waits for the oldest
+// batches to complete when the ring is full. Copies larger than the ring get
+// a staging buffer of their own, freed with their batch.
+class VulkanUploadQueue
+{
+public:
+  explicit VulkanUploadQueue(VulkanDevice &device,
+      VkDeviceSize stagingCapacity = VkDeviceSize(64) << 20);
+  // Waits for the submitted batches, copies that were not flushed are dropped
+  ~VulkanUploadQueue();
+
+  VulkanUploadQueue(const VulkanUploadQueue &) = delete;
+  VulkanUploadQueue &operator=(const VulkanUploadQueue &) = delete;
+
+  // Copy size bytes of data to buffer at offset
+  void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void *data,
+      VkDeviceSize size);
+
+  // Copy the levels of a 2D image of width * height texels of texelSize
+  // bytes, levels[i] being level i tightly packed, and make it ready to be
+  // sampled: it ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+  void uploadImage(VkImage image, uint32_t width, uint32_t height,
+      size_t texelSize, const std::vector<std::vector<unsigned char>> &levels);
+
+  // Submit the copies recorded since the last flush. Returns the value of
+  // semaphore() signaled when all the copies so far have completed.
+  uint64_t flush();
+
+  VkSemaphore semaphore() const { return m_semaphore; }
+
+  // Block until the copies of the batches up to value have completed
+  void wait(uint64_t value);
+
+private:
+  struct Batch
+  {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    uint64_t value = 0; // Signaled when the batch completes
+    VkDeviceSize stagingByteCount = 0; // In the ring, padding included
+    std::vector<VulkanBuffer> dedicatedStaging;
+  };
+
+  // Staging memory for size bytes, copied by the current batch: the mapped
+  // pointer and the buffer holding it at offset
+  unsigned char *allocateStaging(
+      VkDeviceSize size, VkBuffer &buffer, VkDeviceSize &offset);
+  // Current batch, started if needed
+  Batch &currentBatch();
+  // Release the staging memory of the completed batches, after waiting for
+  // the oldest one if waitForOne is set
+  void reclaim(bool waitForOne);
+
+  VulkanDevice &m_device;
+  VkSemaphore m_semaphore = VK_NULL_HANDLE;
+  uint64_t m_submittedValue = 0;
+
+  VulkanBuffer m_staging;
+  VkDeviceSize m_stagingHead = 0; // Next free byte
+  VkDeviceSize m_stagingUsedByteCount = 0;
+
+  bool m_isRecording = false;
+  Batch m_current;
+  std::deque<Batch> m_pending; // Submitted, oldest first
+  std::vector<Batch> m_freeBatches;
+};
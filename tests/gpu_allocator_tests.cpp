@@ -0,0 +1,215 @@
+// Checks of the GpuMemoryPool of the glTF viewer on a CpuBufferBackend,
+// without a GL context. Run by ctest, returns the number of failed checks.
+
+#include "gpu_allocator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+int failureCount = 0;
+
+void check(bool condition, const char *message)
+{
+  if (!condition) {
+    std::cerr << "GpuMemoryPool: " << message << std::endl;
+    ++failureCount;
+  }
+}
+
+// Bytes of the allocation seeded with seed
+std::vector<unsigned char> makeAllocationBytes(size_t byteCount, uint32_t seed)
+{
+  std::vector<unsigned char> bytes(byteCount);
+  auto state = seed * 2654435761u + 1;
+  for (auto &byte : bytes) {
+    state = state * 1664525u + 1013904223u;
+    byte = (unsigned char)(state >> 24);
+  }
+  return bytes;
+}
+
+// True if the range of allocation in the buffers of backend holds bytes
+bool hasAllocationBytes(const CpuBufferBackend &backend,
+    const GpuMemoryPool &pool, GpuMemoryPool::AllocationId allocation,
+    const std::vector<unsigned char> &bytes)
+{
+  const auto range = pool.range(allocation);
+  const auto &data = backend.data(range.buffer);
+  return size_t(range.offset) + bytes.size() <= data.size() &&
+         std::equal(begin(bytes), end(bytes), data.begin() + range.offset);
+}
+
+// Scripted sequence on pages of 64 units
+void checkBlockMerging()
+{
+  GpuMemoryPoolOptions options;
+  options.granularity = 256;
+  options.pageByteCount = 64 * options.granularity;
+  const auto unit = options.granularity;
+  const auto page = options.pageByteCount;
+  CpuBufferBackend backend;
+  GpuMemoryPool pool(backend, options);
+
+  // Four blocks of one unit, the rest of the page is one free block
+  GpuMemoryPool::AllocationId blocks[4];
+  for (auto &block : blocks) {
+    block = pool.allocate(unit);
+  }
+  auto stats = pool.stats();
+  check(stats.pageCount == 1 && backend.bufferCount() == 1,
+      "small allocations do not share a page");
+  check(stats.freeBlockCount == 1 &&
+            stats.largestFreeBlockByteCount == page - 4 * unit,
+      "the free space of a page is not one block");
+  check(std::abs(stats.utilization() - 4.f / 64) < 1e-6f, "wrong utilization");
+  check(stats.fragmentation() == 0, "one free block is fragmented");
+
+  // Freeing blocks 0 and 2 leaves holes of one unit
+  pool.free(blocks[0]);
+  pool.free(blocks[2]);
+  stats = pool.stats();
+  check(stats.freeBlockCount == 3 && stats.usedByteCount == 2 * unit,
+      "freed blocks with a used neighbour are merged");
+  check(std::abs(stats.fragmentation() - (1.f - 60.f / 62)) < 1e-6f,
+      "wrong fragmentation");
+
+  // Block 1 merges with both its free neighbours, block 3 with the merged
+  // block and the end of the page, which is released once empty
+  pool.free(blocks[1]);
+  stats = pool.stats();
+  check(stats.freeBlockCount == 2 &&
+            stats.largestFreeBlockByteCount == page - 4 * unit,
+      "a freed block is not merged with its free neighbours");
+  const auto merged = pool.allocate(3 * unit);
+  stats = pool.stats();
+  check(stats.freeBlockCount == 1 && pool.range(merged).offset == 0,
+      "the merged block is not reused by an allocation of its size");
+  pool.free(merged);
+  pool.free(blocks[3]);
+  stats = pool.stats();
+  check(stats.pageCount == 0 && backend.bufferCount() == 0,
+      "an empty page is not released");
+
+  // Allocations larger than a page get a page of their own, released when
+  // they are freed
+  const auto small = pool.allocate(unit);
+  const auto bytes = makeAllocationBytes(3 * page + 7, 1);
+  const auto large = pool.allocate(bytes.size(), bytes.data());
+  stats = pool.stats();
+  check(stats.pageCount == 2 &&
+            stats.capacityByteCount == page + 3 * page + unit &&
+            pool.range(large).offset == 0 &&
+            pool.range(large).buffer != pool.range(small).buffer,
+      "a large allocation does not get a dedicated page");
+  check(hasAllocationBytes(backend, pool, large, bytes),
+      "a dedicated page does not hold the data of its allocation");
+  pool.free(large);
+  stats = pool.stats();
+  check(stats.pageCount == 1 && backend.bufferCount() == 1,
+      "a dedicated page is not released");
+  pool.free(small);
+}
+
+// Random allocations of 16 bytes to 64 KB in pages of 256 KB, one in 100
+// larger than a page, half of them freed, then the pool defragmented
+void checkRandomAllocations(size_t allocationCount)
+{
+  GpuMemoryPoolOptions options;
+  options.pageByteCount = size_t(256) << 10;
+  CpuBufferBackend backend;
+  GpuMemoryPool pool(backend, options);
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> logSize(4.f, 16.f);
+  std::uniform_int_distribution<int> largeChance(0, 99);
+  std::vector<GpuMemoryPool::AllocationId> allocations(allocationCount);
+  std::vector<std::vector<unsigned char>> contents(allocationCount);
+  for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+       ++allocationIdx) {
+    const auto byteCount =
+        largeChance(random) == 0
+            ? options.pageByteCount + size_t(random() % 65536)
+            : size_t(std::exp2(logSize(random)));
+    contents[allocationIdx] =
+        makeAllocationBytes(byteCount, uint32_t(allocationIdx));
+    allocations[allocationIdx] = pool.allocate(
+        contents[allocationIdx].size(), contents[allocationIdx].data());
+  }
+
+  const auto checkContents = [&](const char *message) {
+    for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+         ++allocationIdx) {
+      if (allocations[allocationIdx] != GpuMemoryPool::invalidAllocation &&
+          !hasAllocationBytes(backend, pool, allocations[allocationIdx],
+              contents[allocationIdx])) {
+        check(false, message);
+        return;
+      }
+    }
+  };
+  checkContents("an allocation does not hold its data");
+
+  std::vector<size_t> freeOrder(allocationCount);
+  std::iota(begin(freeOrder), end(freeOrder), size_t(0));
+  std::shuffle(begin(freeOrder), end(freeOrder), random);
+  freeOrder.resize(allocationCount / 2);
+  for (const auto allocationIdx : freeOrder) {
+    pool.free(allocations[allocationIdx]);
+    allocations[allocationIdx] = GpuMemoryPool::invalidAllocation;
+  }
+  checkContents("freeing an allocation changes the data of another");
+  size_t requestedByteCount = 0;
+  for (size_t allocationIdx = 0; allocationIdx < allocationCount;
+       ++allocationIdx) {
+    if (allocations[allocationIdx] != GpuMemoryPool::invalidAllocation) {
+      requestedByteCount += contents[allocationIdx].size();
+    }
+  }
+
+  const auto before = pool.stats();
+  check(before.allocationCount == allocationCount - freeOrder.size() &&
+            before.requestedByteCount == requestedByteCount,
+      "the stats do not count the allocations left");
+  check(before.usedByteCount >= requestedByteCount &&
+            before.usedByteCount <= before.capacityByteCount &&
+            before.pageCount == backend.bufferCount(),
+      "the stats do not match the pages");
+
+  const auto movedCount = pool.defragment();
+  const auto after = pool.stats();
+  checkContents("defragment() changes the data of a moved allocation");
+  check(movedCount > 0, "defragment() does not move fragmented allocations");
+  check(after.allocationCount == before.allocationCount &&
+            after.usedByteCount == before.usedByteCount &&
+            after.pageCount <= before.pageCount &&
+            after.pageCount == backend.bufferCount(),
+      "defragment() loses allocations or pages");
+  check(after.movedByteCount > before.movedByteCount,
+      "defragment() does not count the moved bytes");
+
+  for (const auto allocation : allocations) {
+    if (allocation != GpuMemoryPool::invalidAllocation) {
+      pool.free(allocation);
+    }
+  }
+  check(pool.stats().pageCount == 0 && backend.bufferCount() == 0,
+      "pages are left after freeing every allocation");
+}
+
+} // namespace
+
+int main()
+{
+  checkBlockMerging();
+  checkRandomAllocations(2000);
+  if (failureCount) {
+    std::cerr << failureCount << " failed checks" << std::endl;
+  }
+  return failureCount;
+}